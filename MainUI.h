@@ -26,6 +26,7 @@
 #include <QLabel>
 #include <QFileInfo>
 #include <QDir>
+#include <QStandardPaths>
 #include <QKeyEvent>
 #include <KTextEditor/View>
 #include <KTextEditor/Document>
@@ -112,6 +113,10 @@ private:
         terminal = new QTermWidget;
         terminal->setShellProgram("/bin/bash");
         terminal->setScrollBarPosition(QTermWidget::ScrollBarRight);
+        const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+        if (QDir().mkpath(dataDir))
+            terminal->setPersistentHistory(dataDir + "/terminal.history", 10000);
+        terminal->setHistoryIndexEnabled(true);
 #else
         terminal = new CMDWidget;
 #endif
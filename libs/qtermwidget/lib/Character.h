@@ -25,11 +25,20 @@
 
 // Qt
 #include <QHash>
+#include <QMutex>
 #include <QSet>
+#include <QVarLengthArray>
+#include <QVector>
+
+// Standard
+#include <atomic>
+#include <functional>
 
 // Local
 #include "CharacterColor.h"
 
+class QObject;
+
 namespace Konsole
 {
 
@@ -54,7 +63,60 @@ static const int LINE_DOUBLEHEIGHT    = (1 << 2);
 #define RE_CONCEAL         (1 << 9)
 #define RE_OVERLINE        (1 << 10)
 
-class ScreenWindow;
+// the largest value which fits into Character::character, extended
+// character ids are kept below it
+#define CHARACTER_VALUE_MASK  0x1FFFFF
+
+/**
+ * A CharacterColor packed into 16 bits, as it is kept in a Character.
+ *
+ * Colors of the default, system and 256 color spaces are kept in the bits
+ * themselves.  True colors are kept in the ExtendedCharTable, which the
+ * bits refer to.  Packing a true color which finds no room in the table
+ * gives the closest of the 256 colors instead.
+ */
+class PackedColor
+{
+public:
+  /** The largest id of a true color. */
+  static constexpr uint MAX_TRUE_COLOR_ID = 0x7FFF;
+
+  /** Constructs a color whose color space is undefined. */
+  PackedColor() : _value(0) {}
+  /** Packs @p color. */
+  PackedColor(const CharacterColor& color);
+  /** Unpacks the color. */
+  operator CharacterColor() const;
+
+  /** Returns true if the color space of this color is defined. */
+  bool isValid() const { return _value != 0; }
+
+  /** Returns the color within the specified color @p palette, see CharacterColor::color() */
+  QColor color(const ColorEntry* palette) const;
+
+  /**
+   * Returns the index of this color in a palette of TABLE_COLORS entries,
+   * or -1 if it is neither a default nor a system color.
+   */
+  int paletteIndex() const;
+
+  /** Returns the id of this color in the ExtendedCharTable, or 0 if it is not a true color. */
+  uint trueColorId() const { return (_value & TRUE_COLOR) ? _value & MAX_TRUE_COLOR_ID : 0; }
+  /** Returns the true color with the @p id, see trueColorId() */
+  static PackedColor fromTrueColorId(uint id)
+  { PackedColor color; color._value = TRUE_COLOR | (id & MAX_TRUE_COLOR_ID); return color; }
+
+  friend bool operator == (PackedColor a, PackedColor b) { return a._value == b._value; }
+  friend bool operator != (PackedColor a, PackedColor b) { return a._value != b._value; }
+
+private:
+  // set for true colors, the other bits are their id.  Otherwise the color
+  // space is kept in bits 12-14, CharacterColor::_v in bits 8-11 and
+  // CharacterColor::_u in bits 0-7
+  static constexpr quint16 TRUE_COLOR = 0x8000;
+
+  quint16 _value;
+};
 
 /**
  * A single character in the terminal which consists of a unicode character
@@ -72,26 +134,30 @@ public:
    * @param _b The color used to draw the character's background.
    * @param _r A set of rendition flags which specify how this character is to be drawn.
    */
-  inline Character(quint16 _c = ' ',
-            CharacterColor  _f = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_FORE_COLOR),
-            CharacterColor  _b = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_BACK_COLOR),
-            quint8  _r = DEFAULT_RENDITION)
+  inline Character(uint _c = ' ',
+            PackedColor  _f = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_FORE_COLOR),
+            PackedColor  _b = CharacterColor(COLOR_SPACE_DEFAULT,DEFAULT_BACK_COLOR),
+            quint16 _r = DEFAULT_RENDITION)
        : character(_c), rendition(_r), foregroundColor(_f), backgroundColor(_b) {}
 
+  // The character value and the rendition share one 32 bit word, and the
+  // colors are packed into 16 bits each, which keeps a cell at 8 bytes.
+  // Unicode code points need 21 bits, the rendition flags the remaining 11.
+
   /** The unicode character value for this character.
    *
    * RE_EXTENDED_CHAR character is a hash code which can be used to look up the unicode
    * character sequence in the ExtendedCharTable used to create the sequence.
    */
-  wchar_t character;
+  uint character : 21;
 
   /** A combination of RENDITION flags which specify options for drawing the character. */
-  quint8  rendition;
+  uint rendition : 11;
 
   /** The foreground color used to draw this character. */
-  CharacterColor  foregroundColor;
+  PackedColor  foregroundColor;
   /** The color used to draw this character's background. */
-  CharacterColor  backgroundColor;
+  PackedColor  backgroundColor;
 
   /**
    * Returns true if this character has a transparent background when
@@ -150,10 +216,8 @@ inline bool operator != (const Character& a, const Character& b)
 
 inline bool Character::isTransparent(const ColorEntry* base) const
 {
-  return ((backgroundColor._colorSpace == COLOR_SPACE_DEFAULT) &&
-          base[backgroundColor._u+0+(backgroundColor._v?BASE_COLORS:0)].transparent)
-      || ((backgroundColor._colorSpace == COLOR_SPACE_SYSTEM) &&
-          base[backgroundColor._u+2+(backgroundColor._v?BASE_COLORS:0)].transparent);
+  const int index = backgroundColor.paletteIndex();
+  return index >= 0 && base[index].transparent;
 }
 
 inline bool Character::equalsFormat(const Character& other) const
@@ -166,12 +230,8 @@ inline bool Character::equalsFormat(const Character& other) const
 
 inline ColorEntry::FontWeight Character::fontWeight(const ColorEntry* base) const
 {
-    if (backgroundColor._colorSpace == COLOR_SPACE_DEFAULT)
-        return base[backgroundColor._u+0+(backgroundColor._v?BASE_COLORS:0)].fontWeight;
-    else if (backgroundColor._colorSpace == COLOR_SPACE_SYSTEM)
-        return base[backgroundColor._u+2+(backgroundColor._v?BASE_COLORS:0)].fontWeight;
-    else
-        return ColorEntry::UseCurrentFormat;
+    const int index = backgroundColor.paletteIndex();
+    return index >= 0 ? base[index].fontWeight : ColorEntry::UseCurrentFormat;
 }
 
 extern unsigned short vt100_graphics[32];
@@ -179,63 +239,261 @@ extern unsigned short vt100_graphics[32];
 
 /**
  * A table which stores sequences of unicode characters, referenced
- * by hash keys.  The hash key itself is the same size as a unicode
- * character ( ushort ) so that it can occupy the same space in
- * a structure.
+ * by ids.  The id is the same size as a unicode character ( 21 bits,
+ * see CHARACTER_VALUE_MASK ) so that it can occupy the same space in
+ * a structure.  The table also stores the true colors of cells, see
+ * PackedColor, which are referenced by ids of 15 bits.
+ *
+ * Each sequence is stored once.  Sequences are found by their hash in a
+ * bucket table, and the entry of an id is found by indexing, so neither
+ * adding nor looking up a sequence depends on the number of entries.
+ *
+ * Cells are copied freely, so the table can not count the references to
+ * an id.  Entries are reclaimed in collections instead, which only run
+ * when few ids are left.  A collection starts a new epoch and asks every
+ * owner of cells, see registerOwner(), to mark the ids it uses on the
+ * owner's own thread.  Sequences and colors which are added or found are
+ * marked as well.  Once all owners are done, the entries which were not
+ * marked in the epoch are freed.  If no ids are left, createExtendedChar()
+ * and createColor() fail rather than reusing an id which may still be in use.
+ *
+ * True colors are looked up for every cell which is painted and packed
+ * whenever the emulation changes colors, so lookupColor() does not lock the
+ * table, and createColor() only does for colors its thread has not packed
+ * since the last collection.
  */
 class ExtendedCharTable
 {
 public:
+    /** A sequence of unicode characters, see lookupExtendedChar() */
+    typedef QVarLengthArray<uint, 8> Sequence;
+
+    /**
+     * Called on the thread of its owner to mark the ids used by the owner,
+     * using markExtendedChars().
+     */
+    typedef std::function<void()> MarkFunction;
+
+    /** Memory and usage statistics of the table. */
+    struct Statistics
+    {
+        int entries;            // sequences in the table
+        int capacity;           // largest number of sequences
+        int colors;             // true colors in the table
+        qint64 memoryUsage;     // bytes used by the table
+        quint64 added;          // calls to createExtendedChar()
+        quint64 found;          // ... which found the sequence in the table
+        quint64 failed;         // ... which found no id left
+        quint64 collections;    // collections which have finished
+        quint64 reclaimed;      // entries freed by them
+    };
+
     /** Constructs a new character table. */
     ExtendedCharTable();
     ~ExtendedCharTable();
 
     /**
      * Adds a sequences of unicode characters to the table and returns
-     * a hash code which can be used later to look up the sequence
+     * an id which can be used later to look up the sequence
      * using lookupExtendedChar()
      *
-     * If the same sequence already exists in the table, the hash
+     * If the same sequence already exists in the table, the id
      * of the existing sequence will be returned.
      *
      * @param unicodePoints An array of unicode character points
      * @param length Length of @p unicodePoints
+     *
+     * @return The id of the sequence, or 0 if the table is full.
      */
-    uint createExtendedChar(uint* unicodePoints , ushort length);
+    uint createExtendedChar(const uint* unicodePoints , ushort length);
     /**
-     * Looks up and returns a pointer to a sequence of unicode characters
-     * which was added to the table using createExtendedChar().
+     * Copies a sequence of unicode characters which was added to the
+     * table using createExtendedChar() to @p chars.
+     *
+     * @param id The id returned by createExtendedChar()
+     * @param chars Set to the sequence, or emptied if there is none.
      *
-     * @param hash The hash key returned by createExtendedChar()
-     * @param length This variable is set to the length of the
-     * character sequence.
+     * @return Whether the sequence was found.
+     */
+    bool lookupExtendedChar(uint id , Sequence& chars) const;
+
+    /**
+     * Adds the true color @p rgb to the table and returns an id which can
+     * be used later to look up the color using lookupColor().  The same
+     * color gets the same id as long as it is in use.
      *
-     * @return A unicode character sequence of size @p length.
+     * @return The id of the color, or 0 if the table is full.
      */
-    uint* lookupExtendedChar(uint hash , ushort& length) const;
+    uint createColor(QRgb rgb);
+    /** Returns the color with the @p id returned by createColor(), or black if there is none. */
+    QRgb lookupColor(uint id) const;
 
     /**
-     * Keeps track of all screens.
-     * Used in createExtendedChar for checking all screens.
+     * Registers an owner of cells.  @p mark is called on the thread of
+     * @p owner during each collection.
      */
-    QSet<ScreenWindow*> windows;
+    void registerOwner(QObject* owner, const MarkFunction& mark);
+    void unregisterOwner(QObject* owner);
+    /** Marks the ids of the extended characters and true colors in @p cells as used. */
+    void markExtendedChars(const Character* cells, int count);
+    /** Marks the true color of @p color, if it is one, as used. */
+    void markColor(PackedColor color);
+    /** Marks the extended characters with the ids @p chars and the true colors with the ids @p colors as used. */
+    void markIds(const QVector<uint>& chars, const QVector<uint>& colors);
+
+    /** Returns the statistics of the table. */
+    Statistics statistics() const;
 
     /** The global ExtendedCharTable instance. */
     static ExtendedCharTable instance;
 private:
+    // number of ids, id 0 is not used as it has a special meaning for chars
+    static constexpr uint CAPACITY = 1 << 20;
+    static_assert(CAPACITY - 1 <= CHARACTER_VALUE_MASK, "ids must fit into Character::character");
+    // a collection starts once fewer ids are left, and at most once per as
+    // many new entries
+    static constexpr uint COLLECTION_THRESHOLD = CAPACITY / 8;
+    // entries are allocated in pages, so that they never move
+    static constexpr uint PAGE_SIZE = 4096;
+    // length of the sequences which are stored in the entry itself
+    static constexpr int INLINE_LENGTH = 6;
+    // number of color ids, id 0 is not used
+    static constexpr uint COLOR_CAPACITY = PackedColor::MAX_TRUE_COLOR_ID + 1;
+    static constexpr uint COLOR_COLLECTION_THRESHOLD = COLOR_CAPACITY / 8;
+    // colors are allocated in pages, so that they never move
+    static constexpr uint COLOR_PAGE_SIZE = 1024;
+    // the colors packed last by each thread, see createColor()
+    static constexpr int COLOR_CACHE_BITS = 6;
+
+    struct Entry
+    {
+        uint hash;
+        uint next;              // next entry with the same bucket or next free entry, or 0
+        uint epoch;             // the last epoch the entry was marked in
+        ushort length;          // 0 if the entry is free
+        ushort allocated;       // size of 'points' if it is allocated on the heap
+        uint* points;           // inlinePoints or a buffer on the heap
+        uint inlinePoints[INLINE_LENGTH];
+    };
+
+    // read without the mutex, see lookupColor()
+    struct TrueColor
+    {
+        std::atomic<QRgb> rgb;      // 0 if the id is free, true colors are opaque
+        std::atomic<uint> epoch;    // the last epoch the color was marked in
+    };
+
+    Entry& entry(uint id) const { return _pages[id / PAGE_SIZE][id % PAGE_SIZE]; }
+    TrueColor& color(uint id) const { return _colorPages[id / COLOR_PAGE_SIZE].load()[id % COLOR_PAGE_SIZE]; }
+    // marks the color with 'id', if there is one.  Called with the mutex locked
+    void markColorId(uint id);
     // calculates the hash key of a sequence of unicode points of size 'length'
-    uint extendedCharHash(uint* unicodePoints , ushort length) const;
-    // tests whether the entry in the table specified by 'hash' matches the
-    // character sequence 'unicodePoints' of size 'length'
-    bool extendedCharMatch(uint hash , uint* unicodePoints , ushort length) const;
-    // internal, maps hash keys to character sequence buffers.  The first ushort
-    // in each value is the length of the buffer, followed by the ushorts in the buffer
-    // themselves.
-    QHash<uint,uint*> extendedCharTable;
+    static uint extendedCharHash(const uint* unicodePoints , ushort length);
+    // returns an unused id, or 0 if there is none
+    uint allocateEntry();
+    void unlinkFromBucket(uint id);
+    // doubles the number of buckets
+    void rehash();
+    // starts a collection if few ids are left.  Called with the mutex locked
+    void startCollectionIfNeeded();
+    // called on the thread of 'owner' once it has marked its ids
+    void finishMarking(QObject* owner);
+    // frees the entries which were not marked in this epoch.  Called with
+    // the mutex locked
+    void sweep();
+
+    // guards the table, which is shared by all emulations, some of
+    // which may process their input on worker threads
+    mutable QMutex _mutex;
+    QVector<Entry*> _pages;
+    QVector<uint> _buckets;     // first entry of each bucket, or 0
+    uint _count;                // ids handed out so far, the next new id is _count + 1
+    uint _freeIds;              // first free entry, or 0
+    uint _freeCount;
+    std::atomic<uint> _epoch;
+    uint _allocatedSinceCollection;
+    QHash<QObject*, MarkFunction> _owners;
+    QSet<QObject*> _marking;    // owners which have not marked their ids yet
+    bool _collecting;
+    qint64 _heapPoints;         // code points stored on the heap
+    quint64 _added;
+    quint64 _found;
+    quint64 _failed;
+    quint64 _collections;
+    quint64 _reclaimed;
+    std::atomic<TrueColor*> _colorPages[COLOR_CAPACITY / COLOR_PAGE_SIZE];
+    uint _colorCount;           // color ids handed out so far, including 0
+    // incremented when a sweep starts and when it ends, so that ids cached
+    // by createColor() are known to be still valid
+    std::atomic<uint> _sweeps;
+    QHash<QRgb, uint> _colorIds;
+    QVector<uint> _freeColors;
+    uint _colorsAllocatedSinceCollection;
 };
 
+inline PackedColor::PackedColor(const CharacterColor& color)
+{
+  if (color._colorSpace != COLOR_SPACE_RGB)
+  {
+    _value = (color._colorSpace << 12) | (color._v << 8) | color._u;
+    return;
+  }
+
+  const uint id = ExtendedCharTable::instance.createColor(qRgb(color._u, color._v, color._w));
+  if (id != 0)
+  {
+    _value = TRUE_COLOR | id;
+    return;
+  }
+
+  // the closest color of the 6x6x6 color cube, see color256()
+  auto level = [](int value) { return value < 48 ? 0 : value < 115 ? 1 : (value - 35) / 40; };
+  _value = (COLOR_SPACE_256 << 12) | (16 + 36 * level(color._u) + 6 * level(color._v) + level(color._w));
+}
+
+inline PackedColor::operator CharacterColor() const
+{
+  CharacterColor color;
+  if (_value & TRUE_COLOR)
+  {
+    const QRgb rgb = ExtendedCharTable::instance.lookupColor(_value & MAX_TRUE_COLOR_ID);
+    color._colorSpace = COLOR_SPACE_RGB;
+    color._u = qRed(rgb);
+    color._v = qGreen(rgb);
+    color._w = qBlue(rgb);
+  }
+  else
+  {
+    color._colorSpace = _value >> 12;
+    color._v = (_value >> 8) & 0xF;
+    color._u = _value & 0xFF;
+  }
+  return color;
+}
+
+inline QColor PackedColor::color(const ColorEntry* palette) const
+{
+  if (_value & TRUE_COLOR)
+    return QColor(ExtendedCharTable::instance.lookupColor(_value & MAX_TRUE_COLOR_ID));
+  return CharacterColor(*this).color(palette);
 }
+
+inline int PackedColor::paletteIndex() const
+{
+  const int space = _value >> 12;
+  const int offset = ((_value >> 8) & 0xF) ? BASE_COLORS : 0;
+  if (space == COLOR_SPACE_DEFAULT)
+    return (_value & 0xFF) + offset;
+  if (space == COLOR_SPACE_SYSTEM)
+    return (_value & 0xFF) + 2 + offset;
+  return -1;
+}
+
+}
+Q_DECLARE_TYPEINFO(Konsole::PackedColor, Q_PRIMITIVE_TYPE);
 Q_DECLARE_TYPEINFO(Konsole::Character, Q_MOVABLE_TYPE);
 
+static_assert(sizeof(Konsole::Character) == 8, "Character cells are expected to be packed into 8 bytes");
+
 #endif // CHARACTER_H
 
@@ -138,6 +138,7 @@ extern const ColorEntry base_color_table[TABLE_COLORS] KDE_NO_EXPORT;
 class CharacterColor
 {
     friend class Character;
+    friend class PackedColor;
 
 public:
   /** Constructs a new CharacterColor whose color and color space are undefined. */
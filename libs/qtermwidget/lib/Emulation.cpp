@@ -23,6 +23,7 @@
 #include "Emulation.h"
 
 // System
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <unistd.h>
@@ -34,6 +35,7 @@
 #include <QHash>
 #include <QKeyEvent>
 #include <QRegularExpression>
+#include <QScreen>
 #include <QTextStream>
 #include <QThread>
 
@@ -54,15 +56,52 @@ Emulation::Emulation() :
   _keyTranslator(nullptr),
   _usesMouse(false),
   _bracketedPasteMode(false),
-  _toUtf16(QStringConverter::Utf8)
+  _screenLockUsers(0),
+  _updateRequested(false),
+  _lastFrameTime(0),
+  _frameInterval(0),
+  _frameRequestTime(-1),
+  _keypressTime(-1),
+  _frameLatencyTotal(0),
+  _lowLatencyFrame(false),
+  _synchronizedUpdate(false),
+  _synchronizedUpdateGeneration(0),
+  _synchronizedUpdateTimerGeneration(0),
+  _utf8CodePoint(0),
+  _utf8MinValue(0),
+  _utf8Pending(0),
+  _zmodemMatched(0)
 {
   // create screens with a default size
   _screen[0] = new Screen(40,80);
   _screen[1] = new Screen(40,80);
   _currentScreen = _screen[0];
 
-  QObject::connect(&_bulkTimer1, &QTimer::timeout, this, &Konsole::Emulation::showBulk);
-  QObject::connect(&_bulkTimer2, &QTimer::timeout, this, &Konsole::Emulation::showBulk);
+  // programs using the alternate screen redraw it when they are resized
+  _screen[0]->setReflowLines(true);
+
+  HistoryMemoryGovernor::instance()->registerOwner(this, [this] (qint64 bytes) {
+      return releaseHistoryMemory(bytes);
+  });
+  ExtendedCharTable::instance.registerOwner(this, [this] {
+      markExtendedChars();
+  });
+
+  const QScreen* screen = QGuiApplication::primaryScreen();
+  setRefreshRate(screen ? screen->refreshRate() : 0);
+  _frameClock.start();
+  _frameTimer.setSingleShot(true);
+  _frameTimer.setTimerType(Qt::PreciseTimer);
+  QObject::connect(&_frameTimer, &QTimer::timeout, this, &Konsole::Emulation::showBulk);
+  connect(this, &Emulation::outputFromKeypressEvent,
+          this, &Emulation::keypressOutput);
+
+  _reflowTimer.setSingleShot(true);
+  QObject::connect(&_reflowTimer, &QTimer::timeout, this, &Konsole::Emulation::reflowHistory);
+
+  _synchronizedUpdateTimer.setSingleShot(true);
+  QObject::connect(&_synchronizedUpdateTimer, &QTimer::timeout,
+                   this, &Konsole::Emulation::synchronizedUpdateTimeout);
 
   // listen for mouse status changes
   connect(this, &Konsole::Emulation::programUsesMouseChanged,
@@ -91,6 +130,25 @@ bool Emulation::programBracketedPasteMode() const
     return _bracketedPasteMode;
 }
 
+void Emulation::setScreenLocking(bool enable)
+{
+    // the lock is never destroyed before the emulation, so that windows
+    // and threads which still hold a pointer to it remain valid
+    if (enable && !_screenLock)
+        _screenLock = std::make_unique<QRecursiveMutex>();
+
+    _screenLockUsers += enable ? 1 : -1;
+    Q_ASSERT(_screenLockUsers >= 0);
+
+    for (ScreenWindow* window : std::as_const(_windows))
+        window->setScreenLock(screenLock());
+}
+
+QRecursiveMutex* Emulation::screenLock() const
+{
+    return _screenLockUsers > 0 ? _screenLock.get() : nullptr;
+}
+
 void Emulation::bracketedPasteModeChanged(bool bracketedPasteMode)
 {
     _bracketedPasteMode = bracketedPasteMode;
@@ -98,10 +156,12 @@ void Emulation::bracketedPasteModeChanged(bool bracketedPasteMode)
 
 ScreenWindow* Emulation::createWindow()
 {
+    QMutexLocker locker(screenLock());
+
     ScreenWindow* window = new ScreenWindow();
     window->setScreen(_currentScreen);
+    window->setScreenLock(screenLock());
     _windows << window;
-    ExtendedCharTable::instance.windows << window;
 
     connect(window, &Konsole::ScreenWindow::selectionChanged,
             this, &Konsole::Emulation::bufferedUpdate);
@@ -119,11 +179,13 @@ ScreenWindow* Emulation::createWindow()
 
 Emulation::~Emulation()
 {
+  HistoryMemoryGovernor::instance()->unregisterOwner(this);
+  ExtendedCharTable::instance.unregisterOwner(this);
+
   QListIterator<ScreenWindow*> windowIter(_windows);
   while (windowIter.hasNext())
   {
     auto win = windowIter.next();
-    ExtendedCharTable::instance.windows.remove(win);
     delete win;
   }
 
@@ -145,10 +207,12 @@ void Emulation::setScreen(int n)
 
 void Emulation::clearHistory()
 {
+    QMutexLocker locker(screenLock());
     _screen[0]->setScroll( _screen[0]->getScroll() , false );
 }
 void Emulation::setHistory(const HistoryType& t)
 {
+  QMutexLocker locker(screenLock());
   _screen[0]->setScroll(t);
 
   showBulk();
@@ -159,6 +223,18 @@ const HistoryType& Emulation::history() const
   return _screen[0]->getScroll();
 }
 
+void Emulation::setHistoryIndexEnabled(bool enable)
+{
+  QMutexLocker locker(screenLock());
+  _screen[0]->setHistoryIndexEnabled(enable);
+}
+
+bool Emulation::linesMayMatch(const QVector<quint32>& query, int startLine, int endLine) const
+{
+  QMutexLocker locker(screenLock());
+  return _currentScreen->linesMayMatch(query, startLine, endLine);
+}
+
 void Emulation::setKeyBindings(const QString& name)
 {
   _keyTranslator = KeyboardTranslatorManager::instance()->findTranslator(name);
@@ -190,6 +266,12 @@ void Emulation::receiveChar(wchar_t c)
   };
 }
 
+void Emulation::receiveChars(const uint* chars, int count)
+{
+  for (int i = 0; i < count; i++)
+    receiveChar(chars[i]);
+}
+
 void Emulation::sendKeyEvent(QKeyEvent* ev, bool)
 {
   emit stateSet(NOTIFYNORMAL);
@@ -213,40 +295,122 @@ void Emulation::sendMouseEvent(int /*buttons*/, int /*column*/, int /*row*/, int
 }
 
 /*
-   We are doing code conversion from locale to unicode first.
+   The incoming bytes are decoded as UTF-8 directly from the PTY buffer, without
+   going through intermediate QByteArray/QString/std::wstring copies.  Malformed
+   sequences (stray continuation bytes, overlong forms, surrogates and values
+   above U+10FFFF) are replaced by U+FFFD, like QStringDecoder does.
 TODO: Character composition from the old code.  See #96536
 */
 
 void Emulation::receiveData(const char* text, int length)
 {
+    static const uint REPLACEMENT_CHARACTER = 0xFFFD;
+    static const char ZMODEM_INDICATOR[] = "\030B00";
+    static const int ZMODEM_INDICATOR_LENGTH = sizeof(ZMODEM_INDICATOR) - 1;
+    static const int MAX_RUN_LENGTH = 256;
+
     emit stateSet(NOTIFYACTIVITY);
 
     bufferedUpdate();
 
-    /* XXX: the following code involves encoding & decoding of "UTF-16
-     * surrogate pairs", which does not work with characters higher than
-     * U+10FFFF
-     * https://unicodebook.readthedocs.io/unicode_encodings.html#surrogates
-     */
-    QByteArray ba(text, length);
-    QString str = _toUtf16(ba);
-    std::wstring unicodeText = str.toStdWString();
-
-    //send characters to terminal emulator
-    for (size_t i=0;i<unicodeText.length();i++)
-        receiveChar(unicodeText[i]);
-
-    //look for z-modem indicator
-    //-- someone who understands more about z-modems that I do may be able to move
-    //this check into the above for loop?
-    for (int i=0;i<length;i++)
+    // printable characters are collected and handed to receiveChars() in
+    // batches, control characters flush the batch and go to receiveChar()
+    uint run[MAX_RUN_LENGTH];
+    int runLength = 0;
+
+    auto flushRun = [&]() {
+        if (runLength > 0)
+        {
+            receiveChars(run, runLength);
+            runLength = 0;
+        }
+    };
+    auto decoded = [&](uint cp) {
+        if (cp >= 0x20 && cp != 0x7f && (cp < 0x80 || cp >= 0xa0))
+        {
+            run[runLength++] = cp;
+            if (runLength == MAX_RUN_LENGTH)
+                flushRun();
+        }
+        else
+        {
+            flushRun();
+            receiveChar(cp);
+        }
+    };
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text);
+
+    for (int i = 0; i < length; i++)
     {
-        if (text[i] == '\030')
+        const unsigned char byte = data[i];
+
+        //look for z-modem indicator, which may be split across two buffers
+        if (byte == ZMODEM_INDICATOR[_zmodemMatched])
         {
-            if ((length-i-1 > 3) && (strncmp(text+i+1, "B00", 3) == 0))
+            if (++_zmodemMatched == ZMODEM_INDICATOR_LENGTH)
+            {
+                _zmodemMatched = 0;
                 emit zmodemDetected();
+            }
+        }
+        else
+        {
+            _zmodemMatched = (byte == '\030') ? 1 : 0;
+        }
+
+        if (_utf8Pending > 0)
+        {
+            if ((byte & 0xC0) == 0x80)
+            {
+                _utf8CodePoint = (_utf8CodePoint << 6) | (byte & 0x3F);
+                if (--_utf8Pending == 0)
+                {
+                    const uint cp = _utf8CodePoint;
+                    if (cp < _utf8MinValue || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+                        decoded(REPLACEMENT_CHARACTER);
+                    else
+                        decoded(cp);
+                }
+                continue;
+            }
+
+            // the sequence was cut short, replace it and handle this byte
+            // as the start of a new one
+            _utf8Pending = 0;
+            decoded(REPLACEMENT_CHARACTER);
+        }
+
+        if (byte < 0x80)
+        {
+            decoded(byte);
+        }
+        else if ((byte & 0xE0) == 0xC0)
+        {
+            _utf8CodePoint = byte & 0x1F;
+            _utf8MinValue = 0x80;
+            _utf8Pending = 1;
+        }
+        else if ((byte & 0xF0) == 0xE0)
+        {
+            _utf8CodePoint = byte & 0x0F;
+            _utf8MinValue = 0x800;
+            _utf8Pending = 2;
+        }
+        else if ((byte & 0xF8) == 0xF0)
+        {
+            _utf8CodePoint = byte & 0x07;
+            _utf8MinValue = 0x10000;
+            _utf8Pending = 3;
+        }
+        else
+        {
+            // stray continuation byte or invalid lead byte
+            decoded(REPLACEMENT_CHARACTER);
         }
     }
+
+    flushRun();
 }
 
 //OLDER VERSION
@@ -302,38 +466,211 @@ void Emulation::writeToStream( TerminalCharacterDecoder* _decoder ,
                                int startLine ,
                                int endLine)
 {
+  QMutexLocker locker(screenLock());
   _currentScreen->writeLinesToStream(_decoder,startLine,endLine);
 }
 
+void Emulation::copyLineCells(int startLine, int endLine, QVector<Character>& cells,
+                              QVector<int>& lineEnds, QVector<unsigned char>& lineProperties) const
+{
+  QMutexLocker locker(screenLock());
+  _currentScreen->copyLineCells(startLine, endLine, cells, lineEnds, lineProperties);
+}
+
 int Emulation::lineCount() const
 {
+    QMutexLocker locker(screenLock());
     // sum number of lines currently on _screen plus number of lines in history
     return _currentScreen->getLines() + _currentScreen->getHistLines();
 }
 
+qint64 Emulation::droppedLineCount() const
+{
+    QMutexLocker locker(screenLock());
+    return _currentScreen->totalDroppedLines();
+}
+
+uint Emulation::historyGeneration() const
+{
+    QMutexLocker locker(screenLock());
+    // the lowest bit tells the screens apart
+    const uint generation = _screen[0]->historyGeneration() + _screen[1]->historyGeneration();
+    return (generation << 1) | (_currentScreen == _screen[1] ? 1 : 0);
+}
+
 void Emulation::showBulk()
 {
-    _bulkTimer1.stop();
-    _bulkTimer2.stop();
+    QMutexLocker locker(screenLock());
+
+    _frameTimer.stop();
+
+    // the frame is presented once the program has finished drawing it
+    if (_synchronizedUpdate)
+        return;
+
+    const qint64 now = _frameClock.nsecsElapsed();
+    if (_frameRequestTime >= 0)
+    {
+        const qint64 latency = now - _frameRequestTime;
+        _frameLatencyTotal += latency;
+        _frameStats.maxLatency = qMax(_frameStats.maxLatency, latency / 1000);
+    }
+    ++_frameStats.framesPresented;
+    if (_lowLatencyFrame)
+        ++_frameStats.lowLatencyFrames;
+    _frameRequestTime = -1;
+    _lowLatencyFrame = false;
+    _lastFrameTime = now;
 
     emit outputChanged();
 
     _currentScreen->resetScrolledLines();
     _currentScreen->resetDroppedLines();
+    // the history of the primary screen may be rewrapped while the
+    // alternate screen is shown.  Its line map must not move the views
+    // later on, once the primary screen is shown again
+    _screen[0]->resetReflowedLines();
+    _screen[1]->resetReflowedLines();
+
+    const qint64 historyUsage = _screen[0]->historyMemoryUsage() + _screen[1]->historyMemoryUsage();
+    locker.unlock();
+    HistoryMemoryGovernor::instance()->setUsage(this, historyUsage);
+}
+
+qint64 Emulation::releaseHistoryMemory(qint64 bytes)
+{
+    QMutexLocker locker(screenLock());
+
+    qint64 freed = _screen[0]->releaseHistoryMemory(bytes);
+    if (freed < bytes)
+        freed += _screen[1]->releaseHistoryMemory(bytes - freed);
+    if (freed > 0)
+        bufferedUpdate();
+    return freed;
+}
+
+void Emulation::markExtendedChars()
+{
+    QMutexLocker locker(screenLock());
+
+    _screen[0]->markExtendedChars();
+    _screen[1]->markExtendedChars();
+    for (const ScreenWindow* window : std::as_const(_windows))
+        window->markExtendedChars();
+}
+
+void Emulation::setSynchronizedUpdate(bool active)
+{
+    // longest time updates are held back for
+    static const int SYNCHRONIZED_UPDATE_TIMEOUT = 150;
+
+    if (_synchronizedUpdate.exchange(active) == active)
+        return;
+
+    if (!active)
+    {
+        // the timer can only be stopped on its own thread.  If it keeps
+        // running, synchronizedUpdateTimeout() ignores it
+        if (QThread::currentThread() == thread())
+            _synchronizedUpdateTimer.stop();
+        bufferedUpdate();
+        return;
+    }
+
+    // each frame gets a generation of its own, so that the timer of a frame
+    // which has ended can not release the next one early
+    const uint generation = ++_synchronizedUpdateGeneration;
+    auto startTimer = [this, generation] {
+        if (_synchronizedUpdate && _synchronizedUpdateGeneration == generation)
+        {
+            _synchronizedUpdateTimerGeneration = generation;
+            _synchronizedUpdateTimer.start(SYNCHRONIZED_UPDATE_TIMEOUT);
+        }
+    };
+    if (QThread::currentThread() == thread())
+        startTimer();
+    else
+        QMetaObject::invokeMethod(this, startTimer, Qt::QueuedConnection);
+}
+
+void Emulation::synchronizedUpdateTimeout()
+{
+    // the frame is not changed by the thread processing the input meanwhile
+    QMutexLocker locker(screenLock());
+
+    if (_synchronizedUpdateTimerGeneration != _synchronizedUpdateGeneration)
+        return;
+    if (_synchronizedUpdate.exchange(false))
+        showBulk();
+}
+
+void Emulation::keypressOutput()
+{
+    _keypressTime = _frameClock.nsecsElapsed();
+}
+
+Emulation::FrameStatistics Emulation::frameStatistics() const
+{
+    FrameStatistics stats = _frameStats;
+    if (stats.framesPresented > 0)
+        stats.averageLatency = _frameLatencyTotal / qint64(stats.framesPresented) / 1000;
+    return stats;
+}
+
+void Emulation::resetFrameStatistics()
+{
+    _frameStats = FrameStatistics();
+    _frameLatencyTotal = 0;
+}
+
+void Emulation::setRefreshRate(qreal rate)
+{
+    // screens which do not know their rate report 0
+    _frameInterval = qint64(1e9 / (rate >= 1 ? rate : 60));
 }
 
 void Emulation::bufferedUpdate()
 {
-    static const int BULK_TIMEOUT1 = 10;
-    static const int BULK_TIMEOUT2 = 40;
+    // the timers belong to the thread the emulation lives in, requests made
+    // while receiveData() runs on a worker thread are forwarded to it
+    if (QThread::currentThread() != thread())
+    {
+        if (!_updateRequested.exchange(true))
+        {
+            QMetaObject::invokeMethod(this, [this] {
+                _updateRequested = false;
+                bufferedUpdate();
+            }, Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    // output arriving this long after a key press is taken to be its echo
+    static const qint64 KEYPRESS_ECHO_WINDOW = 50 * 1000 * 1000;
+
+    const qint64 now = _frameClock.nsecsElapsed();
+    if (_frameRequestTime < 0)
+        _frameRequestTime = now;
+
+    if (_keypressTime >= 0 && now - _keypressTime < KEYPRESS_ECHO_WINDOW)
+    {
+        // present once the data at hand has been processed; further output
+        // is paced normally until the next key press
+        _keypressTime = -1;
+        _lowLatencyFrame = true;
+        _frameTimer.start(0);
+        return;
+    }
 
-   _bulkTimer1.setSingleShot(true);
-   _bulkTimer1.start(BULK_TIMEOUT1);
-   if (!_bulkTimer2.isActive())
-   {
-      _bulkTimer2.setSingleShot(true);
-      _bulkTimer2.start(BULK_TIMEOUT2);
-   }
+    // a frame is already scheduled, this update will be part of it
+    if (_frameTimer.isActive())
+    {
+        ++_frameStats.updatesCoalesced;
+        return;
+    }
+
+    const qint64 due = _lastFrameTime + _frameInterval - now;
+    _frameTimer.start(due > 0 ? int((due + 999999) / 1000000) : 0);
 }
 
 char Emulation::eraseChar() const
@@ -346,6 +683,8 @@ void Emulation::setImageSize(int lines, int columns)
   if ((lines < 1) || (columns < 1))
     return;
 
+  QMutexLocker locker(screenLock());
+
   QSize screenSize[2] = { QSize(_screen[0]->getColumns(),
                                 _screen[0]->getLines()),
                           QSize(_screen[1]->getColumns(),
@@ -358,17 +697,35 @@ void Emulation::setImageSize(int lines, int columns)
   _screen[0]->resizeImage(lines,columns);
   _screen[1]->resizeImage(lines,columns);
 
+  // the rest of the history is rewrapped in the background
+  if (_screen[0]->isReflowingHistory())
+    QMetaObject::invokeMethod(this, [this] { _reflowTimer.start(0); });
+
   emit imageSizeChanged(lines,columns);
 
   bufferedUpdate();
 }
 
+void Emulation::reflowHistory()
+{
+  // number of history lines rewrapped per pass of the event loop
+  static const int REFLOW_STEP_LINES = 2000;
+
+  QMutexLocker locker(screenLock());
+
+  if (_screen[0]->reflowHistoryStep(REFLOW_STEP_LINES))
+    _reflowTimer.start(0);
+  else
+    bufferedUpdate();
+}
+
 QSize Emulation::imageSize() const
 {
+  QMutexLocker locker(screenLock());
   return {_currentScreen->getColumns(), _currentScreen->getLines()};
 }
 
-uint ExtendedCharTable::extendedCharHash(uint* unicodePoints , ushort length) const
+uint ExtendedCharTable::extendedCharHash(const uint* unicodePoints , ushort length)
 {
     uint hash = 0;
     for ( ushort i = 0 ; i < length ; i++ )
@@ -377,127 +734,382 @@ uint ExtendedCharTable::extendedCharHash(uint* unicodePoints , ushort length) co
     }
     return hash;
 }
-bool ExtendedCharTable::extendedCharMatch(uint hash , uint* unicodePoints , ushort length) const
+
+void ExtendedCharTable::unlinkFromBucket(uint id)
 {
-    uint* entry = extendedCharTable[hash];
+    uint* link = &_buckets[entry(id).hash & (_buckets.size() - 1)];
+    while (*link != id)
+        link = &entry(*link).next;
+    *link = entry(id).next;
+}
 
-    // compare given length with stored sequence length ( given as the first ushort in the
-    // stored buffer )
-    if ( entry == nullptr || entry[0] != length )
-       return false;
-    // if the lengths match, each character must be checked.  the stored buffer starts at
-    // entry[1]
-    for ( int i = 0 ; i < length ; i++ )
+void ExtendedCharTable::rehash()
+{
+    QVector<uint> buckets(_buckets.size() * 2, 0);
+    for (uint id = 1; id <= _count; id++)
     {
-        if ( entry[i+1] != unicodePoints[i] )
-           return false;
+        // free entries are linked in the free list instead
+        Entry& e = entry(id);
+        if (e.length == 0)
+            continue;
+        uint& head = buckets[e.hash & (buckets.size() - 1)];
+        e.next = head;
+        head = id;
     }
-    return true;
+    _buckets.swap(buckets);
 }
-uint ExtendedCharTable::createExtendedChar(uint* unicodePoints , ushort length)
+
+uint ExtendedCharTable::allocateEntry()
 {
-    // look for this sequence of points in the table
-    uint hash = extendedCharHash(unicodePoints,length);
-    const uint initialHash = hash;
-    bool triedCleaningSolution = false;
+    uint id = 0;
+    if (_freeIds)
+    {
+        id = _freeIds;
+        _freeIds = entry(id).next;
+        _freeCount--;
+    }
+    else if (_count + 1 < CAPACITY)
+    {
+        id = ++_count;
+        if (id / PAGE_SIZE == uint(_pages.size()))
+            _pages.append(new Entry[PAGE_SIZE]());
+        Entry& e = entry(id);
+        e.points = e.inlinePoints;
+        e.allocated = 0;
+        e.length = 0;
+        if (_count > uint(_buckets.size()))
+            rehash();
+    }
+    else
+    {
+        return 0;
+    }
+    _allocatedSinceCollection++;
+    return id;
+}
 
-    // check existing entry for match
-    while (extendedCharTable.contains(hash) && hash != 0) // 0 has a special meaning for chars so we don't use it
+void ExtendedCharTable::startCollectionIfNeeded()
+{
+    const uint left = CAPACITY - 1 - _count + _freeCount;
+    const uint colorsLeft = COLOR_CAPACITY - _colorCount + _freeColors.size();
+    const bool fewIds = left < COLLECTION_THRESHOLD && _allocatedSinceCollection >= COLLECTION_THRESHOLD;
+    const bool fewColors = colorsLeft < COLOR_COLLECTION_THRESHOLD
+                           && _colorsAllocatedSinceCollection >= COLOR_COLLECTION_THRESHOLD;
+    if (_collecting || (!fewIds && !fewColors))
+        return;
+
+    _collecting = true;
+    _epoch++;
+    _allocatedSinceCollection = 0;
+    _colorsAllocatedSinceCollection = 0;
+    if (_owners.isEmpty())
+    {
+        sweep();
+        return;
+    }
+
+    // owners may be busy with their cells on other threads, so each one
+    // marks its ids on its own thread
+    for (auto it = _owners.constBegin(); it != _owners.constEnd(); ++it)
+    {
+        QObject* owner = it.key();
+        const MarkFunction mark = it.value();
+        _marking.insert(owner);
+        QMetaObject::invokeMethod(owner, [this, owner, mark] {
+            mark();
+            finishMarking(owner);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void ExtendedCharTable::finishMarking(QObject* owner)
+{
+    QMutexLocker locker(&_mutex);
+    if (_collecting && _marking.remove(owner) && _marking.isEmpty())
+        sweep();
+}
+
+void ExtendedCharTable::sweep()
+{
+    _sweeps++;
+    for (uint id = 1; id <= _count; id++)
     {
-        if (extendedCharMatch(hash, unicodePoints, length))
+        Entry& e = entry(id);
+        if (e.length == 0 || e.epoch == _epoch)
+            continue;
+
+        unlinkFromBucket(id);
+        if (e.allocated)
         {
-            // this sequence already has an entry in the table,
-            // return its hash
-            return hash;
+            delete[] e.points;
+            _heapPoints -= e.allocated;
+            e.points = e.inlinePoints;
+            e.allocated = 0;
         }
-        else
-        {
-            // if hash is already used by another, different sequence of
-            // unicode character points, then try next hash
-            hash++;
+        e.length = 0;
+        e.next = _freeIds;
+        _freeIds = id;
+        _freeCount++;
+        _reclaimed++;
+    }
+    for (uint id = 1; id < _colorCount; id++)
+    {
+        TrueColor& trueColor = color(id);
+        const QRgb rgb = trueColor.rgb;
+        if (rgb == 0 || trueColor.epoch.load() == _epoch.load())
+            continue;
+
+        _colorIds.remove(rgb);
+        trueColor.rgb = 0;
+        _freeColors.append(id);
+        _reclaimed++;
+    }
+    _sweeps++;
+    _collecting = false;
+    _collections++;
+}
 
-            if (hash == initialHash)
-            {
-                if (!triedCleaningSolution)
-                {
-                    triedCleaningSolution = true;
-                    // All the hashes are full, go to all Screens and try to free any
-                    // This is slow but should happen very rarely
-                    QSet<uint> usedExtendedChars;
-                    for (const auto &w : std::as_const(windows))
-                    {
-                        if (w->screen())
-                        {
-                            usedExtendedChars += w->screen()->usedExtendedChars();
-                        }
-                    }
-
-                    QHash<uint,uint*>::iterator it = extendedCharTable.begin();
-                    QHash<uint,uint*>::iterator itEnd = extendedCharTable.end();
-                    while (it != itEnd)
-                    {
-                        if (usedExtendedChars.contains(it.key()))
-                        {
-                            ++it;
-                        }
-                        else
-                        {
-                            it = extendedCharTable.erase(it);
-                        }
-                    }
-                }
-                else
-                {
-                    qWarning() << "Using all the extended char hashes, going to miss this extended character";
-                    return 0;
-                }
-            }
+uint ExtendedCharTable::createExtendedChar(const uint* unicodePoints , ushort length)
+{
+    QMutexLocker locker(&_mutex);
+    _added++;
+
+    const uint hash = extendedCharHash(unicodePoints, length);
+    for (uint id = _buckets[hash & (_buckets.size() - 1)]; id != 0; id = entry(id).next)
+    {
+        Entry& e = entry(id);
+        if (e.hash == hash && e.length == length &&
+            std::equal(unicodePoints, unicodePoints + length, e.points))
+        {
+            // this sequence already has an entry in the table, which
+            // is in use again
+            _found++;
+            e.epoch = _epoch;
+            return id;
         }
     }
 
+    const uint id = length > 0 ? allocateEntry() : 0;
+    if (id == 0)
+    {
+        _failed++;
+        return 0;
+    }
 
-     // add the new sequence to the table and
-     // return that index
-    uint* buffer = new uint[length+1];
-    buffer[0] = length;
-    for ( int i = 0 ; i < length ; i++ )
-       buffer[i+1] = unicodePoints[i];
+    Entry& e = entry(id);
+    if (length > INLINE_LENGTH)
+    {
+        _heapPoints += length;
+        e.points = new uint[length];
+        e.allocated = length;
+    }
+    std::copy(unicodePoints, unicodePoints + length, e.points);
+    e.length = length;
+    e.hash = hash;
+    e.epoch = _epoch;
 
-    extendedCharTable.insert(hash,buffer);
+    uint& head = _buckets[hash & (_buckets.size() - 1)];
+    e.next = head;
+    head = id;
 
-    return hash;
+    startCollectionIfNeeded();
+    return id;
+}
+
+bool ExtendedCharTable::lookupExtendedChar(uint id , Sequence& chars) const
+{
+    // the sequence is copied while the table is locked, as the entry may
+    // be freed and reused by another thread right after
+    QMutexLocker locker(&_mutex);
+    if ( id != 0 && id <= _count && entry(id).length > 0 )
+    {
+        const Entry& e = entry(id);
+        chars.resize(e.length);
+        std::copy(e.points, e.points + e.length, chars.data());
+        return true;
+    }
+    else
+    {
+        chars.clear();
+        return false;
+    }
 }
 
-uint* ExtendedCharTable::lookupExtendedChar(uint hash , ushort& length) const
+uint ExtendedCharTable::createColor(QRgb rgb)
 {
-    // lookup index in table and if found, set the length
-    // argument and return a pointer to the character sequence
+    struct CachedColor
+    {
+        QRgb rgb;
+        uint id;
+        uint sweeps;    // _sweeps when the id was found
+    };
+    static thread_local CachedColor cache[1 << COLOR_CACHE_BITS] = {};
+
+    // an id found before stays valid until the next sweep.  It is marked like
+    // a color found in the table, and dropped if a sweep has started since,
+    // which may not have seen the mark
+    CachedColor& cached = cache[(rgb * 0x9E3779B1u) >> (32 - COLOR_CACHE_BITS)];
+    const uint sweeps = _sweeps;
+    if (cached.id != 0 && cached.rgb == rgb && cached.sweeps == sweeps)
+    {
+        color(cached.id).epoch = _epoch.load();
+        if (_sweeps == sweeps)
+            return cached.id;
+    }
+
+    QMutexLocker locker(&_mutex);
 
-    uint* buffer = extendedCharTable[hash];
-    if ( buffer )
+    uint id = 0;
+    const auto it = _colorIds.constFind(rgb);
+    if (it != _colorIds.constEnd())
     {
-        length = buffer[0];
-        return buffer+1;
+        id = *it;
+        color(id).epoch = _epoch.load();
     }
     else
     {
-        length = 0;
-        return nullptr;
+        if (!_freeColors.isEmpty())
+        {
+            id = _freeColors.takeLast();
+        }
+        else if (_colorCount < COLOR_CAPACITY)
+        {
+            id = _colorCount++;
+            std::atomic<TrueColor*>& page = _colorPages[id / COLOR_PAGE_SIZE];
+            if (!page.load())
+                page = new TrueColor[COLOR_PAGE_SIZE]();
+        }
+        else
+        {
+            return 0;
+        }
+
+        // the color is set before the id is handed out, see lookupColor()
+        color(id).epoch = _epoch.load();
+        color(id).rgb = rgb;
+        _colorIds.insert(rgb, id);
+        _colorsAllocatedSinceCollection++;
+        startCollectionIfNeeded();
+    }
+
+    cached = CachedColor{rgb, id, _sweeps};
+    return id;
+}
+
+QRgb ExtendedCharTable::lookupColor(uint id) const
+{
+    // the color of an id does not change while cells use it
+    const TrueColor* page = id < COLOR_CAPACITY ? _colorPages[id / COLOR_PAGE_SIZE].load() : nullptr;
+    const QRgb rgb = page ? page[id % COLOR_PAGE_SIZE].rgb.load() : 0;
+    return rgb != 0 ? rgb : qRgb(0, 0, 0);
+}
+
+void ExtendedCharTable::markColorId(uint id)
+{
+    if (id != 0 && id < _colorCount)
+        color(id).epoch = _epoch.load();
+}
+
+void ExtendedCharTable::registerOwner(QObject* owner, const MarkFunction& mark)
+{
+    QMutexLocker locker(&_mutex);
+    _owners.insert(owner, mark);
+}
+
+void ExtendedCharTable::unregisterOwner(QObject* owner)
+{
+    QMutexLocker locker(&_mutex);
+    _owners.remove(owner);
+    if (_collecting && _marking.remove(owner) && _marking.isEmpty())
+        sweep();
+}
+
+void ExtendedCharTable::markExtendedChars(const Character* cells, int count)
+{
+    QMutexLocker locker(&_mutex);
+    for (int i = 0; i < count; i++)
+    {
+        const uint id = cells[i].character;
+        if ((cells[i].rendition & RE_EXTENDED_CHAR) && id != 0 && id <= _count)
+            entry(id).epoch = _epoch;
+
+        markColorId(cells[i].foregroundColor.trueColorId());
+        markColorId(cells[i].backgroundColor.trueColorId());
+    }
+}
+
+void ExtendedCharTable::markColor(PackedColor color)
+{
+    QMutexLocker locker(&_mutex);
+    markColorId(color.trueColorId());
+}
+
+void ExtendedCharTable::markIds(const QVector<uint>& chars, const QVector<uint>& colors)
+{
+    QMutexLocker locker(&_mutex);
+    for (const uint id : chars)
+    {
+        if (id != 0 && id <= _count)
+            entry(id).epoch = _epoch;
     }
+    for (const uint id : colors)
+        markColorId(id);
+}
+
+ExtendedCharTable::Statistics ExtendedCharTable::statistics() const
+{
+    QMutexLocker locker(&_mutex);
+
+    Statistics stats;
+    stats.entries = _count - _freeCount;
+    stats.capacity = CAPACITY - 1;
+    stats.colors = _colorIds.size();
+    stats.memoryUsage = qint64(_pages.size()) * PAGE_SIZE * sizeof(Entry)
+                      + _buckets.size() * sizeof(uint)
+                      + _heapPoints * sizeof(uint)
+                      + qint64((_colorCount + COLOR_PAGE_SIZE - 1) / COLOR_PAGE_SIZE) * COLOR_PAGE_SIZE * sizeof(TrueColor)
+                      + _colorIds.capacity() * qint64(sizeof(QRgb) + sizeof(uint))
+                      + _freeColors.capacity() * sizeof(uint);
+    stats.added = _added;
+    stats.found = _found;
+    stats.failed = _failed;
+    stats.collections = _collections;
+    stats.reclaimed = _reclaimed;
+    return stats;
 }
 
 ExtendedCharTable::ExtendedCharTable()
+  : _buckets(PAGE_SIZE, 0),
+    _count(0),
+    _freeIds(0),
+    _freeCount(0),
+    _epoch(0),
+    _allocatedSinceCollection(0),
+    _collecting(false),
+    _heapPoints(0),
+    _added(0),
+    _found(0),
+    _failed(0),
+    _collections(0),
+    _reclaimed(0),
+    _colorPages(),
+    _colorCount(1),
+    _sweeps(0),
+    _colorsAllocatedSinceCollection(0)
 {
 }
 ExtendedCharTable::~ExtendedCharTable()
 {
     // free all allocated character buffers
-    QHashIterator<uint,uint*> iter(extendedCharTable);
-    while ( iter.hasNext() )
+    for (uint id = 1; id <= _count; id++)
     {
-        iter.next();
-        delete[] iter.value();
+        if (entry(id).allocated)
+            delete[] entry(id).points;
     }
+    for (Entry* page : std::as_const(_pages))
+        delete[] page;
+    for (const std::atomic<TrueColor*>& page : _colorPages)
+        delete[] page.load();
 }
 
 // global instance
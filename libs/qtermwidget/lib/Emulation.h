@@ -24,14 +24,18 @@
 #define EMULATION_H
 
 // System
+#include <atomic>
 #include <cstdio>
+#include <memory>
 
 // Qt
+#include <QElapsedTimer>
 #include <QKeyEvent>
 //#include <QPointer>
+#include <QRecursiveMutex>
 #include <QTextStream>
 #include <QTimer>
-#include <QStringDecoder>
+#include <QVector>
 
 #include "qtermwidget_export.h"
 #include "KeyboardTranslator.h"
@@ -39,6 +43,7 @@
 namespace Konsole
 {
 
+class Character;
 class HistoryType;
 class Screen;
 class ScreenWindow;
@@ -163,6 +168,21 @@ public:
    */
   int lineCount() const;
 
+  /**
+   * Returns the number of lines which have been dropped from the top of the
+   * history since the emulation was created.  Line numbers taken at two
+   * different times can be compared by subtracting the difference.
+   */
+  qint64 droppedLineCount() const;
+
+  /**
+   * Returns a number which changes whenever the lines returned by
+   * writeToStream() are replaced rather than added to or dropped from the
+   * history, for example when the history is cleared or the alternate
+   * screen is switched to.
+   */
+  uint historyGeneration() const;
+
   /**
    * Sets the history store used by this emulation.  When new lines
    * are added to the output, older lines at the top of the screen are transferred to a history
@@ -176,6 +196,17 @@ public:
   const HistoryType& history() const;
   /** Clears the history scroll. */
   void clearHistory();
+  /**
+   * Enables or disables an index of the history which lets searches skip
+   * the lines which cannot match.  See linesMayMatch()
+   */
+  void setHistoryIndexEnabled(bool enable);
+  /**
+   * Returns false if lines @p startLine to @p endLine of writeToStream()
+   * cannot contain a match of the expression @p query was made from,
+   * using HistoryTrigramIndex::query().  Returns true if they may.
+   */
+  bool linesMayMatch(const QVector<quint32>& query, int startLine, int endLine) const;
 
   /**
    * Copies the output history from @p startLine to @p endLine
@@ -190,6 +221,14 @@ public:
    */
   virtual void writeToStream(TerminalCharacterDecoder* decoder,int startLine,int endLine);
 
+  /**
+   * Copies the cells of the lines from @p startLine to @p endLine, the
+   * lines of writeToStream(), without decoding them.  See
+   * Screen::copyLineCells()
+   */
+  void copyLineCells(int startLine, int endLine, QVector<Character>& cells,
+                     QVector<int>& lineEnds, QVector<unsigned char>& lineProperties) const;
+
   /** TODO Document me */
   virtual char eraseChar() const;
 
@@ -224,6 +263,57 @@ public:
 
   bool programBracketedPasteMode() const;
 
+  /**
+   * Enables or disables locking of the emulation's screens.
+   *
+   * Locking is required when receiveData() is called from a thread other than
+   * the one the emulation lives in ( see Session::setThreadedEmulation() ).
+   * The thread calling receiveData() must then hold screenLock() while doing so,
+   * and the screen windows created by createWindow() take the lock whenever
+   * they access the screens.  It is also required to read the screens from
+   * another thread, as HistorySearch does.
+   *
+   * Calls nest: locking stays enabled until each call enabling it has been
+   * matched by a call disabling it.
+   */
+  void setScreenLocking(bool enable);
+
+  /**
+   * Returns the lock guarding the emulation's screens, or nullptr if
+   * screen locking is disabled.  See setScreenLocking()
+   */
+  QRecursiveMutex* screenLock() const;
+
+  /**
+   * Counters describing how the emulation paced updates of its views.
+   * See frameStatistics()
+   */
+  struct FrameStatistics
+  {
+      /** Number of updates sent to the views. */
+      quint64 framesPresented = 0;
+      /** Number of those which were sent right after a key press. */
+      quint64 lowLatencyFrames = 0;
+      /** Number of update requests folded into an already scheduled frame. */
+      quint64 updatesCoalesced = 0;
+      /** Average time from the first update request of a frame to its presentation, in microseconds. */
+      qint64 averageLatency = 0;
+      /** Longest time from the first update request of a frame to its presentation, in microseconds. */
+      qint64 maxLatency = 0;
+  };
+
+  /** Returns the frame pacing counters collected since the last resetFrameStatistics() */
+  FrameStatistics frameStatistics() const;
+  /** Clears the frame pacing counters. */
+  void resetFrameStatistics();
+
+  /**
+   * Sets the refresh rate, in Hz, of the screen the views are shown on.
+   * Updates are presented at most once per refresh.  Until it is set, the
+   * rate of the primary screen is used.
+   */
+  void setRefreshRate(qreal rate);
+
 public slots:
 
   /** Change the size of the emulation's image */
@@ -258,8 +348,9 @@ public slots:
 
   /**
    * Processes an incoming stream of characters.  receiveData() decodes the incoming
-   * character buffer using the current codec(), and then calls receiveChar() for
-   * each unicode character in the resulting buffer.
+   * UTF-8 character buffer in place and calls receiveChar() for each unicode code
+   * point.  Multi-byte sequences which are split across two calls are carried over
+   * to the next call, so @p buffer may end at any byte boundary.
    *
    * receiveData() also starts a timer which causes the outputChanged() signal
    * to be emitted when it expires.  The timer allows multiple updates in quick
@@ -441,6 +532,16 @@ protected:
    */
   virtual void receiveChar(wchar_t ch);
 
+  /**
+   * Processes a run of printable characters.  receiveData() collects
+   * characters which are neither C0 nor C1 control codes and passes them here
+   * in batches.  The default implementation calls receiveChar() for each one.
+   *
+   * @p chars The unicode character codes.
+   * @p count The number of characters in @p chars
+   */
+  virtual void receiveChars(const uint* chars, int count);
+
   /**
    * Sets the active screen.  The terminal has two screens, primary and alternate.
    * The primary screen is used by default.  When certain interactive programs such
@@ -457,6 +558,14 @@ protected:
   };
   void setCodec(EmulationCodec codec); // codec number, 0 = locale, 1=utf8
 
+  /**
+   * Holds back or releases updates of the attached views.  While updates are
+   * held back, the program is drawing a new frame and intermediate states of
+   * the screens are not shown.  Updates are released again after a timeout,
+   * in case the program never ends the frame.
+   */
+  void setSynchronizedUpdate(bool active);
+
 
   QList<ScreenWindow*> _windows;
 
@@ -476,6 +585,10 @@ protected slots:
    * Schedules an update of attached views.
    * Repeated calls to bufferedUpdate() in close succession will result in only a single update,
    * much like the Qt buffered update of widgets.
+   *
+   * Updates are presented at most once per refresh, see setRefreshRate().  Output
+   * which follows a key press is presented on the next pass of the event loop
+   * instead, so that typing echoes without delay.
    */
   void bufferedUpdate();
 
@@ -485,16 +598,52 @@ private slots:
   // view
   void showBulk();
 
+  // remembers when the last key press produced output, see bufferedUpdate()
+  void keypressOutput();
+
+  // releases updates which were held back for too long, see setSynchronizedUpdate()
+  void synchronizedUpdateTimeout();
+
+  // rewraps a part of the history after the number of columns has changed
+  void reflowHistory();
+
   void usesMouseChanged(bool usesMouse);
 
   void bracketedPasteModeChanged(bool bracketedPasteMode);
 
 private:
+  // drops old history lines on behalf of the HistoryMemoryGovernor
+  qint64 releaseHistoryMemory(qint64 bytes);
+  // marks the extended characters in use on behalf of the ExtendedCharTable
+  void markExtendedChars();
+
   bool _usesMouse;
   bool _bracketedPasteMode;
-  QTimer _bulkTimer1{this};
-  QTimer _bulkTimer2{this};
-  QStringDecoder _toUtf16;
+  QTimer _frameTimer{this};      // fires when the next frame is due
+  QElapsedTimer _frameClock;     // time base for the frame pacing below
+  qint64 _lastFrameTime;         // when the last frame was presented, in ns
+  qint64 _frameInterval;         // the time between two refreshes of the screen, in ns
+  qint64 _frameRequestTime;      // first update request of the pending frame, in ns, or -1
+  qint64 _keypressTime;          // last key press which produced output, in ns, or -1
+  qint64 _frameLatencyTotal;     // sum of the frame latencies, in ns
+  bool _lowLatencyFrame;         // the pending frame answers a key press
+
+  std::atomic<bool> _synchronizedUpdate; // updates are held back, see setSynchronizedUpdate()
+  std::atomic<uint> _synchronizedUpdateGeneration; // frames begun so far
+  uint _synchronizedUpdateTimerGeneration;          // frame _synchronizedUpdateTimer runs for
+  QTimer _synchronizedUpdateTimer{this};
+  QTimer _reflowTimer{this};      // drives Screen::reflowHistoryStep()
+  FrameStatistics _frameStats;
+
+  std::unique_ptr<QRecursiveMutex> _screenLock;
+  int _screenLockUsers;           // see setScreenLocking()
+  std::atomic<bool> _updateRequested; // bufferedUpdate() was requested from another thread
+
+  // state of the incremental UTF-8 decoder, kept between receiveData() calls
+  uint _utf8CodePoint;   // code point accumulated so far
+  uint _utf8MinValue;    // smallest code point allowed for the current sequence
+  int _utf8Pending;      // number of continuation bytes still expected
+  int _zmodemMatched;    // number of bytes of the z-modem indicator seen so far
 };
 
 }
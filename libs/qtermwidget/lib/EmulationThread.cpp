@@ -0,0 +1,125 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "EmulationThread.h"
+
+// Konsole
+#include "Emulation.h"
+
+using namespace Konsole;
+
+EmulationThread::EmulationThread(Emulation* emulation, QObject* parent)
+    : QThread(parent)
+    , _emulation(emulation)
+    , _processingLeft(0)
+    , _stopping(false)
+    , _lowWaterMark(0)
+    , _lowWaterContext(nullptr)
+{
+    Q_ASSERT(_emulation->screenLock());
+}
+
+EmulationThread::~EmulationThread()
+{
+    stop();
+}
+
+void EmulationThread::receiveData(const char* data, int length)
+{
+    QMutexLocker locker(&_mutex);
+
+    const bool wasEmpty = _pending.isEmpty();
+    _pending.append(data, length);
+
+    if (wasEmpty)
+        _dataAvailable.wakeOne();
+}
+
+int EmulationThread::pendingBytes() const
+{
+    QMutexLocker locker(&_mutex);
+    return _pending.size() + _processingLeft;
+}
+
+void EmulationThread::notifyWhenBelow(int bytes, QObject* context, std::function<void()> callback)
+{
+    QMutexLocker locker(&_mutex);
+
+    _lowWaterMark = bytes;
+    _lowWaterContext = context;
+    _lowWaterCallback = std::move(callback);
+    checkLowWaterMark();
+}
+
+void EmulationThread::checkLowWaterMark()
+{
+    if (!_lowWaterCallback || _pending.size() + _processingLeft >= _lowWaterMark)
+        return;
+
+    QMetaObject::invokeMethod(_lowWaterContext, std::move(_lowWaterCallback), Qt::QueuedConnection);
+    _lowWaterCallback = nullptr;
+}
+
+void EmulationThread::stop()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopping = true;
+        _dataAvailable.wakeOne();
+    }
+    wait();
+}
+
+void EmulationThread::run()
+{
+    forever
+    {
+        {
+            QMutexLocker locker(&_mutex);
+            while (_pending.isEmpty() && !_stopping)
+                _dataAvailable.wait(&_mutex);
+
+            // queued data is still processed when stopping, so that no
+            // output is lost when switching back to unthreaded processing
+            if (_pending.isEmpty())
+                return;
+
+            _processing.swap(_pending);
+            _processingLeft = _processing.size();
+        }
+
+        const char* data = _processing.constData();
+        const int size = _processing.size();
+        for (int offset = 0; offset < size; offset += MAX_SLICE_SIZE)
+        {
+            {
+                QMutexLocker screenLocker(_emulation->screenLock());
+                _emulation->receiveData(data + offset, qMin(MAX_SLICE_SIZE, size - offset));
+            }
+
+            QMutexLocker locker(&_mutex);
+            _processingLeft = qMax(0, size - offset - MAX_SLICE_SIZE);
+            checkLowWaterMark();
+        }
+
+        // keep the allocation around for the next swap
+        _processing.resize(0);
+    }
+}
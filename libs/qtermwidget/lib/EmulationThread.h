@@ -0,0 +1,99 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef EMULATIONTHREAD_H
+#define EMULATIONTHREAD_H
+
+// Qt
+#include <QByteArray>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <functional>
+
+namespace Konsole
+{
+
+class Emulation;
+
+/**
+ * Feeds the output of a terminal program to an Emulation on a worker thread.
+ *
+ * Data passed to receiveData() is queued and handed to Emulation::receiveData()
+ * by the thread in slices of at most MAX_SLICE_SIZE bytes.  The emulation's
+ * screen lock is held while a slice is processed, so that its screen windows
+ * always copy out the image between two slices and never in the middle of one.
+ *
+ * The emulation must have screen locking enabled, see Emulation::setScreenLocking()
+ */
+class EmulationThread : public QThread
+{
+public:
+    /** Constructs a thread feeding @p emulation.  Call start() to start processing. */
+    explicit EmulationThread(Emulation* emulation, QObject* parent = nullptr);
+    /** Processes any data which is still queued and stops the thread. */
+    ~EmulationThread() override;
+
+    /**
+     * Queues @p length bytes from @p data for processing by the emulation.
+     * This does not wait for the emulation, the data is copied.
+     */
+    void receiveData(const char* data, int length);
+
+    /** Returns the number of bytes which are queued but not processed yet. */
+    int pendingBytes() const;
+
+    /**
+     * Calls @p callback in the thread of @p context once fewer than @p bytes
+     * are waiting to be processed.  This happens at most once per call, a
+     * later call replaces a notification which is still outstanding.
+     */
+    void notifyWhenBelow(int bytes, QObject* context, std::function<void()> callback);
+
+    /** Processes any data which is still queued and waits for the thread to finish. */
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    static const int MAX_SLICE_SIZE = 64 * 1024;
+
+    Emulation* _emulation;
+
+    // queues the notification requested by notifyWhenBelow() if it is due,
+    // must be called with _mutex held
+    void checkLowWaterMark();
+
+    mutable QMutex _mutex;          // guards the members below
+    QWaitCondition _dataAvailable;
+    QByteArray _pending;            // filled by receiveData()
+    QByteArray _processing;         // drained by the thread, swapped with _pending
+    int _processingLeft;            // bytes of _processing not processed yet
+    bool _stopping;
+
+    int _lowWaterMark;
+    QObject* _lowWaterContext;
+    std::function<void()> _lowWaterCallback;
+};
+
+}
+
+#endif // EMULATIONTHREAD_H
@@ -21,6 +21,8 @@
 #include "Filter.h"
 
 // System
+#include <atomic>
+#include <climits>
 #include <iostream>
 
 // Qt
@@ -40,6 +42,7 @@
 //#include <KRun>
 
 // Konsole
+#include "LineChangeTracker.h"
 #include "TerminalCharacterDecoder.h"
 #include "konsole_wcwidth.h"
 
@@ -119,10 +122,23 @@ QList<Filter::HotSpot*> FilterChain::hotSpots() const
     return list;
 }
 //QList<Filter::HotSpot*> FilterChain::hotSpotsAtLine(int line) const;
+void FilterChain::moveHotSpots(int lines)
+{
+    QListIterator<Filter*> iter(*this);
+    while (iter.hasNext())
+        iter.next()->moveHotSpots(lines);
+}
+void FilterChain::removeHotSpots(int firstLine, int lastLine)
+{
+    QListIterator<Filter*> iter(*this);
+    while (iter.hasNext())
+        iter.next()->removeHotSpots(firstLine, lastLine);
+}
 
 TerminalImageFilterChain::TerminalImageFilterChain()
 : _buffer(nullptr)
 , _linePositions(nullptr)
+, _changes(new LineChangeTracker())
 {
 }
 
@@ -130,15 +146,51 @@ TerminalImageFilterChain::~TerminalImageFilterChain()
 {
     delete _buffer;
     delete _linePositions;
+    delete _changes;
 }
 
-void TerminalImageFilterChain::setImage(const Character* const image , int lines , int columns, const QVector<LineProperty>& lineProperties)
+void TerminalImageFilterChain::setImage(const Character* const image , int lines , int columns,
+                                        const QVector<LineProperty>& lineProperties, qint64 firstLine)
 {
     if (empty())
+    {
+        _processedGenerations.clear();
         return;
+    }
 
-    // reset all filters and hotspots
-    reset();
+    auto isWrapped = [](const QVector<LineProperty>& properties, int line) {
+        return (properties.value(line, LINE_DEFAULT) & LINE_WRAPPED) != 0;
+    };
+
+    // filters which were added or changed since the last image need all of the lines
+    QList<quint64> generations;
+    generations.reserve(size());
+    for (const Filter* filter : std::as_const(*this))
+        generations << filter->generation();
+    if (generations != _processedGenerations)
+        _changes->clear();
+    const QVector<bool> changed = _changes->update(image, lines, columns, lineProperties, firstLine);
+
+    // keep the hotspots of the lines which have not changed
+    if (_changes->allChanged())
+    {
+        reset();
+    }
+    else
+    {
+        moveHotSpots(-_changes->scrolled());
+        removeHotSpots(INT_MIN, -1);
+        removeHotSpots(lines, INT_MAX);
+        for (int i = 0; i < lines; i++)
+        {
+            if (!changed[i])
+                continue;
+            const int first = i;
+            while (i + 1 < lines && changed[i + 1])
+                i++;
+            removeHotSpots(first, i);
+        }
+    }
 
     PlainTextDecoder decoder;
     // Include trailing whitespace because otherwise, if a string is wrapped at
@@ -163,27 +215,43 @@ void TerminalImageFilterChain::setImage(const Character* const image , int lines
     for (int i=0 ; i < lines ; i++)
     {
         _linePositions->append(_buffer->length());
+
+        // the lines which have not changed are left empty, so the filters
+        // only find the hotspots which are not there yet
+        if (!changed[i])
+        {
+            lineStream << QLatin1Char('\n');
+            continue;
+        }
+
         decoder.decodeLine(image + i*columns,columns,LINE_DEFAULT);
 
         // pretend that each line ends with a newline character.
         // this prevents a link that occurs at the end of one line
         // being treated as part of a link that occurs at the start of the next line
         //
-        // the downside is that links which are spread over more than one line are not
-        // highlighted.
-        //
-        // TODO - Use the "line wrapped" attribute associated with lines in a
-        // terminal image to avoid adding this imaginary character for wrapped
-        // lines
-        if ( !(lineProperties.value(i,LINE_DEFAULT) & LINE_WRAPPED) )
+        // lines which are wrapped continue on the next line, so that
+        // links which are spread over more than one line are highlighted
+        if ( !isWrapped(lineProperties, i) )
             lineStream << QLatin1Char('\n');
     }
     decoder.end();
+
+    _processedGenerations = generations;
+}
+
+void TerminalImageFilterChain::markExtendedChars() const
+{
+    _changes->markExtendedChars();
 }
 
+// the generations handed out so far, see Filter::generation()
+static std::atomic<quint64> filterGenerations(0);
+
 Filter::Filter() :
 _linePositions(nullptr),
-_buffer(nullptr)
+_buffer(nullptr),
+_generation(++filterGenerations)
 {
 }
 
@@ -192,6 +260,16 @@ Filter::~Filter()
     qDeleteAll(_hotspotList);
     _hotspotList.clear();
 }
+quint64 Filter::generation() const
+{
+    return _generation;
+}
+
+void Filter::settingsChanged()
+{
+    _generation = ++filterGenerations;
+}
+
 void Filter::reset()
 {
     qDeleteAll(_hotspotList);
@@ -261,6 +339,36 @@ QList<Filter::HotSpot*> Filter::hotSpotsAtLine(int line) const
     return _hotspots.values(line);
 }
 
+void Filter::moveHotSpots(int lines)
+{
+    if (lines == 0)
+        return;
+
+    _hotspots.clear();
+    for (HotSpot* spot : std::as_const(_hotspotList))
+    {
+        spot->moveLines(lines);
+        for (int line = spot->startLine() ; line <= spot->endLine() ; line++)
+            _hotspots.insert(line,spot);
+    }
+}
+
+void Filter::removeHotSpots(int firstLine, int lastLine)
+{
+    QMutableListIterator<HotSpot*> iter(_hotspotList);
+    while (iter.hasNext())
+    {
+        HotSpot* spot = iter.next();
+        if (spot->startLine() < firstLine || spot->startLine() > lastLine)
+            continue;
+
+        for (int line = spot->startLine() ; line <= spot->endLine() ; line++)
+            _hotspots.remove(line,spot);
+        iter.remove();
+        delete spot;
+    }
+}
+
 Filter::HotSpot* Filter::hotSpotAt(int line , int column) const
 {
     QListIterator<HotSpot*> spotIter(_hotspots.values(line));
@@ -312,6 +420,11 @@ Filter::HotSpot::Type Filter::HotSpot::type() const
 {
     return _type;
 }
+void Filter::HotSpot::moveLines(int lines)
+{
+    _startLine += lines;
+    _endLine += lines;
+}
 void Filter::HotSpot::setType(Type type)
 {
     _type = type;
@@ -343,6 +456,7 @@ QStringList RegExpFilter::HotSpot::capturedTexts() const
 void RegExpFilter::setRegExp(const QRegularExpression& regExp)
 {
     _searchText = regExp;
+    settingsChanged();
 }
 QRegularExpression RegExpFilter::regExp() const
 {
@@ -352,6 +466,15 @@ QRegularExpression RegExpFilter::regExp() const
 {
     _buffer = QString();
 }*/
+void RegExpFilter::setTriggers(const QStringList& triggers)
+{
+    _triggers = triggers;
+    settingsChanged();
+}
+QStringList RegExpFilter::triggers() const
+{
+    return _triggers;
+}
 void RegExpFilter::process()
 {
     const QString* text = buffer();
@@ -368,7 +491,45 @@ void RegExpFilter::process()
         return;
     }
 
-    match = _searchText.match(*text);
+    if (_triggers.isEmpty())
+    {
+        processText(*text, 0);
+        return;
+    }
+
+    // look for the triggers first, which is much cheaper than matching the
+    // expression, and only search the lines they are found on
+    QVector<int> nextTrigger(_triggers.size(), -1);
+    int position = 0;
+    while (position < text->length())
+    {
+        int trigger = INT_MAX;
+        for (int i = 0; i < _triggers.size(); i++)
+        {
+            if (nextTrigger[i] != INT_MAX && nextTrigger[i] < position)
+            {
+                nextTrigger[i] = text->indexOf(_triggers.at(i), position);
+                if (nextTrigger[i] == -1)
+                    nextTrigger[i] = INT_MAX;
+            }
+            trigger = qMin(trigger, nextTrigger[i]);
+        }
+        if (trigger == INT_MAX)
+            break;
+
+        const int lineStart = text->lastIndexOf(QLatin1Char('\n'), trigger) + 1;
+        int lineEnd = text->indexOf(QLatin1Char('\n'), trigger);
+        if (lineEnd == -1)
+            lineEnd = text->length();
+
+        processText(text->mid(lineStart, lineEnd - lineStart), lineStart);
+        position = lineEnd + 1;
+    }
+}
+
+void RegExpFilter::processText(const QString& text, int position)
+{
+    auto match = _searchText.match(text);
     while (match.hasMatch()) {
         int startLine = 0;
         int endLine = 0;
@@ -377,12 +538,11 @@ void RegExpFilter::process()
 
         QStringList captureList;
         for (int i = 0; i <= match.lastCapturedIndex(); i++) {
-            QString text = match.captured(i);
-            captureList.append(text);
+            captureList.append(match.captured(i));
         }
 
-        getLineColumn(match.capturedStart(), startLine, startColumn);
-        getLineColumn(match.capturedEnd(), endLine, endColumn);
+        getLineColumn(position + match.capturedStart(), startLine, startColumn);
+        getLineColumn(position + match.capturedEnd(), endLine, endColumn);
 
         RegExpFilter::HotSpot* spot = newHotSpot(startLine, startColumn, endLine, endColumn);
         spot->setCapturedTexts(captureList);
@@ -394,7 +554,7 @@ void RegExpFilter::process()
             break;
         }
 
-        match = _searchText.match(*text, match.capturedEnd());
+        match = _searchText.match(text, match.capturedEnd());
     }
 }
 
@@ -484,6 +644,8 @@ const QRegularExpression UrlFilter::CompleteUrlRegExp(QLatin1Char('(')+FullUrlRe
 UrlFilter::UrlFilter()
 {
     setRegExp( CompleteUrlRegExp );
+    // every URL contains one of these, most lines of output none of them
+    setTriggers( { QStringLiteral("://"), QStringLiteral("www."), QStringLiteral("@") } );
 }
 
 UrlFilter::HotSpot::~HotSpot()
@@ -36,6 +36,7 @@ namespace Konsole
 
 typedef unsigned char LineProperty;
 class Character;
+class LineChangeTracker;
 
 /**
  * A filter processes blocks of text looking for certain patterns (such as URLs or keywords from a list)
@@ -118,6 +119,9 @@ public:
         */
        virtual QList<QAction*> actions();
 
+       /** Moves the hotspot @p lines lines down, or up if @p lines is negative */
+       void moveLines(int lines);
+
     protected:
        /** Sets the type of a hotspot.  This should only be set once */
        void setType(Type type);
@@ -156,12 +160,30 @@ public:
     /** Returns the list of hotspots identified by the filter which occur on a given line */
     QList<HotSpot*> hotSpotsAtLine(int line) const;
 
+    /** Moves all hotspots @p lines lines down, or up if @p lines is negative */
+    void moveHotSpots(int lines);
+    /** Deletes the hotspots which start on a line from @p firstLine to @p lastLine */
+    void removeHotSpots(int firstLine, int lastLine);
+
     /**
      * TODO: Document me
      */
     void setBuffer(const QString* buffer , const QList<int>* linePositions);
 
+    /**
+     * Returns a number which changes whenever the filter may find other
+     * hotspots in the same text.  No two filters share a generation, so
+     * text processed by one filter is not taken to be processed by another.
+     */
+    quint64 generation() const;
+
 protected:
+    /**
+     * Subclasses call this when a setting changes which hotspots they find,
+     * so that text processed already is processed again.  See generation()
+     */
+    void settingsChanged();
+
     /** Adds a new hotspot to the list */
     void addHotSpot(HotSpot*);
     /** Returns the internal buffer */
@@ -175,6 +197,7 @@ private:
 
     const QList<int>* _linePositions;
     const QString* _buffer;
+    quint64 _generation;
 };
 
 /**
@@ -218,6 +241,19 @@ public:
     /** Returns the regular expression which the filter searches for in blocks of text */
     QRegularExpression regExp() const;
 
+    /**
+     * Sets strings of which every match of the regular expression contains at
+     * least one.  process() then only runs the expression on the lines which
+     * contain one of them, and skips the others without matching.  Lines which
+     * are wrapped count as one.  With no triggers, the default, all of the
+     * text is searched.
+     *
+     * Matches must not span more than one line for this to be used.
+     */
+    void setTriggers(const QStringList& triggers);
+    /** Returns the strings which lines must contain to be searched.  See setTriggers() */
+    QStringList triggers() const;
+
     /**
      * Reimplemented to search the filter's text buffer for text matching regExp()
      *
@@ -235,7 +271,11 @@ protected:
                                     int endLine,int endColumn);
 
 private:
+    // adds hotspots for the matches in @p text, which starts at @p position in buffer()
+    void processText(const QString& text, int position);
+
     QRegularExpression _searchText;
+    QStringList _triggers;
 };
 
 class FilterObject;
@@ -359,9 +399,22 @@ public:
     /** Returns a list of all hotspots at the given line in all the chain's filters */
     QList<Filter::HotSpot> hotSpotsAtLine(int line) const;
 
+    /** Moves the hotspots of each filter in the chain, see Filter::moveHotSpots() */
+    void moveHotSpots(int lines);
+    /** Deletes hotspots of each filter in the chain, see Filter::removeHotSpots() */
+    void removeHotSpots(int firstLine, int lastLine);
+
 };
 
-/** A filter chain which processes character images from terminal displays */
+/**
+ * A filter chain which processes character images from terminal displays.
+ *
+ * The chain remembers the image it was given last.  When a new image is set,
+ * the hotspots of the lines which have not changed, or have only been scrolled,
+ * are kept, and only the changed lines are decoded for the filters to process.
+ * The buffer of the filters then holds the text of the changed lines, the
+ * other lines are left empty.
+ */
 class QTERMWIDGET_NO_EXPORT TerminalImageFilterChain : public FilterChain
 {
 public:
@@ -375,13 +428,27 @@ public:
      * @param lines The number of lines in the terminal image
      * @param columns The number of columns in the terminal image
      * @param lineProperties The line properties to set for image
+     * @param firstLine The number of the first line of the image in the output,
+     * counted so that a line keeps its number while it is scrolled.  The lines
+     * of the previous image are compared with the lines the same number of
+     * lines away in the new one.
      */
     void setImage(const Character* const image , int lines , int columns,
-                  const QVector<LineProperty>& lineProperties);
+                  const QVector<LineProperty>& lineProperties, qint64 firstLine);
+
+    /**
+     * Marks the extended characters and true colors of the image set last as
+     * used, see ExtendedCharTable
+     */
+    void markExtendedChars() const;
 
 private:
     QString* _buffer;
     QList<int>* _linePositions;
+
+    // finds the lines which have changed since the image processed last
+    LineChangeTracker* _changes;
+    QList<quint64> _processedGenerations;  // generations of the filters which processed the last image
 };
 
 }
@@ -26,11 +26,18 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <new>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <cerrno>
 
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QSet>
 #include <QtDebug>
 
 // KDE
@@ -90,8 +97,9 @@ FIXME: There is noticeable decrease in speed, also. Perhaps,
 HistoryFile::HistoryFile()
   : ion(-1),
     length(0),
-    fileMap(nullptr),
-    readWriteBalance(0)
+    fileLength(0),
+    segmentUseCounter(0),
+    lastMappedEnd(-1)
 {
   if (tmpFile.open())
   {
@@ -100,89 +108,272 @@ HistoryFile::HistoryFile()
   }
 }
 
+HistoryFile::HistoryFile(const QString& fileName)
+  : ion(-1),
+    length(0),
+    fileLength(0),
+    namedFile(fileName),
+    segmentUseCounter(0),
+    lastMappedEnd(-1)
+{
+  if (namedFile.open(QIODevice::ReadWrite))
+  {
+    ion = namedFile.handle();
+    length = fileLength = namedFile.size();
+  }
+}
+
 HistoryFile::~HistoryFile()
 {
-    if (fileMap)
-        unmap();
+    unmap();
+    // the data of a named file is kept, write what is still buffered
+    if (namedFile.isOpen())
+        flush();
 }
 
-//TODO:  Mapping the entire file in will cause problems if the history file becomes exceedingly large,
-//(ie. larger than available memory).  HistoryFile::map() should only map in sections of the file at a time,
-//to avoid this.
-void HistoryFile::map()
+const HistoryFile::Segment* HistoryFile::segmentAt(qint64 loc)
 {
-    Q_ASSERT( fileMap == nullptr );
+    const qint64 start = loc - loc % SEGMENT_SIZE;
+
+    int lru = -1;
+    for (int i = 0; i < segments.size(); i++)
+    {
+        Segment& segment = segments[i];
+        if (segment.start == start)
+        {
+            if (loc < segment.start + segment.length)
+            {
+                segment.lastUse = ++segmentUseCounter;
+                return &segment;
+            }
+            // mapped before the file had grown this far, map it again
+            munmap(segment.data, segment.length);
+            segments.remove(i);
+            break;
+        }
+        if (lru < 0 || segment.lastUse < segments[lru].lastUse)
+            lru = i;
+    }
+
+    if (segments.size() >= MAX_SEGMENTS && lru >= 0)
+    {
+        munmap(segments[lru].data, segments[lru].length);
+        segments.remove(lru);
+    }
 
-    fileMap = (char*)mmap( nullptr , length , PROT_READ , MAP_PRIVATE , ion , 0 );
+    const qint64 segmentLength = qMin(SEGMENT_SIZE, fileLength - start);
+    void* data = mmap( nullptr , segmentLength , PROT_READ , MAP_PRIVATE , ion , start );
 
     //if mmap'ing fails, fall back to the read-lseek combination
-    if ( fileMap == MAP_FAILED )
+    if ( data == MAP_FAILED )
+    {
+        //qDebug() << __FILE__ << __LINE__ << ": mmap'ing history failed.  errno = " << errno;
+        return nullptr;
+    }
+
+    // sections read one after another, as when searching or saving the
+    // history, are read ahead by the kernel
+    if (start == lastMappedEnd)
     {
-            readWriteBalance = 0;
-            fileMap = nullptr;
-            //qDebug() << __FILE__ << __LINE__ << ": mmap'ing history failed.  errno = " << errno;
+        madvise(data, segmentLength, MADV_SEQUENTIAL);
+        madvise(data, segmentLength, MADV_WILLNEED);
     }
+    else
+        madvise(data, segmentLength, MADV_RANDOM);
+    lastMappedEnd = start + segmentLength;
+
+    segments.append({ start, segmentLength, static_cast<char*>(data), ++segmentUseCounter });
+    return &segments.last();
 }
 
 void HistoryFile::unmap()
 {
-    int result = munmap( fileMap , length );
-    Q_ASSERT( result == 0 ); Q_UNUSED( result )
-
-    fileMap = nullptr;
+    for (const Segment& segment : std::as_const(segments))
+    {
+        int result = munmap( segment.data , segment.length );
+        Q_ASSERT( result == 0 ); Q_UNUSED( result )
+    }
+    segments.clear();
+    lastMappedEnd = -1;
 }
 
 bool HistoryFile::isMapped() const
 {
-    return (fileMap != nullptr);
+    return !segments.isEmpty();
 }
 
 void HistoryFile::add(const unsigned char* bytes, int len)
 {
-  if ( fileMap )
-          unmap();
+  writeBuffer.append(reinterpret_cast<const char*>(bytes), len);
+  length += len;
 
-  readWriteBalance++;
+  if (writeBuffer.size() >= WRITE_BUFFER_SIZE)
+      flush();
+}
 
-  int rc = 0;
+void HistoryFile::flush()
+{
+  qint64 written = 0;
+  while (written < writeBuffer.size())
+  {
+    const ssize_t rc = pwrite(ion, writeBuffer.constData() + written,
+                              writeBuffer.size() - written, fileLength + written);
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      // the data which could not be written stays buffered and is
+      // written with the next batch
+      perror("HistoryFile::flush.write");
+      break;
+    }
+    written += rc;
+  }
 
-  rc = KDE_lseek(ion,length,SEEK_SET); if (rc < 0) { perror("HistoryFile::add.seek"); return; }
-  rc = write(ion,bytes,len);       if (rc < 0) { perror("HistoryFile::add.write"); return; }
-  length += rc;
+  writeBuffer.remove(0, written);
+  fileLength += written;
 }
 
-void HistoryFile::get(unsigned char* bytes, int len, int loc)
+bool HistoryFile::readFile(unsigned char* bytes, int len, qint64 loc)
 {
-  //count number of get() calls vs. number of add() calls.
-  //If there are many more get() calls compared with add()
-  //calls (decided by using MAP_THRESHOLD) then mmap the log
-  //file to improve performance.
-  readWriteBalance--;
-  if ( !fileMap && readWriteBalance < MAP_THRESHOLD )
-          map();
+  int done = 0;
+  while (done < len)
+  {
+    const ssize_t rc = pread(ion, bytes + done, len - done, loc + done);
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+    {
+      perror("HistoryFile::get.read");
+      return false;
+    }
+    done += rc;
+  }
+  return true;
+}
 
-  if ( fileMap )
+void HistoryFile::get(unsigned char* bytes, int len, qint64 loc)
+{
+  if (loc < 0 || len < 0 || loc + len > length)
   {
-    for (int i=0;i<len;i++)
-            bytes[i]=fileMap[loc+i];
+    fprintf(stderr,"getHist(...,%d,%lld): invalid args.\n",len,static_cast<long long>(loc));
+    return;
   }
-  else
+
+  // copy the part of the range which is in the file from the mapped sections
+  while (len > 0 && loc < fileLength)
   {
-      int rc = 0;
+    const Segment* segment = segmentAt(loc);
+    if (!segment)
+    {
+      const int count = static_cast<int>(qMin<qint64>(len, fileLength - loc));
+      if (!readFile(bytes, count, loc))
+        return;
+      bytes += count;
+      loc += count;
+      len -= count;
+      break;
+    }
 
-      if (loc < 0 || len < 0 || loc + len > length)
-        fprintf(stderr,"getHist(...,%d,%d): invalid args.\n",len,loc);
-      rc = KDE_lseek(ion,loc,SEEK_SET); if (rc < 0) { perror("HistoryFile::get.seek"); return; }
-      rc = read(ion,bytes,len);     if (rc < 0) { perror("HistoryFile::get.read"); return; }
+    const int count = static_cast<int>(qMin<qint64>(len, segment->start + segment->length - loc));
+    memcpy(bytes, segment->data + (loc - segment->start), count);
+    bytes += count;
+    loc += count;
+    len -= count;
   }
+
+  // the rest has not been written yet
+  if (len > 0)
+    memcpy(bytes, writeBuffer.constData() + (loc - fileLength), len);
 }
 
-int HistoryFile::len() const
+qint64 HistoryFile::len() const
 {
   return length;
 }
 
 
+// Extended Char Usage //////////////////////////////////////
+
+ExtendedCharUsage::ExtendedCharUsage()
+  : _firstLine(0)
+{
+}
+
+void ExtendedCharUsage::compact(QVector<uint>& ids)
+{
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+void ExtendedCharUsage::addId(Block& block, QVector<uint>& ids, uint id)
+{
+  // cells next to each other mostly share their colors
+  if (!ids.isEmpty() && ids.constLast() == id)
+    return;
+
+  ids.append(id);
+  if (block.chars.size() + block.colors.size() >= block.compactSize)
+  {
+    compact(block.chars);
+    compact(block.colors);
+    block.compactSize = qMax(MIN_COMPACT_SIZE, 2 * int(block.chars.size() + block.colors.size()));
+  }
+}
+
+void ExtendedCharUsage::addLine(const Character* cells, int count)
+{
+  if (_blocks.isEmpty() || _blocks.constLast().lines == BLOCK_LINES)
+  {
+    if (!_blocks.isEmpty())
+    {
+      Block& full = _blocks.last();
+      compact(full.chars);
+      compact(full.colors);
+      full.chars.squeeze();
+      full.colors.squeeze();
+    }
+    _blocks.append(Block{0, QVector<uint>(), QVector<uint>(), MIN_COMPACT_SIZE});
+  }
+
+  Block& block = _blocks.last();
+  block.lines++;
+  for (int i = 0; i < count; i++)
+  {
+    const Character& cell = cells[i];
+    if ((cell.rendition & RE_EXTENDED_CHAR) && cell.character != 0)
+      addId(block, block.chars, cell.character);
+    if (const uint id = cell.foregroundColor.trueColorId())
+      addId(block, block.colors, id);
+    if (const uint id = cell.backgroundColor.trueColorId())
+      addId(block, block.colors, id);
+  }
+}
+
+void ExtendedCharUsage::dropLines(int count)
+{
+  _firstLine += count;
+  while (!_blocks.isEmpty() && _firstLine >= _blocks.constFirst().lines)
+  {
+    _firstLine -= _blocks.constFirst().lines;
+    _blocks.removeFirst();
+  }
+  if (_blocks.isEmpty())
+    _firstLine = 0;
+}
+
+void ExtendedCharUsage::clear()
+{
+  _blocks.clear();
+  _firstLine = 0;
+}
+
+void ExtendedCharUsage::mark() const
+{
+  for (const Block& block : _blocks)
+    ExtendedCharTable::instance.markIds(block.chars, block.colors);
+}
+
 // History Scroll abstract base class //////////////////////////////////////
 
 
@@ -201,6 +392,11 @@ bool HistoryScroll::hasScroll() const
   return true;
 }
 
+void HistoryScroll::markExtendedChars() const
+{
+  m_extendedChars.mark();
+}
+
 // History Scroll File //////////////////////////////////////
 
 /*
@@ -226,7 +422,7 @@ HistoryScrollFile::~HistoryScrollFile()
 
 int HistoryScrollFile::getLines() const
 {
-  return index.len() / sizeof(int);
+  return index.len() / sizeof(qint64);
 }
 
 int HistoryScrollFile::getLineLen(int lineno) const
@@ -236,7 +432,7 @@ int HistoryScrollFile::getLineLen(int lineno) const
 
 bool HistoryScrollFile::isWrappedLine(int lineno) const
 {
-  if (lineno>=0 && lineno <= getLines()) {
+  if (lineno>=0 && lineno < getLines()) {
     unsigned char flag;
     lineflags.get((unsigned char*)&flag,sizeof(unsigned char),(lineno)*sizeof(unsigned char));
     return flag;
@@ -244,17 +440,13 @@ bool HistoryScrollFile::isWrappedLine(int lineno) const
   return false;
 }
 
-int HistoryScrollFile::startOfLine(int lineno) const
+qint64 HistoryScrollFile::startOfLine(int lineno) const
 {
   if (lineno <= 0) return 0;
   if (lineno <= getLines())
     {
-
-    if (!index.isMapped())
-            index.map();
-
-    int res = 0;
-    index.get((unsigned char*)&res,sizeof(int),(lineno-1)*sizeof(int));
+    qint64 res = 0;
+    index.get((unsigned char*)&res,sizeof(qint64),(lineno-1)*qint64(sizeof(qint64)));
     return res;
     }
   return cells.len();
@@ -262,21 +454,19 @@ int HistoryScrollFile::startOfLine(int lineno) const
 
 void HistoryScrollFile::getCells(int lineno, int colno, int count, Character res[]) const
 {
-  cells.get((unsigned char*)res,count*sizeof(Character),startOfLine(lineno)+colno*sizeof(Character));
+  cells.get((unsigned char*)res,count*sizeof(Character),startOfLine(lineno)+colno*qint64(sizeof(Character)));
 }
 
 void HistoryScrollFile::addCells(const Character text[], int count)
 {
   cells.add((unsigned char*)text,count*sizeof(Character));
+  m_extendedChars.addLine(text,count);
 }
 
 void HistoryScrollFile::addLine(bool previousWrapped)
 {
-  if (index.isMapped())
-          index.unmap();
-
-  int locn = cells.len();
-  index.add((unsigned char*)&locn,sizeof(int));
+  qint64 locn = cells.len();
+  index.add((unsigned char*)&locn,sizeof(qint64));
   unsigned char flags = previousWrapped ? 0x01 : 0x00;
   lineflags.add((unsigned char*)&flags,sizeof(unsigned char));
 }
@@ -289,6 +479,7 @@ HistoryScrollBuffer::HistoryScrollBuffer(unsigned int maxLineCount)
    ,_maxLineCount(0)
    ,_usedLines(0)
    ,_head(0)
+   ,_cellCount(0)
 {
   setMaxNbLines(maxLineCount);
 }
@@ -303,13 +494,18 @@ void HistoryScrollBuffer::addCellsVector(const QVector<Character>& cells)
     _head++;
     if ( _usedLines < _maxLineCount )
         _usedLines++;
+    else
+        m_extendedChars.dropLines(1);
+    m_extendedChars.addLine(cells.constData(), cells.size());
 
     if ( _head >= _maxLineCount )
     {
         _head = 0;
     }
 
-    _historyBuffer[bufferIndex(_usedLines-1)] = cells;
+    HistoryLine& line = _historyBuffer[bufferIndex(_usedLines-1)];
+    _cellCount += cells.size() - line.size();
+    line = cells;
     _wrappedLine[bufferIndex(_usedLines-1)] = false;
 }
 void HistoryScrollBuffer::addCells(const Character a[], int count)
@@ -392,15 +588,55 @@ void HistoryScrollBuffer::setMaxNbLines(unsigned int lineCount)
 
     _usedLines = qMin(_usedLines,static_cast<int>(lineCount));
     _maxLineCount = lineCount;
+    _cellCount = 0;
+    for ( int i = 0 ; i < _usedLines ; i++ )
+        _cellCount += newBuffer[i].size();
     _head = ( _usedLines == _maxLineCount ) ? 0 : _usedLines-1;
 
     _historyBuffer = newBuffer;
     delete[] oldBuffer;
 
+    m_extendedChars.clear();
+    for ( int i = 0 ; i < _usedLines ; i++ )
+        m_extendedChars.addLine(_historyBuffer[i].constData(), _historyBuffer[i].size());
+
     _wrappedLine.resize(lineCount);
     dynamic_cast<HistoryTypeBuffer*>(m_histType)->m_nbLines = lineCount;
 }
 
+qint64 HistoryScrollBuffer::memoryUsage() const
+{
+    return _cellCount * sizeof(Character) + qint64(_maxLineCount) * sizeof(HistoryLine);
+}
+
+void HistoryScrollBuffer::dropLines(int count)
+{
+    count = qMin(count, _usedLines);
+    if (count <= 0)
+        return;
+
+    QBitArray wrappedLine(_maxLineCount);
+    for (int i = count; i < _usedLines; i++)
+        wrappedLine[i - count] = _wrappedLine[bufferIndex(i)];
+
+    // put the oldest line first, then move the remaining lines to the start
+    if (_usedLines == _maxLineCount)
+        std::rotate(_historyBuffer, _historyBuffer + (_head + 1) % _maxLineCount,
+                    _historyBuffer + _maxLineCount);
+    for (int i = count; i < _usedLines; i++)
+        _historyBuffer[i - count].swap(_historyBuffer[i]);
+    for (int i = _usedLines - count; i < _maxLineCount; i++)
+    {
+        _cellCount -= _historyBuffer[i].size();
+        _historyBuffer[i] = HistoryLine();
+    }
+
+    _usedLines -= count;
+    _head = _usedLines - 1;
+    _wrappedLine = wrappedLine;
+    m_extendedChars.dropLines(count);
+}
+
 int HistoryScrollBuffer::bufferIndex(int lineNumber) const
 {
     Q_ASSERT( lineNumber >= 0 );
@@ -525,7 +761,12 @@ void HistoryScrollBlockArray::addCells(const Character a[], int count)
   Q_ASSERT(res > 0);
   Q_UNUSED( res )
 
+  // once the array is full, the new line takes the place of the oldest one
+  const int lines = m_lineLengths.count();
   m_lineLengths.insert(m_blockArray.getCurrent(), count);
+  if (m_lineLengths.count() == lines)
+    m_extendedChars.dropLines(1);
+  m_extendedChars.addLine(a, count);
 }
 
 void HistoryScrollBlockArray::addLine(bool)
@@ -543,7 +784,6 @@ void* CompactHistoryBlock::allocate ( size_t length )
 
   void* block = tail;
   tail += length;
-  //kDebug() << "allocated " << length << " bytes at address " << block;
   allocCount++;
   return block;
 }
@@ -554,178 +794,261 @@ void CompactHistoryBlock::deallocate ( )
   Q_ASSERT ( allocCount >= 0 );
 }
 
-void* CompactHistoryBlockList::allocate(size_t size)
+void CompactHistoryBlock::reset ( )
 {
-  CompactHistoryBlock* block;
-  if ( list.isEmpty() || list.last()->remaining() < size)
-  {
-    block = new CompactHistoryBlock();
-    list.append ( block );
-    //kDebug() << "new block created, remaining " << block->remaining() << "number of blocks=" << list.size();
-  }
-  else
-  {
-    block = list.last();
-    //kDebug() << "old block used, remaining " << block->remaining();
-  }
-  return block->allocate(size);
+  Q_ASSERT ( !isInUse() );
+  tail = blockStart;
 }
 
-void CompactHistoryBlockList::deallocate(void* ptr)
+CompactHistoryBlockList::CompactHistoryBlockList()
+  : current(nullptr),
+    blockCount(0),
+    totalLength(0)
 {
-  Q_ASSERT( !list.isEmpty());
+}
 
-  int i=0;
-  CompactHistoryBlock *block = list.at(i);
-  while ( i<list.size() && !block->contains(ptr) )
+void* CompactHistoryBlockList::allocate(size_t size, CompactHistoryBlock*& block)
+{
+  if ( current == nullptr || current->remaining() < size )
   {
-    i++;
-    block=list.at(i);
+    // the previous block is freed once its last line is dropped
+    if ( current != nullptr && !current->isInUse() )
+    {
+      blockCount--;
+      if ( current->length() == CompactHistoryBlock::DEFAULT_LENGTH && freeBlocks.size() < MAX_FREE_BLOCKS )
+      {
+        current->reset();
+        freeBlocks.append(current);
+      }
+      else
+      {
+        totalLength -= current->length();
+        delete current;
+      }
+    }
+
+    if ( !freeBlocks.isEmpty() && size <= CompactHistoryBlock::DEFAULT_LENGTH )
+    {
+      current = freeBlocks.takeLast();
+    }
+    else
+    {
+      current = new CompactHistoryBlock(qMax(size, CompactHistoryBlock::DEFAULT_LENGTH));
+      totalLength += current->length();
+    }
+    blockCount++;
   }
 
-  Q_ASSERT( i<list.size() );
+  block = current;
+  return block->allocate(size);
+}
 
+void CompactHistoryBlockList::deallocate(CompactHistoryBlock* block)
+{
   block->deallocate();
 
-  if (!block->isInUse())
+  if ( block->isInUse() )
+    return;
+
+  if ( block == current )
+  {
+    // nothing else lives in the block, start filling it again
+    block->reset();
+    return;
+  }
+
+  blockCount--;
+  if ( block->length() == CompactHistoryBlock::DEFAULT_LENGTH && freeBlocks.size() < MAX_FREE_BLOCKS )
+  {
+    block->reset();
+    freeBlocks.append(block);
+  }
+  else
   {
-    list.removeAt(i);
+    totalLength -= block->length();
     delete block;
-    //kDebug() << "block deleted, new size = " << list.size();
   }
 }
 
 CompactHistoryBlockList::~CompactHistoryBlockList()
 {
-  qDeleteAll ( list.begin(), list.end() );
-  list.clear();
+  // all lines have been destroyed at this point
+  delete current;
+  qDeleteAll ( freeBlocks );
+  freeBlocks.clear();
 }
 
-void* CompactHistoryLine::operator new (size_t size, CompactHistoryBlockList& blockList)
+// rounds 'size' up so that what is allocated after it stays aligned
+static inline size_t alignedSize(size_t size)
 {
-  return blockList.allocate(size);
+  return (size + alignof(void*) - 1) & ~(alignof(void*) - 1);
 }
 
-CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlockList& bList )
-  : blockList(bList),
-    formatLength(0)
+CompactHistoryLine* CompactHistoryLine::create ( const TextLine& line, CompactHistoryBlockList& blockList )
 {
-  length=line.size();
-
-  if (!line.empty()) {
-    formatLength=1;
-    int k=1;
-
-    // count number of different formats in this text line
-    Character c = line[0];
-    while ( k<length )
-    {
-      if ( !(line[k].equalsFormat(c)))
-      {
-        formatLength++; // format change detected
-        c=line[k];
-      }
-      k++;
-    }
+  const int length = line.size();
 
-    //kDebug() << "number of different formats in string: " << formatLength;
-    formatArray = (CharacterFormat*) blockList.allocate(sizeof(CharacterFormat)*formatLength);
-    Q_ASSERT (formatArray!=nullptr);
-    text = (quint16*) blockList.allocate(sizeof(quint16)*line.size());
-    Q_ASSERT (text!=nullptr);
-
-    length=line.size();
-    wrapped=false;
-
-    // record formats and their positions in the format array
-    c=line[0];
-    formatArray[0].setFormat ( c );
-    formatArray[0].startPos=0;                        // there's always at least 1 format (for the entire line, unless a change happens)
+  // count number of different formats in this text line, and look for
+  // characters which do not fit in 16 bits
+  int formatLength = 0;
+  bool wideText = false;
+  for ( int k=0; k<length; k++ )
+  {
+    if ( k == 0 || !line[k].equalsFormat(line[k-1]) )
+      formatLength++;
+    if ( line[k].character > 0xFFFF )
+      wideText = true;
+  }
 
-    k=1;                                              // look for possible format changes
-    int j=1;
-    while ( k<length && j<formatLength )
+  const size_t formatOffset = alignedSize(sizeof(CompactHistoryLine));
+  const size_t textOffset = formatOffset + alignedSize(sizeof(CharacterFormat)*formatLength);
+  const size_t size = alignedSize(textOffset + (wideText ? sizeof(uint) : sizeof(quint16))*length);
+
+  CompactHistoryBlock* block = nullptr;
+  quint8* memory = static_cast<quint8*>(blockList.allocate(size, block));
+  Q_ASSERT ( memory != nullptr );
+
+  CompactHistoryLine* result = new (memory) CompactHistoryLine();
+  result->block = block;
+  result->formatArray = reinterpret_cast<CharacterFormat*>(memory + formatOffset);
+  result->text = memory + textOffset;
+  result->length = length;
+  result->formatLength = formatLength;
+  result->wrapped = false;
+  result->wideText = wideText;
+
+  // record formats and their positions in the format array
+  int j = 0;
+  for ( int k=0; k<length; k++ )
+  {
+    if ( k == 0 || !line[k].equalsFormat(line[k-1]) )
     {
-      if (!(line[k].equalsFormat(c)))
-      {
-        c=line[k];
-        formatArray[j].setFormat(c);
-        formatArray[j].startPos=k;
-        //kDebug() << "format entry " << j << " at pos " << formatArray[j].startPos << " " << &(formatArray[j].startPos) ;
-        j++;
-      }
-      k++;
+      result->formatArray[j].setFormat(line[k]);
+      result->formatArray[j].startPos=k;
+      j++;
     }
+  }
 
-    // copy character values
-    for ( int i=0; i<line.size(); i++ )
-    {
+  // copy character values
+  if ( wideText )
+  {
+    uint* text = static_cast<uint*>(result->text);
+    for ( int i=0; i<length; i++ )
+      text[i]=line[i].character;
+  }
+  else
+  {
+    quint16* text = static_cast<quint16*>(result->text);
+    for ( int i=0; i<length; i++ )
       text[i]=line[i].character;
-      //kDebug() << "char " << i << " at mem " << &(text[i]);
-    }
   }
-  //kDebug() << "line created, length " << length << " at " << &(length);
+
+  return result;
 }
 
-CompactHistoryLine::~CompactHistoryLine()
+void CompactHistoryLine::destroy ( CompactHistoryLine* line, CompactHistoryBlockList& blockList )
 {
-  //kDebug() << "~CHL";
-  if (length>0) {
-    blockList.deallocate(text);
-    blockList.deallocate(formatArray);
-  }
-  blockList.deallocate(this);
+  CompactHistoryBlock* block = line->block;
+  line->~CompactHistoryLine();
+  blockList.deallocate(block);
+}
+
+int CompactHistoryLine::formatIndex ( int column ) const
+{
+  // the last format which starts at or before 'column'
+  const CharacterFormat* format = std::upper_bound ( formatArray, formatArray + formatLength, column,
+      [] ( int value, const CharacterFormat& format ) { return value < format.startPos; } );
+  return qMax ( 0, static_cast<int>(format - formatArray) - 1 );
 }
 
-void CompactHistoryLine::getCharacter ( int index, Character &r )
+void CompactHistoryLine::getCharacter ( int index, Character &r ) const
 {
   Q_ASSERT ( index < length );
-  int formatPos=0;
-  while ( ( formatPos+1 ) < formatLength && index >= formatArray[formatPos+1].startPos )
-    formatPos++;
+  const CharacterFormat& format = formatArray[formatIndex(index)];
 
-  r.character=text[index];
-  r.rendition = formatArray[formatPos].rendition;
-  r.foregroundColor = formatArray[formatPos].fgColor;
-  r.backgroundColor = formatArray[formatPos].bgColor;
+  r.character = wideText ? static_cast<const uint*>(text)[index] : static_cast<const quint16*>(text)[index];
+  r.rendition = format.rendition;
+  r.foregroundColor = format.fgColor;
+  r.backgroundColor = format.bgColor;
 }
 
-void CompactHistoryLine::getCharacters ( Character* array, int length, int startColumn )
+void CompactHistoryLine::getCharacters ( Character* array, int length, int startColumn ) const
 {
   Q_ASSERT ( startColumn >= 0 && length >= 0 );
   Q_ASSERT ( startColumn+length <= ( int ) getLength() );
 
-  for ( int i=startColumn; i<length+startColumn; i++ )
+  if ( length == 0 )
+    return;
+
+  // fill in the characters one format run at a time
+  const int endColumn = startColumn + length;
+  int column = startColumn;
+  for ( int formatPos = formatIndex(startColumn); column < endColumn; formatPos++ )
   {
-    getCharacter ( i, array[i-startColumn] );
+    const CharacterFormat& format = formatArray[formatPos];
+    const int runEnd = ( formatPos+1 < formatLength ) ? qMin<int> ( formatArray[formatPos+1].startPos, endColumn ) : endColumn;
+
+    Character* dest = array + ( column - startColumn );
+    const Character style ( 0, format.fgColor, format.bgColor, format.rendition );
+    std::fill ( dest, dest + ( runEnd - column ), style );
+
+    if ( wideText )
+    {
+      const uint* source = static_cast<const uint*>(text);
+      for ( int i = column; i < runEnd; i++ )
+        (dest++)->character = source[i];
+    }
+    else
+    {
+      const quint16* source = static_cast<const quint16*>(text);
+      for ( int i = column; i < runEnd; i++ )
+        (dest++)->character = source[i];
+    }
+
+    column = runEnd;
   }
 }
 
 CompactHistoryScroll::CompactHistoryScroll ( unsigned int maxLineCount )
     : HistoryScroll ( new CompactHistoryType ( maxLineCount ) )
-    ,lines()
+    ,_head(0)
+    ,_count(0)
     ,blockList()
 {
-  //kDebug() << "scroll of length " << maxLineCount << " created";
   setMaxNbLines ( maxLineCount );
 }
 
 CompactHistoryScroll::~CompactHistoryScroll()
 {
-  qDeleteAll ( lines.begin(), lines.end() );
-  lines.clear();
+  while ( _count > 0 )
+    removeFirstLine();
 }
 
-void CompactHistoryScroll::addCellsVector ( const TextLine& cells )
+void CompactHistoryScroll::removeFirstLine()
 {
-  CompactHistoryLine *line;
-  line = new(blockList) CompactHistoryLine ( cells, blockList );
+  CompactHistoryLine::destroy ( _lines[_head], blockList );
+  _lines[_head] = nullptr;
+  _head = (_head + 1) % _lines.size();
+  _count--;
+  m_extendedChars.dropLines ( 1 );
+}
 
-  if ( lines.size() > ( int ) _maxLineCount )
+void CompactHistoryScroll::addCellsVector ( const TextLine& cells )
+{
+  // the ring grows with the lines up to the line limit, after that the
+  // oldest line is dropped first, so that its block can be reused
+  if ( _count == _lines.size() )
   {
-    delete lines.takeAt ( 0 );
+    const int capacity = qMax ( 1, static_cast<int> ( _maxLineCount ) );
+    if ( _lines.size() < capacity )
+      resizeRing ( qMin ( capacity, qMax ( MIN_RING_SIZE, 2 * _lines.size() ) ) );
+    else
+      removeFirstLine();
   }
-  lines.append ( line );
+
+  _lines[(_head + _count) % _lines.size()] = CompactHistoryLine::create ( cells, blockList );
+  _count++;
+  m_extendedChars.addLine ( cells.constData(), cells.size() );
 }
 
 void CompactHistoryScroll::addCells ( const Character a[], int count )
@@ -737,144 +1060,926 @@ void CompactHistoryScroll::addCells ( const Character a[], int count )
 
 void CompactHistoryScroll::addLine ( bool previousWrapped )
 {
-  CompactHistoryLine *line = lines.last();
-  //kDebug() << "last line at address " << line;
-  line->setWrapped(previousWrapped);
+  line(_count - 1)->setWrapped(previousWrapped);
+}
+
+qint64 CompactHistoryScroll::memoryUsage() const
+{
+  return blockList.memoryUsage() + _lines.size() * sizeof ( CompactHistoryLine* );
+}
+
+void CompactHistoryScroll::dropLines ( int count )
+{
+  count = qMin ( count, _count );
+  while ( count-- > 0 )
+    removeFirstLine();
 }
 
 int CompactHistoryScroll::getLines() const
 {
-  return lines.size();
+  return _count;
 }
 
 int CompactHistoryScroll::getLineLen ( int lineNumber ) const
 {
-  Q_ASSERT ( lineNumber >= 0 && lineNumber < lines.size() );
-  CompactHistoryLine* line = lines[lineNumber];
-  //kDebug() << "request for line at address " << line;
-  return line->getLength();
+  Q_ASSERT ( lineNumber >= 0 && lineNumber < _count );
+  return line(lineNumber)->getLength();
 }
 
 
 void CompactHistoryScroll::getCells ( int lineNumber, int startColumn, int count, Character buffer[] ) const
 {
   if ( count == 0 ) return;
-  Q_ASSERT ( lineNumber < lines.size() );
-  CompactHistoryLine* line = lines[lineNumber];
+  Q_ASSERT ( lineNumber < _count );
+  CompactHistoryLine* historyLine = line(lineNumber);
   Q_ASSERT ( startColumn >= 0 );
-  Q_ASSERT ( (unsigned int)startColumn <= line->getLength() - count );
-  line->getCharacters ( buffer, count, startColumn );
+  Q_ASSERT ( (unsigned int)startColumn <= historyLine->getLength() - count );
+  historyLine->getCharacters ( buffer, count, startColumn );
 }
 
 void CompactHistoryScroll::setMaxNbLines ( unsigned int lineCount )
 {
   _maxLineCount = lineCount;
 
-  while (lines.size() > static_cast<int>(lineCount)) {
-    delete lines.takeAt(0);
-  }
-  //kDebug() << "set max lines to: " << _maxLineCount;
+  // at least the line being added has to fit.  A larger limit is only
+  // taken up as lines arrive
+  const int capacity = qMax(1, static_cast<int>(lineCount));
+  while ( _count > capacity )
+    removeFirstLine();
+
+  if ( _lines.size() > capacity )
+    resizeRing ( capacity );
 }
 
-bool CompactHistoryScroll::isWrappedLine ( int lineNumber ) const
+void CompactHistoryScroll::resizeRing ( int size )
 {
-  Q_ASSERT ( lineNumber < lines.size() );
-  return lines[lineNumber]->isWrapped();
+  Q_ASSERT ( size >= _count );
+  QVector<CompactHistoryLine*> lines ( size, nullptr );
+  for ( int i = 0; i < _count; i++ )
+    lines[i] = line(i);
+  _lines.swap(lines);
+  _head = 0;
 }
 
+bool CompactHistoryScroll::isWrappedLine ( int lineNumber ) const
+{
+  Q_ASSERT ( lineNumber < _count );
+  return line(lineNumber)->isWrapped();
+}
 
-//////////////////////////////////////////////////////////////////////
-// History Types
-//////////////////////////////////////////////////////////////////////
+// Compressed History Scroll //////////////////////////////////////
 
-HistoryType::HistoryType()
+CompressedHistoryScroll::CompressedHistoryScroll ( unsigned int maxLineCount )
+    : HistoryScroll ( new CompressedHistoryType ( maxLineCount ) )
+    ,_firstLine(0)
+    ,_count(0)
+    ,_dataSize(0)
+    ,_nextBlockId(0)
+    ,_cacheClock(0)
+    ,_maxLineCount(maxLineCount)
 {
 }
 
-HistoryType::~HistoryType()
+CompressedHistoryScroll::~CompressedHistoryScroll()
 {
 }
 
-//////////////////////////////
-
-HistoryTypeNone::HistoryTypeNone()
+const CompressedHistoryScroll::Block& CompressedHistoryScroll::blockAt ( int lineNumber, int& index ) const
 {
+  Q_ASSERT ( lineNumber >= 0 && lineNumber < _count );
+  const int line = _firstLine + lineNumber;
+  index = line % BLOCK_LINES;
+  return _blocks[line / BLOCK_LINES];
 }
 
-bool HistoryTypeNone::isEnabled() const
+const Character* CompressedHistoryScroll::cells ( const Block& block ) const
 {
-  return false;
+  if ( !block.compressed )
+    return reinterpret_cast<const Character*> ( block.data.constData() );
+
+  _cacheClock++;
+  int victim = 0;
+  for ( int i = 0; i < _cache.size(); i++ )
+  {
+    if ( _cache[i].id == block.id )
+    {
+      _cache[i].lastUse = _cacheClock;
+      return reinterpret_cast<const Character*> ( _cache[i].cells.constData() );
+    }
+    if ( _cache[i].lastUse < _cache[victim].lastUse )
+      victim = i;
+  }
+
+  if ( _cache.size() < CACHE_BLOCKS )
+  {
+    victim = _cache.size();
+    _cache.append ( CachedBlock() );
+  }
+  CachedBlock& entry = _cache[victim];
+  entry.id = block.id;
+  entry.cells = qUncompress ( block.data );
+  entry.lastUse = _cacheClock;
+  Q_ASSERT ( entry.cells.size() == int ( lineEnd ( block, block.lineEnd.size() - 1 ) * sizeof ( Character ) ) );
+  return reinterpret_cast<const Character*> ( entry.cells.constData() );
 }
 
-HistoryScroll* HistoryTypeNone::scroll(HistoryScroll *old) const
+void CompressedHistoryScroll::removeFirstLine()
 {
-  delete old;
-  return new HistoryScrollNone();
+  _firstLine++;
+  _count--;
+  m_extendedChars.dropLines ( 1 );
+  if ( _firstLine < BLOCK_LINES )
+    return;
+
+  // the block is full, so it is not the one lines are added to
+  const quint64 id = _blocks.first().id;
+  for ( int i = 0; i < _cache.size(); i++ )
+  {
+    if ( _cache[i].id == id )
+    {
+      _cache.remove ( i );
+      break;
+    }
+  }
+  _dataSize -= _blocks.first().data.size() + BLOCK_LINES * sizeof ( quint32 );
+  _blocks.removeFirst();
+  _firstLine = 0;
 }
 
-int HistoryTypeNone::maximumLineCount() const
+void CompressedHistoryScroll::addCells ( const Character a[], int count )
 {
-  return 0;
-}
+  if ( _blocks.isEmpty() || _blocks.last().lineEnd.size() == BLOCK_LINES )
+  {
+    // the block which has just dropped out of the hot tier is compressed
+    const int coldBlock = _blocks.size() - HOT_BLOCKS - 1;
+    if ( coldBlock >= 0 && !_blocks[coldBlock].compressed )
+    {
+      Block& block = _blocks[coldBlock];
+      _dataSize -= block.data.size();
+      block.data = qCompress ( block.data, COMPRESSION_LEVEL );
+      _dataSize += block.data.size();
+      block.compressed = true;
+    }
 
-//////////////////////////////
+    Block block;
+    block.id = _nextBlockId++;
+    block.compressed = false;
+    block.lineEnd.reserve ( BLOCK_LINES );
+    _blocks.append ( block );
+  }
 
-HistoryTypeBlockArray::HistoryTypeBlockArray(size_t size)
-  : m_size(size)
-{
+  Block& block = _blocks.last();
+  const quint32 start = block.lineEnd.isEmpty() ? 0 : lineEnd ( block, block.lineEnd.size() - 1 );
+  block.data.append ( reinterpret_cast<const char*> ( a ), count * sizeof ( Character ) );
+  block.lineEnd.append ( start + count );
+  _dataSize += count * sizeof ( Character ) + sizeof ( quint32 );
+  _count++;
+  m_extendedChars.addLine ( a, count );
+
+  while ( _count > qMax ( 1, static_cast<int> ( _maxLineCount ) ) )
+    removeFirstLine();
 }
 
-bool HistoryTypeBlockArray::isEnabled() const
+void CompressedHistoryScroll::addLine ( bool previousWrapped )
 {
-  return true;
+  quint32& end = _blocks.last().lineEnd.last();
+  end = previousWrapped ? ( end | WRAPPED_FLAG ) : ( end & ~WRAPPED_FLAG );
 }
 
-int HistoryTypeBlockArray::maximumLineCount() const
+qint64 CompressedHistoryScroll::memoryUsage() const
 {
-  return m_size;
+  qint64 usage = _dataSize;
+  for ( const CachedBlock& entry : _cache )
+    usage += entry.cells.size();
+  return usage;
 }
 
-HistoryScroll* HistoryTypeBlockArray::scroll(HistoryScroll *old) const
+void CompressedHistoryScroll::dropLines ( int count )
 {
-  delete old;
-  return new HistoryScrollBlockArray(m_size);
+  count = qMin ( count, _count );
+  while ( count-- > 0 )
+    removeFirstLine();
 }
 
+int CompressedHistoryScroll::getLines() const
+{
+  return _count;
+}
 
-//////////////////////////////
+int CompressedHistoryScroll::getLineLen ( int lineNumber ) const
+{
+  int index;
+  const Block& block = blockAt ( lineNumber, index );
+  return lineEnd ( block, index ) - lineStart ( block, index );
+}
 
-HistoryTypeBuffer::HistoryTypeBuffer(unsigned int nbLines)
-  : m_nbLines(nbLines)
+void CompressedHistoryScroll::getCells ( int lineNumber, int startColumn, int count, Character buffer[] ) const
 {
+  if ( count == 0 ) return;
+  int index;
+  const Block& block = blockAt ( lineNumber, index );
+  const int start = lineStart ( block, index );
+  Q_ASSERT ( startColumn >= 0 && start + startColumn + count <= lineEnd ( block, index ) );
+  memcpy ( buffer, cells ( block ) + start + startColumn, count * sizeof ( Character ) );
 }
 
-bool HistoryTypeBuffer::isEnabled() const
+bool CompressedHistoryScroll::isWrappedLine ( int lineNumber ) const
 {
-  return true;
+  int index;
+  const Block& block = blockAt ( lineNumber, index );
+  return block.lineEnd[index] & WRAPPED_FLAG;
 }
 
-int HistoryTypeBuffer::maximumLineCount() const
+void CompressedHistoryScroll::setMaxNbLines ( unsigned int lineCount )
 {
-  return m_nbLines;
+  _maxLineCount = lineCount;
+  static_cast<CompressedHistoryType*> ( m_histType )->m_nbLines = lineCount;
+
+  while ( _count > qMax ( 1, static_cast<int> ( lineCount ) ) )
+    removeFirstLine();
 }
 
-HistoryScroll* HistoryTypeBuffer::scroll(HistoryScroll *old) const
+
+// Persistent History Scroll //////////////////////////////////////
+
+static const char HISTORY_FILE_MAGIC[8] = { 'Q', 'T', 'W', 'H', 'I', 'S', 'T', '\n' };
+
+PersistentHistoryScroll::PersistentHistoryScroll ( const QString& fileName, unsigned int maxLineCount, bool restoreLines )
+    : HistoryScroll ( new PersistentHistoryType ( fileName, maxLineCount ) )
+    ,_fileName ( fileName )
+    ,_lock ( nullptr )
+    ,_data ( nullptr )
+    ,_firstLine ( 0 )
+    ,_count ( 0 )
+    ,_tablesClock ( 0 )
+    ,_maxLineCount ( maxLineCount )
 {
-  if (old)
   {
-    HistoryScrollBuffer *oldBuffer = dynamic_cast<HistoryScrollBuffer*>(old);
-    if (oldBuffer)
+    // a process which died holding the lock is noticed right away, the
+    // timeout only guards against a process which hangs.  Without the lock
+    // the files of other processes may not be locked yet, so none is used
+    QLockFile directoryLock ( directoryLockName() );
+    if ( directoryLock.tryLock ( DIRECTORY_LOCK_TIMEOUT ) )
+      _path = createFile ( _lock );
+    if ( !_path.isEmpty() )
     {
-       oldBuffer->setMaxNbLines(m_nbLines);
-       return oldBuffer;
+      const qint64 validLength = restoreLines ? restore() : 0;
+      QFile::resize ( _path, validLength );
+      _data = new HistoryFile ( _path );
     }
+  }
+
+  if ( !_data || !_data->isOpen() )
+  {
+    // the history can not be saved, keep it for this session only
+    qWarning() << "Could not write the history file" << fileName;
+    if ( !_path.isEmpty() )
+      QFile::remove ( _path );
+    _path.clear();
+    delete _lock;
+    _lock = nullptr;
+    _chunks.clear();
+    _pendingEnds.clear();
+    _pendingCells.clear();
+    delete _data;
+    _data = new HistoryFile();
+  }
+
+  if ( _data->len() == 0 )
+  {
+    FileHeader header;
+    memcpy ( header.magic, HISTORY_FILE_MAGIC, sizeof ( header.magic ) );
+    header.version = FORMAT_VERSION;
+    header.cellSize = sizeof ( Character );
+    _data->add ( reinterpret_cast<const unsigned char*> ( &header ), sizeof ( header ) );
+  }
+
+  _count = _chunks.size() * CHUNK_LINES + _pendingEnds.size();
+  setMaxNbLines ( maxLineCount );
+}
+
+PersistentHistoryScroll::~PersistentHistoryScroll()
+{
+  if ( !_pendingEnds.isEmpty() )
+    writeChunk();
+  compact();
+  delete _data;
+
+  if ( !_path.isEmpty() && ::rename ( QFile::encodeName ( _path ).constData(),
+                                      QFile::encodeName ( _fileName ).constData() ) != 0 )
+    perror ( "PersistentHistoryScroll: rename" );
+  delete _lock;
+}
+
+QString PersistentHistoryScroll::directoryLockName() const
+{
+  return _fileName + QLatin1String ( ".lock" );
+}
+
+QString PersistentHistoryScroll::createFile ( QLockFile*& lock ) const
+{
+  QTemporaryFile file ( _fileName + QLatin1String ( ".XXXXXX" ) );
+  file.setAutoRemove ( false );
+  if ( !file.open() )
+    return QString();
+  const QString path = QFileInfo ( file.fileName() ).absoluteFilePath();
+  file.close();
+
+  lock = new QLockFile ( path + QLatin1String ( ".lock" ) );
+  // the file is in use as long as the process runs, however long that is
+  lock->setStaleLockTime ( 0 );
+  if ( !lock->tryLock() )
+  {
+    delete lock;
+    lock = nullptr;
+    QFile::remove ( path );
+    return QString();
+  }
+  return path;
+}
+
+qint64 PersistentHistoryScroll::restore()
+{
+  // a file which was still in use under a name of its own, because the
+  // program did not exit properly, may be newer than the saved one.  The
+  // newest file is used and the others are removed.  Files which other
+  // processes are still using are locked and left alone.
+  const QFileInfo info ( _fileName );
+  const QFileInfoList files = info.absoluteDir().entryInfoList (
+      QStringList ( info.fileName() + QLatin1String ( ".??????" ) ), QDir::Files );
+  QFileInfoList candidates;
+  for ( const QFileInfo& file : files )
+  {
+    if ( file.absoluteFilePath() == _path )
+      continue;
+    QLockFile lock ( file.absoluteFilePath() + QLatin1String ( ".lock" ) );
+    lock.setStaleLockTime ( 0 );
+    // the lock of a process which has died is removed by tryLock()
+    if ( !lock.tryLock() )
+      continue;
+    lock.unlock();
+    candidates.append ( file );
+  }
+  if ( info.exists() )
+    candidates.append ( info );
+
+  QString newest;
+  QDateTime newestTime;
+  for ( const QFileInfo& candidate : std::as_const ( candidates ) )
+  {
+    if ( newest.isEmpty() || candidate.lastModified() > newestTime )
+    {
+      newest = candidate.absoluteFilePath();
+      newestTime = candidate.lastModified();
+    }
+  }
+  for ( const QFileInfo& candidate : std::as_const ( candidates ) )
+  {
+    if ( candidate.absoluteFilePath() != newest )
+      QFile::remove ( candidate.absoluteFilePath() );
+  }
+
+  if ( newest.isEmpty() || ::rename ( QFile::encodeName ( newest ).constData(),
+                                      QFile::encodeName ( _path ).constData() ) != 0 )
+    return 0;
+
+  // only the chunk headers are read, the lines are read when they are used
+  HistoryFile file ( _path );
+  const qint64 length = file.len();
+  FileHeader header;
+  if ( length < qint64 ( sizeof ( header ) ) )
+    return 0;
+  file.get ( reinterpret_cast<unsigned char*> ( &header ), sizeof ( header ), 0 );
+  if ( memcmp ( header.magic, HISTORY_FILE_MAGIC, sizeof ( header.magic ) ) != 0 ||
+       header.version != FORMAT_VERSION || header.cellSize != sizeof ( Character ) )
+    return 0;
+
+  qint64 offset = sizeof ( header );
+  while ( offset + qint64 ( sizeof ( ChunkHeader ) ) <= length )
+  {
+    ChunkHeader chunk;
+    file.get ( reinterpret_cast<unsigned char*> ( &chunk ), sizeof ( chunk ), offset );
+    const qint64 endsOffset = offset + sizeof ( ChunkHeader );
+    const qint64 cellsOffset = endsOffset + chunk.lineCount * sizeof ( quint32 );
+    const qint64 extendedOffset = cellsOffset + qint64 ( chunk.cellCount ) * sizeof ( Character );
+    const qint64 colorsOffset = extendedOffset + qint64 ( chunk.extendedCount ) * sizeof ( quint32 );
+    const qint64 end = colorsOffset + qint64 ( chunk.colorCount ) * sizeof ( QRgb );
+
+    // the end of the file may not have been written completely
+    if ( chunk.lineCount == 0 || chunk.lineCount > CHUNK_LINES || end > length )
+      break;
+
+    if ( chunk.lineCount < CHUNK_LINES )
+    {
+      // the last chunk is not full, its lines are read back to complete it
+      _pendingEnds.resize ( chunk.lineCount );
+      file.get ( reinterpret_cast<unsigned char*> ( _pendingEnds.data() ),
+                 chunk.lineCount * sizeof ( quint32 ), endsOffset );
+      _pendingCells.resize ( chunk.cellCount );
+      file.get ( reinterpret_cast<unsigned char*> ( _pendingCells.data() ),
+                 chunk.cellCount * sizeof ( Character ), cellsOffset );
+      QVector<quint32> extended ( chunk.extendedCount );
+      file.get ( reinterpret_cast<unsigned char*> ( extended.data() ),
+                 chunk.extendedCount * sizeof ( quint32 ), extendedOffset );
+      QVector<QRgb> colors ( chunk.colorCount );
+      file.get ( reinterpret_cast<unsigned char*> ( colors.data() ),
+                 chunk.colorCount * sizeof ( QRgb ), colorsOffset );
+      ChunkTables tables;
+      decodeTables ( extended.constData(), extended.size(), colors.constData(), colors.size(), tables );
+      readExtendedChars ( _pendingCells.data(), _pendingCells.size(), tables );
+      if ( ( _pendingEnds.last() & ~WRAPPED_FLAG ) != chunk.cellCount )
+      {
+        _pendingEnds.clear();
+        _pendingCells.clear();
+      }
+      break;
+    }
+
+    _chunks.append ( offset );
+    offset = end;
+  }
+  return offset;
+}
+
+void PersistentHistoryScroll::writeChunk()
+{
+  // the ids of characters made of several code points and of true colors
+  // are only valid while the program runs, the characters and colors
+  // themselves are saved after the cells
+  QVector<Character> cells ( _pendingCells );
+  QVector<quint32> extended;
+  QHash<uint, quint32> offsets;
+  QVector<QRgb> colors;
+  QHash<uint, uint> colorNumbers;
+  auto writeColor = [&colors, &colorNumbers] ( PackedColor& color ) {
+    const uint id = color.trueColorId();
+    if ( id == 0 )
+      return;
+    auto it = colorNumbers.constFind ( id );
+    if ( it == colorNumbers.constEnd() )
+    {
+      // the numbers have as many bits as the ids, a chunk with more colors
+      // than that keeps the rest in the default colors
+      if ( uint ( colors.size() ) == PackedColor::MAX_TRUE_COLOR_ID )
+      {
+        color = PackedColor();
+        return;
+      }
+      colors.append ( ExtendedCharTable::instance.lookupColor ( id ) );
+      it = colorNumbers.insert ( id, colors.size() );
+    }
+    color = PackedColor::fromTrueColorId ( *it );
+  };
+  for ( Character& c : cells )
+  {
+    writeColor ( c.foregroundColor );
+    writeColor ( c.backgroundColor );
+    if ( !( c.rendition & RE_EXTENDED_CHAR ) )
+      continue;
+    auto it = offsets.constFind ( c.character );
+    if ( it == offsets.constEnd() )
+    {
+      ExtendedCharTable::Sequence chars;
+      ExtendedCharTable::instance.lookupExtendedChar ( c.character, chars );
+      it = offsets.insert ( c.character, extended.size() );
+      extended.append ( chars.size() );
+      for ( const uint point : std::as_const ( chars ) )
+        extended.append ( point );
+    }
+    c.character = *it;
+  }
+
+  const ChunkHeader header = { static_cast<quint32> ( _pendingEnds.size() ),
+                               static_cast<quint32> ( cells.size() ),
+                               static_cast<quint32> ( extended.size() ),
+                               static_cast<quint32> ( colors.size() ) };
+  _chunks.append ( _data->len() );
+  _data->add ( reinterpret_cast<const unsigned char*> ( &header ), sizeof ( header ) );
+  _data->add ( reinterpret_cast<const unsigned char*> ( _pendingEnds.constData() ),
+               _pendingEnds.size() * sizeof ( quint32 ) );
+  _data->add ( reinterpret_cast<const unsigned char*> ( cells.constData() ),
+               cells.size() * sizeof ( Character ) );
+  _data->add ( reinterpret_cast<const unsigned char*> ( extended.constData() ),
+               extended.size() * sizeof ( quint32 ) );
+  _data->add ( reinterpret_cast<const unsigned char*> ( colors.constData() ),
+               colors.size() * sizeof ( QRgb ) );
+
+  _pendingEnds.resize ( 0 );
+  _pendingCells.resize ( 0 );
+
+  // the file holds the dropped lines until it is compacted
+  compact();
+}
+
+void PersistentHistoryScroll::decodeTables ( const quint32* extended, int count, const QRgb* colors, int colorCount,
+                                            ChunkTables& tables )
+{
+  // the characters follow each other, each being its length and its code points
+  tables.chars.fill ( 0, count );
+  tables.charIds.clear();
+  for ( int offset = 0; offset < count && extended[offset] > 0 && extended[offset] < quint32 ( count - offset );
+        offset += extended[offset] + 1 )
+  {
+    // the character is kept as its first code point if the table is full
+    const uint id = ExtendedCharTable::instance.createExtendedChar (
+        extended + offset + 1, static_cast<ushort> ( extended[offset] ) );
+    if ( id != 0 )
+    {
+      tables.chars[offset] = id | EXTENDED_FLAG;
+      tables.charIds.append ( id );
+    }
+    else
+    {
+      tables.chars[offset] = extended[offset + 1];
+    }
+  }
+
+  tables.colors.resize ( colorCount );
+  tables.colorIds.clear();
+  for ( int i = 0; i < colorCount; i++ )
+  {
+    tables.colors[i] = CharacterColor ( COLOR_SPACE_RGB, int ( colors[i] & 0xFFFFFF ) );
+    if ( const uint id = tables.colors[i].trueColorId() )
+      tables.colorIds.append ( id );
+  }
+}
+
+const PersistentHistoryScroll::ChunkTables& PersistentHistoryScroll::chunkTables ( int chunk ) const
+{
+  const qint64 offset = _chunks[chunk];
+  _tablesClock++;
+  int victim = 0;
+  for ( int i = 0; i < _tables.size(); i++ )
+  {
+    if ( _tables[i].offset == offset )
+    {
+      _tables[i].lastUse = _tablesClock;
+      return _tables[i];
+    }
+    if ( _tables[i].lastUse < _tables[victim].lastUse )
+      victim = i;
+  }
+
+  if ( _tables.size() < CACHED_TABLES )
+  {
+    victim = _tables.size();
+    _tables.append ( ChunkTables() );
+  }
+
+  ChunkHeader header;
+  _data->get ( reinterpret_cast<unsigned char*> ( &header ), sizeof ( header ), offset );
+  const qint64 extendedOffset = offset + sizeof ( ChunkHeader ) + CHUNK_LINES * sizeof ( quint32 )
+                              + header.cellCount * qint64 ( sizeof ( Character ) );
+  QVector<quint32> extended ( header.extendedCount );
+  _data->get ( reinterpret_cast<unsigned char*> ( extended.data() ), extended.size() * sizeof ( quint32 ),
+               extendedOffset );
+  QVector<QRgb> colors ( header.colorCount );
+  _data->get ( reinterpret_cast<unsigned char*> ( colors.data() ), colors.size() * sizeof ( QRgb ),
+               extendedOffset + extended.size() * qint64 ( sizeof ( quint32 ) ) );
+
+  ChunkTables& tables = _tables[victim];
+  decodeTables ( extended.constData(), extended.size(), colors.constData(), colors.size(), tables );
+  tables.offset = offset;
+  tables.lastUse = _tablesClock;
+  return tables;
+}
+
+void PersistentHistoryScroll::readExtendedChars ( Character* cells, int cellCount, const ChunkTables& tables )
+{
+  auto readColor = [&tables] ( PackedColor& color ) {
+    const uint number = color.trueColorId();
+    if ( number == 0 )
+      return;
+    color = number <= uint ( tables.colors.size() ) ? tables.colors[number - 1] : PackedColor();
+  };
+  for ( int i = 0; i < cellCount; i++ )
+  {
+    Character& c = cells[i];
+    readColor ( c.foregroundColor );
+    readColor ( c.backgroundColor );
+    if ( !( c.rendition & RE_EXTENDED_CHAR ) )
+      continue;
+    const uint value = c.character < uint ( tables.chars.size() ) ? tables.chars[c.character] : 0;
+    if ( value & EXTENDED_FLAG )
+    {
+      c.character = value & ~EXTENDED_FLAG;
+    }
+    else
+    {
+      c.character = value != 0 ? value : ' ';
+      c.rendition &= ~RE_EXTENDED_CHAR;
+    }
+  }
+}
+
+void PersistentHistoryScroll::compact()
+{
+  const qint64 start = _chunks.isEmpty() ? _data->len() : _chunks.first();
+  const qint64 used = _data->len() - start;
+  if ( _path.isEmpty() || start - qint64 ( sizeof ( FileHeader ) ) <= used )
+    return;
+
+  QLockFile* lock = nullptr;
+  QString path;
+  {
+    // the file is compacted another time if the lock can not be taken
+    QLockFile directoryLock ( directoryLockName() );
+    if ( !directoryLock.tryLock ( DIRECTORY_LOCK_TIMEOUT ) )
+      return;
+    path = createFile ( lock );
+  }
+  QFile file ( path );
+  if ( path.isEmpty() || !file.open ( QIODevice::WriteOnly ) )
+  {
+    if ( !path.isEmpty() )
+      QFile::remove ( path );
+    delete lock;
+    return;
+  }
+
+  QByteArray buffer;
+  buffer.resize ( sizeof ( FileHeader ) );
+  _data->get ( reinterpret_cast<unsigned char*> ( buffer.data() ), buffer.size(), 0 );
+  bool ok = file.write ( buffer ) == buffer.size();
+
+  static const qint64 COPY_SIZE = 1024 * 1024;
+  for ( qint64 offset = start; ok && offset < _data->len(); offset += COPY_SIZE )
+  {
+    buffer.resize ( qMin ( COPY_SIZE, _data->len() - offset ) );
+    _data->get ( reinterpret_cast<unsigned char*> ( buffer.data() ), buffer.size(), offset );
+    ok = file.write ( buffer ) == buffer.size();
+  }
+
+  file.close();
+  if ( !ok )
+  {
+    file.remove();
+    delete lock;
+    return;
+  }
+
+  delete _data;
+  QFile::remove ( _path );
+  delete _lock;
+  _lock = lock;
+  _path = path;
+  _data = new HistoryFile ( _path );
+  const qint64 shift = start - sizeof ( FileHeader );
+  for ( qint64& chunk : _chunks )
+    chunk -= shift;
+  for ( ChunkTables& tables : _tables )
+    tables.offset -= shift;
+}
+
+int PersistentHistoryScroll::chunkAt ( int lineNumber, int& index ) const
+{
+  Q_ASSERT ( lineNumber >= 0 && lineNumber < _count );
+  const int line = _firstLine + lineNumber;
+  const int chunk = line / CHUNK_LINES;
+  if ( chunk < _chunks.size() )
+  {
+    index = line % CHUNK_LINES;
+    return chunk;
+  }
+  index = line - _chunks.size() * CHUNK_LINES;
+  return -1;
+}
+
+void PersistentHistoryScroll::lineBounds ( int chunk, int index, quint32& start, quint32& end ) const
+{
+  if ( chunk < 0 )
+  {
+    start = index > 0 ? _pendingEnds[index - 1] : 0;
+    end = _pendingEnds[index];
+  }
+  else if ( index > 0 )
+  {
+    quint32 ends[2];
+    _data->get ( reinterpret_cast<unsigned char*> ( ends ), sizeof ( ends ),
+                 _chunks[chunk] + sizeof ( ChunkHeader ) + ( index - 1 ) * sizeof ( quint32 ) );
+    start = ends[0];
+    end = ends[1];
+  }
+  else
+  {
+    start = 0;
+    _data->get ( reinterpret_cast<unsigned char*> ( &end ), sizeof ( end ),
+                 _chunks[chunk] + sizeof ( ChunkHeader ) );
+  }
+  start &= ~WRAPPED_FLAG;
+}
+
+void PersistentHistoryScroll::removeFirstLine()
+{
+  _firstLine++;
+  _count--;
+  if ( _firstLine == CHUNK_LINES && !_chunks.isEmpty() )
+  {
+    const qint64 offset = _chunks.takeFirst();
+    for ( int i = 0; i < _tables.size(); i++ )
+    {
+      if ( _tables[i].offset == offset )
+      {
+        _tables.remove ( i );
+        break;
+      }
+    }
+    _firstLine = 0;
+  }
+}
+
+void PersistentHistoryScroll::addCells ( const Character a[], int count )
+{
+  const quint32 start = _pendingEnds.isEmpty() ? 0 : _pendingEnds.last() & ~WRAPPED_FLAG;
+  _pendingCells.resize ( start + count );
+  std::copy ( a, a + count, _pendingCells.begin() + start );
+  _pendingEnds.append ( start + count );
+  _count++;
+
+  if ( _maxLineCount > 0 )
+  {
+    while ( _count > static_cast<int> ( _maxLineCount ) )
+      removeFirstLine();
+  }
+}
+
+void PersistentHistoryScroll::addLine ( bool previousWrapped )
+{
+  quint32& end = _pendingEnds.last();
+  end = previousWrapped ? ( end | WRAPPED_FLAG ) : ( end & ~WRAPPED_FLAG );
+
+  if ( _pendingEnds.size() == CHUNK_LINES )
+    writeChunk();
+}
+
+int PersistentHistoryScroll::getLines() const
+{
+  return _count;
+}
+
+int PersistentHistoryScroll::getLineLen ( int lineNumber ) const
+{
+  int index;
+  const int chunk = chunkAt ( lineNumber, index );
+  quint32 start, end;
+  lineBounds ( chunk, index, start, end );
+  return ( end & ~WRAPPED_FLAG ) - start;
+}
+
+void PersistentHistoryScroll::getCells ( int lineNumber, int startColumn, int count, Character buffer[] ) const
+{
+  if ( count == 0 ) return;
+  int index;
+  const int chunk = chunkAt ( lineNumber, index );
+  quint32 start, end;
+  lineBounds ( chunk, index, start, end );
+  Q_ASSERT ( startColumn >= 0 && start + startColumn + count <= ( end & ~WRAPPED_FLAG ) );
+
+  if ( chunk < 0 )
+  {
+    memcpy ( buffer, _pendingCells.constData() + start + startColumn, count * sizeof ( Character ) );
+    return;
+  }
+
+  const qint64 cells = _chunks[chunk] + sizeof ( ChunkHeader ) + CHUNK_LINES * sizeof ( quint32 );
+  _data->get ( reinterpret_cast<unsigned char*> ( buffer ), count * sizeof ( Character ),
+               cells + ( start + startColumn ) * qint64 ( sizeof ( Character ) ) );
+
+  const bool hasExtendedCells = std::any_of ( buffer, buffer + count, [] ( const Character& c ) {
+    return ( c.rendition & RE_EXTENDED_CHAR ) || c.foregroundColor.trueColorId() || c.backgroundColor.trueColorId();
+  } );
+  if ( hasExtendedCells )
+    readExtendedChars ( buffer, count, chunkTables ( chunk ) );
+}
+
+bool PersistentHistoryScroll::isWrappedLine ( int lineNumber ) const
+{
+  int index;
+  const int chunk = chunkAt ( lineNumber, index );
+  quint32 start, end;
+  lineBounds ( chunk, index, start, end );
+  return end & WRAPPED_FLAG;
+}
+
+qint64 PersistentHistoryScroll::memoryUsage() const
+{
+  return _pendingCells.size() * sizeof ( Character ) + _pendingEnds.size() * sizeof ( quint32 )
+       + _chunks.size() * sizeof ( qint64 );
+}
+
+void PersistentHistoryScroll::markExtendedChars() const
+{
+  // the lines in the file hold the characters themselves, only the ids
+  // they were given when they were read last are in use
+  ExtendedCharTable::instance.markExtendedChars ( _pendingCells.constData(), _pendingCells.size() );
+  for ( const ChunkTables& tables : std::as_const ( _tables ) )
+    ExtendedCharTable::instance.markIds ( tables.charIds, tables.colorIds );
+}
+
+void PersistentHistoryScroll::setMaxNbLines ( unsigned int lineCount )
+{
+  _maxLineCount = lineCount;
+  static_cast<PersistentHistoryType*> ( m_histType )->m_nbLines = lineCount;
+
+  if ( lineCount > 0 )
+  {
+    while ( _count > static_cast<int> ( lineCount ) )
+      removeFirstLine();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// History Types
+//////////////////////////////////////////////////////////////////////
+
+HistoryType::HistoryType()
+{
+}
+
+HistoryType::~HistoryType()
+{
+}
+
+//////////////////////////////
+
+HistoryTypeNone::HistoryTypeNone()
+{
+}
+
+bool HistoryTypeNone::isEnabled() const
+{
+  return false;
+}
+
+HistoryScroll* HistoryTypeNone::scroll(HistoryScroll *old) const
+{
+  delete old;
+  return new HistoryScrollNone();
+}
+
+int HistoryTypeNone::maximumLineCount() const
+{
+  return 0;
+}
+
+//////////////////////////////
+
+HistoryTypeBlockArray::HistoryTypeBlockArray(size_t size)
+  : m_size(size)
+{
+}
+
+bool HistoryTypeBlockArray::isEnabled() const
+{
+  return true;
+}
+
+int HistoryTypeBlockArray::maximumLineCount() const
+{
+  return m_size;
+}
+
+HistoryScroll* HistoryTypeBlockArray::scroll(HistoryScroll *old) const
+{
+  delete old;
+  return new HistoryScrollBlockArray(m_size);
+}
+
+
+//////////////////////////////
+
+HistoryTypeBuffer::HistoryTypeBuffer(unsigned int nbLines)
+  : m_nbLines(nbLines)
+{
+}
+
+bool HistoryTypeBuffer::isEnabled() const
+{
+  return true;
+}
+
+int HistoryTypeBuffer::maximumLineCount() const
+{
+  return m_nbLines;
+}
+
+HistoryScroll* HistoryTypeBuffer::scroll(HistoryScroll *old) const
+{
+  if (old)
+  {
+    HistoryScrollBuffer *oldBuffer = dynamic_cast<HistoryScrollBuffer*>(old);
+    if (oldBuffer)
+    {
+       oldBuffer->setMaxNbLines(m_nbLines);
+       return oldBuffer;
+    }
+
+    HistoryScroll *newScroll = new HistoryScrollBuffer(m_nbLines);
+    int lines = old->getLines();
+    int startLine = 0;
+    if (lines > static_cast<int>(m_nbLines))
+       startLine = lines - m_nbLines;
 
-    HistoryScroll *newScroll = new HistoryScrollBuffer(m_nbLines);
-    int lines = old->getLines();
-    int startLine = 0;
-    if (lines > static_cast<int>(m_nbLines))
-       startLine = lines - m_nbLines;
-
     Character line[LINE_SIZE];
     for(int i = startLine; i < lines; i++)
     {
@@ -985,3 +2090,228 @@ HistoryScroll* CompactHistoryType::scroll ( HistoryScroll *old ) const
   }
   return new CompactHistoryScroll ( m_nbLines );
 }
+
+//////////////////////////////
+
+CompressedHistoryType::CompressedHistoryType ( unsigned int nbLines )
+    : m_nbLines ( nbLines )
+{
+}
+
+bool CompressedHistoryType::isEnabled() const
+{
+  return true;
+}
+
+int CompressedHistoryType::maximumLineCount() const
+{
+  return m_nbLines;
+}
+
+HistoryScroll* CompressedHistoryType::scroll ( HistoryScroll *old ) const
+{
+  CompressedHistoryScroll *oldScroll = dynamic_cast<CompressedHistoryScroll*> ( old );
+  if ( oldScroll )
+  {
+    oldScroll->setMaxNbLines ( m_nbLines );
+    return oldScroll;
+  }
+
+  HistoryScroll *newScroll = new CompressedHistoryScroll ( m_nbLines );
+  if ( old )
+  {
+    const int lines = old->getLines();
+    const int startLine = qMax ( 0, lines - static_cast<int> ( m_nbLines ) );
+    TextLine cells;
+    for ( int i = startLine; i < lines; i++ )
+    {
+      cells.resize ( old->getLineLen ( i ) );
+      old->getCells ( i, 0, cells.size(), cells.data() );
+      newScroll->addCellsVector ( cells );
+      newScroll->addLine ( old->isWrappedLine ( i ) );
+    }
+    delete old;
+  }
+  return newScroll;
+}
+
+//////////////////////////////////////////////////////////////////////
+// History Memory Governor
+//////////////////////////////////////////////////////////////////////
+
+Q_GLOBAL_STATIC(HistoryMemoryGovernor, theHistoryMemoryGovernor)
+
+HistoryMemoryGovernor::HistoryMemoryGovernor()
+  : _totalUsage(0)
+  , _budget(0)
+  , _viewCounter(0)
+  , _enforcing(false)
+{
+}
+
+HistoryMemoryGovernor* HistoryMemoryGovernor::instance()
+{
+  return theHistoryMemoryGovernor;
+}
+
+void HistoryMemoryGovernor::registerOwner(const void* owner, const ReleaseFunction& release)
+{
+  QMutexLocker locker(&_mutex);
+  _owners.insert(owner, { release, 0, ++_viewCounter });
+}
+
+void HistoryMemoryGovernor::unregisterOwner(const void* owner)
+{
+  QMutexLocker locker(&_mutex);
+  auto it = _owners.constFind(owner);
+  if (it == _owners.constEnd())
+    return;
+  _totalUsage -= it->usage;
+  _owners.erase(it);
+}
+
+void HistoryMemoryGovernor::setUsage(const void* owner, qint64 bytes)
+{
+  {
+    QMutexLocker locker(&_mutex);
+    auto it = _owners.find(owner);
+    if (it == _owners.end())
+      return;
+    _totalUsage += bytes - it->usage;
+    it->usage = bytes;
+    if (_budget == 0 || _totalUsage <= _budget || _enforcing)
+      return;
+    _enforcing = true;
+  }
+  enforceBudget();
+}
+
+void HistoryMemoryGovernor::markViewed(const void* owner)
+{
+  QMutexLocker locker(&_mutex);
+  auto it = _owners.find(owner);
+  if (it != _owners.end())
+    it->lastViewed = ++_viewCounter;
+}
+
+void HistoryMemoryGovernor::enforceBudget()
+{
+  // owners are asked in the order they were last viewed, each one at most
+  // once, as an owner may not be able to free as much as was asked for
+  QSet<const void*> asked;
+  QMutexLocker locker(&_mutex);
+  while (_budget > 0 && _totalUsage > _budget)
+  {
+    const void* owner = nullptr;
+    quint64 lastViewed = 0;
+    for (auto it = _owners.constBegin(); it != _owners.constEnd(); ++it)
+    {
+      if (it->usage > 0 && !asked.contains(it.key()) && (!owner || it->lastViewed < lastViewed))
+      {
+        owner = it.key();
+        lastViewed = it->lastViewed;
+      }
+    }
+    if (!owner)
+      break;
+    asked.insert(owner);
+
+    // the owner takes its own locks while it releases memory
+    const ReleaseFunction release = _owners.value(owner).release;
+    const qint64 excess = _totalUsage - _budget;
+    locker.unlock();
+    const qint64 freed = release(excess);
+    locker.relock();
+
+    auto it = _owners.find(owner);
+    if (it != _owners.end() && freed > 0)
+    {
+      const qint64 released = qMin(freed, it->usage);
+      it->usage -= released;
+      _totalUsage -= released;
+    }
+  }
+  _enforcing = false;
+}
+
+void HistoryMemoryGovernor::setBudget(qint64 bytes)
+{
+  {
+    QMutexLocker locker(&_mutex);
+    _budget = qMax<qint64>(0, bytes);
+    if (_budget == 0 || _totalUsage <= _budget || _enforcing)
+      return;
+    _enforcing = true;
+  }
+  enforceBudget();
+}
+
+qint64 HistoryMemoryGovernor::budget() const
+{
+  QMutexLocker locker(&_mutex);
+  return _budget;
+}
+
+qint64 HistoryMemoryGovernor::usage() const
+{
+  QMutexLocker locker(&_mutex);
+  return _totalUsage;
+}
+
+qint64 HistoryMemoryGovernor::usage(const void* owner) const
+{
+  QMutexLocker locker(&_mutex);
+  return _owners.value(owner).usage;
+}
+
+//////////////////////////////
+
+PersistentHistoryType::PersistentHistoryType ( const QString& fileName, unsigned int nbLines )
+    : m_fileName ( fileName )
+    , m_nbLines ( nbLines )
+{
+}
+
+bool PersistentHistoryType::isEnabled() const
+{
+  return true;
+}
+
+int PersistentHistoryType::maximumLineCount() const
+{
+  return m_nbLines;
+}
+
+const QString& PersistentHistoryType::getFileName() const
+{
+  return m_fileName;
+}
+
+HistoryScroll* PersistentHistoryType::scroll ( HistoryScroll *old ) const
+{
+  PersistentHistoryScroll *oldScroll = dynamic_cast<PersistentHistoryScroll*> ( old );
+  if ( oldScroll && oldScroll->fileName() == m_fileName )
+  {
+    oldScroll->setMaxNbLines ( m_nbLines );
+    return oldScroll;
+  }
+
+  // a new, empty history is asked for when the history is cleared or
+  // rewrapped, only a history replacing one of another type is restored
+  HistoryScroll *newScroll = new PersistentHistoryScroll ( m_fileName, m_nbLines, old != nullptr );
+  if ( old )
+  {
+    const int lines = old->getLines();
+    const int startLine = m_nbLines > 0 ? qMax ( 0, lines - static_cast<int> ( m_nbLines ) ) : 0;
+    TextLine cells;
+    for ( int i = startLine; i < lines; i++ )
+    {
+      cells.resize ( old->getLineLen ( i ) );
+      old->getCells ( i, 0, cells.size(), cells.data() );
+      newScroll->addCellsVector ( cells );
+      newScroll->addLine ( old->isWrappedLine ( i ) );
+    }
+    delete old;
+  }
+  return newScroll;
+}
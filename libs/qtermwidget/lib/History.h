@@ -24,6 +24,8 @@
 // Qt
 #include <QBitRef>
 #include <QHash>
+#include <QLockFile>
+#include <QMutex>
 #include <QVector>
 #include <QTemporaryFile>
 
@@ -37,6 +39,8 @@
 // map
 #include <sys/mman.h>
 
+#include <functional>
+
 namespace Konsole
 {
 
@@ -49,41 +53,107 @@ class HistoryFile
 {
 public:
   HistoryFile();
+  //uses the file 'fileName', which is kept.  Data is added after what the file holds.
+  explicit HistoryFile(const QString& fileName);
   virtual ~HistoryFile();
 
+  //returns false if the file could not be opened
+  bool isOpen() const { return ion >= 0; }
+
   virtual void add(const unsigned char* bytes, int len);
-  virtual void get(unsigned char* bytes, int len, int loc);
-  virtual int  len() const;
+  virtual void get(unsigned char* bytes, int len, qint64 loc);
+  virtual qint64 len() const;
 
-  //mmaps the file in read-only mode
-  void map();
-  //un-mmaps the file
+  //un-mmaps all sections of the file
   void unmap();
-  //returns true if the file is mmap'ed
+  //returns true if any section of the file is mmap'ed
   bool isMapped() const;
 
+  //writes the data buffered by add() to the file
+  void flush();
 
 private:
+  //a section of the file which is mmap'ed in read-only mode
+  struct Segment
+  {
+    qint64 start;
+    qint64 length;
+    char* data;
+    quint64 lastUse;
+  };
+
+  //returns the mapped section containing 'loc', mapping it if necessary,
+  //or nullptr if mmap'ing fails.  'loc' must be in the written part of the file.
+  const Segment* segmentAt(qint64 loc);
+  //reads from the written part of the file without mmap'ing it
+  bool readFile(unsigned char* bytes, int len, qint64 loc);
+
   int  ion;
-  int  length;
+  qint64 length;       //number of bytes added, including those still in writeBuffer
+  qint64 fileLength;   //number of bytes written to the file
   QTemporaryFile tmpFile;
+  QFile namedFile;     //used instead of tmpFile if a file name is given
+
+  //data added but not written to the file yet.  add() only appends here and
+  //the buffer is written in one go once it holds WRITE_BUFFER_SIZE bytes.
+  QByteArray writeBuffer;
 
-  //pointer to start of mmap'ed file data, or 0 if the file is not mmap'ed
-  char* fileMap;
+  //the file is mmap'ed in sections of SEGMENT_SIZE bytes, of which at most
+  //MAX_SEGMENTS are kept.  The least recently used one is dropped first.
+  //The file only grows at the end, so a mapping stays valid when data is added.
+  QVector<Segment> segments;
+  quint64 segmentUseCounter;
+  qint64 lastMappedEnd;  //end of the section mapped last, to detect sequential reads
 
-  //incremented whenever 'add' is called and decremented whenever
-  //'get' is called.
-  //this is used to detect when a large number of lines are being read and processed from the history
-  //and automatically mmap the file for better performance (saves the overhead of many lseek-read calls).
-  int readWriteBalance = 0;
+  static constexpr qint64 SEGMENT_SIZE = 4 * 1024 * 1024;
+  static constexpr int MAX_SEGMENTS = 8;
 
-  //when readWriteBalance goes below this threshold, the file will be mmap'ed automatically
-  static const int MAP_THRESHOLD = -1000;
+  static const int WRITE_BUFFER_SIZE = 256 * 1024;
 };
 #endif
 
 //////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////////////////
+// The ids of the extended characters and true colors used by the lines
+// of a history, see ExtendedCharTable.  They are kept per block of lines,
+// so that the ids in use are marked without reading the lines, and the
+// ids of a block are no longer marked once all of its lines are dropped.
+// Lines are only added at the end and dropped from the start.
+//////////////////////////////////////////////////////////////////////
+class ExtendedCharUsage
+{
+public:
+  ExtendedCharUsage();
+
+  // adds a line holding the cells 'cells'
+  void addLine(const Character* cells, int count);
+  // drops the 'count' oldest lines
+  void dropLines(int count);
+  void clear();
+  // marks the ids used by the lines as used
+  void mark() const;
+
+private:
+  static constexpr int BLOCK_LINES = 1024;
+  // the ids of a block are sorted and made unique once there are this many
+  static constexpr int MIN_COMPACT_SIZE = 256;
+
+  struct Block
+  {
+    int lines;
+    QVector<uint> chars;    // ids of extended characters
+    QVector<uint> colors;   // ids of true colors
+    int compactSize;        // size at which the ids are made unique next
+  };
+
+  static void addId(Block& block, QVector<uint>& ids, uint id);
+  static void compact(QVector<uint>& ids);
+
+  QList<Block> _blocks;     // the last block is the one lines are added to
+  int _firstLine;           // lines already dropped from the first block
+};
+
 //////////////////////////////////////////////////////////////////////
 // Abstract base class for file and buffer versions
 //////////////////////////////////////////////////////////////////////
@@ -117,6 +187,13 @@ public:
 
   virtual void addLine(bool previousWrapped=false) = 0;
 
+  // memory used for the lines, in bytes.  Histories kept on disk return 0.
+  virtual qint64 memoryUsage() const { return 0; }
+  // drops the 'count' oldest lines, histories which cannot drop lines ignore this
+  virtual void dropLines(int /*count*/) {}
+  // marks the extended characters and true colors of the lines as used, see ExtendedCharTable
+  virtual void markExtendedChars() const;
+
   //
   // FIXME:  Passing around constant references to HistoryType instances
   // is very unsafe, because those references will no longer
@@ -126,6 +203,9 @@ public:
 
 protected:
   HistoryType* m_histType;
+  // the ids used by the lines, which the subclasses keep up to date as
+  // they add and drop lines
+  ExtendedCharUsage m_extendedChars;
 
 };
 
@@ -150,10 +230,10 @@ public:
   void addLine(bool previousWrapped=false) override;
 
 private:
-  int startOfLine(int lineno) const;
+  qint64 startOfLine(int lineno) const;
 
   QString m_logFileName;
-  mutable HistoryFile index; // lines Row(int)
+  mutable HistoryFile index; // lines Row(qint64)
   mutable HistoryFile cells; // text  Row(Character)
   mutable HistoryFile lineflags; // flags Row(unsigned char)
 };
@@ -179,6 +259,9 @@ public:
   void addCellsVector(const QVector<Character>& cells) override;
   void addLine(bool previousWrapped=false) override;
 
+  qint64 memoryUsage() const override;
+  void dropLines(int count) override;
+
   void setMaxNbLines(unsigned int nbLines);
   unsigned int maxNbLines() const { return _maxLineCount; }
 
@@ -191,6 +274,7 @@ private:
   int _maxLineCount;
   int _usedLines;
   int _head;
+  qint64 _cellCount;    // number of cells in all lines
 
   //QVector<histline*> m_histBuffer;
   //QBitArray m_wrappedLine;
@@ -262,6 +346,10 @@ protected:
 // History using compact storage
 // This implementation uses a list of fixed-sized blocks
 // where history lines are allocated in (avoids heap fragmentation)
+//
+// Lines are only added at the end and dropped from the start, so the
+// lines in a block are dropped in the order they were allocated.  A block
+// is recycled as soon as the last of its lines is dropped.
 //////////////////////////////////////////////////////////////////////
 typedef QVector<Character> TextLine;
 
@@ -282,39 +370,38 @@ public:
     bgColor=c.backgroundColor;
   }
 
-  CharacterColor fgColor, bgColor;
+  PackedColor fgColor, bgColor;
   quint16 startPos;
-  quint8 rendition;
+  quint16 rendition;
 };
 
 class CompactHistoryBlock
 {
 public:
+  static constexpr size_t DEFAULT_LENGTH = 4096*64; // 256kb
 
-  CompactHistoryBlock(){
-    blockLength = 4096*64; // 256kb
-    head = (quint8*) mmap(nullptr, blockLength, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
-    //head = (quint8*) malloc(blockLength);
-    Q_ASSERT(head != MAP_FAILED);
-    tail = blockStart = head;
+  explicit CompactHistoryBlock(size_t length = DEFAULT_LENGTH){
+    blockLength = length;
+    blockStart = (quint8*) mmap(nullptr, blockLength, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    Q_ASSERT(blockStart != MAP_FAILED);
+    tail = blockStart;
     allocCount=0;
   }
 
-  virtual ~CompactHistoryBlock(){
-    //free(blockStart);
+  ~CompactHistoryBlock(){
     munmap(blockStart, blockLength);
   }
 
-  virtual unsigned int remaining(){ return blockStart+blockLength-tail;}
-  virtual unsigned  length() { return blockLength; }
-  virtual void* allocate(size_t length);
-  virtual bool contains(void *addr) {return addr>=blockStart && addr<(blockStart+blockLength);}
-  virtual void deallocate();
-  virtual bool isInUse(){ return allocCount!=0; } ;
+  size_t remaining() const { return blockStart+blockLength-tail;}
+  size_t length() const { return blockLength; }
+  void* allocate(size_t length);
+  void deallocate();
+  bool isInUse() const { return allocCount!=0; }
+  // makes the whole block available again, it must not be in use
+  void reset();
 
 private:
   size_t blockLength;
-  quint8* head;
   quint8* tail;
   quint8* blockStart;
   int allocCount;
@@ -322,45 +409,58 @@ private:
 
 class CompactHistoryBlockList {
 public:
-  CompactHistoryBlockList() {};
+  CompactHistoryBlockList();
   ~CompactHistoryBlockList();
 
-  void *allocate( size_t size );
-  void deallocate(void *);
-  int length() {return list.size();}
+  // allocates 'size' bytes and returns the block they were taken from in 'block'
+  void *allocate( size_t size, CompactHistoryBlock*& block );
+  // releases an allocation made from 'block'
+  void deallocate( CompactHistoryBlock* block );
+  int length() const { return blockCount; }
+  // bytes of all blocks, including those kept for reuse
+  size_t memoryUsage() const { return totalLength; }
+
 private:
-  QList<CompactHistoryBlock*> list;
+  // the number of emptied blocks which are kept for reuse
+  static constexpr int MAX_FREE_BLOCKS = 4;
+
+  CompactHistoryBlock* current;           // the block new lines are allocated in
+  QVector<CompactHistoryBlock*> freeBlocks;
+  int blockCount;
+  size_t totalLength;
 };
 
 class CompactHistoryLine
 {
 public:
-  CompactHistoryLine(const TextLine&, CompactHistoryBlockList& blockList);
-  virtual ~CompactHistoryLine();
+  // creates a copy of 'line' in memory taken from 'blockList'
+  static CompactHistoryLine* create(const TextLine& line, CompactHistoryBlockList& blockList);
+  // frees a line created by create()
+  static void destroy(CompactHistoryLine* line, CompactHistoryBlockList& blockList);
 
-  // custom new operator to allocate memory from custom pool instead of heap
-  static void *operator new( size_t size, CompactHistoryBlockList& blockList);
-  static void operator delete( void *) { /* do nothing, deallocation from pool is done in destructor*/ } ;
+  void getCharacters(Character* array, int length, int startColumn) const;
+  void getCharacter(int index, Character &r) const;
+  bool isWrapped() const {return wrapped;};
+  void setWrapped(bool isWrapped) { wrapped=isWrapped;};
+  unsigned int getLength() const {return length;};
 
-  virtual void getCharacters(Character* array, int length, int startColumn) ;
-  virtual void getCharacter(int index, Character &r) ;
-  virtual bool isWrapped() const {return wrapped;};
-  virtual void setWrapped(bool isWrapped) { wrapped=isWrapped;};
-  virtual unsigned int getLength() const {return length;};
+private:
+  CompactHistoryLine() = default;
+  // returns the index in formatArray of the format used at 'column'
+  int formatIndex(int column) const;
 
-protected:
-  CompactHistoryBlockList& blockList;
+  // the line, its formats and its text are allocated in one piece from 'block'
+  CompactHistoryBlock* block;
   CharacterFormat* formatArray;
+  void* text;             // quint16 values, or uint values if wideText is set
   quint16 length;
-  quint16* text;
   quint16 formatLength;
   bool wrapped;
+  bool wideText;          // the line contains characters outside the BMP
 };
 
 class CompactHistoryScroll : public HistoryScroll
 {
-  typedef QList<CompactHistoryLine*> HistoryArray;
-
 public:
   CompactHistoryScroll(unsigned int maxNbLines = 1000);
   ~CompactHistoryScroll() override;
@@ -374,17 +474,238 @@ public:
   void addCellsVector(const TextLine& cells) override;
   void addLine(bool previousWrapped=false) override;
 
+  qint64 memoryUsage() const override;
+  void dropLines(int count) override;
+
   void setMaxNbLines(unsigned int nbLines);
   unsigned int maxNbLines() const { return _maxLineCount; }
 
 private:
-  bool hasDifferentColors(const TextLine& line) const;
-  HistoryArray lines;
+  // the lines are kept in a ring, line 0 being at index _head
+  CompactHistoryLine* line(int lineNumber) const
+  { return _lines[(_head + lineNumber) % _lines.size()]; }
+  void removeFirstLine();
+  // moves the lines into a ring of @p size entries, starting at index 0
+  void resizeRing ( int size );
+
+  // the number of entries the ring starts with once a line arrives
+  static const int MIN_RING_SIZE = 64;
+
+  QVector<CompactHistoryLine*> _lines;
+  int _head;
+  int _count;
   CompactHistoryBlockList blockList;
 
   unsigned int _maxLineCount;
 };
 
+//////////////////////////////////////////////////////////////////////
+// History with a compressed cold tier
+// Lines are stored in blocks of a fixed number of lines.  The newest
+// blocks are kept as plain cells, older blocks are compressed and only
+// decompressed, into a small cache, when they are read.
+//////////////////////////////////////////////////////////////////////
+
+class CompressedHistoryScroll : public HistoryScroll
+{
+public:
+  CompressedHistoryScroll(unsigned int maxNbLines = 1000);
+  ~CompressedHistoryScroll() override;
+
+  int  getLines() const override;
+  int  getLineLen(int lineno) const override;
+  void getCells(int lineno, int colno, int count, Character res[]) const override;
+  bool isWrappedLine(int lineno) const override;
+
+  void addCells(const Character a[], int count) override;
+  void addLine(bool previousWrapped=false) override;
+
+  qint64 memoryUsage() const override;
+  void dropLines(int count) override;
+
+  void setMaxNbLines(unsigned int nbLines);
+  unsigned int maxNbLines() const { return _maxLineCount; }
+
+private:
+  static constexpr int BLOCK_LINES = 256;   // lines per block
+  static constexpr int HOT_BLOCKS = 4;      // full blocks kept uncompressed
+  static constexpr int CACHE_BLOCKS = 4;    // decompressed blocks kept for reading
+  static constexpr int COMPRESSION_LEVEL = 1;
+  static constexpr quint32 WRAPPED_FLAG = 0x80000000;
+
+  struct Block
+  {
+    quint64 id;
+    QByteArray data;            // the cells of all lines, compressed if 'compressed' is set
+    QVector<quint32> lineEnd;   // end of each line in cells, WRAPPED_FLAG marks wrapped lines
+    bool compressed;
+  };
+
+  struct CachedBlock
+  {
+    quint64 id;
+    QByteArray cells;
+    quint64 lastUse;
+  };
+
+  // returns the block holding 'lineNumber' and the index of the line in it
+  const Block& blockAt(int lineNumber, int& index) const;
+  static int lineStart(const Block& block, int index)
+  { return index == 0 ? 0 : block.lineEnd[index - 1] & ~WRAPPED_FLAG; }
+  static int lineEnd(const Block& block, int index)
+  { return block.lineEnd[index] & ~WRAPPED_FLAG; }
+  // returns the uncompressed cells of 'block'
+  const Character* cells(const Block& block) const;
+  void removeFirstLine();
+
+  QList<Block> _blocks;        // the last block is the one lines are added to
+  int _firstLine;              // lines already dropped from the first block
+  int _count;
+  qint64 _dataSize;            // bytes in the data and line end arrays of all blocks
+  quint64 _nextBlockId;
+  mutable QVector<CachedBlock> _cache;
+  mutable quint64 _cacheClock;
+
+  unsigned int _maxLineCount;
+};
+
+//////////////////////////////////////////////////////////////////////
+// History kept in a file which outlives the session
+//
+// The file starts with a FileHeader and holds a series of chunks.  A chunk
+// is a ChunkHeader, the end of each of its lines (in cells, WRAPPED_FLAG
+// marks wrapped lines), the cells of its lines, the characters made of
+// several code points and the true colors.  The ids of such characters and
+// colors are only valid while the program runs, so the cells hold the offset
+// of the length and the code points of the character, and the number of the
+// color counting from 1, in the last parts instead.  All chunks but the
+// last one hold CHUNK_LINES lines, so that lines are found without reading
+// the file.  Lines are collected in memory and written a chunk at a time.
+// The characters and colors of the chunks read last are kept with the ids
+// they were given, so that reading a line does not read them again.  Once
+// more than half of the file holds dropped lines, the lines still in use are
+// copied to a new file.
+//
+// While the history is in use the file has a name of its own next to the
+// file name it was given, and is locked with a QLockFile so that other
+// processes using the same file name leave it alone.  It is moved to that
+// name when the history is deleted, so that the history which replaced it,
+// e.g. after rewrapping, is the one which is found next time.
+//////////////////////////////////////////////////////////////////////
+
+class PersistentHistoryScroll : public HistoryScroll
+{
+public:
+  /**
+   * Creates a history which is saved to @p fileName.  If @p restoreLines is true,
+   * the lines saved in @p fileName before are restored.
+   */
+  PersistentHistoryScroll(const QString& fileName, unsigned int maxNbLines, bool restoreLines);
+  ~PersistentHistoryScroll() override;
+
+  int  getLines() const override;
+  int  getLineLen(int lineno) const override;
+  void getCells(int lineno, int colno, int count, Character res[]) const override;
+  bool isWrappedLine(int lineno) const override;
+
+  void addCells(const Character a[], int count) override;
+  void addLine(bool previousWrapped=false) override;
+
+  qint64 memoryUsage() const override;
+  void markExtendedChars() const override;
+
+  void setMaxNbLines(unsigned int nbLines);
+  unsigned int maxNbLines() const { return _maxLineCount; }
+  const QString& fileName() const { return _fileName; }
+
+private:
+  static constexpr int CHUNK_LINES = 256;
+  static constexpr quint32 WRAPPED_FLAG = 0x80000000;
+  static constexpr quint32 FORMAT_VERSION = 3;
+  // how long to wait for another process to create or take over its file, in ms
+  static constexpr int DIRECTORY_LOCK_TIMEOUT = 5000;
+  // chunks whose characters and colors are kept, see ChunkTables
+  static constexpr int CACHED_TABLES = 4;
+  // set in ChunkTables::chars for the ids of characters in the ExtendedCharTable
+  static constexpr uint EXTENDED_FLAG = 0x80000000;
+
+  struct FileHeader
+  {
+    char magic[8];
+    quint32 version;
+    quint32 cellSize;   // sizeof(Character) of the program which wrote the file
+  };
+
+  struct ChunkHeader
+  {
+    quint32 lineCount;
+    quint32 cellCount;
+    quint32 extendedCount;  // words holding the characters made of several code points
+    quint32 colorCount;     // true colors
+  };
+
+  // the characters and colors saved with a chunk, as they are used while
+  // the program runs
+  struct ChunkTables
+  {
+    qint64 offset;              // start of the chunk in the file
+    // for each offset which starts a character, its id with EXTENDED_FLAG
+    // set, or its first code point if the table is full.  0 elsewhere
+    QVector<uint> chars;
+    QVector<PackedColor> colors;    // the color of each number, counting from 1
+    QVector<uint> charIds;      // the ids in 'chars' and 'colors', see markExtendedChars()
+    QVector<uint> colorIds;
+    quint64 lastUse;
+  };
+
+  // moves the newest saved file which is not in use to _path and returns
+  // the length of its valid part, reading the chunks in it
+  qint64 restore();
+  // creates a new file next to _fileName and locks it with 'lock'.  Returns
+  // the path of the file, or an empty string.  See directoryLockName()
+  QString createFile(QLockFile*& lock) const;
+  // the lock held while a file next to _fileName is created or taken over,
+  // so that other processes never see a file before it is locked
+  QString directoryLockName() const;
+  // writes the lines collected in memory as a chunk
+  void writeChunk();
+  // makes the tables of a chunk from the characters 'extended' of size
+  // 'count' and the true colors 'colors' saved with it
+  static void decodeTables(const quint32* extended, int count, const QRgb* colors, int colorCount,
+                           ChunkTables& tables);
+  // returns the tables of 'chunk', reading them if they are not kept
+  const ChunkTables& chunkTables(int chunk) const;
+  // replaces the offsets in the extended cells of 'cells' by the ids of
+  // their characters, and the numbers of the true colors by their ids
+  static void readExtendedChars(Character* cells, int cellCount, const ChunkTables& tables);
+  // copies the chunks in use to a new file, leaving out those no longer
+  // used, if they take more than half of the file
+  void compact();
+  // returns the chunk holding 'lineNumber', or -1 if it is still in memory,
+  // and the index of the line in it
+  int chunkAt(int lineNumber, int& index) const;
+  // returns where the line 'index' of 'chunk' starts and ends, see chunkAt()
+  void lineBounds(int chunk, int index, quint32& start, quint32& end) const;
+  void removeFirstLine();
+
+  QString _fileName;
+  QString _path;               // the file written while the history is in use
+  QLockFile* _lock;            // held on _path while it is in use
+  HistoryFile* _data;
+  QVector<qint64> _chunks;     // start of each chunk in use in the file
+  int _firstLine;              // lines no longer used in the first chunk
+  int _count;
+
+  // the newest lines, which are not written yet
+  QVector<quint32> _pendingEnds;
+  QVector<Character> _pendingCells;
+
+  mutable QVector<ChunkTables> _tables;
+  mutable quint64 _tablesClock;
+
+  unsigned int _maxLineCount;
+};
+
 //////////////////////////////////////////////////////////////////////
 // History type
 //////////////////////////////////////////////////////////////////////
@@ -485,9 +806,115 @@ protected:
   unsigned int m_nbLines;
 };
 
+class CompressedHistoryType : public HistoryType
+{
+    friend class CompressedHistoryScroll;
+
+public:
+  CompressedHistoryType(unsigned int size);
+
+  bool isEnabled() const override;
+  int maximumLineCount() const override;
+
+  HistoryScroll* scroll(HistoryScroll *) const override;
+
+protected:
+  unsigned int m_nbLines;
+};
+
+class PersistentHistoryType : public HistoryType
+{
+    friend class PersistentHistoryScroll;
+
+public:
+  /**
+   * @p nbLines is the maximum number of lines, 0 means no limit.
+   */
+  PersistentHistoryType(const QString& fileName, unsigned int nbLines);
+
+  bool isEnabled() const override;
+  int maximumLineCount() const override;
+  const QString& getFileName() const;
+
+  HistoryScroll* scroll(HistoryScroll *) const override;
+
+protected:
+  QString m_fileName;
+  unsigned int m_nbLines;
+};
+
 
 #endif
 
+//////////////////////////////////////////////////////////////////////
+// Memory budget shared by the histories of all sessions
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * Keeps the memory used by the histories of all sessions in the process
+ * within a budget.  Each owner of histories, usually the emulation of a
+ * session, registers with the governor and reports how much memory its
+ * histories use.  When the total exceeds the budget, the oldest lines of the
+ * histories which have not been viewed for the longest time are dropped.
+ *
+ * The governor may be used from any thread, but owners are asked to release
+ * memory from the thread which reports the usage.
+ */
+class HistoryMemoryGovernor
+{
+public:
+  /**
+   * Called to free memory of an owner.  It drops the oldest history lines
+   * until about @p bytes bytes are freed and returns the number of bytes freed.
+   */
+  typedef std::function<qint64(qint64 bytes)> ReleaseFunction;
+
+  HistoryMemoryGovernor();
+
+  static HistoryMemoryGovernor* instance();
+
+  void registerOwner(const void* owner, const ReleaseFunction& release);
+  void unregisterOwner(const void* owner);
+
+  /**
+   * Records that the histories of @p owner use @p bytes bytes and frees
+   * memory if this exceeds the budget.
+   */
+  void setUsage(const void* owner, qint64 bytes);
+
+  /**
+   * Marks the histories of @p owner as viewed.  Histories which have not
+   * been viewed for the longest time are the first to lose lines.
+   */
+  void markViewed(const void* owner);
+
+  /** Sets the budget in bytes, 0 means no limit.  The default is no limit. */
+  void setBudget(qint64 bytes);
+  qint64 budget() const;
+
+  /** Returns the memory used by the histories of all owners, in bytes. */
+  qint64 usage() const;
+  /** Returns the memory used by the histories of @p owner, in bytes. */
+  qint64 usage(const void* owner) const;
+
+private:
+  void enforceBudget();
+
+  struct Owner
+  {
+    ReleaseFunction release;
+    qint64 usage;
+    quint64 lastViewed;
+  };
+
+  mutable QMutex _mutex;
+  QHash<const void*, Owner> _owners;
+  qint64 _totalUsage;
+  qint64 _budget;
+  quint64 _viewCounter;
+  bool _enforcing;       // enforceBudget() is running
+};
+
 }
 
 #endif // TEHISTORY_H
@@ -0,0 +1,431 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryMatchIndex.h"
+
+// Standard
+#include <algorithm>
+
+// Qt
+#include <QTextStream>
+#include <QThread>
+
+// Konsole
+#include "Emulation.h"
+#include "HistoryTrigramIndex.h"
+#include "TerminalCharacterDecoder.h"
+
+using namespace Konsole;
+
+namespace
+{
+
+// decodes lines @p firstLine to @p lastLine of @p emulation into plain text,
+// the position of each line in the text is stored in @p linePositions
+QString decodeLines(Emulation* emulation, int firstLine, int lastLine, QList<int>& linePositions)
+{
+    QString text;
+    QTextStream stream(&text);
+    PlainTextDecoder decoder;
+    decoder.begin(&stream);
+    decoder.setRecordLinePositions(true);
+    emulation->writeToStream(&decoder, firstLine, lastLine);
+    linePositions = decoder.linePositions();
+    return text;
+}
+
+// returns the line of the text containing @p position
+int lineAt(const QList<int>& linePositions, int position)
+{
+    const auto it = std::upper_bound(linePositions.cbegin(), linePositions.cend(), position);
+    return qMax(0, int(it - linePositions.cbegin()) - 1);
+}
+
+// returns a matcher for @p text, which ignores the case if @p regExp does
+LiteralMatcher literalMatcher(const QRegularExpression& regExp, const QString& text)
+{
+    return LiteralMatcher(text, (regExp.patternOptions() & QRegularExpression::CaseInsensitiveOption)
+                                ? Qt::CaseInsensitive : Qt::CaseSensitive);
+}
+
+bool startsBefore(const HistoryMatchIndex::Match& match, qint64 line)
+{
+    return match.startLine < line;
+}
+
+bool matchBefore(const HistoryMatchIndex::Match& a, const HistoryMatchIndex::Match& b)
+{
+    return a.startLine < b.startLine || (a.startLine == b.startLine && a.startColumn < b.startColumn);
+}
+
+// copies the lines from @p firstLine on of @p emulation into @p image, @p lines lines of @p columns cells
+void copyImage(Emulation* emulation, int firstLine, int lines, int columns,
+               QVector<Character>& image, QVector<LineProperty>& lineProperties)
+{
+    LiteralMatcher::Lines copied;
+    emulation->copyLineCells(firstLine, firstLine + lines - 1, copied.cells, copied.lineEnds, copied.lineProperties);
+    image.fill(Character(), lines * columns);
+    for (int line = 0; line < lines; line++)
+    {
+        const int start = copied.lineStart(line);
+        const int length = qMin(columns, copied.lineEnds.at(line) - start);
+        std::copy(copied.cells.constBegin() + start, copied.cells.constBegin() + start + length,
+                  image.begin() + line * columns);
+    }
+    lineProperties = copied.lineProperties;
+}
+
+// returns the position of the first match of @p matches which touches @p line or a later line
+int firstMatchFrom(const QList<HistoryMatchIndex::Match>& matches, qint64 line)
+{
+    int index = int(std::lower_bound(matches.cbegin(), matches.cend(), line, startsBefore) - matches.cbegin());
+    while (index > 0 && matches.at(index - 1).endLine >= line)
+        index--;
+    return index;
+}
+
+}
+
+HistoryMatchIndex::HistoryMatchIndex(Emulation* emulation, QObject* parent)
+    : QObject(parent)
+    , m_emulation(emulation)
+{
+    ExtendedCharTable::instance.registerOwner(this, [this] {
+        m_screenChanges.markExtendedChars();
+    });
+}
+
+HistoryMatchIndex::~HistoryMatchIndex()
+{
+    ExtendedCharTable::instance.unregisterOwner(this);
+    stopBuild();
+}
+
+void HistoryMatchIndex::setRegExp(const QRegularExpression& regExp, const QString& literalText)
+{
+    if (regExp == m_regExp && literalText == m_literalText)
+        return;
+
+    m_regExp = regExp;
+    m_literalText = literalText;
+    rebuild();
+}
+
+QRegularExpression HistoryMatchIndex::regExp() const
+{
+    return m_regExp;
+}
+
+int HistoryMatchIndex::count() const
+{
+    return m_historyMatches.size() + m_screenMatches.size();
+}
+
+int HistoryMatchIndex::indexOf(int column, int line) const
+{
+    const qint64 absoluteLine = line + m_droppedLines;
+    auto before = [](const Match& match, const QPair<qint64, int>& position) {
+        return match.startLine < position.first
+               || (match.startLine == position.first && match.startColumn < position.second);
+    };
+
+    const QPair<qint64, int> position(absoluteLine, column);
+    const QList<Match>* lists[] = { &m_historyMatches, &m_screenMatches };
+    int offset = 0;
+    for (const QList<Match>* matches : lists)
+    {
+        const auto it = std::lower_bound(matches->cbegin(), matches->cend(), position, before);
+        if (it != matches->cend() && it->startLine == absoluteLine && it->startColumn == column)
+            return offset + int(it - matches->cbegin());
+        offset += matches->size();
+    }
+    return -1;
+}
+
+QList<HistoryMatchIndex::Match> HistoryMatchIndex::matchesInLines(int firstLine, int lastLine) const
+{
+    QList<Match> result;
+    const qint64 absoluteFirst = firstLine + m_droppedLines;
+    const qint64 absoluteLast = lastLine + m_droppedLines;
+
+    const QList<Match>* lists[] = { &m_historyMatches, &m_screenMatches };
+    for (const QList<Match>* matches : lists)
+    {
+        for (int i = firstMatchFrom(*matches, absoluteFirst);
+             i < matches->size() && matches->at(i).startLine <= absoluteLast; i++)
+        {
+            Match match = matches->at(i);
+            match.startLine -= m_droppedLines;
+            match.endLine -= m_droppedLines;
+            result << match;
+        }
+    }
+    return result;
+}
+
+void HistoryMatchIndex::update()
+{
+    if (m_regExp.pattern().isEmpty() || !m_emulation)
+        return;
+
+    QMutexLocker locker(m_emulation->screenLock());
+
+    if (m_emulation->historyGeneration() != m_generation)
+    {
+        locker.unlock();
+        rebuild();
+        return;
+    }
+
+    const qint64 dropped = m_emulation->droppedLineCount();
+    const int lines = m_emulation->lineCount();
+    const int historyLines = lines - m_emulation->imageSize().height();
+    const qint64 historyEnd = dropped + historyLines;
+    const int oldCount = count();
+
+    // forget the matches in lines which have been dropped from the history
+    int firstKept = 0;
+    while (firstKept < m_historyMatches.size() && m_historyMatches.at(firstKept).startLine < dropped)
+        firstKept++;
+    m_historyMatches.remove(0, firstKept);
+
+    // lines which have moved back from the history to the screen
+    if (historyEnd < m_scannedEnd)
+    {
+        while (!m_historyMatches.isEmpty() && m_historyMatches.constLast().startLine >= historyEnd)
+            m_historyMatches.removeLast();
+        m_scannedEnd = historyEnd;
+        m_buildEnd = qMin(m_buildEnd, historyEnd);
+    }
+
+    // only the lines which have entered the history since the last update are searched
+    if (historyEnd > m_scannedEnd)
+    {
+        scanLines(int(qMax(m_scannedEnd, dropped) - dropped), historyLines - 1, dropped, m_historyMatches);
+        m_scannedEnd = historyEnd;
+    }
+
+    // the lines on the screen may have changed anywhere, only those which have are searched again
+    const int screenLines = lines - historyLines;
+    const int columns = m_emulation->imageSize().width();
+    QVector<LineProperty> lineProperties;
+    copyImage(m_emulation, historyLines, screenLines, columns, m_screenImage, lineProperties);
+    const QVector<bool> changedLines = m_screenChanges.update(m_screenImage.constData(), screenLines, columns,
+                                                              lineProperties, historyEnd);
+
+    QList<Match> screenMatches;
+    for (const Match& match : std::as_const(m_screenMatches))
+    {
+        const qint64 line = match.startLine - historyEnd;
+        if (line >= 0 && line < screenLines && !changedLines.at(int(line)))
+            screenMatches << match;
+    }
+    for (int i = 0; i < screenLines; i++)
+    {
+        if (!changedLines.at(i))
+            continue;
+        const int first = i;
+        while (i + 1 < screenLines && changedLines.at(i + 1))
+            i++;
+        scanLines(historyLines + first, historyLines + i, dropped, screenMatches);
+    }
+    std::sort(screenMatches.begin(), screenMatches.end(), matchBefore);
+    m_screenMatches.swap(screenMatches);
+    m_droppedLines = dropped;
+
+    // the display repaints the lines which have changed anyway
+    locker.unlock();
+    if (count() != oldCount)
+        emit changed();
+}
+
+void HistoryMatchIndex::rebuild()
+{
+    stopBuild();
+    m_historyMatches.clear();
+    m_screenMatches.clear();
+    m_screenChanges.clear();
+
+    if (m_regExp.pattern().isEmpty() || !m_emulation)
+    {
+        emit changed();
+        return;
+    }
+
+    {
+        QMutexLocker locker(m_emulation->screenLock());
+        m_generation = m_emulation->historyGeneration();
+        m_droppedLines = m_emulation->droppedLineCount();
+        m_buildStart = m_droppedLines;
+        m_buildEnd = m_droppedLines + m_emulation->lineCount() - m_emulation->imageSize().height();
+        m_scannedEnd = m_buildEnd;
+    }
+
+    // the history which is there now is searched in the background, the
+    // output which arrives in the meantime is searched by update()
+    if (m_buildEnd > m_buildStart)
+    {
+        m_searchedEmulation = m_emulation;
+        m_searchedEmulation->setScreenLocking(true);
+        m_buildCancelled = false;
+        const qint64 start = m_buildStart;
+        const qint64 end = m_buildEnd;
+        const uint generation = m_generation;
+        // an expression of its own, so that it is not compiled in both threads at once
+        const QRegularExpression regExp(m_regExp.pattern(), m_regExp.patternOptions());
+        const QString literalText = m_literalText;
+        m_buildThread = QThread::create([this, regExp, literalText, start, end, generation]() {
+            buildHistory(regExp, literalText, start, end, generation);
+        });
+        QThread* thread = m_buildThread;
+        connect(thread, &QThread::finished, this, [this, thread]() {
+            if (thread == m_buildThread)
+                buildFinished();
+        });
+        m_buildThread->start(QThread::LowPriority);
+    }
+
+    update();
+    emit changed();
+}
+
+void HistoryMatchIndex::stopBuild()
+{
+    if (!m_buildThread)
+        return;
+
+    m_buildCancelled = true;
+    m_buildThread->wait();
+    delete m_buildThread;
+    m_buildThread = nullptr;
+    m_builtMatches.clear();
+
+    if (m_emulation)
+        m_emulation->setScreenLocking(false);
+    m_searchedEmulation = nullptr;
+}
+
+void HistoryMatchIndex::buildFinished()
+{
+    QList<Match> built;
+    built.swap(m_builtMatches);
+    stopBuild();
+
+    // keep the matches in lines which are still in the history
+    const auto dropped = std::remove_if(built.begin(), built.end(), [this](const Match& match) {
+        return match.startLine < m_droppedLines || match.startLine >= m_buildEnd;
+    });
+    built.erase(dropped, built.end());
+
+    built << m_historyMatches;
+    m_historyMatches.swap(built);
+    emit changed();
+}
+
+void HistoryMatchIndex::buildHistory(const QRegularExpression& regExp, const QString& literalText,
+                                     qint64 buildStart, qint64 buildEnd, uint generation)
+{
+    const HistoryTrigramIndex::Query query = HistoryTrigramIndex::query(regExp);
+    const LiteralMatcher matcher = literalMatcher(regExp, literalText);
+    LiteralMatcher::Lines lines;
+    for (qint64 start = buildStart; start < buildEnd && !m_buildCancelled; start += BLOCK_LINES)
+    {
+        QString text;
+        QList<int> linePositions;
+        lines.clear();
+        qint64 dropped;
+        int firstLine;
+        {
+            QMutexLocker locker(m_searchedEmulation->screenLock());
+            // update() starts again once it notices
+            if (m_searchedEmulation->historyGeneration() != generation)
+                return;
+
+            dropped = m_searchedEmulation->droppedLineCount();
+            firstLine = int(qMax(start, dropped) - dropped);
+            const int lastLine = int(qMin(start + BLOCK_LINES, buildEnd) - 1 - dropped);
+            if (lastLine < firstLine || !m_searchedEmulation->linesMayMatch(query, firstLine, lastLine))
+                continue;
+            if (matcher.isEmpty())
+                text = decodeLines(m_searchedEmulation, firstLine, lastLine, linePositions);
+            else
+                m_searchedEmulation->copyLineCells(firstLine, lastLine, lines.cells, lines.lineEnds, lines.lineProperties);
+        }
+        if (matcher.isEmpty())
+            findMatches(regExp, text, linePositions, dropped + firstLine, m_builtMatches);
+        else
+            findMatches(matcher, lines, dropped + firstLine, m_builtMatches);
+    }
+}
+
+void HistoryMatchIndex::scanLines(int firstLine, int lastLine, qint64 droppedLines, QList<Match>& matches) const
+{
+    const LiteralMatcher matcher = literalMatcher(m_regExp, m_literalText);
+    LiteralMatcher::Lines lines;
+    for (int start = firstLine; start <= lastLine; start += BLOCK_LINES)
+    {
+        const int end = qMin(start + BLOCK_LINES - 1, lastLine);
+        if (matcher.isEmpty())
+        {
+            QList<int> linePositions;
+            const QString text = decodeLines(m_emulation, start, end, linePositions);
+            findMatches(m_regExp, text, linePositions, droppedLines + start, matches);
+        }
+        else
+        {
+            lines.clear();
+            m_emulation->copyLineCells(start, end, lines.cells, lines.lineEnds, lines.lineProperties);
+            findMatches(matcher, lines, droppedLines + start, matches);
+        }
+    }
+}
+
+void HistoryMatchIndex::findMatches(const QRegularExpression& regExp, const QString& text,
+                                    const QList<int>& linePositions, qint64 firstLine, QList<Match>& matches)
+{
+    QRegularExpressionMatchIterator it = regExp.globalMatch(text);
+    while (it.hasNext())
+    {
+        const QRegularExpressionMatch match = it.next();
+        if (match.capturedLength() == 0)
+            continue;
+
+        const int start = match.capturedStart();
+        const int end = match.capturedEnd() - 1;
+        const int startLine = lineAt(linePositions, start);
+        const int endLine = lineAt(linePositions, end);
+        matches << Match{ firstLine + startLine, start - linePositions.value(startLine),
+                          firstLine + endLine, end - linePositions.value(endLine) };
+    }
+}
+
+void HistoryMatchIndex::findMatches(const LiteralMatcher& matcher, const LiteralMatcher::Lines& lines,
+                                    qint64 firstLine, QList<Match>& matches)
+{
+    int end = 0;
+    for (int start = matcher.indexIn(lines, 0, int(lines.cells.size()), &end); start > -1;
+         start = matcher.indexIn(lines, end + 1, int(lines.cells.size()), &end))
+    {
+        const int startLine = lines.lineAt(start);
+        const int endLine = lines.lineAt(end);
+        matches << Match{ firstLine + startLine, start - lines.lineStart(startLine),
+                          firstLine + endLine, end - lines.lineStart(endLine) };
+    }
+}
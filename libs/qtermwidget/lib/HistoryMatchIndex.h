@@ -0,0 +1,156 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef HISTORYMATCHINDEX_H
+#define HISTORYMATCHINDEX_H
+
+// Qt
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QRegularExpression>
+
+#include <atomic>
+
+// Konsole
+#include "LineChangeTracker.h"
+#include "LiteralMatcher.h"
+
+class QThread;
+
+namespace Konsole
+{
+
+class Emulation;
+
+/**
+ * Keeps the positions of all matches of a regular expression in the output
+ * of an emulation, the history as well as the screen.
+ *
+ * The history is searched once in a thread of its own when the expression is
+ * set.  After that update() only searches the lines which have entered the
+ * history since the last call, and the lines on the screen which have changed
+ * since then, as found by a LineChangeTracker.  The cost of an update
+ * therefore depends on the amount of new output, not on the length of the
+ * history; the rest of the screen is only compared, not searched again.
+ *
+ * Matches are found in each block of lines read from the emulation, so a
+ * match may span wrapped lines but not the border between two blocks.
+ */
+class HistoryMatchIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Match
+    {
+        qint64 startLine;
+        int startColumn;
+        qint64 endLine;
+        int endColumn;     // the last column of the match
+    };
+
+    /** Constructs an index of the output of @p emulation.  It is empty until setRegExp() is called. */
+    explicit HistoryMatchIndex(Emulation* emulation, QObject* parent = nullptr);
+    /** Stops the search of the history and waits for its thread to finish. */
+    ~HistoryMatchIndex() override;
+
+    /**
+     * Sets the expression to look for and searches the output again.  An empty pattern clears the index.
+     *
+     * If @p literalText is not empty, it is looked for in the cells instead,
+     * as HistorySearch::setLiteralText() does, so that the matches and their
+     * columns are those a search for the same text finds.
+     */
+    void setRegExp(const QRegularExpression& regExp, const QString& literalText = QString());
+    /** Returns the expression which is looked for.  See setRegExp() */
+    QRegularExpression regExp() const;
+
+    /** Returns the number of matches found so far. */
+    int count() const;
+
+    /**
+     * Returns the position of the match starting at @p column, @p line among
+     * all matches, or -1 if there is no such match.
+     */
+    int indexOf(int column, int line) const;
+
+    /**
+     * Returns the matches which touch the lines from @p firstLine to
+     * @p lastLine.  The line numbers of the matches are those of
+     * Emulation::writeToStream().
+     */
+    QList<Match> matchesInLines(int firstLine, int lastLine) const;
+
+public slots:
+    /** Searches the output which has been added since the last update. */
+    void update();
+
+signals:
+    /**
+     * Emitted when matches have been added or removed, or the expression
+     * has changed.  Matches which only moved along with the text they are
+     * in do not cause the signal.
+     */
+    void changed();
+
+private:
+    void rebuild();
+    void stopBuild();
+    void buildFinished();
+    // runs in the build thread
+    void buildHistory(const QRegularExpression& regExp, const QString& literalText,
+                      qint64 buildStart, qint64 buildEnd, uint generation);
+
+    // searches lines @p firstLine to @p lastLine, the screen lock must be held
+    void scanLines(int firstLine, int lastLine, qint64 droppedLines, QList<Match>& matches) const;
+    static void findMatches(const QRegularExpression& regExp, const QString& text,
+                            const QList<int>& linePositions, qint64 firstLine, QList<Match>& matches);
+    static void findMatches(const LiteralMatcher& matcher, const LiteralMatcher::Lines& lines,
+                            qint64 firstLine, QList<Match>& matches);
+
+    // lines read while the screen lock is held when the history is searched
+    static const int BLOCK_LINES = 1000;
+
+    QPointer<Emulation> m_emulation;
+    Emulation* m_searchedEmulation = nullptr; // used by the build thread
+    QRegularExpression m_regExp;
+    QString m_literalText;       // looked for instead of m_regExp, if not empty
+
+    // line numbers are counted from the first line of output which has ever
+    // been in the history, so that they do not change when lines are dropped
+    QList<Match> m_historyMatches;
+    QList<Match> m_screenMatches;
+    LineChangeTracker m_screenChanges;   // the screen at the last update
+    QVector<Character> m_screenImage;
+    qint64 m_droppedLines = 0;   // Emulation::droppedLineCount() at the last update
+    qint64 m_scannedEnd = 0;     // end of the history lines searched so far
+    uint m_generation = 0;       // Emulation::historyGeneration() at the last update
+
+    // searches the history which was there when the expression was set
+    QThread* m_buildThread = nullptr;
+    std::atomic<bool> m_buildCancelled{false};
+    qint64 m_buildStart = 0;
+    qint64 m_buildEnd = 0;       // lines from here on are searched by update()
+    QList<Match> m_builtMatches;
+};
+
+}
+
+#endif // HISTORYMATCHINDEX_H
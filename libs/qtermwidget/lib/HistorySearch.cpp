@@ -16,8 +16,11 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
     02110-1301  USA.
 */
+#include <algorithm>
+
 #include <QApplication>
 #include <QTextStream>
+#include <QThread>
 #include <QDebug>
 
 #include "TerminalCharacterDecoder.h"
@@ -26,133 +29,244 @@
 
 HistorySearch::HistorySearch(EmulationPtr emulation, const QRegularExpression& regExp,
         bool forwards, int startColumn, int startLine,
-        QObject* parent) :
+        QObject* parent, bool nearest) :
 QObject(parent),
 m_emulation(emulation),
 m_regExp(regExp),
+m_query(HistoryTrigramIndex::query(regExp)),
 m_forwards(forwards),
+m_nearest(nearest),
 m_startColumn(startColumn),
 m_startLine(startLine) {
 }
 
 HistorySearch::~HistorySearch() {
+    if (m_thread) {
+        m_cancelled = true;
+        m_thread->wait();
+        delete m_thread;
+    }
+
+    if (m_searchedEmulation && m_emulation) {
+        m_emulation->setScreenLocking(false);
+    }
 }
 
 void HistorySearch::search() {
-    bool found = false;
+    if (m_regExp.pattern().isEmpty() || !m_emulation)
+    {
+        emit finished();
+        deleteLater();
+        return;
+    }
 
-    if (! m_regExp.pattern().isEmpty())
+    // the search thread reads the screens while the emulation keeps running
+    m_searchedEmulation = m_emulation;
+    m_searchedEmulation->setScreenLocking(true);
     {
+        QMutexLocker locker(m_searchedEmulation->screenLock());
+        m_linesTotal = m_searchedEmulation->lineCount();
+        m_startDroppedLines = m_searchedEmulation->droppedLineCount();
+    }
+    m_progressTimer.start();
+
+    m_thread = QThread::create([this]() { run(); });
+    connect(m_thread, &QThread::finished, this, &HistorySearch::done);
+    m_thread->start(QThread::LowPriority);
+}
+
+void HistorySearch::cancel() {
+    m_cancelled = true;
+}
+
+void HistorySearch::setLiteralText(const QString& text) {
+    const Qt::CaseSensitivity cs = (m_regExp.patternOptions() & QRegularExpression::CaseInsensitiveOption)
+                                   ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    m_literalMatcher = LiteralMatcher(text, cs);
+}
+
+void HistorySearch::run() {
+    const int lastLine = m_linesTotal - 1;
+
+    if (m_nearest) {
         if (m_forwards) {
-            found = search(m_startColumn, m_startLine, -1, m_emulation->lineCount()) || search(0, 0, m_startColumn, m_startLine);
+            m_found = search(true, m_startColumn, m_startLine, -1, lastLine) || search(false, 0, 0, m_startColumn, m_startLine);
         } else {
-            found = search(0, 0, m_startColumn, m_startLine) || search(m_startColumn, m_startLine, -1, m_emulation->lineCount());
+            m_found = search(false, 0, 0, m_startColumn, m_startLine) || search(true, m_startColumn, m_startLine, -1, lastLine);
         }
+    } else if (m_forwards) {
+        m_found = search(true, m_startColumn, m_startLine, -1, lastLine) || search(true, 0, 0, m_startColumn, m_startLine);
+    } else {
+        m_found = search(false, 0, 0, m_startColumn, m_startLine) || search(false, m_startColumn, m_startLine, -1, lastLine);
+    }
+}
 
-        if (found) {
-            emit matchFound(m_foundStartColumn, m_foundStartLine, m_foundEndColumn, m_foundEndLine);
-        }
-        else {
-            emit noMatchFound();
-        }
+void HistorySearch::done() {
+    if (m_cancelled)
+    {
+        deleteLater();
+        return;
+    }
+
+    // lines dropped from the history while the search ran have moved the match up
+    const int dropped = m_emulation ? static_cast<int>(m_emulation->droppedLineCount() - m_foundDroppedLines) : 0;
+    if (m_found && m_emulation && m_foundStartLine - dropped >= 0) {
+        emit matchFound(m_foundStartColumn, m_foundStartLine - dropped, m_foundEndColumn, m_foundEndLine - dropped);
+    }
+    else {
+        emit noMatchFound();
     }
+    emit finished();
 
     deleteLater();
 }
 
-bool HistorySearch::search(int startColumn, int startLine, int endColumn, int endLine) {
-    qDebug() << "search from" << startColumn << "," << startLine
-            <<  "to" << endColumn << "," << endLine;
-
+bool HistorySearch::search(bool forwards, int startColumn, int startLine, int endColumn, int endLine) {
     int linesRead = 0;
     int linesToRead = endLine - startLine + 1;
 
-    qDebug() << "linesToRead:" << linesToRead;
-
     // We read process history from (and including) startLine to (and including) endLine in
-    // blocks of at most 10K lines so that we do not use unhealthy amounts of memory
+    // blocks of at most BLOCK_LINES lines, so that the screen lock is held only briefly and
+    // we do not use unhealthy amounts of memory
     int blockSize;
-    while ((blockSize = qMin(10000, linesToRead - linesRead)) > 0) {
+    while ((blockSize = qMin(BLOCK_LINES, linesToRead - linesRead)) > 0) {
+        if (m_cancelled)
+            return false;
+
+        // Calculate lines to read. The line numbers were taken when the search started,
+        // lines dropped from the history since then have moved the others up
+        int blockStartLine = forwards ? startLine + linesRead : endLine - linesRead - blockSize + 1;
+        int blockEndLine = blockStartLine + blockSize - 1;
+        linesRead += blockSize;
+        reportProgress(blockSize);
 
         QString string;
         QTextStream searchStream(&string);
         PlainTextDecoder decoder;
         decoder.begin(&searchStream);
         decoder.setRecordLinePositions(true);
+        m_lines.clear();
 
-        // Calculate lines to read and read them
-        int blockStartLine = m_forwards ? startLine + linesRead : endLine - linesRead - blockSize + 1;
-        int chunkEndLine = blockStartLine + blockSize - 1;
-        m_emulation->writeToStream(&decoder, blockStartLine, chunkEndLine);
-
-        // We search between startColumn in the first line of the string and endColumn in the last
-        // line of the string. First we calculate the position (in the string) of endColumn in the
-        // last line of the string
-        int endPosition;
-
-        // The String that Emulator.writeToStream produces has a newline at the end, and so ends with an
-        // empty line - we ignore that.
-        int numberOfLinesInString = decoder.linePositions().size() - 1;
-        if (numberOfLinesInString > 0 && endColumn > -1 )
-        {
-            endPosition = decoder.linePositions().at(numberOfLinesInString - 1) + endColumn;
-        }
-        else
+        int firstLine;
+        int lastLine;
+        int shift;
+        qint64 droppedLines;
         {
-            endPosition = string.size();
+            QMutexLocker locker(m_searchedEmulation->screenLock());
+            droppedLines = m_searchedEmulation->droppedLineCount();
+            shift = static_cast<int>(droppedLines - m_startDroppedLines);
+            firstLine = qMax(0, blockStartLine - shift);
+            lastLine = qMin(blockEndLine - shift, m_searchedEmulation->lineCount() - 1);
+            if (lastLine < firstLine || !m_searchedEmulation->linesMayMatch(m_query, firstLine, lastLine))
+                continue;
+            // literal text is looked for in the cells themselves
+            if (m_literalMatcher.isEmpty())
+                m_searchedEmulation->writeToStream(&decoder, firstLine, lastLine);
+            else
+                m_searchedEmulation->copyLineCells(firstLine, lastLine, m_lines.cells, m_lines.lineEnds, m_lines.lineProperties);
         }
 
-        // So now we can log for m_regExp in the string between startColumn and endPosition
-        int matchStart;
-	QRegularExpressionMatch match;
-        if (m_forwards)
-        {
-            matchStart = string.indexOf(m_regExp, startColumn, &match);
-            if (matchStart >= endPosition)
-                matchStart = -1;
-        }
-        else
+        // the columns only apply to the lines they were given for
+        const int searchStart = (blockStartLine == startLine && firstLine == startLine - shift) ? startColumn : 0;
+        const bool stopAtEndColumn = endColumn > -1 && blockEndLine == endLine && lastLine == endLine - shift;
+
+        const bool found = m_literalMatcher.isEmpty()
+                           ? findInText(forwards, string, decoder.linePositions(), searchStart, stopAtEndColumn ? endColumn : -1)
+                           : findInCells(forwards, searchStart, stopAtEndColumn ? endColumn : -1);
+        if (found)
         {
-            matchStart = string.lastIndexOf(m_regExp, endPosition - 1, &match);
-            if (matchStart < startColumn)
-                matchStart = -1;
+            m_foundStartLine += firstLine;
+            m_foundEndLine += firstLine;
+            m_foundDroppedLines = droppedLines;
+            return true;
         }
+    }
 
-        if (matchStart > -1)
-        {
-            int matchEnd = matchStart + match.capturedLength() - 1;
-            qDebug() << "Found in string from" << matchStart << "to" << matchEnd;
+    return false;
+}
+
+bool HistorySearch::findInText(bool forwards, const QString& string, const QList<int>& linePositions,
+                               int searchStart, int endColumn) {
+    // We search between searchStart in the first line of the string and endColumn in the last
+    // line of the string. First we calculate the position (in the string) of endColumn in the
+    // last line of the string
+    int endPosition;
+
+    // The String that Emulator.writeToStream produces has a newline at the end, and so ends with an
+    // empty line - we ignore that.
+    int numberOfLinesInString = linePositions.size() - 1;
+    if (numberOfLinesInString > 0 && endColumn > -1)
+    {
+        endPosition = linePositions.at(numberOfLinesInString - 1) + endColumn;
+    }
+    else
+    {
+        endPosition = string.size();
+    }
 
-            // Translate startPos and endPos to startColum, startLine, endColumn and endLine in history.
-            int startLineNumberInString = findLineNumberInString(decoder.linePositions(), matchStart);
-            m_foundStartColumn = matchStart - decoder.linePositions().at(startLineNumberInString);
-            m_foundStartLine = startLineNumberInString + startLine + linesRead;
+    // So now we can log for m_regExp in the string between searchStart and endPosition
+    QRegularExpressionMatch match;
+    int matchStart = forwards ? string.indexOf(m_regExp, searchStart, &match)
+                              : string.lastIndexOf(m_regExp, endPosition - 1, &match);
+    if (matchStart < searchStart || matchStart >= endPosition)
+        return false;
 
-            int endLineNumberInString = findLineNumberInString(decoder.linePositions(), matchEnd);
-            m_foundEndColumn = matchEnd - decoder.linePositions().at(endLineNumberInString);
-            m_foundEndLine = endLineNumberInString + startLine + linesRead;
+    int matchEnd = matchStart + match.capturedLength() - 1;
 
-            qDebug() << "m_foundStartColumn" << m_foundStartColumn
-                    << "m_foundStartLine" << m_foundEndLine
-                    << "m_foundEndColumn" << m_foundEndColumn
-                    << "m_foundEndLine" << m_foundEndLine;
+    // Translate startPos and endPos to startColum, startLine, endColumn and endLine in the string.
+    int startLineNumberInString = findLineNumberInString(linePositions, matchStart);
+    m_foundStartColumn = matchStart - linePositions.at(startLineNumberInString);
+    m_foundStartLine = startLineNumberInString;
 
-            return true;
-        }
+    int endLineNumberInString = findLineNumberInString(linePositions, matchEnd);
+    m_foundEndColumn = matchEnd - linePositions.at(endLineNumberInString);
+    m_foundEndLine = endLineNumberInString;
 
+    return true;
+}
 
-        linesRead += blockSize;
-    }
+bool HistorySearch::findInCells(bool forwards, int searchStart, int endColumn) {
+    const int lineCount = m_lines.lineCount();
+    if (lineCount == 0)
+        return false;
 
-    qDebug() << "Not found";
-    return false;
+    // a column past the end of a line stands for the end of the line
+    const int from = qMin(searchStart, m_lines.lineEnds.at(0));
+    const int to = endColumn > -1 ? qMin(m_lines.lineStart(lineCount - 1) + endColumn, m_lines.lineEnds.at(lineCount - 1))
+                                  : m_lines.lineEnds.at(lineCount - 1);
+
+    int matchEnd = 0;
+    const int matchStart = forwards ? m_literalMatcher.indexIn(m_lines, from, to, &matchEnd)
+                                    : m_literalMatcher.lastIndexIn(m_lines, from, to, &matchEnd);
+    if (matchStart < 0)
+        return false;
+
+    m_foundStartLine = m_lines.lineAt(matchStart);
+    m_foundStartColumn = matchStart - m_lines.lineStart(m_foundStartLine);
+    m_foundEndLine = m_lines.lineAt(matchEnd);
+    m_foundEndColumn = matchEnd - m_lines.lineStart(m_foundEndLine);
+
+    return true;
 }
 
+void HistorySearch::reportProgress(int lines) {
+    m_linesSearched = qMin(m_linesSearched + lines, m_linesTotal);
+    if (m_progressTimer.elapsed() < PROGRESS_INTERVAL)
+        return;
+    m_progressTimer.restart();
+
+    // emitted in the thread of the search object, unless it has been cancelled by then
+    const int searched = m_linesSearched;
+    const int total = m_linesTotal;
+    QMetaObject::invokeMethod(this, [this, searched, total]() {
+        if (!m_cancelled)
+            emit progress(searched, total);
+    }, Qt::QueuedConnection);
+}
 
-int HistorySearch::findLineNumberInString(QList<int> linePositions, int position) {
-    int lineNum = 0;
-    while (lineNum + 1 < linePositions.size() && linePositions[lineNum + 1] <= position)
-        lineNum++;
 
-    return lineNum;
+int HistorySearch::findLineNumberInString(const QList<int>& linePositions, int position) {
+    // the positions are sorted, the line is the last one starting at or before position
+    const auto it = std::upper_bound(linePositions.cbegin(), linePositions.cend(), position);
+    return qMax(0, static_cast<int>(it - linePositions.cbegin()) - 1);
 }
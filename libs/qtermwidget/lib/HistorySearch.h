@@ -19,52 +19,122 @@
 #ifndef TASK_H
 #define	TASK_H
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QPointer>
 #include <QMap>
 #include <QRegularExpression>
 
+#include <atomic>
+
 #include <Session.h>
 #include <ScreenWindow.h>
 
 #include "Emulation.h"
+#include "HistoryTrigramIndex.h"
+#include "LiteralMatcher.h"
 #include "TerminalCharacterDecoder.h"
 
+class QThread;
+
 using namespace Konsole;
 
 typedef QPointer<Emulation> EmulationPtr;
 
+/**
+ * Searches the output of an emulation for a regular expression.
+ *
+ * The search runs in a thread of its own.  It reads the history in small
+ * blocks, holding the screen lock of the emulation only while a block is
+ * copied, so the terminal stays responsive while a long history is searched.
+ * The signals are emitted in the thread the search was created in.
+ */
 class HistorySearch : public QObject
 {
     Q_OBJECT
 
 public:
+    /**
+     * Prepares a search for @p regExp starting at @p startColumn, @p startLine.
+     *
+     * The search goes towards the end of the output if @p forwards is true and
+     * wraps around at the end.  If @p nearest is true, the part before the
+     * start is searched backwards from the start instead, so the match closest
+     * to the start is found first.  Use this for searches which follow the view.
+     */
     explicit HistorySearch(EmulationPtr emulation, const QRegularExpression& regExp, bool forwards,
-                           int startColumn, int startLine, QObject* parent);
+                           int startColumn, int startLine, QObject* parent, bool nearest = false);
 
+    /** Cancels the search and waits for its thread to finish. */
     ~HistorySearch() override;
 
+    /** Starts the search.  The search deletes itself when it is done. */
     void search();
 
+    /**
+     * Stops the search.  No signals are emitted after this returns, the search
+     * deletes itself once its thread has noticed.
+     */
+    void cancel();
+
+    /**
+     * Looks for @p text as it is rather than for the expression, which avoids
+     * the regular expression engine and decoding the output.  The expression
+     * must match the same text, its case sensitivity applies.  The columns of
+     * the match are then those of the cells, see LiteralMatcher.  Call this
+     * before search().
+     */
+    void setLiteralText(const QString& text);
+
 signals:
     void matchFound(int startColumn, int startLine, int endColumn, int endLine);
     void noMatchFound();
+    /** Reports that @p linesSearched of @p linesTotal lines have been searched. */
+    void progress(int linesSearched, int linesTotal);
+    /** Emitted when the search ends, whether or not a match was found. */
+    void finished();
 
 private:
-    bool search(int startColumn, int startLine, int endColumn, int endLine);
-    int findLineNumberInString(QList<int> linePositions, int position);
-
+    void run();
+    bool search(bool forwards, int startColumn, int startLine, int endColumn, int endLine);
+    // look for a match in the block which has been read, from searchStart in its first
+    // line up to endColumn in its last one, or its end if endColumn is -1
+    bool findInText(bool forwards, const QString& string, const QList<int>& linePositions,
+                    int searchStart, int endColumn);
+    bool findInCells(bool forwards, int searchStart, int endColumn);
+    int findLineNumberInString(const QList<int>& linePositions, int position);
+    void reportProgress(int lines);
+    void done();
+
+    // lines read while the screen lock is held
+    static const int BLOCK_LINES = 1000;
+    // least time between two progress() signals, in ms
+    static const int PROGRESS_INTERVAL = 100;
 
     EmulationPtr m_emulation;
+    Emulation* m_searchedEmulation = nullptr; // used by the search thread
     QRegularExpression m_regExp;
+    LiteralMatcher m_literalMatcher{QString(), Qt::CaseSensitive}; // used instead of m_regExp, if not empty
+    LiteralMatcher::Lines m_lines;      // the block which is searched for the literal text
+    HistoryTrigramIndex::Query m_query; // lets blocks which cannot match be skipped
     bool m_forwards = false;
+    bool m_nearest = false;
     int m_startColumn = 0;
     int m_startLine = 0;
 
+    QThread* m_thread = nullptr;
+    std::atomic<bool> m_cancelled{false};
+    bool m_found = false;
+    qint64 m_startDroppedLines = 0; // Emulation::droppedLineCount() when the search started
+    int m_linesTotal = 0;
+    int m_linesSearched = 0;
+    QElapsedTimer m_progressTimer;
+
     int m_foundStartColumn = 0;
     int m_foundStartLine = 0;
     int m_foundEndColumn = 0;
     int m_foundEndLine = 0;
+    qint64 m_foundDroppedLines = 0; // Emulation::droppedLineCount() when the match was read
 };
 
 #endif	/* TASK_H */
@@ -0,0 +1,357 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryTrigramIndex.h"
+
+// Standard
+#include <algorithm>
+#include <string>
+
+// Konsole
+#include "History.h"
+#include "konsole_wcwidth.h"
+
+using namespace Konsole;
+
+namespace
+{
+
+// more trigrams hardly narrow the search any further
+const int MAX_QUERY_TRIGRAMS = 32;
+
+bool isBitSet(const QVector<quint64>& filter, int bit)
+{
+    return (filter.at(bit >> 6) >> (bit & 63)) & 1;
+}
+
+}
+
+HistoryTrigramIndex::Query HistoryTrigramIndex::query(const QRegularExpression& regExp)
+{
+    const QString pattern = regExp.pattern();
+    // options and quoting change the meaning of what follows them
+    if ((regExp.patternOptions() & QRegularExpression::ExtendedPatternSyntax)
+        || pattern.contains(QLatin1String("\\Q"))
+        || pattern.contains(QRegularExpression(QStringLiteral("\\(\\?[^:]"))))
+        return Query();
+
+    const QList<uint> chars = pattern.toUcs4();
+    QList<QVector<uint>> literals;
+    QVector<uint> run;
+    auto endRun = [&literals, &run]() {
+        if (run.size() >= 3)
+            literals << run;
+        run.clear();
+    };
+
+    int depth = 0;
+    for (int i = 0; i < chars.size(); i++)
+    {
+        const uint c = chars.at(i);
+        if (c == '\\')
+        {
+            if (++i == chars.size())
+                break;
+            // escaped letters and digits are classes, references, assertions or
+            // characters given by their code.  Only the classes and assertions
+            // which take no arguments are understood, as the arguments of the
+            // others must not be taken for literal characters
+            const uint escaped = chars.at(i);
+            if (escaped < 0x80 && QChar(escaped).isLetterOrNumber())
+            {
+                if (!QLatin1String("dDwWsSbB").contains(QLatin1Char(char(escaped))))
+                    return Query();
+                if (depth == 0)
+                    endRun();
+            }
+            else if (depth == 0)
+            {
+                run << escaped;
+            }
+        }
+        else if (c == '[')
+        {
+            // skip the class, a ']' right at its start belongs to it
+            i++;
+            if (i < chars.size() && chars.at(i) == '^')
+                i++;
+            if (i < chars.size() && chars.at(i) == ']')
+                i++;
+            while (i < chars.size() && chars.at(i) != ']')
+            {
+                if (chars.at(i) == '\\')
+                    i++;
+                else if (chars.at(i) == '[' && i + 1 < chars.size() && chars.at(i + 1) == ':')
+                {
+                    i += 2;
+                    while (i + 1 < chars.size() && !(chars.at(i) == ':' && chars.at(i + 1) == ']'))
+                        i++;
+                    i++;
+                }
+                i++;
+            }
+            if (depth == 0)
+                endRun();
+        }
+        else if (c == '(')
+        {
+            if (depth++ == 0)
+                endRun();
+        }
+        else if (c == ')')
+        {
+            if (depth > 0)
+                depth--;
+        }
+        else if (depth > 0)
+        {
+            continue;
+        }
+        else if (c == '|')
+        {
+            return Query();
+        }
+        else if (c == '*' || c == '?' || c == '{')
+        {
+            // the character before may not be there at all
+            if (!run.isEmpty())
+                run.removeLast();
+            endRun();
+            if (c == '{')
+            {
+                while (i < chars.size() && chars.at(i) != '}')
+                    i++;
+            }
+        }
+        else if (c == '+' || c == '.' || c == '^' || c == '$')
+        {
+            endRun();
+        }
+        else
+        {
+            run << c;
+        }
+    }
+    endRun();
+
+    // the trigrams of each piece of text which takes up space without a
+    // break, which is on one line of the output wherever it is matched
+    QList<QVector<quint32>> pieces;
+    int trigrams = 0;
+    for (QVector<uint>& literal : literals)
+    {
+        // a trigram is only formed of characters which take up space in the terminal
+        int start = 0;
+        for (int i = 0; i <= literal.size(); i++)
+        {
+            if (i < literal.size() && konsole_wcwidth(literal.at(i)) > 0)
+            {
+                literal[i] = QChar::toCaseFolded(char32_t(literal.at(i)));
+                continue;
+            }
+            QVector<quint32> piece;
+            for (int j = start; j + 2 < i && trigrams < MAX_QUERY_TRIGRAMS; j++, trigrams++)
+                piece << hash(literal.at(j), literal.at(j + 1), literal.at(j + 2));
+            if (!piece.isEmpty())
+                pieces << piece;
+            start = i + 1;
+        }
+    }
+
+    // each piece is stored as the number of its trigrams followed by them
+    Query query;
+    for (QVector<quint32>& piece : pieces)
+    {
+        std::sort(piece.begin(), piece.end());
+        piece.erase(std::unique(piece.begin(), piece.end()), piece.end());
+        query << quint32(piece.size()) << piece;
+    }
+    return query;
+}
+
+HistoryTrigramIndex::HistoryTrigramIndex()
+{
+    clear();
+}
+
+int HistoryTrigramIndex::lineCount() const
+{
+    return m_lineCount;
+}
+
+void HistoryTrigramIndex::update(const HistoryScroll* scroll, int addedLines)
+{
+    const int lines = scroll->getLines();
+    // lines which were added and dropped again in the meantime are never indexed
+    for (int line = qMax(0, lines - addedLines); line < lines; line++)
+    {
+        const int length = scroll->getLineLen(line);
+        m_buffer.resize(length);
+        if (length > 0)
+            scroll->getCells(line, 0, length, m_buffer.data());
+        addLine(m_buffer.constData(), length, scroll->isWrappedLine(line));
+    }
+    dropLines(m_lineCount - lines);
+}
+
+void HistoryTrigramIndex::rebuild(const HistoryScroll* scroll)
+{
+    clear();
+    update(scroll, scroll->getLines());
+}
+
+void HistoryTrigramIndex::clear()
+{
+    m_blocks.clear();
+    m_firstLineOffset = 0;
+    m_lineCount = 0;
+    m_windowLength = 0;
+    m_continued = false;
+    m_buffer.clear();
+}
+
+bool HistoryTrigramIndex::mayContain(const Query& query, int firstLine, int lastLine) const
+{
+    if (query.isEmpty() || firstLine < 0 || lastLine >= m_lineCount || firstLine > lastLine)
+        return true;
+
+    const int firstBlock = (firstLine + m_firstLineOffset) / BLOCK_LINES;
+    const int lastBlock = (lastLine + m_firstLineOffset) / BLOCK_LINES;
+    auto blockContains = [this](int block, quint32 trigram) {
+        const QVector<quint64>& filter = m_blocks.at(block).filter;
+        return isBitSet(filter, trigram & FILTER_MASK) && isBitSet(filter, (trigram >> 16) & FILTER_MASK);
+    };
+
+    // the trigrams of a piece must all be in one block, or in blocks which a
+    // wrapped line continues through.  Different pieces may be on different
+    // lines, as the expression may match more than one line
+    for (int piece = 0; piece < query.size(); piece += query.at(piece) + 1)
+    {
+        const quint32* trigrams = query.constData() + piece + 1;
+        const int count = int(query.at(piece));
+        bool found = false;
+        for (int block = firstBlock; block <= lastBlock && !found; block++)
+        {
+            int runEnd = block;
+            while (runEnd < lastBlock && m_blocks.at(runEnd + 1).continued)
+                runEnd++;
+
+            found = true;
+            for (int i = 0; i < count && found; i++)
+            {
+                found = false;
+                for (int b = block; b <= runEnd && !found; b++)
+                    found = blockContains(b, trigrams[i]);
+            }
+            block = runEnd;
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+qint64 HistoryTrigramIndex::memoryUsage() const
+{
+    return qint64(sizeof(*this)) + qint64(m_blocks.size()) * (sizeof(Block) + FILTER_WORDS * sizeof(quint64))
+           + qint64(m_buffer.capacity()) * sizeof(Character);
+}
+
+void HistoryTrigramIndex::addLine(const Character* cells, int count, bool wrapped)
+{
+    if (m_firstLineOffset + m_lineCount >= m_blocks.size() * BLOCK_LINES)
+        m_blocks << Block{ QVector<quint64>(FILTER_WORDS, 0), m_continued };
+    if (!m_continued)
+        m_windowLength = 0;
+
+    // the same characters PlainTextDecoder writes out
+    for (int i = 0; i < count;)
+    {
+        const Character& cell = cells[i];
+        if (cell.rendition & RE_EXTENDED_CHAR)
+        {
+            ExtendedCharTable::Sequence chars;
+            if (ExtendedCharTable::instance.lookupExtendedChar(cell.character, chars))
+            {
+                addCharacter(chars[0]);
+                i += qMax(1, string_width(std::wstring(chars.constBegin(), chars.constEnd())));
+            }
+            else
+            {
+                i++;
+            }
+        }
+        else
+        {
+            addCharacter(cell.character);
+            i += qMax(1, konsole_wcwidth(cell.character));
+        }
+    }
+
+    m_continued = wrapped;
+    m_lineCount++;
+}
+
+void HistoryTrigramIndex::dropLines(int count)
+{
+    count = qMin(count, m_lineCount);
+    if (count <= 0)
+        return;
+
+    m_lineCount -= count;
+    if (m_lineCount == 0)
+    {
+        clear();
+        return;
+    }
+
+    m_firstLineOffset += count;
+    const int blocks = m_firstLineOffset / BLOCK_LINES;
+    m_blocks.remove(0, blocks);
+    m_firstLineOffset -= blocks * BLOCK_LINES;
+}
+
+void HistoryTrigramIndex::addCharacter(uint c)
+{
+    c = QChar::toCaseFolded(char32_t(c));
+    if (m_windowLength < 2)
+    {
+        m_window[m_windowLength++] = c;
+        return;
+    }
+
+    const quint32 trigram = hash(m_window[0], m_window[1], c);
+    QVector<quint64>& filter = m_blocks.last().filter;
+    const int firstBit = trigram & FILTER_MASK;
+    const int secondBit = (trigram >> 16) & FILTER_MASK;
+    filter[firstBit >> 6] |= quint64(1) << (firstBit & 63);
+    filter[secondBit >> 6] |= quint64(1) << (secondBit & 63);
+
+    m_window[0] = m_window[1];
+    m_window[1] = c;
+}
+
+quint32 HistoryTrigramIndex::hash(uint first, uint second, uint third)
+{
+    quint32 h = first * 0x9e3779b1u;
+    h = (h ^ (h >> 15) ^ second) * 0x85ebca77u;
+    h = (h ^ (h >> 13) ^ third) * 0xc2b2ae3du;
+    return h ^ (h >> 16);
+}
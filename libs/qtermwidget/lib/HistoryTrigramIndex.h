@@ -0,0 +1,133 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef HISTORYTRIGRAMINDEX_H
+#define HISTORYTRIGRAMINDEX_H
+
+// Qt
+#include <QList>
+#include <QRegularExpression>
+#include <QVector>
+
+// Konsole
+#include "Character.h"
+
+namespace Konsole
+{
+
+class HistoryScroll;
+
+/**
+ * Records which sequences of three characters (trigrams) occur in the lines
+ * of a history, so that a search can skip the lines which cannot match.
+ *
+ * The lines are grouped in blocks.  Each block keeps a Bloom filter of the
+ * trigrams of its lines: the filter may claim that a block contains a
+ * trigram which it does not contain, but never the reverse.  Blocks are
+ * added as the history grows and removed once all their lines have been
+ * dropped from it, so the index never has to be rebuilt while output
+ * arrives.
+ *
+ * Characters are indexed case folded and as PlainTextDecoder produces
+ * them, with wrapped lines joined.  Of an extended character only the
+ * first code point is indexed.
+ */
+class HistoryTrigramIndex
+{
+public:
+    /**
+     * The trigrams which any match of an expression must contain, as
+     * returned by query(), grouped by the pieces of text they were taken
+     * from.  An empty query matches every line.
+     */
+    typedef QVector<quint32> Query;
+
+    /**
+     * Returns the trigrams of the text which every match of @p regExp
+     * must contain.  Only the literal parts of the pattern outside of
+     * groups and character classes are used, and none at all if the
+     * pattern has alternatives at the top level or escapes which take
+     * arguments, such as \x41 or \g1.
+     */
+    static Query query(const QRegularExpression& regExp);
+
+    HistoryTrigramIndex();
+
+    /** Returns the number of lines which are indexed. */
+    int lineCount() const;
+
+    /**
+     * Updates the index after @p addedLines lines were added to the end
+     * of @p scroll, indexing them and forgetting the lines which
+     * @p scroll has dropped from its start.
+     */
+    void update(const HistoryScroll* scroll, int addedLines);
+
+    /** Indexes all lines of @p scroll again. */
+    void rebuild(const HistoryScroll* scroll);
+
+    /** Removes all lines from the index. */
+    void clear();
+
+    /**
+     * Returns false if none of the lines from @p firstLine to @p lastLine
+     * can contain all trigrams of @p query.  The trigrams of each piece of
+     * text in the expression must be found in the same block of lines.
+     * Returns true if they may, or if the lines are not all indexed.
+     */
+    bool mayContain(const Query& query, int firstLine, int lastLine) const;
+
+    /** Returns the number of bytes used by the index. */
+    qint64 memoryUsage() const;
+
+private:
+    void addLine(const Character* cells, int count, bool wrapped);
+    void dropLines(int count);
+    void addCharacter(uint c);
+
+    static quint32 hash(uint first, uint second, uint third);
+
+    // lines per block
+    static const int BLOCK_LINES = 128;
+    // size of the filter of a block, 16384 bits
+    static const int FILTER_WORDS = 256;
+    static const int FILTER_MASK = FILTER_WORDS * 64 - 1;
+
+    struct Block
+    {
+        QVector<quint64> filter;
+        bool continued;     // the first line continues the last one of the block before
+    };
+
+    QList<Block> m_blocks;
+    int m_firstLineOffset;  // lines of the first block which have been dropped
+    int m_lineCount;
+
+    // the last characters added, the trigrams continue into the next line
+    // if the line was wrapped
+    uint m_window[2];
+    int m_windowLength;
+    bool m_continued;
+
+    QVector<Character> m_buffer; // line read from the history
+};
+
+}
+
+#endif // HISTORYTRIGRAMINDEX_H
@@ -0,0 +1,119 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "LineChangeTracker.h"
+
+// Standard
+#include <algorithm>
+
+using namespace Konsole;
+
+namespace
+{
+
+bool isWrapped(const QVector<LineProperty>& properties, int line)
+{
+    return (properties.value(line, LINE_DEFAULT) & LINE_WRAPPED) != 0;
+}
+
+bool startsText(const QVector<LineProperty>& properties, int line)
+{
+    return line == 0 || !isWrapped(properties, line - 1);
+}
+
+bool endsText(const QVector<LineProperty>& properties, int line, int lineCount)
+{
+    return line == lineCount - 1 || !isWrapped(properties, line);
+}
+
+}
+
+LineChangeTracker::LineChangeTracker()
+{
+    clear();
+}
+
+QVector<bool> LineChangeTracker::update(const Character* image, int lines, int columns,
+                                        const QVector<LineProperty>& lineProperties, qint64 firstLine)
+{
+    // find the lines which are the same as in the last image, after scrolling
+    _allChanged = (lines != _lines || columns != _columns);
+    _scrolled = _allChanged ? 0 : static_cast<int>(firstLine - _firstLine);
+
+    QVector<bool> changed(lines, true);
+    for (int i = 0; i < lines && !_allChanged; i++)
+    {
+        const int oldLine = i + _scrolled;
+        if (oldLine < 0 || oldLine >= _lines)
+            continue;
+        if (startsText(lineProperties, i) != startsText(_lineProperties, oldLine)
+            || endsText(lineProperties, i, lines) != endsText(_lineProperties, oldLine, _lines))
+            continue;
+
+        const Character* line = image + i * columns;
+        changed[i] = !std::equal(line, line + columns, _image.constData() + oldLine * columns);
+    }
+
+    // a wrapped text has changed as a whole if any of its lines has changed
+    for (int start = 0; start < lines;)
+    {
+        int end = start;
+        while (!endsText(lineProperties, end, lines))
+            end++;
+        if (std::find(changed.cbegin() + start, changed.cbegin() + end + 1, true) != changed.cbegin() + end + 1)
+            std::fill(changed.begin() + start, changed.begin() + end + 1, true);
+        start = end + 1;
+    }
+
+    _image.resize(lines * columns);
+    std::copy(image, image + lines * columns, _image.begin());
+    _lineProperties = lineProperties;
+    _lines = lines;
+    _columns = columns;
+    _firstLine = firstLine;
+
+    return changed;
+}
+
+bool LineChangeTracker::allChanged() const
+{
+    return _allChanged;
+}
+
+int LineChangeTracker::scrolled() const
+{
+    return _scrolled;
+}
+
+void LineChangeTracker::markExtendedChars() const
+{
+    ExtendedCharTable::instance.markExtendedChars(_image.constData(), _image.size());
+}
+
+void LineChangeTracker::clear()
+{
+    _image.clear();
+    _lineProperties.clear();
+    _lines = -1;
+    _columns = 0;
+    _firstLine = 0;
+    _allChanged = true;
+    _scrolled = 0;
+}
@@ -0,0 +1,95 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef LINECHANGETRACKER_H
+#define LINECHANGETRACKER_H
+
+// Qt
+#include <QVector>
+
+// Konsole
+#include "Character.h"
+
+namespace Konsole
+{
+
+/**
+ * Finds the lines of a terminal image which have changed since the image
+ * before, so that whatever is found in the text of the image only needs to
+ * be looked for again in those lines.
+ *
+ * The image may have been scrolled in the meantime: a line is compared with
+ * the line of the image before which had the same number in the output.
+ * Lines which are wrapped are taken together with the lines they continue
+ * on, if one of them has changed, all of them have.  The first and the last
+ * line of the image cut them off.
+ */
+class LineChangeTracker
+{
+public:
+    LineChangeTracker();
+
+    /**
+     * Compares @p image with the image given last and returns for each of its
+     * lines whether it has changed.  The new image is kept for the next call.
+     *
+     * @param image The terminal image
+     * @param lines The number of lines in the terminal image
+     * @param columns The number of columns in the terminal image
+     * @param lineProperties The line properties of the lines of the image
+     * @param firstLine The number of the first line of the image in the output,
+     * counted so that a line keeps its number while it is scrolled.
+     */
+    QVector<bool> update(const Character* image, int lines, int columns,
+                         const QVector<LineProperty>& lineProperties, qint64 firstLine);
+
+    /**
+     * Returns true if no line could be compared in the last update(), because
+     * there was no image before or it was of another size.
+     */
+    bool allChanged() const;
+    /**
+     * Returns the number of lines the image was scrolled up by in the last
+     * update(), which is 0 if allChanged() is true.
+     */
+    int scrolled() const;
+
+    /** Forgets the image, all lines of the next one count as changed. */
+    void clear();
+
+    /**
+     * Marks the extended characters and true colors of the image kept as
+     * used, so that their ids are not reused while it is compared with, see
+     * ExtendedCharTable
+     */
+    void markExtendedChars() const;
+
+private:
+    QVector<Character> _image;
+    QVector<LineProperty> _lineProperties;
+    int _lines;
+    int _columns;
+    qint64 _firstLine;
+    bool _allChanged;
+    int _scrolled;
+};
+
+}
+
+#endif // LINECHANGETRACKER_H
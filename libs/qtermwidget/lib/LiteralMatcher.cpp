@@ -0,0 +1,274 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "LiteralMatcher.h"
+
+// Qt
+#include <QtAlgorithms>
+
+// Standard
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Konsole
+#include "konsole_wcwidth.h"
+
+using namespace Konsole;
+
+#ifdef __SSE2__
+namespace
+{
+
+// The first 32 bits of a cell hold its character and its rendition.  The
+// masks of the two are taken from cells rather than spelled out, so that
+// they do not depend on how the compiler lays out the bit fields
+struct CellMasks
+{
+    quint32 character;
+    quint32 extended;
+};
+
+quint32 firstWord(const Character& cell)
+{
+    quint32 word;
+    memcpy(&word, &cell, sizeof(word));
+    return word;
+}
+
+const CellMasks& cellMasks()
+{
+    static const CellMasks masks = {
+        firstWord(Character(CHARACTER_VALUE_MASK, PackedColor(), PackedColor(), 0)),
+        firstWord(Character(0, PackedColor(), PackedColor(), RE_EXTENDED_CHAR))
+    };
+    return masks;
+}
+
+// Finds the cells among four in a row which may start a match.  The
+// character word of a cell is the first of its two 32 bit lanes, and the
+// bytes of the lanes which match are set in the returned mask, eight bits
+// to a cell
+class CandidateScan
+{
+public:
+    CandidateScan(uint first, uint firstOther, bool nonAscii)
+        : m_characterMask(_mm_set1_epi32(int(cellMasks().character)))
+        , m_extendedMask(_mm_set1_epi32(int(cellMasks().extended)))
+        , m_first(_mm_set1_epi32(int(first)))
+        , m_firstOther(_mm_set1_epi32(int(firstOther)))
+        , m_lastChar(_mm_set1_epi32(nonAscii ? 0x7F : CHARACTER_VALUE_MASK))
+    {}
+
+    quint32 operator()(const Character* cells) const
+    {
+        quint32 mask = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + 2 * half));
+            const __m128i chars = _mm_and_si128(words, m_characterMask);
+            __m128i found = _mm_or_si128(_mm_cmpeq_epi32(chars, m_first), _mm_cmpeq_epi32(chars, m_firstOther));
+            found = _mm_or_si128(found, _mm_cmpgt_epi32(chars, m_lastChar));
+            found = _mm_or_si128(found, _mm_cmpeq_epi32(_mm_and_si128(words, m_extendedMask), m_extendedMask));
+            mask |= quint32(_mm_movemask_epi8(found) & 0x0F0F) << (16 * half);
+        }
+        return mask;
+    }
+
+private:
+    const __m128i m_characterMask;
+    const __m128i m_extendedMask;
+    const __m128i m_first;
+    const __m128i m_firstOther;
+    const __m128i m_lastChar;
+};
+
+}
+#endif
+
+void LiteralMatcher::Lines::clear()
+{
+    cells.clear();
+    lineEnds.clear();
+    lineProperties.clear();
+}
+
+int LiteralMatcher::Lines::lineAt(int position) const
+{
+    return int(std::upper_bound(lineEnds.cbegin(), lineEnds.cend(), position) - lineEnds.cbegin());
+}
+
+LiteralMatcher::LiteralMatcher(const QString& text, Qt::CaseSensitivity cs)
+    : m_caseSensitivity(cs)
+{
+    const QList<uint> chars = text.toUcs4();
+    m_text.reserve(chars.size());
+    for (const uint c : chars)
+        m_text << fold(c);
+
+    if (!m_text.isEmpty())
+    {
+        m_first = m_text.first();
+        m_firstOther = m_first;
+        if (cs == Qt::CaseInsensitive)
+        {
+            if (m_first >= 'a' && m_first <= 'z')
+                m_firstOther = m_first - ('a' - 'A');
+            m_nonAsciiCandidates = true;
+        }
+    }
+}
+
+int LiteralMatcher::nextCandidate(const Character* cells, int from, int to) const
+{
+    int i = from;
+#ifdef __SSE2__
+    const CandidateScan candidates(m_first, m_firstOther, m_nonAsciiCandidates);
+    for (; i + 4 <= to; i += 4)
+    {
+        // the scan finds more cells than fold() would, so they are checked once more
+        quint32 mask = candidates(cells + i);
+        while (mask)
+        {
+            const int cell = i + int(qCountTrailingZeroBits(mask)) / 8;
+            if (isCandidate(cells[cell]))
+                return cell;
+            mask &= ~(0xFFu << (8 * (cell - i)));
+        }
+    }
+#endif
+    for (; i < to; i++)
+    {
+        if (isCandidate(cells[i]))
+            return i;
+    }
+    return to;
+}
+
+int LiteralMatcher::previousCandidate(const Character* cells, int from, int to) const
+{
+    int i = to;
+#ifdef __SSE2__
+    const CandidateScan candidates(m_first, m_firstOther, m_nonAsciiCandidates);
+    for (; i - 4 >= from; i -= 4)
+    {
+        quint32 mask = candidates(cells + i - 4);
+        while (mask)
+        {
+            const int cell = i - 4 + (31 - int(qCountLeadingZeroBits(mask))) / 8;
+            if (isCandidate(cells[cell]))
+                return cell;
+            mask &= ~(0xFFu << (8 * (cell - (i - 4))));
+        }
+    }
+#endif
+    for (i--; i >= from; i--)
+    {
+        if (isCandidate(cells[i]))
+            return i;
+    }
+    return from - 1;
+}
+
+int LiteralMatcher::indexIn(const Lines& lines, int from, int to, int* end) const
+{
+    if (m_text.isEmpty())
+        return -1;
+
+    // most cells are told apart by their first character alone
+    const Character* cells = lines.cells.constData();
+    to = qMin(to, int(lines.cells.size()));
+    for (int i = nextCandidate(cells, qMax(0, from), to); i < to; i = nextCandidate(cells, i + 1, to))
+    {
+        if (matchesAt(lines, i, end))
+            return i;
+    }
+    return -1;
+}
+
+int LiteralMatcher::lastIndexIn(const Lines& lines, int from, int to, int* end) const
+{
+    if (m_text.isEmpty())
+        return -1;
+
+    const Character* cells = lines.cells.constData();
+    from = qMax(0, from);
+    for (int i = previousCandidate(cells, from, qMin(to, int(lines.cells.size()))); i >= from;
+         i = previousCandidate(cells, from, i))
+    {
+        if (matchesAt(lines, i, end))
+            return i;
+    }
+    return -1;
+}
+
+bool LiteralMatcher::matchesAt(const Lines& lines, int position, int* end) const
+{
+    int line = lines.lineAt(position);
+    int lineEnd = lines.lineEnds.at(line);
+    int i = position;
+    int k = 0;
+    while (k < m_text.size())
+    {
+        // the match goes on into the next line only if the line is wrapped
+        while (i >= lineEnd)
+        {
+            if (!(lines.lineProperties.at(line) & LINE_WRAPPED) || line + 1 == lines.lineCount())
+                return false;
+            i = lineEnd;
+            lineEnd = lines.lineEnds.at(++line);
+        }
+
+        // the same characters PlainTextDecoder writes out
+        const Character& cell = lines.cells.at(i);
+        if (cell.rendition & RE_EXTENDED_CHAR)
+        {
+            ExtendedCharTable::Sequence chars;
+            if (!ExtendedCharTable::instance.lookupExtendedChar(cell.character, chars))
+            {
+                // nothing is written for the cell, so no match starts in it
+                if (i == position)
+                    return false;
+                i++;
+                continue;
+            }
+            for (int c = 0; c < chars.size() && k < m_text.size(); c++, k++)
+            {
+                if (fold(chars.at(c)) != m_text.at(k))
+                    return false;
+            }
+            *end = i;
+            i += qMax(1, string_width(std::wstring(chars.constBegin(), chars.constEnd())));
+        }
+        else
+        {
+            if (fold(cell.character) != m_text.at(k))
+                return false;
+            k++;
+            *end = i;
+            i += qMax(1, konsole_wcwidth(cell.character));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef LITERALMATCHER_H
+#define LITERALMATCHER_H
+
+// Qt
+#include <QString>
+#include <QVector>
+
+// Konsole
+#include "Character.h"
+
+namespace Konsole
+{
+
+/**
+ * Looks for a piece of text in lines of terminal characters, without
+ * decoding them into a string first.
+ *
+ * The cells are compared the way PlainTextDecoder writes them out, so the
+ * text is found where it would be found in the decoded lines: the cells
+ * which follow wide characters are skipped, and a match may go on into
+ * the next line only if the line is wrapped.  Positions are those of the
+ * cells rather than of the characters in the decoded text.
+ */
+class LiteralMatcher
+{
+public:
+    /** Lines of cells, as Emulation::copyLineCells() copies them. */
+    struct Lines
+    {
+        QVector<Character> cells;
+        QVector<int> lineEnds;          // the end of each line in cells
+        QVector<LineProperty> lineProperties;
+
+        void clear();
+        int lineCount() const { return lineEnds.size(); }
+        /** Returns the position of the first cell of @p line */
+        int lineStart(int line) const { return line > 0 ? lineEnds.at(line - 1) : 0; }
+        /** Returns the line the cell at @p position belongs to */
+        int lineAt(int position) const;
+    };
+
+    /**
+     * Constructs a matcher for @p text.  If @p cs is Qt::CaseInsensitive,
+     * characters are compared after case folding.
+     */
+    LiteralMatcher(const QString& text, Qt::CaseSensitivity cs);
+
+    bool isEmpty() const { return m_text.isEmpty(); }
+
+    /**
+     * Returns the position of the first match in @p lines which starts at
+     * or after @p from and before @p to, or -1 if there is none.  @p end is
+     * set to the position of the last cell of the match.
+     */
+    int indexIn(const Lines& lines, int from, int to, int* end) const;
+    /** Like indexIn(), but returns the last match starting in the range. */
+    int lastIndexIn(const Lines& lines, int from, int to, int* end) const;
+
+private:
+    bool matchesAt(const Lines& lines, int position, int* end) const;
+
+    /** Returns whether a match may start in @p cell, judging by its first character */
+    inline bool isCandidate(const Character& cell) const
+    {
+        return fold(cell.character) == m_first || (cell.rendition & RE_EXTENDED_CHAR);
+    }
+    /** Returns the first candidate cell in [@p from, @p to), or @p to if there is none */
+    int nextCandidate(const Character* cells, int from, int to) const;
+    /** Returns the last candidate cell in [@p from, @p to), or @p from - 1 if there is none */
+    int previousCandidate(const Character* cells, int from, int to) const;
+
+    inline uint fold(uint c) const
+    {
+        if (m_caseSensitivity == Qt::CaseSensitive)
+            return c;
+        // the same as case folding, without the table lookup
+        if (c < 0x80)
+            return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        return QChar::toCaseFolded(char32_t(c));
+    }
+
+    QVector<uint> m_text;    // folded if the case is ignored
+    Qt::CaseSensitivity m_caseSensitivity;
+
+    // the characters the candidate scan looks for: the first one, its upper
+    // case if it is an ASCII letter and the case is ignored, and every
+    // character past ASCII if the case is ignored, since those may fold to it
+    uint m_first = 0;
+    uint m_firstOther = 0;
+    bool m_nonAsciiCandidates = false;
+};
+
+}
+
+#endif // LITERALMATCHER_H
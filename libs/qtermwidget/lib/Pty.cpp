@@ -329,13 +329,9 @@ void Pty::dataReceived()
 
 void Pty::lockPty(bool lock)
 {
-    Q_UNUSED(lock)
-
-// TODO: Support for locking the Pty
-  //if (lock)
-    //suspend();
-  //else
-    //resume();
+    // while the pty is not read the terminal program blocks as soon as
+    // the kernel's pty buffer is full
+    pty()->setSuspended(lock);
 }
 
 int Pty::foregroundProcessGroup() const
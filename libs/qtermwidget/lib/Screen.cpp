@@ -68,15 +68,28 @@ Character Screen::defaultChar = Character(' ',
 : lines(l),
     columns(c),
     screenLines(new ImageLine[lines+1] ),
+    _screenLinesHead(0),
     _scrolledLines(0),
     _droppedLines(0),
+    _totalDroppedLines(0),
+    _historyGeneration(0),
     history(new HistoryScrollNone()),
+    _historyIndex(nullptr),
+    _reflowLines(false),
+    _reflowedHistory(nullptr),
+    _reflowSourceLine(0),
+    _reflowedIndex(nullptr),
+    _reflowLineMapStart(0),
+    _reflowAddedLines(0),
+    _logicalLineEnd(-1),
+    _logicalLineStart(-1),
+    _logicalLineGeneration(0),
     cuX(0), cuY(0),
     currentRendition(0),
     _topMargin(0), _bottomMargin(0),
     selBegin(0), selTopLeft(0), selBottomRight(0),
     blockSelectionMode(false),
-    effectiveForeground(CharacterColor()), effectiveBackground(CharacterColor()), effectiveRendition(0),
+    effectiveForeground(), effectiveBackground(), effectiveRendition(0),
     lastPos(-1)
 {
     lineProperties.resize(lines+1);
@@ -95,6 +108,9 @@ Screen::~Screen()
 {
     delete[] screenLines;
     delete history;
+    delete _reflowedHistory;
+    delete _historyIndex;
+    delete _reflowedIndex;
 }
 
 void Screen::cursorUp(int n)
@@ -228,29 +244,29 @@ void Screen::deleteChars(int n)
         n = 1;
 
     // if cursor is beyond the end of the line there is nothing to do
-    if ( cuX >= screenLines[cuY].count() )
+    if ( cuX >= screenLineAt(cuY).count() )
         return;
 
-    if ( cuX+n > screenLines[cuY].count() )
-        n = screenLines[cuY].count() - cuX;
+    if ( cuX+n > screenLineAt(cuY).count() )
+        n = screenLineAt(cuY).count() - cuX;
 
     Q_ASSERT( n >= 0 );
-    Q_ASSERT( cuX+n <= screenLines[cuY].count() );
+    Q_ASSERT( cuX+n <= screenLineAt(cuY).count() );
 
-    screenLines[cuY].remove(cuX,n);
+    screenLineAt(cuY).remove(cuX,n);
 }
 
 void Screen::insertChars(int n)
 {
     if (n == 0) n = 1; // Default
 
-    if ( screenLines[cuY].size() < cuX )
-        screenLines[cuY].resize(cuX);
+    if ( screenLineAt(cuY).size() < cuX )
+        screenLineAt(cuY).resize(cuX);
 
-    screenLines[cuY].insert(cuX,n,' ');
+    screenLineAt(cuY).insert(cuX,n,' ');
 
-    if ( screenLines[cuY].count() > columns )
-        screenLines[cuY].resize(columns);
+    if ( screenLineAt(cuY).count() > columns )
+        screenLineAt(cuY).resize(columns);
 }
 
 void Screen::repeatChars(int count)
@@ -343,6 +359,12 @@ void Screen::resizeImage(int new_lines, int new_columns)
 {
     if ((new_lines==lines) && (new_columns==columns)) return;
 
+    if (_reflowLines && new_columns != columns)
+    {
+        reflowScreenLines(new_columns);
+        startHistoryReflow();
+    }
+
     if (cuY > new_lines-1)
     { // attempt to preserve focus and lines
         _bottomMargin = lines-1; //FIXME: margin lost
@@ -354,20 +376,26 @@ void Screen::resizeImage(int new_lines, int new_columns)
 
     // create new screen lines and copy from old to new
 
+    // the new lines start out in order, with the first one at index 0
     ImageLine* newScreenLines = new ImageLine[new_lines+1];
+    QVarLengthArray<LineProperty,64> newLineProperties(new_lines+1);
     for (int i=0; i < qMin(lines,new_lines+1) ;i++)
-        newScreenLines[i]=screenLines[i];
+    {
+        newScreenLines[i]=screenLineAt(i);
+        newLineProperties[i]=linePropertyAt(i);
+    }
     for (int i=lines;(i > 0) && (i<new_lines+1);i++)
+    {
         newScreenLines[i].resize( new_columns );
-
-    lineProperties.resize(new_lines+1);
-    for (int i=lines;(i > 0) && (i<new_lines+1);i++)
-        lineProperties[i] = LINE_DEFAULT;
+        newLineProperties[i] = LINE_DEFAULT;
+    }
 
     clearSelection();
 
     delete[] screenLines;
     screenLines = newScreenLines;
+    lineProperties = newLineProperties;
+    _screenLinesHead = 0;
 
     lines = new_lines;
     columns = new_columns;
@@ -381,6 +409,247 @@ void Screen::resizeImage(int new_lines, int new_columns)
     clearSelection();
 }
 
+void Screen::setReflowLines(bool enable)
+{
+    _reflowLines = enable;
+}
+
+QVector<int> Screen::wrapPositions(const Character* line, int length, int width)
+{
+    QVector<int> positions;
+    positions << 0;
+
+    int start = 0;
+    while (length - start > width)
+    {
+        int end = start + width;
+        // move a double width character which would be cut in half to the next line
+        if (line[end].character == 0 && end - 1 > start)
+            end--;
+        positions << end;
+        start = end;
+    }
+    return positions;
+}
+
+void Screen::reflowScreenLines(int newColumns)
+{
+    // lines below both the cursor and the last line with content are empty
+    int lastLine = cuY;
+    for (int y = lines - 1; y > lastLine; y--)
+    {
+        if (!screenLineAt(y).isEmpty())
+        {
+            lastLine = y;
+            break;
+        }
+    }
+
+    QVector<ImageLine> newLines;
+    QVector<LineProperty> newProperties;
+    int newCursorLine = -1;
+    int newCursorColumn = 0;
+
+    ImageLine logicalLine;
+    int y = 0;
+    while (y <= lastLine)
+    {
+        // join the lines which were wrapped into one
+        const LineProperty properties = linePropertyAt(y) & ~LINE_WRAPPED;
+        int cursorOffset = -1;
+        logicalLine.resize(0);
+        forever
+        {
+            const ImageLine& line = screenLineAt(y);
+            const bool wrapped = (linePropertyAt(y) & LINE_WRAPPED) && y < lastLine;
+            if (y == cuY)
+                cursorOffset = logicalLine.size() + cuX;
+            y++;
+
+            if (!wrapped)
+            {
+                logicalLine += line;
+                break;
+            }
+            // a wrapped line fills the whole width, clearing may have cut it short
+            const int offset = logicalLine.size();
+            logicalLine += line.mid(0, columns);
+            logicalLine.resize(offset + columns);
+        }
+
+        // trailing blanks would only produce empty lines
+        while (logicalLine.size() > qMax(0, cursorOffset) && logicalLine.last() == defaultChar)
+            logicalLine.removeLast();
+
+        const QVector<int> positions = wrapPositions(logicalLine.constData(), logicalLine.size(), newColumns);
+        for (int i = 0; i < positions.size(); i++)
+        {
+            const bool last = (i + 1 == positions.size());
+            const int start = positions[i];
+            const int end = last ? logicalLine.size() : positions[i + 1];
+
+            if (cursorOffset >= start && (last || cursorOffset < end))
+            {
+                newCursorLine = newLines.size();
+                newCursorColumn = cursorOffset - start;
+            }
+
+            newLines << logicalLine.mid(start, end - start);
+            newProperties << LineProperty(last ? properties : properties | LINE_WRAPPED);
+        }
+    }
+
+    // the lines which no longer fit are moved to the history, but never the
+    // one with the cursor.  Lines below it are dropped instead if need be
+    int overflow = qMax(0, int(newLines.size()) - lines);
+    if (newCursorLine >= 0)
+        overflow = qMin(overflow, newCursorLine);
+    for (int i = 0; i < overflow; i++)
+    {
+        if (hasScroll())
+        {
+            history->addCellsVector(newLines[i]);
+            history->addLine(newProperties[i] & LINE_WRAPPED);
+        }
+    }
+    if (_historyIndex && overflow > 0)
+        _historyIndex->update(history, overflow);
+
+    for (int i = 0; i <= lines; i++)
+    {
+        const bool used = i < lines && overflow + i < newLines.size();
+        screenLineAt(i) = used ? newLines[overflow + i] : ImageLine();
+        linePropertyAt(i) = used ? newProperties[overflow + i] : LINE_DEFAULT;
+    }
+
+    columns = newColumns;
+    if (newCursorLine >= 0)
+    {
+        cuY = newCursorLine - overflow;
+        cuX = newCursorColumn;
+    }
+    lastPos = -1;
+    clearSelection();
+}
+
+bool Screen::isReflowingHistory() const
+{
+    return _reflowedHistory != nullptr;
+}
+
+void Screen::startHistoryReflow()
+{
+    cancelHistoryReflow();
+
+    if (!hasScroll() || history->getLines() == 0)
+        return;
+
+    _reflowedHistory = history->getType().scroll(nullptr);
+    _reflowSourceLine = 0;
+    _reflowLineMap.clear();
+    _reflowLineMapStart = 0;
+    _reflowAddedLines = 0;
+    if (_historyIndex)
+        _reflowedIndex = new HistoryTrigramIndex();
+}
+
+void Screen::cancelHistoryReflow()
+{
+    delete _reflowedHistory;
+    _reflowedHistory = nullptr;
+    _reflowSourceLine = 0;
+    delete _reflowedIndex;
+    _reflowedIndex = nullptr;
+    _reflowLineMap.clear();
+    _reflowLineMapStart = 0;
+    _reflowAddedLines = 0;
+}
+
+bool Screen::reflowHistoryStep(int maxLines)
+{
+    if (!_reflowedHistory)
+        return false;
+
+    const int historyLines = history->getLines();
+    QVector<Character> logicalLine;
+    QVector<int> lineOffsets;
+    int processed = 0;
+    int added = 0;
+
+    while (_reflowSourceLine < historyLines && processed < maxLines)
+    {
+        // join the lines which were wrapped into one.  If the last line of
+        // the history is wrapped, the logical line continues on the screen
+        // and the last part stays wrapped.
+        bool wrapped = false;
+        logicalLine.resize(0);
+        lineOffsets.resize(0);
+        do
+        {
+            const int length = history->getLineLen(_reflowSourceLine);
+            const int offset = logicalLine.size();
+            lineOffsets << offset;
+            logicalLine.resize(offset + length);
+            history->getCells(_reflowSourceLine, 0, length, logicalLine.data() + offset);
+            wrapped = history->isWrappedLine(_reflowSourceLine);
+            _reflowSourceLine++;
+            processed++;
+        } while (wrapped && _reflowSourceLine < historyLines);
+
+        const QVector<int> positions = wrapPositions(logicalLine.constData(), logicalLine.size(), columns);
+        // each old line moves to the new line which its first character is on
+        int part = 0;
+        for (int j = 0; j < lineOffsets.size(); j++)
+        {
+            while (part + 1 < positions.size() && positions[part + 1] <= lineOffsets[j])
+                part++;
+            _reflowLineMap << _reflowAddedLines + added + part;
+        }
+        for (int i = 0; i < positions.size(); i++)
+        {
+            const bool last = (i + 1 == positions.size());
+            const int start = positions[i];
+            const int end = last ? logicalLine.size() : positions[i + 1];
+
+            _reflowedHistory->addCells(logicalLine.constData() + start, end - start);
+            _reflowedHistory->addLine(last ? wrapped : true);
+            added++;
+        }
+    }
+    _reflowAddedLines += added;
+    if (_reflowedIndex)
+        _reflowedIndex->update(_reflowedHistory, added);
+
+    if (_reflowSourceLine < historyLines)
+        return true;
+
+    // all lines have been rewrapped.  The new history may have dropped some
+    // of the lines added to it already
+    const int droppedLines = _reflowAddedLines - _reflowedHistory->getLines();
+    _reflowedLines.resize(historyLines);
+    for (int line = 0; line < historyLines; line++)
+        _reflowedLines[line] = qMax(0, _reflowLineMap[_reflowLineMapStart + line] - droppedLines);
+    _reflowedLines << _reflowedHistory->getLines();
+    _reflowLineMap.clear();
+    _reflowLineMapStart = 0;
+    _reflowAddedLines = 0;
+
+    // switch over to the new history
+    clearSelection();
+    delete history;
+    history = _reflowedHistory;
+    _reflowedHistory = nullptr;
+    if (_reflowedIndex)
+    {
+        delete _historyIndex;
+        _historyIndex = _reflowedIndex;
+        _reflowedIndex = nullptr;
+    }
+    _historyGeneration++;
+    _reflowSourceLine = 0;
+    return false;
+}
+
 void Screen::setDefaultMargins()
 {
     _topMargin = 0;
@@ -424,8 +693,8 @@ void Screen::setDefaultMargins()
 
 void Screen::reverseRendition(Character& p) const
 {
-    CharacterColor f = p.foregroundColor;
-    CharacterColor b = p.backgroundColor;
+    PackedColor f = p.foregroundColor;
+    PackedColor b = p.backgroundColor;
 
     p.foregroundColor = b;
     p.backgroundColor = f; //p->r &= ~RE_TRANSPARENT;
@@ -434,25 +703,32 @@ void Screen::reverseRendition(Character& p) const
 void Screen::updateEffectiveRendition()
 {
     effectiveRendition = currentRendition;
+    CharacterColor foreground = currentForeground;
+    CharacterColor background = currentBackground;
     if (currentRendition & RE_REVERSE)
     {
-        effectiveForeground = currentBackground;
-        effectiveBackground = currentForeground;
-    }
-    else
-    {
-        effectiveForeground = currentForeground;
-        effectiveBackground = currentBackground;
+        foreground = currentBackground;
+        background = currentForeground;
     }
 
     if (currentRendition & RE_BOLD)
-        effectiveForeground.setIntensive();
+        foreground.setIntensive();
+
+    // packed once here rather than for each character
+    effectiveForeground = foreground;
+    effectiveBackground = background;
 }
 
 void Screen::copyFromHistory(Character* dest, int startLine, int count) const
 {
     Q_ASSERT( startLine >= 0 && count > 0 && startLine + count <= history->getLines() );
 
+    if (_reflowedHistory)
+    {
+        copyFromReflowingHistory(dest, startLine, count);
+        return;
+    }
+
     for (int line = startLine; line < startLine + count; line++)
     {
         const int length = qMin(columns,history->getLineLen(line));
@@ -477,6 +753,85 @@ void Screen::copyFromHistory(Character* dest, int startLine, int count) const
     }
 }
 
+void Screen::copyFromReflowingHistory(Character* dest, int startLine, int count) const
+{
+    // the lines are shown from the new line which the first character of
+    // 'startLine' is on, which is where reflowedLine() puts the view after
+    // the rewrapped history replaces the old one
+    int line = logicalLineStart(startLine);
+
+    const int historyLines = history->getLines();
+    QVector<Character> logicalLine;
+    int copied = 0;
+    while (copied < count && line < historyLines)
+    {
+        int startOffset = 0;
+        bool wrapped = false;
+        logicalLine.resize(0);
+        do
+        {
+            if (line == startLine)
+                startOffset = logicalLine.size();
+            const int length = history->getLineLen(line);
+            const int offset = logicalLine.size();
+            logicalLine.resize(offset + length);
+            history->getCells(line, 0, length, logicalLine.data() + offset);
+            wrapped = history->isWrappedLine(line);
+            line++;
+        } while (wrapped && line < historyLines);
+
+        const QVector<int> positions = wrapPositions(logicalLine.constData(), logicalLine.size(), columns);
+        for (int i = 0; i < positions.size() && copied < count; i++)
+        {
+            const int start = positions[i];
+            const int end = (i + 1 == positions.size()) ? logicalLine.size() : positions[i + 1];
+            if (i + 1 < positions.size() && positions[i + 1] <= startOffset)
+                continue;
+
+            const int length = qMin(columns, end - start);
+            const int destLineOffset = copied * columns;
+            for (int column = 0; column < length; column++)
+                dest[destLineOffset + column] = logicalLine[start + column];
+            for (int column = length; column < columns; column++)
+                dest[destLineOffset + column] = defaultChar;
+            copied++;
+        }
+    }
+
+    // the rewrapped lines may not fill the view if the screen became wider
+    fillWithDefaultChar(dest + copied * columns, (count - copied) * columns);
+}
+
+int Screen::logicalLineStart(int line) const
+{
+    // the view is drawn again and again from the same logical line, which
+    // may be very long.  Only the lines between the one looked up last and
+    // 'line' are walked through, the lines of the history before the last
+    // one do not change until they are dropped
+    const qint64 absoluteLine = _totalDroppedLines + line;
+    const bool known = _logicalLineEnd >= 0 && _logicalLineGeneration == _historyGeneration;
+    const int knownStart = known ? int(qMax<qint64>(0, _logicalLineStart - _totalDroppedLines)) : 0;
+    if (known && absoluteLine >= _logicalLineStart && absoluteLine <= _logicalLineEnd)
+        return knownStart;
+
+    const qint64 knownEnd = known ? _logicalLineEnd - _totalDroppedLines : -1;
+    int start = line;
+    while (start > 0 && history->isWrappedLine(start - 1))
+    {
+        start--;
+        if (start == knownEnd)
+        {
+            start = knownStart;
+            break;
+        }
+    }
+
+    _logicalLineStart = _totalDroppedLines + start;
+    _logicalLineEnd = absoluteLine;
+    _logicalLineGeneration = _historyGeneration;
+    return start;
+}
+
 void Screen::copyFromScreen(Character* dest , int startLine , int count) const
 {
     Q_ASSERT( startLine >= 0 && count > 0 && startLine + count <= lines );
@@ -491,7 +846,7 @@ void Screen::copyFromScreen(Character* dest , int startLine , int count) const
             int srcIndex = srcLineStartIndex + column;
             int destIndex = destLineStartIndex + column;
 
-            dest[destIndex] = screenLines[srcIndex/columns].value(srcIndex%columns,defaultChar);
+            dest[destIndex] = screenLineAt(srcIndex/columns).value(srcIndex%columns,defaultChar);
 
             // invert selected text
             if (selBegin != -1 && isSelected(column,line + history->getLines()))
@@ -564,7 +919,7 @@ QVector<LineProperty> Screen::getLineProperties( int startLine , int endLine ) c
     const int firstScreenLine = startLine + linesInHistory - history->getLines();
     for (int line = firstScreenLine; line < firstScreenLine+linesInScreen; line++)
     {
-        result[index]=lineProperties[line];
+        result[index]=linePropertyAt(line);
         index++;
     }
 
@@ -601,8 +956,8 @@ void Screen::backspace()
     cuX = qMin(columns-1,cuX); // nowrap!
     cuX = qMax(0,cuX-1);
 
-    if (screenLines[cuY].size() < cuX+1)
-        screenLines[cuY].resize(cuX+1);
+    if (screenLineAt(cuY).size() < cuX+1)
+        screenLineAt(cuY).resize(cuX+1);
 }
 
 void Screen::tab(int n)
@@ -680,10 +1035,10 @@ void Screen::displayCharacter(wchar_t c)
         return;
     if (w == 0)
     {
-        if (QChar(c).category() != QChar::Mark_NonSpacing)
+        if (!konsole_is_nonspacing_mark(c))
             return;
         // Find previous "real character" to try to combine with
-        int charToCombineWithX = qMin(cuX, screenLines[cuY].length());
+        int charToCombineWithX = qMin(cuX, screenLineAt(cuY).length());
         int charToCombineWithY = cuY;
         bool previousChar = true;
         do {
@@ -691,10 +1046,10 @@ void Screen::displayCharacter(wchar_t c)
             {
                 --charToCombineWithX;
             }
-            else if (charToCombineWithY > 0 && lineProperties.at(charToCombineWithY - 1) & LINE_WRAPPED)
+            else if (charToCombineWithY > 0 && linePropertyAt(charToCombineWithY - 1) & LINE_WRAPPED)
             { // Try previous line
                 --charToCombineWithY;
-                charToCombineWithX = screenLines[charToCombineWithY].length() - 1;
+                charToCombineWithX = screenLineAt(charToCombineWithY).length() - 1;
             }
             else
             {
@@ -709,7 +1064,7 @@ void Screen::displayCharacter(wchar_t c)
                 previousChar = false;
                 break;
             }
-        } while (screenLines[charToCombineWithY][charToCombineWithX] == 0);
+        } while (screenLineAt(charToCombineWithY)[charToCombineWithX] == 0);
 
         if (!previousChar)
         {
@@ -717,26 +1072,28 @@ void Screen::displayCharacter(wchar_t c)
             goto notcombine;
         }
 
-        Character& currentChar = screenLines[charToCombineWithY][charToCombineWithX];
+        Character& currentChar = screenLineAt(charToCombineWithY)[charToCombineWithX];
         if ((currentChar.rendition & RE_EXTENDED_CHAR) == 0)
         {
             uint chars[2] = { static_cast<uint>(currentChar.character), static_cast<uint>(c) };
-            currentChar.rendition |= RE_EXTENDED_CHAR;
-            currentChar.character = ExtendedCharTable::instance.createExtendedChar(chars, 2);
+            // if the table is full the character is left alone
+            const uint id = ExtendedCharTable::instance.createExtendedChar(chars, 2);
+            if (id != 0)
+            {
+                currentChar.rendition |= RE_EXTENDED_CHAR;
+                currentChar.character = id;
+            }
         }
         else
         {
-            ushort extendedCharLength;
-            const uint* oldChars = ExtendedCharTable::instance.lookupExtendedChar(currentChar.character, extendedCharLength);
-            Q_ASSERT(oldChars);
-            if (oldChars && extendedCharLength < 8)
+            ExtendedCharTable::Sequence chars;
+            ExtendedCharTable::instance.lookupExtendedChar(currentChar.character, chars);
+            if (chars.size() > 1 && chars.size() < 8)
             {
-                Q_ASSERT(extendedCharLength > 1);
-                Q_ASSERT(extendedCharLength < 65535); // redundant due to above check
-                auto chars = std::make_unique<uint[]>(extendedCharLength + 1);
-                std::copy_n(oldChars, extendedCharLength, chars.get());
-                chars[extendedCharLength] = c;
-                currentChar.character = ExtendedCharTable::instance.createExtendedChar(chars.get(), extendedCharLength + 1);
+                chars.append(c);
+                const uint id = ExtendedCharTable::instance.createExtendedChar(chars.constData(), chars.size());
+                if (id != 0)
+                    currentChar.character = id;
             }
         }
         return;
@@ -747,7 +1104,7 @@ notcombine:
     {
         if (getMode(MODE_Wrap))
         {
-            lineProperties[cuY] = (LineProperty)(lineProperties[cuY] | LINE_WRAPPED);
+            linePropertyAt(cuY) = (LineProperty)(linePropertyAt(cuY) | LINE_WRAPPED);
             nextLine();
         }
         else
@@ -757,10 +1114,10 @@ notcombine:
     }
 
     // ensure current line vector has enough elements
-    int size = screenLines[cuY].size();
+    int size = screenLineAt(cuY).size();
     if (size < cuX+w)
     {
-        screenLines[cuY].resize(cuX+w);
+        screenLineAt(cuY).resize(cuX+w);
     }
 
     if (getMode(MODE_Insert)) insertChars(w);
@@ -770,7 +1127,7 @@ notcombine:
     // check if selection is still valid.
     checkSelection(lastPos, lastPos);
 
-    Character& currentChar = screenLines[cuY][cuX];
+    Character& currentChar = screenLineAt(cuY)[cuX];
 
     currentChar.character = c;
     currentChar.foregroundColor = effectiveForeground;
@@ -785,10 +1142,10 @@ notcombine:
     {
         i++;
 
-        if ( screenLines[cuY].size() < cuX + i + 1 )
-            screenLines[cuY].resize(cuX+i+1);
+        if ( screenLineAt(cuY).size() < cuX + i + 1 )
+            screenLineAt(cuY).resize(cuX+i+1);
 
-        Character& ch = screenLines[cuY][cuX + i];
+        Character& ch = screenLineAt(cuY)[cuX + i];
         ch.character = 0;
         ch.foregroundColor = effectiveForeground;
         ch.backgroundColor = effectiveBackground;
@@ -799,6 +1156,69 @@ notcombine:
     cuX = newCursorX;
 }
 
+void Screen::displayCharacters(const uint* chars, int count)
+{
+    int i = 0;
+    while (i < count)
+    {
+        // find the run of single-width characters starting at i, anything
+        // else (wide characters, combining marks...) takes the slow path
+        int runEnd = i;
+        while (runEnd < count)
+        {
+            const uint c = chars[runEnd];
+            if (c < 0x7f ? c < 0x20 : konsole_wcwidth(c) != 1)
+                break;
+            ++runEnd;
+        }
+
+        if (runEnd == i)
+        {
+            displayCharacter(chars[i++]);
+            continue;
+        }
+
+        while (i < runEnd)
+        {
+            if (cuX >= columns)
+            {
+                if (!getMode(MODE_Wrap))
+                {
+                    // the character is drawn over the last column
+                    displayCharacter(chars[i++]);
+                    continue;
+                }
+                linePropertyAt(cuY) = (LineProperty)(linePropertyAt(cuY) | LINE_WRAPPED);
+                nextLine();
+            }
+
+            const int n = qMin(runEnd - i, columns - cuX);
+
+            if (screenLineAt(cuY).size() < cuX + n)
+                screenLineAt(cuY).resize(cuX + n);
+
+            if (getMode(MODE_Insert)) insertChars(n);
+
+            // check if selection is still valid.
+            checkSelection(loc(cuX,cuY), loc(cuX + n - 1,cuY));
+
+            Character* line = screenLineAt(cuY).data() + cuX;
+            for (int j = 0; j < n; j++)
+            {
+                line[j].character = chars[i + j];
+                line[j].foregroundColor = effectiveForeground;
+                line[j].backgroundColor = effectiveBackground;
+                line[j].rendition = effectiveRendition;
+            }
+
+            i += n;
+            cuX += n;
+            lastPos = loc(cuX - 1,cuY);
+            lastDrawnChar = chars[i - 1];
+        }
+    }
+}
+
 void Screen::compose(const QString& /*compose*/)
 {
     Q_ASSERT( 0 /*Not implemented yet*/ );
@@ -828,6 +1248,20 @@ void Screen::resetScrolledLines()
 {
     _scrolledLines = 0;
 }
+int Screen::reflowedLine(int line) const
+{
+    if (_reflowedLines.isEmpty())
+        return line;
+    // the last entry is the number of lines in the rewrapped history
+    const int oldHistoryLines = _reflowedLines.size() - 1;
+    if (line >= oldHistoryLines)
+        return _reflowedLines.last() + line - oldHistoryLines;
+    return _reflowedLines[qMax(0, line)];
+}
+void Screen::resetReflowedLines()
+{
+    _reflowedLines.clear();
+}
 
 void Screen::scrollUp(int n)
 {
@@ -941,12 +1375,12 @@ void Screen::clearImage(int loca, int loce, char c)
 
     for (int y=topLine;y<=bottomLine;y++)
     {
-        lineProperties[y] = 0;
+        linePropertyAt(y) = 0;
 
         int endCol = ( y == bottomLine) ? loce%columns : columns-1;
         int startCol = ( y == topLine ) ? loca%columns : 0;
 
-        QVector<Character>& line = screenLines[y];
+        QVector<Character>& line = screenLineAt(y);
 
         if ( isDefaultCh && endCol == columns-1 )
         {
@@ -975,20 +1409,28 @@ void Screen::moveImage(int dest, int sourceBegin, int sourceEnd)
     //so it matters that we do the copy in the right order -
     //forwards if dest < sourceBegin or backwards otherwise.
     //(search the web for 'memmove implementation' for details)
-    if (dest < sourceBegin)
+    //moving everything from sourceBegin to the end of the screen up to the
+    //top, which is how the whole screen scrolls, only has to rotate the ring
+    //of lines.  The lines at the bottom are left with stale content, which
+    //scrollUp() clears afterwards.
+    if (dest == 0 && sourceEnd/columns == this->lines)
+    {
+        _screenLinesHead = physicalLine(sourceBegin/columns);
+    }
+    else if (dest < sourceBegin)
     {
         for (int i=0;i<=lines;i++)
         {
-            screenLines[ (dest/columns)+i ] = screenLines[ (sourceBegin/columns)+i ];
-            lineProperties[(dest/columns)+i]=lineProperties[(sourceBegin/columns)+i];
+            screenLineAt((dest/columns)+i) = screenLineAt((sourceBegin/columns)+i);
+            linePropertyAt((dest/columns)+i)=linePropertyAt((sourceBegin/columns)+i);
         }
     }
     else
     {
         for (int i=lines;i>=0;i--)
         {
-            screenLines[ (dest/columns)+i ] = screenLines[ (sourceBegin/columns)+i ];
-            lineProperties[(dest/columns)+i]=lineProperties[(sourceBegin/columns)+i];
+            screenLineAt((dest/columns)+i) = screenLineAt((sourceBegin/columns)+i);
+            linePropertyAt((dest/columns)+i)=linePropertyAt((sourceBegin/columns)+i);
         }
     }
 
@@ -1340,8 +1782,8 @@ int Screen::copyLineToStream(int line ,
 
         const int screenLine = line-history->getLines();
 
-        Character* data = screenLines[screenLine].data();
-        int length = screenLines[screenLine].count();
+        Character* data = screenLineAt(screenLine).data();
+        int length = screenLineAt(screenLine).count();
 
         //retrieve line from screen image
         for (int i=start;i < qMin(start+count,length);i++)
@@ -1352,8 +1794,8 @@ int Screen::copyLineToStream(int line ,
         // count cannot be any greater than length
         count = qBound(0,count,length-start);
 
-        Q_ASSERT( screenLine < lineProperties.count() );
-        currentLineProperties |= lineProperties[screenLine];
+        Q_ASSERT( screenLine <= lines );
+        currentLineProperties |= linePropertyAt(screenLine);
     }
 
     // add new line character at end
@@ -1378,6 +1820,37 @@ void Screen::writeLinesToStream(TerminalCharacterDecoder* decoder, int fromLine,
     writeToStream(decoder,loc(0,fromLine),loc(columns-1,toLine));
 }
 
+void Screen::copyLineCells(int fromLine, int toLine, QVector<Character>& cells,
+                           QVector<int>& lineEnds, QVector<LineProperty>& lineProperties) const
+{
+    for (int line = fromLine; line <= toLine; line++)
+    {
+        const int start = cells.size();
+        LineProperty properties = 0;
+        if (line < history->getLines())
+        {
+            const int length = history->getLineLen(line);
+            cells.resize(start + length);
+            if (length > 0)
+                history->getCells(line, 0, length, cells.data() + start);
+            if (history->isWrappedLine(line))
+                properties |= LINE_WRAPPED;
+        }
+        else
+        {
+            const int screenLine = line - history->getLines();
+            const ImageLine& imageLine = screenLineAt(screenLine);
+            const int length = qMin(columns, int(imageLine.size()));
+            cells.resize(start + length);
+            for (int i = 0; i < length; i++)
+                cells[start + i] = imageLine.at(i);
+            properties = linePropertyAt(screenLine);
+        }
+        lineEnds << cells.size();
+        lineProperties << properties;
+    }
+}
+
 void Screen::addHistLine()
 {
     // add line to history buffer
@@ -1387,8 +1860,10 @@ void Screen::addHistLine()
     {
         int oldHistLines = history->getLines();
 
-        history->addCellsVector(screenLines[0]);
-        history->addLine( lineProperties[0] & LINE_WRAPPED );
+        history->addCellsVector(screenLineAt(0));
+        history->addLine( linePropertyAt(0) & LINE_WRAPPED );
+        if (_historyIndex)
+            _historyIndex->update(history, 1);
 
         int newHistLines = history->getLines();
 
@@ -1397,7 +1872,17 @@ void Screen::addHistLine()
         // If the history is full, increment the count
         // of dropped lines
         if ( newHistLines == oldHistLines )
+        {
             _droppedLines++;
+            _totalDroppedLines++;
+
+            // the line numbers of the lines still to be rewrapped have moved up
+            if (_reflowedHistory && _reflowSourceLine > 0)
+            {
+                _reflowSourceLine--;
+                _reflowLineMapStart++;
+            }
+        }
 
         // Adjust selection for the new point of reference
         if (newHistLines > oldHistLines)
@@ -1445,6 +1930,9 @@ int Screen::getHistLines() const
 void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
 {
     clearSelection();
+    cancelHistoryReflow();
+    _reflowedLines.clear();
+    _historyGeneration++;
 
     if ( copyPreviousScroll )
         history = t.scroll(history);
@@ -1454,6 +1942,9 @@ void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
         history = t.scroll(nullptr);
         delete oldScroll;
     }
+
+    if (_historyIndex)
+        _historyIndex->rebuild(history);
 }
 
 bool Screen::hasScroll() const
@@ -1466,12 +1957,127 @@ const HistoryType& Screen::getScroll() const
     return history->getType();
 }
 
+qint64 Screen::historyMemoryUsage() const
+{
+    qint64 usage = history->memoryUsage();
+    if (_reflowedHistory)
+        usage += _reflowedHistory->memoryUsage();
+    if (_historyIndex)
+        usage += _historyIndex->memoryUsage();
+    if (_reflowedIndex)
+        usage += _reflowedIndex->memoryUsage();
+    return usage;
+}
+
+qint64 Screen::releaseHistoryMemory(qint64 bytes)
+{
+    const int lines = history->getLines();
+    const qint64 usage = history->memoryUsage();
+    if (lines == 0 || usage == 0 || bytes <= 0)
+        return 0;
+    const qint64 reflowedUsage = _reflowedHistory ? _reflowedHistory->memoryUsage() : 0;
+
+    // assume that the lines use about the same amount of memory each
+    const int count = static_cast<int>(qMin<qint64>(lines, (bytes * lines + usage - 1) / usage));
+    history->dropLines(count);
+    const int dropped = lines - history->getLines();
+    if (dropped == 0)
+        return 0;
+
+    _droppedLines += dropped;
+    _totalDroppedLines += dropped;
+    if (_reflowedHistory)
+    {
+        // the lines rewrapped from the dropped lines end where those of the
+        // first line which is left begin
+        const int rewrapped = qMin(dropped, _reflowSourceLine);
+        const int end = rewrapped < _reflowSourceLine ? _reflowLineMap[_reflowLineMapStart + rewrapped]
+                                                      : _reflowAddedLines;
+        const int alreadyDropped = _reflowAddedLines - _reflowedHistory->getLines();
+        _reflowedHistory->dropLines(end - alreadyDropped);
+        if (_reflowedIndex)
+            _reflowedIndex->update(_reflowedHistory, 0);
+
+        _reflowLineMapStart += rewrapped;
+        _reflowSourceLine -= rewrapped;
+    }
+    if (_historyIndex)
+        _historyIndex->update(history, 0);
+
+    if (selBegin != -1)
+    {
+        const bool beginIsTL = (selBegin == selTopLeft);
+        selTopLeft -= dropped * columns;
+        selBottomRight -= dropped * columns;
+
+        if (selBottomRight < 0)
+            clearSelection();
+        else
+        {
+            if (selTopLeft < 0)
+                selTopLeft = 0;
+            selBegin = beginIsTL ? selTopLeft : selBottomRight;
+        }
+    }
+
+    return usage - history->memoryUsage()
+           + (_reflowedHistory ? reflowedUsage - _reflowedHistory->memoryUsage() : 0);
+}
+
+void Screen::markExtendedChars() const
+{
+    for (int y = 0; y < lines; y++)
+    {
+        const ImageLine& line = screenLineAt(y);
+        ExtendedCharTable::instance.markExtendedChars(line.constData(), line.size());
+    }
+    history->markExtendedChars();
+    if (_reflowedHistory)
+        _reflowedHistory->markExtendedChars();
+    // the colors of the next characters
+    ExtendedCharTable::instance.markColor(effectiveForeground);
+    ExtendedCharTable::instance.markColor(effectiveBackground);
+}
+
+void Screen::setHistoryIndexEnabled(bool enable)
+{
+    if (enable == (_historyIndex != nullptr))
+        return;
+
+    if (enable)
+    {
+        _historyIndex = new HistoryTrigramIndex();
+        _historyIndex->rebuild(history);
+        if (_reflowedHistory)
+        {
+            _reflowedIndex = new HistoryTrigramIndex();
+            _reflowedIndex->rebuild(_reflowedHistory);
+        }
+    }
+    else
+    {
+        delete _historyIndex;
+        _historyIndex = nullptr;
+        delete _reflowedIndex;
+        _reflowedIndex = nullptr;
+    }
+}
+
+bool Screen::linesMayMatch(const HistoryTrigramIndex::Query& query, int startLine, int endLine) const
+{
+    if (!_historyIndex || endLine >= history->getLines()
+        || _historyIndex->lineCount() != history->getLines())
+        return true;
+
+    return _historyIndex->mayContain(query, startLine, endLine);
+}
+
 void Screen::setLineProperty(LineProperty property , bool enable)
 {
     if ( enable )
-        lineProperties[cuY] = (LineProperty)(lineProperties[cuY] | property);
+        linePropertyAt(cuY) = (LineProperty)(linePropertyAt(cuY) | property);
     else
-        lineProperties[cuY] = (LineProperty)(lineProperties[cuY] & ~property);
+        linePropertyAt(cuY) = (LineProperty)(linePropertyAt(cuY) & ~property);
 }
 void Screen::fillWithDefaultChar(Character* dest, int count)
 {
@@ -32,6 +32,7 @@
 // Konsole
 #include "Character.h"
 #include "History.h"
+#include "HistoryTrigramIndex.h"
 
 #define MODE_Origin    0
 #define MODE_Wrap      1
@@ -359,6 +360,16 @@ public:
      */
     void displayCharacter(wchar_t c);
 
+    /**
+     * Displays @p count characters from @p chars starting at the current cursor
+     * position, as if displayCharacter() had been called for each of them.
+     *
+     * Runs of single-width characters are written a line segment at a time, so
+     * the wrapping, insert mode and selection checks are done once per segment
+     * rather than once per character.
+     */
+    void displayCharacters(const uint* chars, int count);
+
     // Do composition with last shown character FIXME: Not implemented yet for KDE 4
     void compose(const QString& compose);
 
@@ -371,9 +382,39 @@ public:
      * The top and bottom margins are reset to the top and bottom of the new
      * screen size.  Tab stops are also reset and the current selection is
      * cleared.
+     *
+     * If reflowing is enabled ( see setReflowLines() ) and the number of columns
+     * changes, lines which were wrapped are joined and wrapped again at the new
+     * width.  The screen is reflowed right away, the history incrementally by
+     * reflowHistoryStep().
      */
     void resizeImage(int new_lines, int new_columns);
 
+    /**
+     * Enables or disables rewrapping of lines when the number of columns changes.
+     * This is meant for the primary screen, programs using the alternate screen
+     * redraw it themselves.
+     */
+    void setReflowLines(bool enable);
+
+    /**
+     * Returns true if the history still contains lines which have not been
+     * wrapped at the current width after a resize.  See reflowHistoryStep()
+     */
+    bool isReflowingHistory() const;
+
+    /**
+     * Rewraps up to @p maxLines further lines of the history at the current width.
+     * Until all lines have been processed the history keeps its previous
+     * contents, the rewrapped history replaces it in the last step.  The
+     * history lines which are looked at by getImage() in the meantime are
+     * rewrapped as they are copied, and reflowedLine() maps the old line
+     * numbers to the new ones after the last step.
+     *
+     * Returns true if there are lines left to process.
+     */
+    bool reflowHistoryStep(int maxLines);
+
     /**
      * Returns the current screen image.
      * The result is an array of Characters of size [getLines()][getColumns()] which
@@ -416,6 +457,32 @@ public:
      * in a history buffer.
      */
     bool hasScroll() const;
+    /** Returns the memory used by the lines in the history, in bytes. */
+    qint64 historyMemoryUsage() const;
+    /**
+     * Drops the oldest lines from the history until about @p bytes bytes
+     * of memory are freed.  While the history is being rewrapped, the
+     * rewrapped parts of these lines are dropped as well.  Returns the
+     * number of bytes freed.
+     */
+    qint64 releaseHistoryMemory(qint64 bytes);
+    /**
+     * Marks the extended characters and true colors on the screen and in
+     * the history as used, see ExtendedCharTable.
+     */
+    void markExtendedChars() const;
+    /**
+     * Enables or disables an index of the trigrams in the history lines,
+     * which lets searches skip the lines which cannot match.  The index
+     * costs about 16 bytes per line.  See linesMayMatch()
+     */
+    void setHistoryIndexEnabled(bool enable);
+    /**
+     * Returns false if the lines from @p startLine to @p endLine cannot
+     * contain a match of @p query.  Always returns true if the history
+     * index is disabled or the lines are not all in the history.
+     */
+    bool linesMayMatch(const HistoryTrigramIndex::Query& query, int startLine, int endLine) const;
 
     /**
      * Sets the start of the selection.
@@ -470,6 +537,14 @@ public:
      * @param toLine The last line in the history to retrieve
      */
     void writeLinesToStream(TerminalCharacterDecoder* decoder, int fromLine, int toLine) const;
+    /**
+     * Appends the cells of the lines from @p fromLine to @p toLine to
+     * @p cells, as they are, without decoding them.  The end of each line
+     * in @p cells and its properties are appended to @p lineEnds and
+     * @p lineProperties.  The lines are those of writeLinesToStream().
+     */
+    void copyLineCells(int fromLine, int toLine, QVector<Character>& cells,
+                       QVector<int>& lineEnds, QVector<LineProperty>& lineProperties) const;
 
     /**
      * Copies the selected characters, set using @see setSelBeginXY and @see setSelExtentXY
@@ -555,29 +630,38 @@ public:
      */
     void resetDroppedLines();
 
+    /**
+     * Returns the number which history line @p line, as numbered before the
+     * history was last rewrapped, has in the rewrapped history.  The lines
+     * after the history are moved along.  If the history has not been
+     * rewrapped since the last call to resetReflowedLines(), @p line is
+     * returned.  See reflowHistoryStep()
+     */
+    int reflowedLine(int line) const;
+
+    /** Forgets the line numbers of the history before it was last rewrapped. */
+    void resetReflowedLines();
+
+    /**
+     * Returns the number of lines of output which have been dropped
+     * from the history since the screen was created.  Unlike
+     * droppedLines() this is never reset.
+     */
+    qint64 totalDroppedLines() const { return _totalDroppedLines; }
+
+    /**
+     * Returns a number which changes whenever the lines in the history are
+     * replaced, rather than added to or dropped from it.  This happens when
+     * a new history is set and when the history has been rewrapped.
+     */
+    uint historyGeneration() const { return _historyGeneration; }
+
     /**
       * Fills the buffer @p dest with @p count instances of the default (ie. blank)
       * Character style.
       */
     static void fillWithDefaultChar(Character* dest, int count);
 
-    QSet<uint> usedExtendedChars() const
-    {
-        QSet<uint> result;
-        for (int i = 0; i < lines; ++i)
-        {
-            const ImageLine &il = screenLines[i];
-            for (int j = 0; j < columns; ++j)
-            {
-                if (il[j].rendition & RE_EXTENDED_CHAR)
-                {
-                    result << il[j].character;
-                }
-            }
-        }
-        return result;
-    }
-
 private:
     Screen(const Screen &) = delete;
     Screen &operator=(const Screen &) = delete;
@@ -628,12 +712,28 @@ private:
     // startIndex and endIndex are positions generated using the loc(x,y) macro
     void writeToStream(TerminalCharacterDecoder* decoder, int startIndex,
                        int endIndex, bool preserveLineBreaks = true) const;
+    // joins the wrapped lines of the screen and wraps them at newColumns,
+    // lines which no longer fit on the screen are moved to the history
+    void reflowScreenLines(int newColumns);
+    // starts rewrapping the history at the current width, see reflowHistoryStep()
+    void startHistoryReflow();
+    // stops rewrapping the history and discards the lines rewrapped so far
+    void cancelHistoryReflow();
+    // returns the offsets at which a line of 'length' characters is split when
+    // it is wrapped at 'width' columns.  Double width characters are not split.
+    static QVector<int> wrapPositions(const Character* line, int length, int width);
+
     // copies 'count' lines from the screen buffer into 'dest',
     // starting from 'startLine', where 0 is the first line in the screen buffer
     void copyFromScreen(Character* dest, int startLine, int count) const;
     // copies 'count' lines from the history buffer into 'dest',
     // starting from 'startLine', where 0 is the first line in the history
     void copyFromHistory(Character* dest, int startLine, int count) const;
+    // like copyFromHistory(), but rewraps the lines at the current width
+    // while the history is being rewrapped
+    void copyFromReflowingHistory(Character* dest, int startLine, int count) const;
+    // returns the first line of the wrapped lines which history line 'line' is part of
+    int logicalLineStart(int line) const;
 
 
     // screen image ----------------
@@ -641,17 +741,54 @@ private:
     int columns;
 
     typedef QVector<Character> ImageLine;      // [0..columns]
-    ImageLine*          screenLines;    // [lines]
+    ImageLine*          screenLines;    // [lines+1]
+
+    // screenLines and lineProperties are used as rings, so that scrolling the
+    // whole screen does not have to move any lines.  Screen line 0 is stored
+    // at index _screenLinesHead, the last one ( the spare line at index 'lines' )
+    // just before it.
+    int _screenLinesHead;
+
+    // returns the index in screenLines and lineProperties of screen line y, 0 <= y <= lines
+    inline int physicalLine(int y) const
+    {
+        const int index = y + _screenLinesHead;
+        return index > lines ? index - (lines + 1) : index;
+    }
+    inline ImageLine& screenLineAt(int y) { return screenLines[physicalLine(y)]; }
+    inline const ImageLine& screenLineAt(int y) const { return screenLines[physicalLine(y)]; }
+    inline LineProperty& linePropertyAt(int y) { return lineProperties[physicalLine(y)]; }
+    inline LineProperty linePropertyAt(int y) const { return lineProperties[physicalLine(y)]; }
 
     int _scrolledLines;
     QRect _lastScrolledRegion;
 
     int _droppedLines;
+    qint64 _totalDroppedLines;
+    uint _historyGeneration;
 
     QVarLengthArray<LineProperty,64> lineProperties;
 
     // history buffer ---------------
     HistoryScroll* history;
+    HistoryTrigramIndex* _historyIndex;  // index of 'history', or nullptr
+
+    // reflow ---------------
+    bool _reflowLines;
+    HistoryScroll* _reflowedHistory;  // history rewrapped so far, or nullptr
+    int _reflowSourceLine;            // next line of 'history' to rewrap
+    HistoryTrigramIndex* _reflowedIndex;  // index of '_reflowedHistory', or nullptr
+    // for each line of 'history' rewrapped so far, starting at _reflowLineMapStart,
+    // the number of its first part among the lines added to '_reflowedHistory'
+    QVector<int> _reflowLineMap;
+    int _reflowLineMapStart;          // entries of lines since dropped from 'history'
+    int _reflowAddedLines;            // lines added to '_reflowedHistory'
+    QVector<int> _reflowedLines;      // see reflowedLine()
+    // the last line looked up by logicalLineStart() and the first line of its
+    // logical line, counted from the first line ever added to the history
+    mutable qint64 _logicalLineEnd;
+    mutable qint64 _logicalLineStart;
+    mutable uint _logicalLineGeneration;  // _historyGeneration of the lines
 
     // cursor location
     int cuX;
@@ -660,7 +797,7 @@ private:
     // cursor color and rendition info
     CharacterColor currentForeground;
     CharacterColor currentBackground;
-    quint8 currentRendition;
+    quint16 currentRendition;
 
     // margins ----------------
     int _topMargin;
@@ -681,9 +818,9 @@ private:
     bool blockSelectionMode;  // Column selection mode
 
     // effective colors and rendition ------------
-    CharacterColor effectiveForeground; // These are derived from
-    CharacterColor effectiveBackground; // the cu_* variables above
-    quint8 effectiveRendition;          // to speed up operation
+    PackedColor effectiveForeground;    // These are derived from
+    PackedColor effectiveBackground;    // the cu_* variables above
+    quint16 effectiveRendition;         // to speed up operation
 
     class SavedState
     {
@@ -693,7 +830,7 @@ private:
 
         int cursorColumn;
         int cursorLine;
-        quint8 rendition;
+        quint16 rendition;
         CharacterColor foreground;
         CharacterColor background;
     };
@@ -31,6 +31,8 @@ using namespace Konsole;
 ScreenWindow::ScreenWindow(QObject* parent)
     : QObject(parent)
     , _screen(nullptr)
+    , _screenLock(nullptr)
+    , _snapshot{nullptr, {}, QPoint(), 0, 0, 0, 0}
     , _windowBuffer(nullptr)
     , _windowBufferSize(0)
     , _bufferNeedsUpdate(true)
@@ -49,6 +51,7 @@ void ScreenWindow::setScreen(Screen* screen)
     Q_ASSERT( screen );
 
     _screen = screen;
+    _bufferNeedsUpdate = true;
 }
 
 Screen* ScreenWindow::screen() const
@@ -56,8 +59,20 @@ Screen* ScreenWindow::screen() const
     return _screen;
 }
 
-Character* ScreenWindow::getImage()
+void ScreenWindow::setScreenLock(QRecursiveMutex* lock)
+{
+    _screenLock = lock;
+}
+
+QRecursiveMutex* ScreenWindow::screenLock() const
 {
+    return _screenLock;
+}
+
+const ScreenWindow::Snapshot& ScreenWindow::snapshot()
+{
+    QMutexLocker locker(_screenLock);
+
     // reallocate internal buffer if the window size has changed
     int size = windowLines() * windowColumns();
     if (_windowBuffer == nullptr || _windowBufferSize != size)
@@ -68,8 +83,8 @@ Character* ScreenWindow::getImage()
         _bufferNeedsUpdate = true;
     }
 
-     if (!_bufferNeedsUpdate)
-        return _windowBuffer;
+    if (!_bufferNeedsUpdate)
+        return _snapshot;
 
     _screen->getImage(_windowBuffer,size,
                       currentLine(),endWindowLine());
@@ -79,8 +94,29 @@ Character* ScreenWindow::getImage()
     // with blank characters
     fillUnusedArea();
 
+    _snapshot.image = _windowBuffer;
+    _snapshot.lineProperties = _screen->getLineProperties(currentLine(),endWindowLine());
+    if (_snapshot.lineProperties.count() != windowLines())
+        _snapshot.lineProperties.resize(windowLines());
+    _snapshot.cursorPosition = QPoint(_screen->getCursorX(), _screen->getCursorY());
+    _snapshot.currentLine = currentLine();
+    _snapshot.lineCount = lineCount();
+    _snapshot.columns = windowColumns();
+    _snapshot.totalDroppedLines = _screen->totalDroppedLines();
+
     _bufferNeedsUpdate = false;
-    return _windowBuffer;
+    return _snapshot;
+}
+
+Character* ScreenWindow::getImage()
+{
+    return snapshot().image;
+}
+
+void ScreenWindow::markExtendedChars() const
+{
+    if (_windowBuffer)
+        ExtendedCharTable::instance.markExtendedChars(_windowBuffer, _windowBufferSize);
 }
 
 void ScreenWindow::fillUnusedArea()
@@ -108,31 +144,34 @@ int ScreenWindow::endWindowLine() const
 }
 QVector<LineProperty> ScreenWindow::getLineProperties()
 {
-    QVector<LineProperty> result = _screen->getLineProperties(currentLine(),endWindowLine());
-
-    if (result.count() != windowLines())
-        result.resize(windowLines());
-
-    return result;
+    return snapshot().lineProperties;
 }
 
 QString ScreenWindow::selectedText( bool preserveLineBreaks ) const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->selectedText( preserveLineBreaks );
 }
 
 void ScreenWindow::getSelectionStart( int& column , int& line )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->getSelectionStart(column,line);
     line -= currentLine();
 }
 void ScreenWindow::getSelectionEnd( int& column , int& line )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->getSelectionEnd(column,line);
     line -= currentLine();
 }
 void ScreenWindow::setSelectionStart( int column , int line , bool columnMode )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->setSelectionStart( column , qMin(line + currentLine(),endWindowLine())  , columnMode);
 
     _bufferNeedsUpdate = true;
@@ -141,6 +180,8 @@ void ScreenWindow::setSelectionStart( int column , int line , bool columnMode )
 
 void ScreenWindow::setSelectionEnd( int column , int line )
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->setSelectionEnd( column , qMin(line + currentLine(),endWindowLine()) );
 
     _bufferNeedsUpdate = true;
@@ -149,11 +190,15 @@ void ScreenWindow::setSelectionEnd( int column , int line )
 
 bool ScreenWindow::isSelected( int column , int line )
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->isSelected( column , qMin(line + currentLine(),endWindowLine()) );
 }
 
 void ScreenWindow::clearSelection()
 {
+    QMutexLocker locker(_screenLock);
+
     _screen->clearSelection();
 
     emit selectionChanged();
@@ -171,27 +216,28 @@ int ScreenWindow::windowLines() const
 
 int ScreenWindow::windowColumns() const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->getColumns();
 }
 
 int ScreenWindow::lineCount() const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->getHistLines() + _screen->getLines();
 }
 
 int ScreenWindow::columnCount() const
 {
+    QMutexLocker locker(_screenLock);
+
     return _screen->getColumns();
 }
 
-QPoint ScreenWindow::cursorPosition() const
+QPoint ScreenWindow::cursorPosition()
 {
-    QPoint position;
-
-    position.setX( _screen->getCursorX() );
-    position.setY( _screen->getCursorY() );
-
-    return position;
+    return snapshot().cursorPosition;
 }
 
 int ScreenWindow::currentLine() const
@@ -255,6 +301,8 @@ void ScreenWindow::resetScrollCount()
 
 QRect ScreenWindow::scrollRegion() const
 {
+    QMutexLocker locker(_screenLock);
+
     bool equalToScreenSize = windowLines() == _screen->getLines();
 
     if ( atEndOfOutput() && equalToScreenSize )
@@ -265,6 +313,8 @@ QRect ScreenWindow::scrollRegion() const
 
 void ScreenWindow::notifyOutputChanged()
 {
+    QMutexLocker locker(_screenLock);
+
     // move window to the bottom of the screen and update scroll count
     // if this window is currently tracking the bottom of the screen
     if ( _trackOutput )
@@ -282,6 +332,9 @@ void ScreenWindow::notifyOutputChanged()
         _currentLine = qMax(0,_currentLine -
                               _screen->droppedLines());
 
+        // if the history has been rewrapped, stay at the same output
+        _currentLine = _screen->reflowedLine(_currentLine);
+
         // ensure that the screen window's current position does
         // not go beyond the bottom of the screen
         _currentLine = qMin( _currentLine , _screen->getHistLines() );
@@ -24,6 +24,7 @@
 #include <QObject>
 #include <QPoint>
 #include <QRect>
+#include <QRecursiveMutex>
 
 // Konsole
 #include "Character.h"
@@ -73,18 +74,54 @@ public:
     /** Returns the screen which this window looks onto */
     Screen* screen() const;
 
+    /**
+     * Sets the lock which is held while the window accesses its screen.
+     * See Emulation::setScreenLocking()
+     */
+    void setScreenLock(QRecursiveMutex* lock);
+    /** Returns the lock set with setScreenLock(), or nullptr if there is none */
+    QRecursiveMutex* screenLock() const;
+
+    /**
+     * The part of the screen which is visible through the window.  All of
+     * it is taken while the screen is locked, so that it is consistent even
+     * if the emulation runs on another thread.
+     */
+    struct Snapshot
+    {
+        Character* image;                       // windowLines() lines of 'columns' characters
+        QVector<LineProperty> lineProperties;   // windowLines() entries
+        QPoint cursorPosition;
+        int currentLine;
+        int lineCount;
+        int columns;
+        qint64 totalDroppedLines;               // see Screen::totalDroppedLines()
+    };
+    /**
+     * Returns the snapshot of the window, which is taken again if the screen
+     * or the window changed since the last call.  The snapshot is managed by
+     * the ScreenWindow instance and valid until the next call.
+     */
+    const Snapshot& snapshot();
+
     /**
      * Returns the image of characters which are currently visible through this window
-     * onto the screen.
+     * onto the screen.  See snapshot()
      *
      * The returned buffer is managed by the ScreenWindow instance and does not need to be
      * deleted by the caller.
      */
     Character* getImage();
 
+    /**
+     * Marks the extended characters and true colors in the image copied last
+     * as used, see ExtendedCharTable
+     */
+    void markExtendedChars() const;
+
     /**
      * Returns the line attributes associated with the lines of characters which
-     * are currently visible through this window
+     * are currently visible through this window.  See snapshot()
      */
     QVector<LineProperty> getLineProperties();
 
@@ -159,9 +196,9 @@ public:
 
     /**
      * Returns the position of the cursor
-     * within the window.
+     * within the window.  See snapshot()
      */
-    QPoint cursorPosition() const;
+    QPoint cursorPosition();
 
     /**
      * Convenience method. Returns true if the window is currently at the bottom
@@ -249,6 +286,8 @@ private:
     void fillUnusedArea();
 
     Screen* _screen; // see setScreen() , screen()
+    QRecursiveMutex* _screenLock; // see setScreenLock() , screenLock()
+    Snapshot _snapshot; // see snapshot()
     Character* _windowBuffer;
     int _windowBufferSize;
     bool _bufferNeedsUpdate;
@@ -25,6 +25,8 @@
 SearchBar::SearchBar(QWidget *parent) : QWidget(parent)
 {
     widget.setupUi(this);
+    widget.progressLabel->hide();
+    widget.matchesLabel->hide();
     setAutoFillBackground(true); // make it always opaque, especially inside translucent windows
     connect(widget.closeButton, &QAbstractButton::clicked, this, &SearchBar::hide);
     connect(widget.searchTextEdit, SIGNAL(textChanged(QString)), this, SIGNAL(searchCriteriaChanged()));
@@ -76,16 +78,32 @@ bool SearchBar::highlightAllMatches()
     return m_highlightMatchesMenuEntry->isChecked();
 }
 
+void SearchBar::setMatchCount(int current, int total)
+{
+    if (current > 0)
+        widget.matchesLabel->setText(tr("Match %1 of %2").arg(current).arg(total));
+    else
+        widget.matchesLabel->setText(tr("%1 matches").arg(total));
+    widget.matchesLabel->show();
+}
+
+void SearchBar::clearMatchCount()
+{
+    widget.matchesLabel->hide();
+}
+
 void SearchBar::show()
 {
     QWidget::show();
     widget.searchTextEdit->setFocus();
     widget.searchTextEdit->selectAll();
+    Q_EMIT visibilityChanged(true);
 }
 
 void SearchBar::hide()
 {
     QWidget::hide();
+    Q_EMIT visibilityChanged(false);
     if (QWidget *p = parentWidget())
     {
         p->setFocus(Qt::OtherFocusReason); // give the focus to the parent widget on hiding
@@ -99,6 +117,18 @@ void SearchBar::noMatchFound()
     widget.searchTextEdit->setPalette(palette);
 }
 
+void SearchBar::searchProgress(int linesSearched, int linesTotal)
+{
+    if (linesTotal <= 0)
+        return;
+    widget.progressLabel->setText(tr("%1%").arg(100LL * linesSearched / linesTotal));
+    widget.progressLabel->show();
+}
+
+void SearchBar::searchFinished()
+{
+    widget.progressLabel->hide();
+}
 
 void SearchBar::keyReleaseEvent(QKeyEvent* keyEvent)
 {
@@ -34,16 +34,21 @@ public:
     bool useRegularExpression();
     bool matchCase();
     bool highlightAllMatches();
+    void setMatchCount(int current, int total);
+    void clearMatchCount();
 
 public slots:
     void noMatchFound();
     void hide();
+    void searchProgress(int linesSearched, int linesTotal);
+    void searchFinished();
 
 signals:
     void searchCriteriaChanged();
     void highlightMatchesChanged(bool highlightMatches);
     void findNext();
     void findPrevious();
+    void visibilityChanged(bool visible);
 
 protected:
     void keyReleaseEvent(QKeyEvent* keyEvent) override;
@@ -31,12 +31,14 @@
 // Qt
 #include <QApplication>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QStringList>
 #include <QFile>
 #include <QtDebug>
 #include <QRegularExpression>
 
+#include "EmulationThread.h"
 #include "Pty.h"
 //#include "kptyprocess.h"
 #include "TerminalDisplay.h"
@@ -51,6 +53,10 @@ Session::Session(QObject* parent) :
     QObject(parent),
         _shellProcess(nullptr)
         , _emulation(nullptr)
+        , _emulationThread(nullptr)
+        , _ingestOffset(0)
+        , _ingestTimer(nullptr)
+        , _ptyThrottled(false)
         , _monitorActivity(false)
         , _monitorSilence(false)
         , _notifiedActivity(false)
@@ -118,6 +124,11 @@ Session::Session(QObject* parent) :
     _monitorTimer = new QTimer(this);
     _monitorTimer->setSingleShot(true);
     connect(_monitorTimer, SIGNAL(timeout()), this, SLOT(monitorTimerDone()));
+
+    //setup timer for processing output which did not fit into one pass of the event loop
+    _ingestTimer = new QTimer(this);
+    _ingestTimer->setSingleShot(true);
+    connect(_ingestTimer, &QTimer::timeout, this, &Session::processIngestBuffer);
 }
 
 WId Session::windowId() const
@@ -188,6 +199,17 @@ void Session::addView(TerminalDisplay * widget)
         widget->setBracketedPasteMode(_emulation->programBracketedPasteMode());
 
         widget->setScreenWindow(_emulation->createWindow());
+
+        // updates are paced to the refresh rate of the screen the view is on
+        connect( widget , &TerminalDisplay::refreshRateChanged , _emulation , &Emulation::setRefreshRate );
+        if ( widget->refreshRate() > 0 )
+            _emulation->setRefreshRate( widget->refreshRate() );
+
+        // the history of the session which was focused last is the last to
+        // lose lines when the histories of all sessions use too much memory
+        connect( widget , &TerminalDisplay::termGetFocus , this , [this] {
+            HistoryMemoryGovernor::instance()->markViewed(_emulation);
+        });
     }
 
     //connect view signals and slots
@@ -596,6 +618,7 @@ void Session::sendKeyEvent(QKeyEvent* e) const
 Session::~Session()
 {
     close();
+    delete _emulationThread;
     delete _emulation;
     delete _shellProcess;
 //  delete _zmodemProc;
@@ -927,12 +950,100 @@ void Session::zmodemFinished()
   }
 }
 */
+// Output of the terminal program is processed in portions, so that a program
+// which writes faster than the emulation can keep up does not block the event
+// loop.  When too much is waiting to be processed, reading from the pty stops
+// and the program is held up by the kernel until the backlog has been worked off.
+
+// bytes and milliseconds processed at most per pass of the event loop
+static const int INGEST_BYTE_BUDGET = 256 * 1024;
+static const int INGEST_TIME_BUDGET = 8;
+// bytes passed to the emulation at once
+static const int INGEST_SLICE_SIZE = 16 * 1024;
+// reading stops above the high and resumes below the low water mark
+static const int INGEST_HIGH_WATER = 1024 * 1024;
+static const int INGEST_LOW_WATER = 128 * 1024;
+
 void Session::onReceiveBlock( const char * buf, int len )
 {
-    _emulation->receiveData( buf, len );
+    if (_emulationThread)
+    {
+        _emulationThread->receiveData( buf, len );
+        if (!_ptyThrottled && _emulationThread->pendingBytes() > INGEST_HIGH_WATER)
+        {
+            setPtyThrottled(true);
+            _emulationThread->notifyWhenBelow(INGEST_LOW_WATER, this, [this] {
+                setPtyThrottled(false);
+            });
+        }
+    }
+    else
+    {
+        _ingestBuffer.append( buf, len );
+        // output arriving while nothing is queued is processed right away
+        if (!_ingestTimer->isActive())
+            processIngestBuffer();
+        else if (_ingestBuffer.size() - _ingestOffset > INGEST_HIGH_WATER)
+            setPtyThrottled(true);
+    }
     emit receivedData( QString::fromLatin1( buf, len ) );
 }
 
+void Session::processIngestBuffer()
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    int budget = INGEST_BYTE_BUDGET;
+    while (_ingestOffset < _ingestBuffer.size() && budget > 0)
+    {
+        const int length = qMin(INGEST_SLICE_SIZE, _ingestBuffer.size() - _ingestOffset);
+        {
+            // the screens may be read by a search running in another thread
+            QMutexLocker locker(_emulation->screenLock());
+            _emulation->receiveData( _ingestBuffer.constData() + _ingestOffset, length );
+        }
+        _ingestOffset += length;
+        budget -= length;
+
+        if (elapsed.elapsed() >= INGEST_TIME_BUDGET)
+            break;
+    }
+
+    const int pending = _ingestBuffer.size() - _ingestOffset;
+    if (pending == 0)
+    {
+        // keep the allocation around for the next burst
+        _ingestBuffer.resize(0);
+        _ingestOffset = 0;
+        _ingestTimer->stop();
+    }
+    else
+    {
+        if (_ingestOffset > pending)
+        {
+            _ingestBuffer.remove(0, _ingestOffset);
+            _ingestOffset = 0;
+        }
+        // continue after input and paint events have been handled
+        _ingestTimer->start(0);
+    }
+
+    if (pending > INGEST_HIGH_WATER)
+        setPtyThrottled(true);
+    else if (pending < INGEST_LOW_WATER)
+        setPtyThrottled(false);
+}
+
+void Session::setPtyThrottled(bool throttled)
+{
+    if (throttled == _ptyThrottled)
+        return;
+
+    _ptyThrottled = throttled;
+    _shellProcess->lockPty(throttled);
+}
+
 QSize Session::size()
 {
     return _emulation->imageSize();
@@ -959,6 +1070,40 @@ int Session::getPtySlaveFd() const
     return ptySlaveFd;
 }
 
+void Session::setThreadedEmulation(bool enable)
+{
+    if (enable == threadedEmulation())
+        return;
+
+    if (enable)
+    {
+        _emulation->setScreenLocking(true);
+        _emulationThread = new EmulationThread(_emulation);
+        _emulationThread->start();
+
+        // hand over the output which was not processed yet
+        _ingestTimer->stop();
+        if (_ingestOffset < _ingestBuffer.size())
+            _emulationThread->receiveData(_ingestBuffer.constData() + _ingestOffset,
+                                          _ingestBuffer.size() - _ingestOffset);
+        _ingestBuffer.resize(0);
+        _ingestOffset = 0;
+    }
+    else
+    {
+        // processes the output which is still queued before returning
+        delete _emulationThread;
+        _emulationThread = nullptr;
+        _emulation->setScreenLocking(false);
+    }
+    setPtyThrottled(false);
+}
+
+bool Session::threadedEmulation() const
+{
+    return _emulationThread != nullptr;
+}
+
 SessionGroup::SessionGroup()
         : _masterMode(0)
 {
@@ -37,6 +37,7 @@ class KProcess;
 namespace Konsole {
 
 class Emulation;
+class EmulationThread;
 class Pty;
 class TerminalDisplay;
 //class ZModemDialog;
@@ -373,6 +374,21 @@ public:
      */
     int getPtySlaveFd() const;
 
+    /**
+     * Sets whether the output of the terminal program is processed by the
+     * emulation on a worker thread instead of the thread the session lives in.
+     *
+     * This keeps a flood of output from blocking the user interface.  Views
+     * attached to the session copy the screen image between two blocks of
+     * processed output, and key presses are translated and sent to the
+     * terminal program without waiting for the emulation.
+     *
+     * Disabled by default.
+     */
+    void setThreadedEmulation(bool enable);
+    /** Returns whether the emulation runs on a worker thread.  See setThreadedEmulation() */
+    bool threadedEmulation() const;
+
 public slots:
 
     /**
@@ -492,6 +508,8 @@ private slots:
 //  void fireZModemDetected();
 
     void onReceiveBlock( const char * buffer, int len );
+    // passes queued output of the terminal program to the emulation
+    void processIngestBuffer();
     void monitorTimerDone();
 
     void onViewSizeChange(int height, int width);
@@ -511,11 +529,19 @@ private:
 
     void updateTerminalSize();
     WId windowId() const;
+    // stops or resumes reading the output of the terminal program
+    void setPtyThrottled(bool throttled);
 
     int            _uniqueIdentifier;
 
     Pty     *_shellProcess;
     Emulation  *  _emulation;
+    EmulationThread * _emulationThread;
+
+    QByteArray     _ingestBuffer;   // output which the emulation has not processed yet
+    int            _ingestOffset;   // start of the unprocessed part of _ingestBuffer
+    QTimer    *    _ingestTimer;
+    bool           _ptyThrottled;
 
     QList<TerminalDisplay *> _views;
 
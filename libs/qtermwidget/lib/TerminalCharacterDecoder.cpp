@@ -112,14 +112,13 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
     {
         if (characters[i].rendition & RE_EXTENDED_CHAR)
         {
-            ushort extendedCharLength = 0;
-            const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, extendedCharLength);
-            if (chars)
+            ExtendedCharTable::Sequence chars;
+            if (ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, chars))
             {
                 std::wstring str;
-                for (ushort nchar = 0; nchar < extendedCharLength; nchar++)
+                for (const uint c : std::as_const(chars))
                 {
-                    str.push_back(chars[nchar]);
+                    str.push_back(c);
                 }
                 plainText += str;
                 i += qMax(1, string_width(str));
@@ -241,14 +240,11 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
         {
             if (characters[i].rendition & RE_EXTENDED_CHAR)
             {
-                ushort extendedCharLength = 0;
-                const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, extendedCharLength);
-                if (chars)
+                ExtendedCharTable::Sequence chars;
+                ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, chars);
+                for (const uint c : std::as_const(chars))
                 {
-                    for (ushort nchar = 0; nchar < extendedCharLength; nchar++)
-                    {
-                        text.push_back(chars[nchar]);
-                    }
+                    text.push_back(c);
                 }
             }
             else
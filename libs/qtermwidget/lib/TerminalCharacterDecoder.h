@@ -139,9 +139,9 @@ private:
     QTextStream* _output;
     const ColorEntry* _colorTable;
     bool _innerSpanOpen;
-    quint8 _lastRendition;
-    CharacterColor _lastForeColor;
-    CharacterColor _lastBackColor;
+    quint16 _lastRendition;
+    PackedColor _lastForeColor;
+    PackedColor _lastBackColor;
 
 };
 
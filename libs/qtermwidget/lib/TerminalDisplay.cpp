@@ -39,10 +39,12 @@
 #include <QPainter>
 #include <QPixmap>
 #include <QRegularExpression>
+#include <QScreen>
 #include <QStyle>
 #include <QTimer>
 #include <QtDebug>
 #include <QUrl>
+#include <QWindow>
 #include <QMimeData>
 #include <QDrag>
 
@@ -61,6 +63,7 @@
 // Konsole
 //#include <config-apps.h>
 #include "Filter.h"
+#include "HistoryMatchIndex.h"
 #include "konsole_wcwidth.h"
 #include "ScreenWindow.h"
 #include "TerminalCharacterDecoder.h"
@@ -439,10 +442,19 @@ TerminalDisplay::TerminalDisplay(QWidget *parent)
   setLayout( _gridLayout );
 
   new AutoScrollHandler(this);
+
+  // the ids in the image must not be reused while it is compared with new ones
+  ExtendedCharTable::instance.registerOwner(this, [this] {
+      if (_image)
+          ExtendedCharTable::instance.markExtendedChars(_image, _imageSize);
+      _filterChain->markExtendedChars();
+  });
 }
 
 TerminalDisplay::~TerminalDisplay()
 {
+  ExtendedCharTable::instance.unregisterOwner(this);
+
   disconnect(_blinkTimer);
   disconnect(_blinkCursorTimer);
   if (_hideMouseTimer)
@@ -843,7 +855,7 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
     }
 
     // setup pen
-    const CharacterColor& textColor = ( invertCharacterColor ? style->backgroundColor : style->foregroundColor );
+    const PackedColor& textColor = ( invertCharacterColor ? style->backgroundColor : style->foregroundColor );
     const QColor color = textColor.color(_colorTable);
     QPen pen = painter.pen();
     if ( pen.color() != color )
@@ -1086,15 +1098,20 @@ void TerminalDisplay::processFilters()
 
     QRegion preUpdateHotSpots = hotSpotRegion();
 
-    // use _screenWindow->getImage() here rather than _image because
+    // use the window's snapshot here rather than _image because
     // other classes may call processFilters() when this display's
     // ScreenWindow emits a scrolled() signal - which will happen before
     // updateImage() is called on the display and therefore _image is
     // out of date at this point
-    _filterChain->setImage( _screenWindow->getImage(),
+    //
+    // lines are numbered including those dropped from the history, so that
+    // the filter chain can tell how far the lines it has seen have moved
+    const ScreenWindow::Snapshot& snapshot = _screenWindow->snapshot();
+    _filterChain->setImage( snapshot.image,
                             _screenWindow->windowLines(),
-                            _screenWindow->windowColumns(),
-                            _screenWindow->getLineProperties() );
+                            snapshot.columns,
+                            snapshot.lineProperties,
+                            snapshot.currentLine + snapshot.totalDroppedLines );
     _filterChain->process();
 
     QRegion postUpdateHotSpots = hotSpotRegion();
@@ -1120,11 +1137,14 @@ void TerminalDisplay::updateImage()
      updateImageSize();
   }
 
-  Character* const newimg = _screenWindow->getImage();
+  // the image, its size and position are taken together, as the screen
+  // may change on the emulation's thread in between
+  const ScreenWindow::Snapshot& snapshot = _screenWindow->snapshot();
+  Character* const newimg = snapshot.image;
   int lines = _screenWindow->windowLines();
-  int columns = _screenWindow->windowColumns();
+  int columns = snapshot.columns;
 
-  setScroll( _screenWindow->currentLine() , _screenWindow->lineCount() );
+  setScroll( snapshot.currentLine , snapshot.lineCount );
 
   Q_ASSERT( this->_usedLines <= this->_lines );
   Q_ASSERT( this->_usedColumns <= this->_columns );
@@ -1136,8 +1156,8 @@ void TerminalDisplay::updateImage()
   int    tLy = tL.y();
   _hasBlinker = false;
 
-  CharacterColor cf;       // undefined
-  CharacterColor _clipboard;       // undefined
+  PackedColor cf;       // undefined
+  PackedColor _clipboard;       // undefined
   int cr  = -1;   // undefined
 
   const int linesToUpdate = qMin(this->_lines, qMax(0,lines  ));
@@ -1520,6 +1540,7 @@ void TerminalDisplay::paintEvent( QPaintEvent* pe )
   }
   drawInputMethodPreeditString(paint,preeditRect());
   paintFilters(paint);
+  paintSearchMatches(paint);
 }
 
 QPoint TerminalDisplay::cursorPosition() const
@@ -1683,6 +1704,81 @@ void TerminalDisplay::paintFilters(QPainter& painter)
     }
 }
 
+void TerminalDisplay::setSearchMatches(HistoryMatchIndex* matches)
+{
+    if (_searchMatches)
+        disconnect(_searchMatches, nullptr, this, nullptr);
+
+    _searchMatches = matches;
+    if (_searchMatches)
+        connect(_searchMatches, &HistoryMatchIndex::changed, this, [this] { update(); });
+    update();
+}
+
+qreal TerminalDisplay::refreshRate() const
+{
+    return _watchedScreen ? _watchedScreen->refreshRate() : 0;
+}
+
+void TerminalDisplay::watchScreen()
+{
+    QWindow* window = this->window()->windowHandle();
+    if (window != _watchedWindow)
+    {
+        disconnect(_screenChangedConnection);
+        _watchedWindow = window;
+        if (window)
+            _screenChangedConnection = connect(window, &QWindow::screenChanged, this, [this] { watchScreen(); });
+    }
+
+    QScreen* screen = window ? window->screen() : nullptr;
+    if (screen == _watchedScreen)
+        return;
+
+    disconnect(_refreshRateConnection);
+    _watchedScreen = screen;
+    if (screen)
+        _refreshRateConnection = connect(screen, &QScreen::refreshRateChanged, this, &TerminalDisplay::refreshRateChanged);
+    emit refreshRateChanged(refreshRate());
+}
+
+void TerminalDisplay::paintSearchMatches(QPainter& painter)
+{
+    if (!_searchMatches || !_screenWindow || _searchMatches->count() == 0)
+        return;
+
+    int leftMargin = _leftBaseMargin
+                     + ((_scrollbarLocation == QTermWidget::ScrollBarLeft
+                         && !_scrollBar->style()->styleHint(QStyle::SH_ScrollBar_Transient, nullptr, _scrollBar))
+                        ? _scrollBar->width() : 0);
+
+    // the highlight colour of the palette, translucent so that the text stays readable
+    QColor color = palette().color(QPalette::Highlight);
+    color.setAlpha(100);
+    const QBrush brush(color);
+
+    // only the matches in the visible lines are looked up
+    const int firstLine = _screenWindow->currentLine();
+    const QList<HistoryMatchIndex::Match> matches = _searchMatches->matchesInLines(firstLine, firstLine + _lines - 1);
+    for (const HistoryMatchIndex::Match& match : matches)
+    {
+        const int startLine = qMax(0, int(match.startLine - firstLine));
+        const int endLine = qMin(_lines - 1, int(match.endLine - firstLine));
+        for (int line = startLine; line <= endLine; line++)
+        {
+            const int startColumn = (line == match.startLine - firstLine) ? match.startColumn : 0;
+            const int endColumn = (line == match.endLine - firstLine) ? match.endColumn : _columns - 1;
+
+            QRect r;
+            r.setCoords( startColumn*_fontWidth + leftMargin,
+                         line*_fontHeight + _topBaseMargin,
+                         (endColumn+1)*_fontWidth - 1 + leftMargin,
+                         (line+1)*_fontHeight - 1 + _topBaseMargin );
+            painter.fillRect(r, brush);
+        }
+    }
+}
+
 // NOTE: This should be called only when "_fixedFont" is set to "false" (temporarily).
 int TerminalDisplay::textWidth(const int startColumn, const int length, const int line) const
 {
@@ -1750,15 +1846,13 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
       if ( _image[loc(x,y)].rendition & RE_EXTENDED_CHAR )
       {
         // sequence of characters
-        ushort extendedCharLength = 0;
-        uint* chars = ExtendedCharTable::instance
-                        .lookupExtendedChar(_image[loc(x,y)].character,extendedCharLength);
-        if (chars)
+        ExtendedCharTable::Sequence chars;
+        if (ExtendedCharTable::instance.lookupExtendedChar(_image[loc(x,y)].character, chars))
         {
-            Q_ASSERT(extendedCharLength > 1);
-            bufferSize += extendedCharLength - 1;
+            Q_ASSERT(chars.size() > 1);
+            bufferSize += chars.size() - 1;
             unistr.resize(bufferSize);
-            for ( int index = 0 ; index < extendedCharLength ; index++ )
+            for ( int index = 0 ; index < chars.size() ; index++ )
             {
                 Q_ASSERT( p < bufferSize );
                 unistr[p++] = chars[index];
@@ -1782,9 +1876,9 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
       bool bigWidth = _fixedFont && !doubleWidth && charWidth > _fontWidth;
       bool tooWide = bigWidth && charWidth >= 2 * _fontWidth;
       bool smallWidth = _fixedFont && c && charWidth < _fontWidth;
-      CharacterColor currentForeground = _image[loc(x,y)].foregroundColor;
-      CharacterColor currentBackground = _image[loc(x,y)].backgroundColor;
-      quint8 currentRendition = _image[loc(x,y)].rendition;
+      PackedColor currentForeground = _image[loc(x,y)].foregroundColor;
+      PackedColor currentBackground = _image[loc(x,y)].backgroundColor;
+      quint16 currentRendition = _image[loc(x,y)].rendition;
 
       quint32 nxtC = 0;
       bool nxtDoubleWidth = false;
@@ -1804,14 +1898,13 @@ void TerminalDisplay::drawContents(QPainter &paint, const QRect &rect)
         if (_image[loc(x+len,y)].rendition & RE_EXTENDED_CHAR)
         {
             // sequence of characters
-            ushort extendedCharLength = 0;
-            const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(c, extendedCharLength);
-            if (chars)
+            ExtendedCharTable::Sequence chars;
+            if (ExtendedCharTable::instance.lookupExtendedChar(c, chars))
             {
-              Q_ASSERT(extendedCharLength > 1);
-              bufferSize += extendedCharLength - 1;
+              Q_ASSERT(chars.size() > 1);
+              bufferSize += chars.size() - 1;
               unistr.resize(bufferSize);
-              for ( int index = 0 ; index < extendedCharLength ; index++ )
+              for ( int index = 0 ; index < chars.size() ; index++ )
               {
                 Q_ASSERT( p < bufferSize );
                 unistr[p++] = chars[index];
@@ -1999,6 +2092,9 @@ void TerminalDisplay::updateImageSize()
 void TerminalDisplay::showEvent(QShowEvent*)
 {
     emit changedContentSizeSignal(_contentHeight,_contentWidth);
+
+    // the window of the display only exists once it is shown
+    watchScreen();
 }
 void TerminalDisplay::hideEvent(QHideEvent*)
 {
@@ -2850,14 +2946,13 @@ QChar TerminalDisplay::charClass(const Character &ch) const
 {
     if (ch.rendition & RE_EXTENDED_CHAR)
     {
-        ushort extendedCharLength = 0;
-        const uint* chars = ExtendedCharTable::instance.lookupExtendedChar(ch.character, extendedCharLength);
-        if (chars && extendedCharLength > 0)
+        ExtendedCharTable::Sequence chars;
+        if (ExtendedCharTable::instance.lookupExtendedChar(ch.character, chars))
         {
             std::wstring str;
-            for (ushort nchar = 0; nchar < extendedCharLength; nchar++)
+            for (const uint c : std::as_const(chars))
             {
-                str.push_back(chars[nchar]);
+                str.push_back(c);
             }
             const QString s = QString::fromStdWString(str);
             if (_wordCharacters.contains(s, Qt::CaseInsensitive))
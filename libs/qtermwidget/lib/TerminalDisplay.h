@@ -38,9 +38,11 @@ class QDragEnterEvent;
 class QDropEvent;
 class QLabel;
 class QTimer;
+class QWindow;
 class QEvent;
 class QGridLayout;
 class QKeyEvent;
+class QScreen;
 class QShowEvent;
 class QHideEvent;
 class QTimerEvent;
@@ -71,6 +73,7 @@ namespace Konsole
 
 extern unsigned short vt100_graphics[32];
 
+class HistoryMatchIndex;
 class ScreenWindow;
 class ScrollBar;
 
@@ -148,6 +151,20 @@ public:
      */
     FilterChain* filterChain() const;
 
+    /**
+     * Sets the search matches which are highlighted on top of the text, or
+     * none if @p matches is nullptr.  Only the matches in the visible lines
+     * are looked up when the display is painted.
+     */
+    void setSearchMatches(HistoryMatchIndex* matches);
+
+    /**
+     * Returns the refresh rate, in Hz, of the screen the display is shown
+     * on, or 0 if it is not known.
+     * @see refreshRateChanged()
+     */
+    qreal refreshRate() const;
+
     /**
      * Updates the filters in the display's filter chain.  This will cause
      * the hotspots to be updated to match the current image.
@@ -584,6 +601,12 @@ signals:
     void notifyBell(const QString&);
     void usesMouseChanged();
 
+    /**
+     * Emitted when the display has moved to another screen, or the refresh
+     * rate of its screen has changed.
+     */
+    void refreshRateChanged(qreal rate);
+
 protected:
     bool event( QEvent * ) override;
 
@@ -653,6 +676,9 @@ private slots:
 
 private:
 
+    // follows the screen the window of the display is on, see refreshRateChanged()
+    void watchScreen();
+
     // -- Drawing helpers --
 
     // determine the width of this text
@@ -717,6 +743,7 @@ private:
     void makeImage();
 
     void paintFilters(QPainter& painter);
+    void paintSearchMatches(QPainter& painter);
 
     void calDrawTextAdditionHeight(QPainter& painter);
 
@@ -845,6 +872,11 @@ private:
     // list of filters currently applied to the display.  used for links and
     // search highlight
     TerminalImageFilterChain* _filterChain;
+    QPointer<HistoryMatchIndex> _searchMatches; // see setSearchMatches()
+    QPointer<QWindow> _watchedWindow;   // see watchScreen()
+    QPointer<QScreen> _watchedScreen;
+    QMetaObject::Connection _screenChangedConnection;
+    QMetaObject::Connection _refreshRateConnection;
     QRegion _mouseOverHotspotArea;
 
     QTermWidget::KeyboardCursorShape _cursorShape;
@@ -32,6 +32,7 @@
 #include <QEvent>
 #include <QKeyEvent>
 #include <QDebug>
+#include <QThread>
 
 // Konsole
 #include "KeyboardTranslator.h"
@@ -60,12 +61,14 @@ Vt102Emulation::~Vt102Emulation()
 
 void Vt102Emulation::clearEntireScreen()
 {
+  QMutexLocker locker(screenLock());
   _currentScreen->clearEntireScreen();
   bufferedUpdate();
 }
 
 void Vt102Emulation::reset()
 {
+  QMutexLocker locker(screenLock());
   resetTokenizer();
   resetModes();
   resetCharset(0);
@@ -165,6 +168,7 @@ void Vt102Emulation::reset()
 
 void Vt102Emulation::resetTokenizer()
 {
+  tokenizerState = StateGround;
   tokenBufferPos = 0;
   argc = 0;
   argv[0] = 0;
@@ -190,77 +194,132 @@ void Vt102Emulation::addToCurrentToken(wchar_t cc)
   tokenBufferPos = qMin(tokenBufferPos+1,MAX_TOKEN_LENGTH-1);
 }
 
-// Character Class flags used while decoding
-#define CTL  1  // Control character
-#define CHR  2  // Printable character
-#define CPN  4  // TODO: Document me
-#define DIG  8  // Digit
-#define SCS 16  // TODO: Document me
-#define GRP 32  // TODO: Document me
-#define CPS 64  // Character which indicates end of window resize
-                // escape sequence '\e[8;<row>;<col>t'
+#define ESC 27
+#define DEL 127
 
 void Vt102Emulation::initTokenizer()
 {
   int i;
   quint8* s;
   for(i = 0;i < 256; ++i)
-    charClass[i] = 0;
-  for(i = 0;i < 32; ++i)
-    charClass[i] |= CTL;
-  for(i = 32;i < 256; ++i)
-    charClass[i] |= CHR;
+    charClass[i] = ClassOther;
   for(s = (quint8*)"@ABCDEFGHILMPSTXZbcdfry"; *s; ++s)
-    charClass[*s] |= CPN;
+    charClass[*s] = ClassCsiPn;
   // resize = \e[8;<row>;<col>t
-  for(s = (quint8*)"t"; *s; ++s)
-    charClass[*s] |= CPS;
+  charClass['t'] = ClassCsiPs;
   for(s = (quint8*)"0123456789"; *s; ++s)
-    charClass[*s] |= DIG;
+    charClass[*s] = ClassDigit;
   for(s = (quint8*)"()+*%"; *s; ++s)
-    charClass[*s] |= SCS;
-  for(s = (quint8*)"()+*#[]%"; *s; ++s)
-    charClass[*s] |= GRP;
+    charClass[*s] = ClassCharset;
+  charClass[ESC] = ClassEscape;
+  charClass[ESC+128] = ClassCsi;
+  charClass[';'] = ClassSeparator;
+  charClass[':'] = ClassSeparator;
+  charClass[' '] = ClassSpace;
+  charClass['?'] = ClassQuestion;
+  charClass['>'] = ClassGreater;
+  charClass['!'] = ClassExclamation;
+  charClass['['] = ClassOpenBracket;
+  charClass[']'] = ClassCloseBracket;
+  charClass['#'] = ClassHash;
+  charClass['q'] = ClassLowerQ;
+  charClass['Y'] = ClassUpperY;
+
+  auto setAll = [this](int state, int action, int nextState) {
+    for (int c = 0; c < CharClassCount; ++c)
+      transitions[state][c] = { quint8(action), quint8(nextState) };
+  };
+  auto set = [this](int state, int c, int action, int nextState) {
+    transitions[state][c] = { quint8(action), quint8(nextState) };
+  };
+
+  // ANSI mode
+  setAll(StateGround,           ActionPrint,            StateGround);
+  set(StateGround,              ClassEscape,            ActionNone,           StateEscape);
+  set(StateGround,              ClassCsi,               ActionCsiIntroducer,  StateCsiEntry);
+
+  setAll(StateEscape,           ActionEscDispatch,      StateGround);
+  set(StateEscape,              ClassOpenBracket,       ActionNone,           StateCsiEntry);
+  set(StateEscape,              ClassCloseBracket,      ActionNone,           StateOscString);
+  set(StateEscape,              ClassCharset,           ActionNone,           StateCharsetEntry);
+  set(StateEscape,              ClassHash,              ActionNone,           StateDecEntry);
+
+  setAll(StateCharsetEntry,     ActionCharsetDispatch,  StateGround);
+  setAll(StateDecEntry,         ActionDecDispatch,      StateGround);
+
+  // the OSC string is collected by receiveChar() itself
+  setAll(StateOscString,        ActionNone,             StateOscString);
+
+  static const TokenizerAction kindDispatch[CsiKindCount] = {
+    ActionCsiDispatch, ActionCsiQuestionDispatch, ActionCsiGreaterDispatch, ActionCsiExclamationDispatch
+  };
+  for (int kind = 0; kind < CsiKindCount; ++kind)
+  {
+    const int states[3] = { StateCsiFirst + kind, StateCsiSpace + kind, StateCsiParam + kind };
+    for (int state : states)
+    {
+      setAll(state, kindDispatch[kind], StateGround);
+      if (kind == CsiPlain)
+      {
+        set(state, ClassCsiPn,  ActionCsiPnDispatch, StateGround);
+        set(state, ClassCsiPs,  ActionCsiPsDispatch, StateGround);
+      }
+      if (kind != CsiExclamation)
+      {
+        set(state, ClassDigit,      ActionParam,     StateCsiParam + kind);
+        set(state, ClassSeparator,  ActionSeparator, StateCsiParam + kind);
+      }
+    }
+    // ESC[ <1 char> ' ' 'q'
+    set(StateCsiFirst + kind,   ClassSpace,   ActionNone,             StateCsiSpace + kind);
+    set(StateCsiSpace + kind,   ClassLowerQ,  ActionCsiSpaceDispatch, StateGround);
+  }
+
+  // the character following ESC[ behaves like a parameter character of a
+  // plain CSI sequence, unless it selects one of the other kinds
+  for (int c = 0; c < CharClassCount; ++c)
+  {
+    transitions[StateCsiEntry][c] = transitions[StateCsiParam + CsiPlain][c];
+    if (transitions[StateCsiEntry][c].nextState == StateCsiParam + CsiPlain)
+      transitions[StateCsiEntry][c].nextState = StateCsiFirst + CsiPlain;
+  }
+  for (int state : { StateCsiEntry, StateCharsetEntry, StateDecEntry })
+  {
+    set(state, ClassQuestion,     ActionNone, StateCsiFirst + CsiQuestion);
+    set(state, ClassGreater,      ActionNone, StateCsiFirst + CsiGreater);
+    set(state, ClassExclamation,  ActionNone, StateCsiFirst + CsiExclamation);
+  }
+
+  // VT52 mode
+  setAll(StateVt52Ground,       ActionPrintVt52,        StateGround);
+  set(StateVt52Ground,          ClassEscape,            ActionNone,           StateVt52Escape);
+  set(StateVt52Ground,          ClassWide,              ActionVt52Dispatch,   StateGround);
+
+  setAll(StateVt52Escape,       ActionVt52Dispatch,     StateGround);
+  set(StateVt52Escape,          ClassUpperY,            ActionNone,           StateVt52Cursor);
+
+  setAll(StateVt52Cursor,       ActionNone,             StateVt52CursorRow);
+  setAll(StateVt52CursorRow,    ActionVt52CursorDispatch, StateGround);
 
   resetTokenizer();
 }
 
 /* Ok, here comes the nasty part of the decoder.
 
-   Instead of keeping an explicit state, we deduce it from the
-   token scanned so far. It is then immediately combined with
-   the current character to form a scanning decision.
-
-   This is done by the following defines.
+   The tokenizer is a state machine: the state stands for the token scanned
+   so far (see TokenizerState) and each incoming character is mapped to a
+   character class.  The pair selects an entry of the transition table built
+   by initTokenizer(), giving the action to take and the next state, so each
+   character is handled in constant time without looking back at the token.
 
-   - P is the length of the token scanned so far.
-   - L (often P-1) is the position on which contents we base a decision.
-   - C is a character or a group of characters (taken from 'charClass').
+   The token itself is still collected in tokenBuffer, since the window
+   attribute changes and the error reporting need its text.
 
-   - 'cc' is the current character
-   - 's' is a pointer to the start of the token buffer
-   - 'p' is the current position within the token buffer
-
-   Note that they need to applied in proper order.
+   Control characters and the text of OSC sequences are handled before the
+   table is consulted.
 */
 
-#define lec(P,L,C) (p == (P) && s[(L)] == (C))
-#define lun(     ) (p ==  1  && cc >= 32 )
-#define les(P,L,C) (p == (P) && s[L] < 256 && (charClass[s[(L)]] & (C)) == (C))
-#define eec(C)     (p >=  3  && cc == (C))
-#define ees(C)     (p >=  3  && cc < 256 && (charClass[cc] & (C)) == (C))
-#define eps(C)     (p >=  3  && s[2] != '?' && s[2] != '!' && s[2] != '>' && cc < 256 && (charClass[cc] & (C)) == (C))
-#define epp( )     (p >=  3  && s[2] == '?')
-#define epe( )     (p >=  3  && s[2] == '!')
-#define egt( )     (p >=  3  && s[2] == '>')
-#define esp( )     (p ==  4  && s[3] == ' ')
-#define Xpe        (tokenBufferPos >= 2 && tokenBuffer[1] == ']')
-#define Xte        (Xpe      && (cc ==  7 || (prevCC == 27 && cc == 92) )) // 27, 92 => "\e\\" (ST, String Terminator)
-#define ces(C)     (cc < 256 && (charClass[cc] & (C)) == (C) && !Xte)
-
 #define CNTL(c) ((c)-'@')
-#define ESC 27
-#define DEL 127
 
 // process an incoming unicode character
 void Vt102Emulation::receiveChar(wchar_t cc)
@@ -268,11 +327,12 @@ void Vt102Emulation::receiveChar(wchar_t cc)
   if (cc == DEL)
     return; //VT100: ignore.
 
-  if (ces(CTL))
+  // BEL terminates an OSC sequence and is not handled as a control character there
+  if (cc < 32 && !(tokenizerState == StateOscString && cc == 7))
   {
-    // ignore control characters in the text part of Xpe (aka OSC) "ESC]"
+    // ignore control characters in the text part of OSC "ESC]"
     // escape sequences; this matches what XTERM docs say
-    if (Xpe) {
+    if (tokenizerState == StateOscString) {
         prevCC = cc;
         return;
     }
@@ -292,49 +352,69 @@ void Vt102Emulation::receiveChar(wchar_t cc)
   // advance the state
   addToCurrentToken(cc);
 
-  wchar_t* s = tokenBuffer;
-  int  p = tokenBufferPos;
-
-  if (getMode(MODE_Ansi))
+  if (tokenizerState == StateOscString)
   {
-    if (lec(1,0,ESC)) { return; }
-    if (lec(1,0,ESC+128)) { s[0] = ESC; receiveChar('['); return; }
-    if (les(2,1,GRP)) { return; }
-    if (Xte         ) { processWindowAttributeChange(); resetTokenizer(); return; }
-    if (Xpe         ) { prevCC = cc; return; }
-    if (lec(3,2,'?')) { return; }
-    if (lec(3,2,'>')) { return; }
-    if (lec(3,2,'!')) { return; }
-    if (lun(       )) { processToken( TY_CHR(), applyCharset(cc), 0);   resetTokenizer(); return; }
-    if (lec(2,0,ESC)) { processToken( TY_ESC(s[1]), 0, 0);              resetTokenizer(); return; }
-    if (les(3,1,SCS)) { processToken( TY_ESC_CS(s[1],s[2]), 0, 0);      resetTokenizer(); return; }
-    if (lec(3,1,'#')) { processToken( TY_ESC_DE(s[2]), 0, 0);           resetTokenizer(); return; }
-    if (eps(    CPN)) { processToken( TY_CSI_PN(cc), argv[0],argv[1]);  resetTokenizer(); return; }
-    if (esp(       )) { return; }
-    if (lec(5, 4, 'q') && s[3] == ' ') {
-      processToken( TY_CSI_PS_SP(cc, argv[0]), argv[0], 0);
+    // the text ends with BEL or ST ("\e\\"), of which only the second char is
+    // appended to tokenBuffer
+    if (cc == 7 || (prevCC == ESC && cc == '\\'))
+    {
+      processWindowAttributeChange();
       resetTokenizer();
-      return;
     }
-
-    // resize = \e[8;<row>;<col>t
-    if (eps(CPS))
+    else
     {
-        processToken( TY_CSI_PS(cc, argv[0]), argv[1], argv[2]);
-        resetTokenizer();
-        return;
+      prevCC = cc;
     }
+    return;
+  }
 
-    if (epe(   )) { processToken( TY_CSI_PE(cc), 0, 0); resetTokenizer(); return; }
-    if (ees(DIG)) { addDigit(cc-'0'); return; }
-    if (eec(';') || eec(':')) { addArgument(); return; }
-    for (int i=0;i<=argc;i++)
-    {
-        if (epp())
-            processToken( TY_CSI_PR(cc,argv[i]), 0, 0);
-        else if (egt())
-            processToken( TY_CSI_PG(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
-        else if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
+  int state = tokenizerState;
+  if (state == StateGround && !getMode(MODE_Ansi))
+    state = StateVt52Ground;
+
+  const TokenizerTransition transition = transitions[state][cc < 256 ? charClass[cc] : ClassWide];
+  tokenizerState = transition.nextState;
+
+  switch (transition.action)
+  {
+    case ActionNone:
+      return;
+    case ActionParam:
+      addDigit(cc-'0');
+      return;
+    case ActionSeparator:
+      addArgument();
+      return;
+    case ActionCsiIntroducer:
+      tokenBuffer[0] = ESC;
+      addToCurrentToken('[');
+      return;
+
+    case ActionPrint            : processToken( TY_CHR(), applyCharset(cc), 0);                    break;
+    case ActionPrintVt52        : processToken( TY_CHR(), cc, 0);                                  break;
+    case ActionEscDispatch      : processToken( TY_ESC(cc), 0, 0);                                 break;
+    case ActionCharsetDispatch  : processToken( TY_ESC_CS(tokenBuffer[1],cc), 0, 0);               break;
+    case ActionDecDispatch      : processToken( TY_ESC_DE(cc), 0, 0);                              break;
+    case ActionCsiPnDispatch    : processToken( TY_CSI_PN(cc), argv[0], argv[1]);                  break;
+    // resize = \e[8;<row>;<col>t
+    case ActionCsiPsDispatch    : processToken( TY_CSI_PS(cc, argv[0]), argv[1], argv[2]);         break;
+    case ActionCsiSpaceDispatch : processToken( TY_CSI_PS_SP(cc, argv[0]), argv[0], 0);            break;
+    case ActionCsiExclamationDispatch : processToken( TY_CSI_PE(cc), 0, 0);                        break;
+    case ActionVt52Dispatch     : processToken( TY_VT52(tokenBuffer[1]), 0, 0);                    break;
+    case ActionVt52CursorDispatch : processToken( TY_VT52(tokenBuffer[1]), tokenBuffer[2], cc);    break;
+
+    case ActionCsiQuestionDispatch:
+      for (int i=0;i<=argc;i++)
+        processToken( TY_CSI_PR(cc,argv[i]), 0, 0);
+      break;
+    case ActionCsiGreaterDispatch:
+      for (int i=0;i<=argc;i++)
+        processToken( TY_CSI_PG(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
+      break;
+    case ActionCsiDispatch:
+      for (int i=0;i<=argc;i++)
+      {
+        if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
         {
             // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
             i += 2;
@@ -349,35 +429,32 @@ void Vt102Emulation::receiveChar(wchar_t cc)
         }
         else
             processToken( TY_CSI_PS(cc,argv[i]), 0, 0);
-    }
-    resetTokenizer();
+      }
+      break;
   }
-  else
+  resetTokenizer();
+}
+
+// process a run of printable unicode characters
+void Vt102Emulation::receiveChars(const uint* chars, int count)
+{
+  int i = 0;
+  while (i < count)
   {
-    // VT52 Mode
-    if (lec(1,0,ESC))
-        return;
-    if (les(1,0,CHR))
-    {
-        processToken( TY_CHR(), s[0], 0);
-        resetTokenizer();
-        return;
-    }
-    if (lec(2,1,'Y'))
-        return;
-    if (lec(3,1,'Y'))
-        return;
-    if (p < 4)
+    // In the ground state every printable character becomes a TY_CHR token,
+    // so unless a charset translation applies the rest of the run can be
+    // handed to the screen at once.
+    const bool translated = _charset[_currentScreen == _screen[1]].graphic ||
+                            _charset[_currentScreen == _screen[1]].pound;
+    if (tokenizerState == StateGround && getMode(MODE_Ansi) && !translated)
     {
-        processToken( TY_VT52(s[1] ), 0, 0);
-        resetTokenizer();
-        return;
+      _currentScreen->displayCharacters(chars + i, count - i);
+      return;
     }
-    processToken( TY_VT52(s[1]), s[2], s[3]);
-    resetTokenizer();
-    return;
+    receiveChar(chars[i++]);
   }
 }
+
 void Vt102Emulation::processWindowAttributeChange()
 {
   // Describes the window or terminal session attribute to change
@@ -403,17 +480,28 @@ void Vt102Emulation::processWindowAttributeChange()
   QString newValue = QString::fromWCharArray(tokenBuffer + i + 1, tokenBufferPos-i-2);
 
   _pendingTitleUpdates[attributeToChange] = newValue;
-  _titleUpdateTimer->start(20);
+
+  // the timer belongs to the thread the emulation lives in, which is not
+  // the current one if the input is processed on a worker thread
+  if (QThread::currentThread() == thread())
+    _titleUpdateTimer->start(20);
+  else
+    QMetaObject::invokeMethod(_titleUpdateTimer, [this] { _titleUpdateTimer->start(20); });
 }
 
 void Vt102Emulation::updateTitle()
 {
-    QListIterator<int> iter( _pendingTitleUpdates.keys() );
+    QHash<int,QString> pendingTitleUpdates;
+    {
+        QMutexLocker locker(screenLock());
+        pendingTitleUpdates.swap(_pendingTitleUpdates);
+    }
+
+    QListIterator<int> iter( pendingTitleUpdates.keys() );
     while (iter.hasNext()) {
         int arg = iter.next();
-        emit titleChanged( arg , _pendingTitleUpdates[arg] );
+        emit titleChanged( arg , pendingTitleUpdates[arg] );
     }
-    _pendingTitleUpdates.clear();
 }
 
 // Interpreting Codes ---------------------------------------------------------
@@ -806,6 +894,9 @@ void Vt102Emulation::processToken(int token, wchar_t p, int q)
     case TY_CSI_PR('s', 2004) :         saveMode      (MODE_BracketedPaste); break; //XTERM
     case TY_CSI_PR('r', 2004) :      restoreMode      (MODE_BracketedPaste); break; //XTERM
 
+    case TY_CSI_PR('h', 2026) :          setMode      (MODE_SynchronizedUpdate); break;
+    case TY_CSI_PR('l', 2026) :        resetMode      (MODE_SynchronizedUpdate); break;
+
     //FIXME: weird DEC reset sequence
     case TY_CSI_PE('p'      ) : /* IGNORED: reset         (        ) */ break;
 
@@ -846,10 +937,20 @@ void Vt102Emulation::clearScreenAndSetColumns(int columnCount)
 
 void Vt102Emulation::sendString(const char* s , int length)
 {
-  if ( length >= 0 )
-    emit sendData(s,length);
-  else
-    emit sendData(s,strlen(s));
+  if ( length < 0 )
+    length = strlen(s);
+
+  // replies produced while the input is processed on a worker thread are
+  // sent from the thread the emulation lives in, as receivers of sendData()
+  // only get a pointer to the buffer
+  if (QThread::currentThread() != thread())
+  {
+    const QByteArray data(s, length);
+    QMetaObject::invokeMethod(this, [this, data] { emit sendData(data.constData(), data.size()); });
+    return;
+  }
+
+  emit sendData(s,length);
 }
 
 void Vt102Emulation::reportCursorPosition()
@@ -1247,6 +1348,7 @@ void Vt102Emulation::resetModes()
   resetMode(MODE_Mouse1006);  saveMode(MODE_Mouse1006);
   resetMode(MODE_Mouse1015);  saveMode(MODE_Mouse1015);
   resetMode(MODE_BracketedPaste);  saveMode(MODE_BracketedPaste);
+  resetMode(MODE_SynchronizedUpdate);
 
   resetMode(MODE_AppScreen);  saveMode(MODE_AppScreen);
   resetMode(MODE_AppCuKeys);  saveMode(MODE_AppCuKeys);
@@ -1277,6 +1379,10 @@ void Vt102Emulation::setMode(int m)
         emit programBracketedPasteModeChanged(true);
     break;
 
+    case MODE_SynchronizedUpdate:
+        setSynchronizedUpdate(true);
+    break;
+
     case MODE_AppScreen : _screen[1]->clearSelection();
                           setScreen(1);
     break;
@@ -1308,6 +1414,10 @@ void Vt102Emulation::resetMode(int m)
         emit programBracketedPasteModeChanged(false);
     break;
 
+    case MODE_SynchronizedUpdate:
+        setSynchronizedUpdate(false);
+    break;
+
     case MODE_AppScreen :
         _screen[0]->clearSelection();
         setScreen(0);
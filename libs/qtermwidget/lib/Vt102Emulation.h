@@ -49,7 +49,8 @@
 #define MODE_132Columns      (MODES_SCREEN+11)  // 80 <-> 132 column mode switch (DECCOLM)
 #define MODE_Allow132Columns (MODES_SCREEN+12)  // Allow DECCOLM mode
 #define MODE_BracketedPaste  (MODES_SCREEN+13)  // Xterm-style bracketed paste mode
-#define MODE_total           (MODES_SCREEN+14)
+#define MODE_SynchronizedUpdate (MODES_SCREEN+14) // Hold back updates of the views (DEC mode 2026)
+#define MODE_total           (MODES_SCREEN+15)
 
 namespace Konsole
 {
@@ -103,13 +104,16 @@ protected:
   void setMode(int mode) override;
   void resetMode(int mode) override;
   void receiveChar(wchar_t cc) override;
+  void receiveChars(const uint* chars, int count) override;
 
 private slots:
   //causes changeTitle() to be emitted for each (int,QString) pair in pendingTitleUpdates
   //used to buffer multiple title updates
   void updateTitle();
 
-private:
+protected:
+  // the tokenizer and what it calls are not private, so that the tests can
+  // compare the tokenizer with the one it replaced
   wchar_t applyCharset(wchar_t c);
   void setCharset(int n, int cs);
   void useCharset(int n);
@@ -145,15 +149,101 @@ private:
   void initTokenizer();
   int prevCC;
 
-  // Set of flags for each of the ASCII characters which indicates
-  // what category they fall into (printable character, control, digit etc.)
-  // for the purposes of decoding terminal output
-  int charClass[256];
+  // Character classes used by the tokenizer's transition table
+  enum CharClass
+  {
+    ClassOther,         // any other character
+    ClassWide,          // characters outside of the 8-bit range
+    ClassEscape,        // ESC
+    ClassCsi,           // 8-bit CSI (ESC+128)
+    ClassDigit,         // 0-9
+    ClassSeparator,     // ';' or ':'
+    ClassSpace,         // ' '
+    ClassQuestion,      // '?'
+    ClassGreater,       // '>'
+    ClassExclamation,   // '!'
+    ClassOpenBracket,   // '['
+    ClassCloseBracket,  // ']'
+    ClassCharset,       // one of "()+*%"
+    ClassHash,          // '#'
+    ClassCsiPn,         // final characters of CSI sequences with two Pn arguments
+    ClassCsiPs,         // 't', final character of '\e[8;<row>;<col>t'
+    ClassLowerQ,        // 'q'
+    ClassUpperY,        // 'Y'
+    CharClassCount
+  };
+
+  // Kinds of CSI sequences, distinguished by the first character after "ESC["
+  enum CsiKind
+  {
+    CsiPlain,
+    CsiQuestion,        // ESC[?
+    CsiGreater,         // ESC[>
+    CsiExclamation,     // ESC[!
+    CsiKindCount
+  };
+
+  // Tokenizer states.  Each one stands for the token scanned so far, the
+  // CSI states come in groups of CsiKindCount, one per CsiKind.
+  enum TokenizerState
+  {
+    StateGround,
+    StateEscape,                                      // ESC
+    StateCsiEntry,                                    // ESC[
+    StateCharsetEntry,                                // ESC followed by one of "()+*%"
+    StateDecEntry,                                    // ESC#
+    StateOscString,                                   // ESC] ...
+    StateCsiFirst,                                    // first character after ESC[
+    StateCsiSpace      = StateCsiFirst + CsiKindCount, // ESC[ <1 char> ' '
+    StateCsiParam      = StateCsiSpace + CsiKindCount, // any other position
+    StateVt52Ground    = StateCsiParam + CsiKindCount,
+    StateVt52Escape,                                  // ESC
+    StateVt52Cursor,                                  // ESC Y
+    StateVt52CursorRow,                               // ESC Y <row>
+    TokenizerStateCount
+  };
+
+  // What the tokenizer does on a transition
+  enum TokenizerAction
+  {
+    ActionNone,                 // the token is not complete yet
+    ActionParam,                // add a digit to the current argument
+    ActionSeparator,            // start a new argument
+    ActionCsiIntroducer,        // 8-bit CSI, continue as if ESC[ had been received
+    ActionPrint,
+    ActionPrintVt52,
+    ActionEscDispatch,
+    ActionCharsetDispatch,
+    ActionDecDispatch,
+    ActionCsiPnDispatch,
+    ActionCsiPsDispatch,        // '\e[8;<row>;<col>t'
+    ActionCsiSpaceDispatch,     // CSI ... ' ' 'q'
+    ActionCsiDispatch,
+    ActionCsiQuestionDispatch,
+    ActionCsiGreaterDispatch,
+    ActionCsiExclamationDispatch,
+    ActionVt52Dispatch,
+    ActionVt52CursorDispatch
+  };
+
+  struct TokenizerTransition
+  {
+    quint8 action;
+    quint8 nextState;
+  };
+
+  // Class of each of the 8-bit characters for the purposes of decoding
+  // terminal output, and the transition taken for each state and class.
+  quint8 charClass[256];
+  TokenizerTransition transitions[TokenizerStateCount][CharClassCount];
+  int tokenizerState;
 
   void reportDecodingError();
 
   void processToken(int code, wchar_t p, int q);
   void processWindowAttributeChange();
+
+private:
   void requestWindowAttribute(int);
 
   void reportTerminalType();
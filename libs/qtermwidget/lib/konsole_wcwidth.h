@@ -13,7 +13,30 @@
 // Standard
 #include <string>
 
-int konsole_wcwidth(wchar_t ucs);
+#include "konsole_wcwidth_table.h"
+
+// returns the class of 'ucs' in the table, see konsole_wcwidth_table.py
+inline unsigned char konsole_wcwidth_class(wchar_t ucs)
+{
+    const unsigned int c = static_cast<unsigned int>(ucs);
+    if (c >= sizeof(konsole_wcwidth_index) * KONSOLE_WCWIDTH_BLOCK_SIZE)
+        return 0;
+    return konsole_wcwidth_blocks[konsole_wcwidth_index[c / KONSOLE_WCWIDTH_BLOCK_SIZE]]
+                                 [c % KONSOLE_WCWIDTH_BLOCK_SIZE];
+}
+
+// returns the number of columns 'ucs' takes, or -1 if it is not printable
+inline int konsole_wcwidth(wchar_t ucs)
+{
+    return (konsole_wcwidth_class(ucs) & 3) - 1;
+}
+
+// returns true if 'ucs' is a non-spacing mark, which is combined with the
+// character before it
+inline bool konsole_is_nonspacing_mark(wchar_t ucs)
+{
+    return konsole_wcwidth_class(ucs) & KONSOLE_WCWIDTH_NONSPACING_MARK;
+}
 
 int string_width( const std::wstring & wstr );
 
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+#
+# Generates konsole_wcwidth_table.h, the character width table used by
+# konsole_wcwidth(), from the Unicode database of the Python interpreter:
+#
+#   python3 konsole_wcwidth_table.py > konsole_wcwidth_table.h
+#
+# Each code point is given a class: its width plus one in the low two bits
+# (0 for characters which are not printed), and NONSPACING_MARK for marks of
+# the general category Mn, which are combined with the character before them.
+# The classes are stored in blocks of 256 code points, identical blocks are
+# stored once.
+
+import sys
+import unicodedata
+
+NONSPACING_MARK = 4
+BLOCK_SIZE = 256
+MAX_CODE_POINT = 0x10FFFF
+
+
+def width(cp, category):
+    if cp == 0:
+        return 0
+    if cp < 0x20 or 0x7F <= cp < 0xA0:
+        return -1
+    if category == 'Co':
+        # Private use area.  libutf8proc makes them zero width, while tmux
+        # assumes them to be width 1, and glibc's default width is also 1
+        return 1
+    if category == 'Cs':
+        return -1
+    if category in ('Mn', 'Me', 'Zl', 'Zp'):
+        return 0
+    if category == 'Cf' and cp != 0x00AD:
+        return 0
+    # Hangul vowels and final consonants are combined with the syllable start
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+        return 0
+    if unicodedata.east_asian_width(chr(cp)) in ('W', 'F'):
+        return 2
+    # code points which are likely to be assigned wide characters later
+    if category == 'Cn' and (0x20000 <= cp <= 0x3FFFD or 0x1FA70 <= cp <= 0x1FAFF):
+        return 2
+    return 1
+
+
+def main():
+    blocks = []
+    block_ids = {}
+    index = []
+    for start in range(0, MAX_CODE_POINT + 1, BLOCK_SIZE):
+        block = []
+        for cp in range(start, start + BLOCK_SIZE):
+            category = unicodedata.category(chr(cp))
+            value = width(cp, category) + 1
+            if category == 'Mn':
+                value |= NONSPACING_MARK
+            block.append(value)
+        block = tuple(block)
+        if block not in block_ids:
+            block_ids[block] = len(blocks)
+            blocks.append(block)
+        index.append(block_ids[block])
+
+    assert len(blocks) <= 256
+
+    out = sys.stdout
+    out.write('// WARNING: Autogenerated by "konsole_wcwidth_table.py" from Unicode %s.\n'
+              % unicodedata.unidata_version)
+    out.write('// You probably do not want to hand-edit this!\n\n')
+    out.write('#ifndef _KONSOLE_WCWIDTH_TABLE_H_\n#define _KONSOLE_WCWIDTH_TABLE_H_\n\n')
+    out.write('#define KONSOLE_WCWIDTH_NONSPACING_MARK %d\n' % NONSPACING_MARK)
+    out.write('#define KONSOLE_WCWIDTH_BLOCK_SIZE %d\n\n' % BLOCK_SIZE)
+
+    out.write('// the block of each range of KONSOLE_WCWIDTH_BLOCK_SIZE code points\n')
+    out.write('inline constexpr unsigned char konsole_wcwidth_index[%d] = {\n' % len(index))
+    for i in range(0, len(index), 16):
+        out.write('    ' + ', '.join('%3d' % v for v in index[i:i + 16]) + ',\n')
+    out.write('};\n\n')
+
+    out.write('// the class of each code point in a block\n')
+    out.write('inline constexpr unsigned char konsole_wcwidth_blocks[%d][%d] = {\n'
+              % (len(blocks), BLOCK_SIZE))
+    for block in blocks:
+        out.write('    {\n')
+        for i in range(0, BLOCK_SIZE, 32):
+            out.write('        ' + ','.join('%d' % v for v in block[i:i + 32]) + ',\n')
+        out.write('    },\n')
+    out.write('};\n\n#endif\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -32,6 +32,8 @@
 #include "KeyboardTranslator.h"
 #include "ColorScheme.h"
 #include "SearchBar.h"
+#include "HistorySearch.h"
+#include "HistoryMatchIndex.h"
 #include "qtermwidget.h"
 
 #ifdef Q_OS_MACOS
@@ -45,6 +47,19 @@
 
 using namespace Konsole;
 
+// returns the expression for the text of the search bar
+static QRegularExpression searchRegExp(SearchBar *searchBar)
+{
+    QRegularExpression regExp;
+    if (searchBar->useRegularExpression()) {
+        regExp.setPattern(searchBar->searchText());
+    } else {
+        regExp.setPattern(QRegularExpression::escape(searchBar->searchText()));
+    }
+    regExp.setPatternOptions(searchBar->matchCase() ? QRegularExpression::NoPatternOption : QRegularExpression::CaseInsensitiveOption);
+    return regExp;
+}
+
 void *createTermWidget(int startnow, void *parent)
 {
     return (void*) new QTermWidget(startnow, (QWidget*)parent);
@@ -57,6 +72,8 @@ public:
 
     TerminalDisplay *m_terminalDisplay;
     Session *m_session;
+    QPointer<HistorySearch> m_historySearch; // the search which is running, if any
+    HistoryMatchIndex *m_matchIndex;         // all matches of the search bar's text
 
     Session* createSession(QWidget* parent);
     TerminalDisplay* createTerminalDisplay(Session *session, QWidget* parent);
@@ -136,7 +153,7 @@ void QTermWidget::selectionChanged(bool textSelected)
 
 void QTermWidget::find()
 {
-    search(true, false);
+    search(true, false, true);
 }
 
 void QTermWidget::findNext()
@@ -149,36 +166,53 @@ void QTermWidget::findPrevious()
     search(false, false);
 }
 
-void QTermWidget::search(bool forwards, bool next)
+void QTermWidget::search(bool forwards, bool next, bool nearest)
 {
+    // a new search replaces the one which is still running
+    if (m_impl->m_historySearch)
+        m_impl->m_historySearch->cancel();
+
     int startColumn, startLine;
 
     if (next) // search from just after current selection
     {
+        QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
         m_impl->m_terminalDisplay->screenWindow()->screen()->getSelectionEnd(startColumn, startLine);
         startColumn++;
     }
     else // search from start of current selection
     {
+        QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
         m_impl->m_terminalDisplay->screenWindow()->screen()->getSelectionStart(startColumn, startLine);
     }
 
     //qDebug() << "current selection starts at: " << startColumn << startLine;
     //qDebug() << "current cursor position: " << m_impl->m_terminalDisplay->screenWindow()->cursorPosition();
 
-    QRegularExpression regExp;
-    if (m_searchBar->useRegularExpression()) {
-        regExp.setPattern(m_searchBar->searchText());
-    } else {
-        regExp.setPattern(QRegularExpression::escape(m_searchBar->searchText()));
+    if (nearest)
+    {
+        // searching as you type starts in the view, so that the matches which can be seen
+        // are found before the rest of the history is read
+        ScreenWindow* sw = m_impl->m_terminalDisplay->screenWindow();
+        if (startLine < sw->currentLine() || startLine >= sw->currentLine() + sw->windowLines())
+        {
+            startColumn = 0;
+            startLine = sw->currentLine();
+        }
     }
-    regExp.setPatternOptions(m_searchBar->matchCase() ? QRegularExpression::NoPatternOption : QRegularExpression::CaseInsensitiveOption);
+
+    const QRegularExpression regExp = searchRegExp(m_searchBar);
 
     HistorySearch *historySearch =
-            new HistorySearch(m_impl->m_session->emulation(), regExp, forwards, startColumn, startLine, this);
+            new HistorySearch(m_impl->m_session->emulation(), regExp, forwards, startColumn, startLine, this, nearest);
     connect(historySearch, SIGNAL(matchFound(int, int, int, int)), this, SLOT(matchFound(int, int, int, int)));
     connect(historySearch, SIGNAL(noMatchFound()), this, SLOT(noMatchFound()));
     connect(historySearch, SIGNAL(noMatchFound()), m_searchBar, SLOT(noMatchFound()));
+    connect(historySearch, SIGNAL(progress(int, int)), m_searchBar, SLOT(searchProgress(int, int)));
+    connect(historySearch, SIGNAL(finished()), m_searchBar, SLOT(searchFinished()));
+    if (!m_searchBar->useRegularExpression())
+        historySearch->setLiteralText(m_searchBar->searchText());
+    m_impl->m_historySearch = historySearch;
     historySearch->search();
 }
 
@@ -192,6 +226,35 @@ void QTermWidget::matchFound(int startColumn, int startLine, int endColumn, int
     sw->notifyOutputChanged();
     sw->setSelectionStart(startColumn, startLine - sw->currentLine(), false);
     sw->setSelectionEnd(endColumn, endLine - sw->currentLine());
+    updateMatchCount();
+}
+
+void QTermWidget::updateMatchIndex()
+{
+    // matches are only kept while they can be seen
+    // plain text is matched the way the search matches it, so that the count agrees with it
+    if (m_searchBar->isVisible() && !m_searchBar->searchText().isEmpty())
+        m_impl->m_matchIndex->setRegExp(searchRegExp(m_searchBar),
+                                        m_searchBar->useRegularExpression() ? QString() : m_searchBar->searchText());
+    else
+        m_impl->m_matchIndex->setRegExp(QRegularExpression());
+    updateMatchCount();
+}
+
+void QTermWidget::updateMatchCount()
+{
+    if (m_impl->m_matchIndex->regExp().pattern().isEmpty())
+    {
+        m_searchBar->clearMatchCount();
+        return;
+    }
+
+    int column, line;
+    {
+        QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
+        m_impl->m_terminalDisplay->screenWindow()->screen()->getSelectionStart(column, line);
+    }
+    m_searchBar->setMatchCount(m_impl->m_matchIndex->indexOf(column, line) + 1, m_impl->m_matchIndex->count());
 }
 
 void QTermWidget::noMatchFound()
@@ -317,6 +380,19 @@ void QTermWidget::init(int startnow)
     m_layout->addWidget(m_searchBar);
     m_searchBar->hide();
 
+    // the matches of the search bar's text are kept up to date as output arrives
+    m_impl->m_matchIndex = new HistoryMatchIndex(m_impl->m_session->emulation(), this);
+    connect(m_impl->m_session->emulation(), &Emulation::outputChanged,
+            m_impl->m_matchIndex, &HistoryMatchIndex::update);
+    connect(m_impl->m_matchIndex, &HistoryMatchIndex::changed, this, &QTermWidget::updateMatchCount);
+    connect(m_searchBar, &SearchBar::searchCriteriaChanged, this, &QTermWidget::updateMatchIndex);
+    connect(m_searchBar, &SearchBar::visibilityChanged, this, &QTermWidget::updateMatchIndex);
+    connect(m_searchBar, &SearchBar::highlightMatchesChanged, this, [this] (bool highlightMatches) {
+        m_impl->m_terminalDisplay->setSearchMatches(highlightMatches ? m_impl->m_matchIndex : nullptr);
+    });
+    if (m_searchBar->highlightAllMatches())
+        m_impl->m_terminalDisplay->setSearchMatches(m_impl->m_matchIndex);
+
     if (startnow && m_impl->m_session) {
         m_impl->m_session->run();
     }
@@ -357,6 +433,10 @@ void QTermWidget::init(int startnow)
 
 QTermWidget::~QTermWidget()
 {
+    // the searches read the emulation from other threads, stop them before the session
+    // goes.  Searches which were cancelled may not have noticed it yet
+    qDeleteAll(findChildren<HistorySearch*>(QString(), Qt::FindDirectChildrenOnly));
+    delete m_impl->m_matchIndex;
     delete m_impl;
     emit destroyed();
 }
@@ -521,6 +601,41 @@ int QTermWidget::historySize() const
      }
 }
 
+void QTermWidget::setCompressedHistory(int lines)
+{
+    m_impl->m_session->setHistoryType(CompressedHistoryType(qMax(1, lines)));
+}
+
+void QTermWidget::setPersistentHistory(const QString& fileName, int lines)
+{
+    m_impl->m_session->setHistoryType(PersistentHistoryType(fileName, qMax(0, lines)));
+}
+
+void QTermWidget::setHistoryIndexEnabled(bool enable)
+{
+    m_impl->m_session->emulation()->setHistoryIndexEnabled(enable);
+}
+
+void QTermWidget::setHistoryMemoryBudget(qint64 bytes)
+{
+    HistoryMemoryGovernor::instance()->setBudget(bytes);
+}
+
+qint64 QTermWidget::historyMemoryBudget()
+{
+    return HistoryMemoryGovernor::instance()->budget();
+}
+
+qint64 QTermWidget::historyMemoryUsage()
+{
+    return HistoryMemoryGovernor::instance()->usage();
+}
+
+qint64 QTermWidget::sessionHistoryMemoryUsage() const
+{
+    return HistoryMemoryGovernor::instance()->usage(m_impl->m_session->emulation());
+}
+
 void QTermWidget::setScrollBarPosition(ScrollBarPosition pos)
 {
     m_impl->m_terminalDisplay->setScrollBarPosition(pos);
@@ -658,41 +773,49 @@ void QTermWidget::setMotionAfterPasting(int action)
 
 int QTermWidget::historyLinesCount()
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     return m_impl->m_terminalDisplay->screenWindow()->screen()->getHistLines();
 }
 
 int QTermWidget::screenColumnsCount()
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     return m_impl->m_terminalDisplay->screenWindow()->screen()->getColumns();
 }
 
 int QTermWidget::screenLinesCount()
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     return m_impl->m_terminalDisplay->screenWindow()->screen()->getLines();
 }
 
 void QTermWidget::setSelectionStart(int row, int column)
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     m_impl->m_terminalDisplay->screenWindow()->screen()->setSelectionStart(column, row, true);
 }
 
 void QTermWidget::setSelectionEnd(int row, int column)
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     m_impl->m_terminalDisplay->screenWindow()->screen()->setSelectionEnd(column, row);
 }
 
 void QTermWidget::getSelectionStart(int& row, int& column)
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     m_impl->m_terminalDisplay->screenWindow()->screen()->getSelectionStart(column, row);
 }
 
 void QTermWidget::getSelectionEnd(int& row, int& column)
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     m_impl->m_terminalDisplay->screenWindow()->screen()->getSelectionEnd(column, row);
 }
 
 QString QTermWidget::selectedText(bool preserveLineBreaks)
 {
+    QMutexLocker locker(m_impl->m_session->emulation()->screenLock());
     return m_impl->m_terminalDisplay->screenWindow()->screen()->selectedText(preserveLineBreaks);
 }
 
@@ -738,6 +861,16 @@ void QTermWidget::setKeyboardCursorShape(KeyboardCursorShape shape)
     m_impl->m_terminalDisplay->setKeyboardCursorShape(shape);
 }
 
+void QTermWidget::setThreadedEmulation(bool enable)
+{
+    m_impl->m_session->setThreadedEmulation(enable);
+}
+
+bool QTermWidget::threadedEmulation() const
+{
+    return m_impl->m_session->threadedEmulation();
+}
+
 void QTermWidget::setBlinkingCursor(bool blink)
 {
     m_impl->m_terminalDisplay->setBlinkingCursor(blink);
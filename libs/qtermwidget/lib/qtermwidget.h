@@ -129,6 +129,38 @@ public:
     // Returns the history size (in lines)
     int historySize() const override;
 
+    /** Keeps a history of @p lines lines of which all but the newest
+     * are compressed.  Uses less memory than setHistorySize() for long
+     * histories, at the cost of decompressing older lines when they are read.
+     */
+    void setCompressedHistory(int lines);
+
+    /** Keeps the history in the file @p fileName, so that it outlives the
+     * terminal.  The lines saved in the file before are restored.
+     *
+     * @param lines history size, 0 for no limit
+     * @note A file must not be used by two terminals at the same time.
+     */
+    void setPersistentHistory(const QString& fileName, int lines);
+
+    /** Keeps an index of the history, so that searches can skip the lines
+     * which cannot match.  This speeds up searching a long history at the
+     * cost of about 16 bytes per line.  Disabled by default.
+     */
+    void setHistoryIndexEnabled(bool enable);
+
+    /** Sets the memory, in bytes, which the histories of all terminals in the
+     * process may use together.  When they use more, the oldest lines of the
+     * terminals which were focused least recently are dropped.
+     * 0, the default, means no limit.
+     */
+    static void setHistoryMemoryBudget(qint64 bytes);
+    static qint64 historyMemoryBudget();
+    // Returns the memory used by the histories of all terminals (in bytes)
+    static qint64 historyMemoryUsage();
+    // Returns the memory used by the history of this terminal (in bytes)
+    qint64 sessionHistoryMemoryUsage() const;
+
     // Presence of scrollbar
     void setScrollBarPosition(QTermWidgetInterface::ScrollBarPosition) override;
 
@@ -217,6 +249,13 @@ public:
      */
     void setKeyboardCursorShape(KeyboardCursorShape shape);
 
+    /**
+     * Processes the output of the terminal program on a worker thread, so that
+     * floods of output do not block the user interface.  Disabled by default.
+     */
+    void setThreadedEmulation(bool enable);
+    bool threadedEmulation() const;
+
     void setBlinkingCursor(bool blink) override;
 
     /** Enables or disables bidi text in the terminal. */
@@ -342,7 +381,9 @@ private slots:
     void cursorChanged(Konsole::Emulation::KeyboardCursorShape cursorShape, bool blinkingCursorEnabled);
 
 private:
-    void search(bool forwards, bool next);
+    void search(bool forwards, bool next, bool nearest = false);
+    void updateMatchIndex();
+    void updateMatchCount();
     void setZoom(int step);
     void init(int startnow);
     TermWidgetImpl * m_impl;
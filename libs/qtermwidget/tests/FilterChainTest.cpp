@@ -0,0 +1,187 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QTest>
+
+// Konsole
+#include "Filter.h"
+
+using namespace Konsole;
+
+/*
+ * Sets images on a TerminalImageFilterChain and checks which of their lines
+ * the filters process again, and that the hotspots of the other lines are
+ * kept.
+ */
+class FilterChainTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void processesChangedLinesOnly();
+    void processesScrolledImage();
+    void processesAllLinesWhenFilterChanges();
+    void processesAllLinesForNewFilter();
+};
+
+namespace
+{
+
+const int LINES = 6;
+const int COLUMNS = 20;
+
+// remembers the lines it has found hotspots on
+class RecordingFilter : public RegExpFilter
+{
+public:
+    RecordingFilter()
+    {
+        setRegExp(QRegularExpression(QStringLiteral("word\\d+")));
+    }
+
+    QList<int> processedLines;
+
+protected:
+    RegExpFilter::HotSpot* newHotSpot(int startLine, int startColumn, int endLine, int endColumn) override
+    {
+        processedLines << startLine;
+        return RegExpFilter::newHotSpot(startLine, startColumn, endLine, endColumn);
+    }
+};
+
+void setLine(QVector<Character>& image, int line, const QString& text)
+{
+    for (int column = 0; column < COLUMNS; column++)
+        image[line * COLUMNS + column] = Character(column < text.size() ? text.at(column).unicode() : ' ');
+}
+
+// an image with "word<n>" on each line, n being the number of the line in the output
+QVector<Character> makeImage(qint64 firstLine)
+{
+    QVector<Character> image(LINES * COLUMNS);
+    for (int line = 0; line < LINES; line++)
+        setLine(image, line, QStringLiteral("word%1").arg(firstLine + line));
+    return image;
+}
+
+void setImage(TerminalImageFilterChain& chain, const QVector<Character>& image, qint64 firstLine)
+{
+    chain.setImage(image.constData(), LINES, COLUMNS, QVector<LineProperty>(LINES, LINE_DEFAULT), firstLine);
+    chain.process();
+}
+
+QString capturedText(const TerminalImageFilterChain& chain, int line)
+{
+    const auto spot = static_cast<RegExpFilter::HotSpot*>(chain.hotSpotAt(line, 0));
+    return spot ? spot->capturedTexts().value(0) : QString();
+}
+
+const QList<int> ALL_LINES = {0, 1, 2, 3, 4, 5};
+
+}
+
+void FilterChainTest::processesChangedLinesOnly()
+{
+    TerminalImageFilterChain chain;
+    auto filter = new RecordingFilter();
+    chain.addFilter(filter);
+
+    QVector<Character> image = makeImage(0);
+    setImage(chain, image, 0);
+    QCOMPARE(filter->processedLines, ALL_LINES);
+
+    // the same image again
+    filter->processedLines.clear();
+    setImage(chain, image, 0);
+    QCOMPARE(filter->processedLines, QList<int>());
+    QCOMPARE(int(chain.hotSpots().size()), LINES);
+
+    // one line edited
+    filter->processedLines.clear();
+    setLine(image, 3, QStringLiteral("word30"));
+    setImage(chain, image, 0);
+    QCOMPARE(filter->processedLines, QList<int>{3});
+    QCOMPARE(int(chain.hotSpots().size()), LINES);
+    QCOMPARE(capturedText(chain, 2), QStringLiteral("word2"));
+    QCOMPARE(capturedText(chain, 3), QStringLiteral("word30"));
+    QCOMPARE(capturedText(chain, 4), QStringLiteral("word4"));
+}
+
+void FilterChainTest::processesScrolledImage()
+{
+    TerminalImageFilterChain chain;
+    auto filter = new RecordingFilter();
+    chain.addFilter(filter);
+
+    setImage(chain, makeImage(0), 0);
+
+    // scrolled up by two lines, only the lines which came in are new
+    filter->processedLines.clear();
+    setImage(chain, makeImage(2), 2);
+    QCOMPARE(filter->processedLines, (QList<int>{4, 5}));
+    QCOMPARE(int(chain.hotSpots().size()), LINES);
+    for (int line = 0; line < LINES; line++)
+        QCOMPARE(capturedText(chain, line), QStringLiteral("word%1").arg(line + 2));
+}
+
+void FilterChainTest::processesAllLinesWhenFilterChanges()
+{
+    TerminalImageFilterChain chain;
+    auto filter = new RecordingFilter();
+    chain.addFilter(filter);
+
+    const QVector<Character> image = makeImage(0);
+    setImage(chain, image, 0);
+
+    // the lines have not changed, but what the filter looks for has
+    filter->processedLines.clear();
+    filter->setRegExp(QRegularExpression(QStringLiteral("word[0-2]")));
+    setImage(chain, image, 0);
+    QCOMPARE(filter->processedLines, (QList<int>{0, 1, 2}));
+    QCOMPARE(int(chain.hotSpots().size()), 3);
+
+    filter->processedLines.clear();
+    filter->setTriggers({ QStringLiteral("word1") });
+    setImage(chain, image, 0);
+    QCOMPARE(filter->processedLines, QList<int>{1});
+    QCOMPARE(int(chain.hotSpots().size()), 1);
+}
+
+void FilterChainTest::processesAllLinesForNewFilter()
+{
+    TerminalImageFilterChain chain;
+    auto filter = new RecordingFilter();
+    chain.addFilter(filter);
+
+    const QVector<Character> image = makeImage(0);
+    setImage(chain, image, 0);
+
+    filter->processedLines.clear();
+    auto newFilter = new RecordingFilter();
+    chain.addFilter(newFilter);
+    setImage(chain, image, 0);
+    QCOMPARE(newFilter->processedLines, ALL_LINES);
+    QCOMPARE(filter->processedLines, ALL_LINES);
+    QCOMPARE(int(chain.hotSpots().size()), 2 * LINES);
+}
+
+QTEST_GUILESS_MAIN(FilterChainTest)
+
+#include "FilterChainTest.moc"
@@ -0,0 +1,130 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QRandomGenerator>
+#include <QTest>
+
+// Konsole
+#include "History.h"
+
+using namespace Konsole;
+
+/*
+ * Compares the history types which keep long histories in memory: the
+ * memory each line takes, and how long it takes to read lines at random,
+ * as the terminal does when the view is scrolled through the history.
+ */
+class HistoryBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void addLines_data();
+    void addLines();
+    void randomAccess_data();
+    void randomAccess();
+};
+
+namespace
+{
+
+const int HISTORY_LINES = 100000;
+
+// a line of build output, the numbers vary from line to line
+QVector<Character> outputLine(int number)
+{
+    const QString text = QStringLiteral("[%1/%2] Building CXX object src/CMakeFiles/module%3.dir/file%4.cpp.o")
+                             .arg(number % 1000).arg(1000).arg(number % 37).arg(number);
+    QVector<Character> cells;
+    for (const uint c : text.toUcs4())
+        cells << Character(c);
+    // the progress is shown in another color
+    for (int i = 0; i < 10 && i < cells.size(); i++)
+        cells[i].foregroundColor = CharacterColor(COLOR_SPACE_SYSTEM, 2);
+    return cells;
+}
+
+HistoryScroll* createScroll(const QString& type)
+{
+    if (type == QLatin1String("compressed"))
+        return CompressedHistoryType(HISTORY_LINES).scroll(nullptr);
+    return CompactHistoryType(HISTORY_LINES).scroll(nullptr);
+}
+
+void fill(HistoryScroll* scroll, int lines)
+{
+    for (int line = 0; line < lines; line++)
+    {
+        scroll->addCellsVector(outputLine(line));
+        scroll->addLine(false);
+    }
+}
+
+}
+
+void HistoryBenchmark::addLines_data()
+{
+    QTest::addColumn<QString>("type");
+
+    QTest::newRow("compact") << "compact";
+    QTest::newRow("compressed") << "compressed";
+}
+
+void HistoryBenchmark::addLines()
+{
+    QFETCH(QString, type);
+
+    qint64 memoryUsage = 0;
+    QBENCHMARK {
+        HistoryScroll* scroll = createScroll(type);
+        fill(scroll, HISTORY_LINES);
+        memoryUsage = scroll->memoryUsage();
+        delete scroll;
+    }
+    qInfo("%s: %.1f bytes per line", qPrintable(type), double(memoryUsage) / HISTORY_LINES);
+}
+
+void HistoryBenchmark::randomAccess_data()
+{
+    addLines_data();
+}
+
+void HistoryBenchmark::randomAccess()
+{
+    QFETCH(QString, type);
+
+    HistoryScroll* scroll = createScroll(type);
+    fill(scroll, HISTORY_LINES);
+
+    QRandomGenerator random(1);
+    Character cells[256];
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++)
+        {
+            const int line = random.bounded(HISTORY_LINES);
+            scroll->getCells(line, 0, qMin(256, scroll->getLineLen(line)), cells);
+        }
+    }
+    delete scroll;
+}
+
+QTEST_GUILESS_MAIN(HistoryBenchmark)
+
+#include "HistoryBenchmark.moc"
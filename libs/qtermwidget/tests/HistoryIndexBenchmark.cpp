@@ -0,0 +1,295 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QFile>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QTest>
+#include <QTextStream>
+
+// Konsole
+#include "History.h"
+#include "HistoryTrigramIndex.h"
+#include "Screen.h"
+#include "TerminalCharacterDecoder.h"
+
+using namespace Konsole;
+
+/*
+ * Searches a long history block by block, as HistorySearch does, with and
+ * without the trigram index telling which blocks cannot match.  The index
+ * pays off for rare text and must not cost much for text found everywhere.
+ *
+ * The history is made up of build, log, listing and compiler lines with
+ * words picked at random.  To measure with real scrollback instead, point
+ * QTERMWIDGET_BENCHMARK_SCROLLBACK at a file holding it as plain text.
+ */
+class HistoryIndexBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void search_data();
+    void search();
+    void falsePositives_data();
+    void falsePositives();
+};
+
+namespace
+{
+
+const int HISTORY_LINES = 100000;
+// lines decoded at once, see HistorySearch
+const int BLOCK_LINES = 1000;
+const int PATTERNS = 200;
+
+// words of two to four syllables, like identifiers and file names
+QString randomWord(QRandomGenerator& random)
+{
+    static const char* const syllables[] = {
+        "ab", "ac", "al", "an", "ar", "be", "bo", "ca", "ch", "co", "da", "de", "di", "el", "en", "er",
+        "ex", "fi", "fo", "ga", "ge", "ha", "im", "in", "io", "is", "ka", "la", "le", "li", "lo", "ma",
+        "me", "mo", "na", "ne", "no", "nu", "op", "or", "pa", "pe", "po", "qu", "ra", "re", "ri", "ro",
+        "sa", "se", "si", "so", "st", "ta", "te", "ti", "to", "tr", "ul", "un", "ur", "va", "ve", "zo"
+    };
+    QString word;
+    for (int i = random.bounded(2, 5); i > 0; i--)
+        word += QLatin1String(syllables[random.bounded(int(sizeof(syllables) / sizeof(*syllables)))]);
+    return word;
+}
+
+QStringList generatedLines()
+{
+    QRandomGenerator random(42);
+    QStringList vocabulary;
+    for (int i = 0; i < 3000; i++)
+        vocabulary << randomWord(random);
+    auto word = [&]() { return vocabulary.at(random.bounded(int(vocabulary.size()))); };
+
+    QStringList lines;
+    for (int line = 0; line < HISTORY_LINES; line++)
+    {
+        switch (random.bounded(4))
+        {
+        case 0:
+            lines << QStringLiteral("[%1/%2] Building CXX object src/%3/CMakeFiles/%4.dir/%5_%6.cpp.o")
+                         .arg(line % 1000).arg(1000).arg(word(), word(), word(), word());
+            break;
+        case 1:
+            lines << QStringLiteral("2026-03-%1 %2:%3:%4 INFO [%5] %6 %7 %8 id=%9")
+                         .arg(random.bounded(1, 29), 2, 10, QLatin1Char('0'))
+                         .arg(random.bounded(24), 2, 10, QLatin1Char('0'))
+                         .arg(random.bounded(60), 2, 10, QLatin1Char('0'))
+                         .arg(random.bounded(60), 2, 10, QLatin1Char('0'))
+                         .arg(word(), word(), word(), word())
+                         .arg(random.generate(), 8, 16, QLatin1Char('0'));
+            break;
+        case 2:
+            lines << QStringLiteral("-rw-r--r-- 1 user users %1 Mar %2 %3.%4")
+                         .arg(random.bounded(100000000), 9)
+                         .arg(random.bounded(1, 29), 2)
+                         .arg(word(), word().left(3));
+            break;
+        default:
+            lines << QStringLiteral("src/%1/%2.cpp:%3:%4: warning: unused variable '%5' [-Wunused-variable]")
+                         .arg(word(), word())
+                         .arg(random.bounded(1, 2000))
+                         .arg(random.bounded(1, 80))
+                         .arg(word());
+            break;
+        }
+    }
+    lines[HISTORY_LINES / 2] = QStringLiteral("file%1.cpp:12: error: undefined reference to `main'").arg(HISTORY_LINES / 2);
+    return lines;
+}
+
+// the scrollback QTERMWIDGET_BENCHMARK_SCROLLBACK points at, or generated lines
+QStringList historyLines()
+{
+    const QString fileName = qEnvironmentVariable("QTERMWIDGET_BENCHMARK_SCROLLBACK");
+    if (fileName.isEmpty())
+        return generatedLines();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        qFatal("cannot read %s", qPrintable(fileName));
+    QStringList lines;
+    QTextStream stream(&file);
+    while (!stream.atEnd() && lines.size() < HISTORY_LINES)
+    {
+        // control characters would be taken for escape sequences
+        QString line = stream.readLine();
+        line.remove(QRegularExpression(QStringLiteral("[\\x00-\\x1f\\x7f]")));
+        lines << line;
+    }
+    return lines;
+}
+
+void fill(Screen& screen, const QStringList& lines)
+{
+    for (const QString& line : lines)
+    {
+        const QList<uint> chars = line.toUcs4();
+        screen.displayCharacters(chars.constData(), chars.size());
+        screen.toStartOfLine();
+        screen.newLine();
+    }
+}
+
+QString decodeLines(const Screen& screen, int first, int last)
+{
+    QString text;
+    QTextStream stream(&text);
+    PlainTextDecoder decoder;
+    decoder.begin(&stream);
+    screen.writeLinesToStream(&decoder, first, last);
+    decoder.end();
+    return text;
+}
+
+/*
+ * Text to look for: two words next to each other on some line of the
+ * history, which are found in few blocks, or a word made up the same way
+ * as those of the history, which is mostly not found at all.
+ */
+QStringList patterns(const QStringList& lines, bool madeUp)
+{
+    QRandomGenerator random(7);
+    static const QRegularExpression words(QStringLiteral("\\w{3,}\\W+\\w{3,}"));
+    QStringList patterns;
+    while (patterns.size() < PATTERNS)
+    {
+        if (madeUp)
+        {
+            patterns << randomWord(random);
+            continue;
+        }
+        const QString& line = lines.at(random.bounded(int(lines.size())));
+        const QRegularExpressionMatch match = words.match(line, random.bounded(int(line.size()) + 1));
+        if (match.hasMatch())
+            patterns << match.captured();
+    }
+    return patterns;
+}
+
+}
+
+void HistoryIndexBenchmark::search_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<bool>("indexed");
+
+    QTest::newRow("rare text, indexed") << "undefined reference" << true;
+    QTest::newRow("rare text, not indexed") << "undefined reference" << false;
+    QTest::newRow("common text, indexed") << "Building CXX" << true;
+    QTest::newRow("common text, not indexed") << "Building CXX" << false;
+}
+
+void HistoryIndexBenchmark::search()
+{
+    QFETCH(QString, pattern);
+    QFETCH(bool, indexed);
+
+    Screen screen(40, 120);
+    screen.setScroll(CompactHistoryType(HISTORY_LINES));
+    screen.setHistoryIndexEnabled(indexed);
+    fill(screen, historyLines());
+
+    const QRegularExpression regExp(pattern);
+    const HistoryTrigramIndex::Query query = HistoryTrigramIndex::query(regExp);
+    int matches = 0;
+    QBENCHMARK {
+        matches = 0;
+        for (int first = 0; first < screen.getHistLines(); first += BLOCK_LINES)
+        {
+            const int last = qMin(first + BLOCK_LINES, screen.getHistLines()) - 1;
+            if (!screen.linesMayMatch(query, first, last))
+                continue;
+
+            QRegularExpressionMatchIterator it = regExp.globalMatch(decodeLines(screen, first, last));
+            while (it.hasNext())
+            {
+                it.next();
+                matches++;
+            }
+        }
+    }
+    qInfo("%d matches, the history and its index take %lld bytes", matches, screen.historyMemoryUsage());
+}
+
+void HistoryIndexBenchmark::falsePositives_data()
+{
+    QTest::addColumn<bool>("madeUp");
+    QTest::addColumn<int>("blockLines");
+
+    QTest::newRow("words from the history, blocks of 1000 lines") << false << BLOCK_LINES;
+    QTest::newRow("words from the history, blocks of 100 lines") << false << 100;
+    QTest::newRow("made up words, blocks of 1000 lines") << true << BLOCK_LINES;
+    QTest::newRow("made up words, blocks of 100 lines") << true << 100;
+}
+
+/*
+ * Counts the blocks without a match which the index lets through anyway,
+ * out of all blocks without a match.  Blocks with a match must always be
+ * let through.
+ */
+void HistoryIndexBenchmark::falsePositives()
+{
+    QFETCH(bool, madeUp);
+    QFETCH(int, blockLines);
+
+    const QStringList lines = historyLines();
+    Screen screen(40, 120);
+    screen.setScroll(CompactHistoryType(HISTORY_LINES));
+    screen.setHistoryIndexEnabled(true);
+    fill(screen, lines);
+
+    QStringList texts;
+    for (int first = 0; first < screen.getHistLines(); first += blockLines)
+        texts << decodeLines(screen, first, qMin(first + blockLines, screen.getHistLines()) - 1);
+
+    qint64 blocksWithoutMatch = 0;
+    qint64 passed = 0;
+    for (const QString& pattern : patterns(lines, madeUp))
+    {
+        const QRegularExpression regExp(QRegularExpression::escape(pattern));
+        const HistoryTrigramIndex::Query query = HistoryTrigramIndex::query(regExp);
+        for (int block = 0; block < texts.size(); block++)
+        {
+            const int first = block * blockLines;
+            const int last = qMin(first + blockLines, screen.getHistLines()) - 1;
+            const bool mayMatch = screen.linesMayMatch(query, first, last);
+            if (regExp.match(texts.at(block)).hasMatch())
+            {
+                QVERIFY2(mayMatch, qPrintable(pattern));
+                continue;
+            }
+            blocksWithoutMatch++;
+            if (mayMatch)
+                passed++;
+        }
+    }
+    qInfo("%lld of %lld blocks without a match were searched (%.2f%%)", passed, blocksWithoutMatch,
+          blocksWithoutMatch ? 100.0 * passed / blocksWithoutMatch : 0.0);
+}
+
+QTEST_GUILESS_MAIN(HistoryIndexBenchmark)
+
+#include "HistoryIndexBenchmark.moc"
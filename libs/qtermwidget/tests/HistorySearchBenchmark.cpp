@@ -0,0 +1,150 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QRegularExpression>
+#include <QTest>
+#include <QTextStream>
+
+// Konsole
+#include "LiteralMatcher.h"
+#include "TerminalCharacterDecoder.h"
+
+using namespace Konsole;
+
+/*
+ * Compares the ways a search for plain text can go through the output:
+ * looking at the cells themselves, as LiteralMatcher does, and decoding
+ * them into text for a regular expression, which Qt compiles with the
+ * PCRE2 JIT where it is available.
+ */
+class HistorySearchBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void findAll_data();
+    void findAll();
+
+private:
+    LiteralMatcher::Lines m_lines;
+};
+
+namespace
+{
+
+const int LINES = 100000;
+// one line in so many holds the text which is looked for
+const int MATCH_INTERVAL = 100;
+const char SEARCH_TEXT[] = "undefined reference";
+
+QString outputLine(int number)
+{
+    if (number % MATCH_INTERVAL == 0)
+        return QStringLiteral("module%1.cpp:(.text+0x%2): Undefined Reference to `init%1'").arg(number % 37).arg(number, 0, 16);
+    return QStringLiteral("[%1/%2] Building CXX object src/CMakeFiles/module%3.dir/file%4.cpp.o")
+        .arg(number % 1000).arg(1000).arg(number % 37).arg(number);
+}
+
+// the text the search decoded the cells into before
+QString decode(const LiteralMatcher::Lines& lines)
+{
+    QString text;
+    QTextStream stream(&text);
+    PlainTextDecoder decoder;
+    decoder.begin(&stream);
+    for (int line = 0; line < lines.lineCount(); line++)
+    {
+        const int start = lines.lineStart(line);
+        decoder.decodeLine(lines.cells.constData() + start, lines.lineEnds.at(line) - start,
+                           lines.lineProperties.at(line));
+        if (!(lines.lineProperties.at(line) & LINE_WRAPPED))
+            stream << QLatin1Char('\n');
+    }
+    decoder.end();
+    return text;
+}
+
+}
+
+void HistorySearchBenchmark::initTestCase()
+{
+    for (int line = 0; line < LINES; line++)
+    {
+        for (const uint c : outputLine(line).toUcs4())
+            m_lines.cells << Character(c);
+        m_lines.lineEnds << m_lines.cells.size();
+        m_lines.lineProperties << 0;
+    }
+}
+
+void HistorySearchBenchmark::findAll_data()
+{
+    QTest::addColumn<bool>("decoded");
+    QTest::addColumn<bool>("caseSensitive");
+    QTest::addColumn<int>("expected");
+
+    QTest::newRow("cells") << false << true << 0;
+    QTest::newRow("cells, ignoring case") << false << false << LINES / MATCH_INTERVAL;
+    QTest::newRow("decoded, regexp") << true << true << 0;
+    QTest::newRow("decoded, regexp, ignoring case") << true << false << LINES / MATCH_INTERVAL;
+}
+
+void HistorySearchBenchmark::findAll()
+{
+    QFETCH(bool, decoded);
+    QFETCH(bool, caseSensitive);
+    QFETCH(int, expected);
+
+    const QString text = QLatin1String(SEARCH_TEXT);
+    int count = 0;
+    if (decoded)
+    {
+        QRegularExpression regExp(QRegularExpression::escape(text), caseSensitive
+                                  ? QRegularExpression::NoPatternOption : QRegularExpression::CaseInsensitiveOption);
+        regExp.optimize();
+        QBENCHMARK {
+            count = 0;
+            QRegularExpressionMatchIterator it = regExp.globalMatch(decode(m_lines));
+            while (it.hasNext())
+            {
+                it.next();
+                count++;
+            }
+        }
+    }
+    else
+    {
+        const LiteralMatcher matcher(text, caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive);
+        const int size = m_lines.cells.size();
+        QBENCHMARK {
+            count = 0;
+            int end = 0;
+            for (int start = matcher.indexIn(m_lines, 0, size, &end); start > -1;
+                 start = matcher.indexIn(m_lines, end + 1, size, &end))
+                count++;
+        }
+    }
+    QCOMPARE(count, expected);
+}
+
+QTEST_GUILESS_MAIN(HistorySearchBenchmark)
+
+#include "HistorySearchBenchmark.moc"
@@ -0,0 +1,183 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QTest>
+
+// Konsole
+#include "History.h"
+#include "HistoryTrigramIndex.h"
+
+using namespace Konsole;
+
+class HistoryTrigramIndexTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void queryMatchesRegExp_data();
+    void queryMatchesRegExp();
+    void escapesWithArguments_data();
+    void escapesWithArguments();
+    void literalQuery();
+    void piecesInOneBlock_data();
+    void piecesInOneBlock();
+};
+
+namespace
+{
+
+// a history holding 'text' as a single line
+void addLine(HistoryScrollBuffer& history, const QString& text, bool wrapped = false)
+{
+    QVector<Character> cells;
+    for (const uint c : text.toUcs4())
+        cells << Character(c);
+    history.addCellsVector(cells);
+    history.addLine(wrapped);
+}
+
+}
+
+void HistoryTrigramIndexTest::queryMatchesRegExp_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<QString>("text");
+
+    QTest::newRow("literal") << "hello" << "say hello world";
+    QTest::newRow("case folded") << "HeLLo" << "say hello world";
+    QTest::newRow("dot") << "foo.bar" << "foo-bar";
+    QTest::newRow("star") << "abcd*ef" << "abcef";
+    QTest::newRow("question mark") << "abcd?ef" << "abcef";
+    QTest::newRow("repeat") << "abcd{0,2}ef" << "abcef";
+    QTest::newRow("class") << "[xyz]abc" << "yabc";
+    QTest::newRow("class with bracket") << "[]x]abcd" << "]abcd";
+    QTest::newRow("posix class") << "[[:digit:]]abc" << "1abc";
+    QTest::newRow("group") << "(ab|cd)efg" << "cdefg";
+    QTest::newRow("escaped dot") << "a\\.bc" << "a.bc";
+    QTest::newRow("digit class") << "\\d+abc" << "42abc";
+    QTest::newRow("word boundary") << "\\bword\\b" << "a word here";
+    QTest::newRow("space class") << "abc\\sdef" << "abc def";
+    QTest::newRow("hex escape") << "\\x41BCD" << "ABCD";
+    QTest::newRow("hex escape with braces") << "\\x{41}BCD" << "ABCD";
+    QTest::newRow("octal escape") << "\\0101BCD" << "ABCD";
+    QTest::newRow("octal escape with braces") << "\\o{101}BCD" << "ABCD";
+    QTest::newRow("unicode property") << "\\pLxyz" << "Axyz";
+    QTest::newRow("unicode property with braces") << "\\p{Lu}xyz" << "Axyz";
+    QTest::newRow("back reference") << "(a)\\1bcd" << "aabcd";
+    QTest::newRow("numbered reference") << "(a)\\g1bcd" << "aabcd";
+    QTest::newRow("named reference") << "(?<n>a)\\k<n>bcd" << "aabcd";
+    QTest::newRow("control character") << "\\cJabc" << "\nabc";
+    QTest::newRow("newline escape") << "x\\nabc" << "x\nabc";
+}
+
+void HistoryTrigramIndexTest::queryMatchesRegExp()
+{
+    QFETCH(QString, pattern);
+    QFETCH(QString, text);
+
+    const QRegularExpression regExp(pattern, QRegularExpression::CaseInsensitiveOption);
+    QVERIFY(regExp.isValid());
+    QVERIFY(regExp.match(text).hasMatch());
+
+    HistoryScrollBuffer history;
+    addLine(history, text);
+    HistoryTrigramIndex index;
+    index.rebuild(&history);
+
+    // the index must never rule out a line which the expression matches
+    QVERIFY(index.mayContain(HistoryTrigramIndex::query(regExp), 0, 0));
+}
+
+void HistoryTrigramIndexTest::escapesWithArguments_data()
+{
+    QTest::addColumn<QString>("pattern");
+
+    QTest::newRow("hex") << "\\x41BCD";
+    QTest::newRow("octal") << "\\0101BCD";
+    QTest::newRow("property") << "\\pLxyz";
+    QTest::newRow("reference") << "(a)\\g1bcd";
+    QTest::newRow("named reference") << "(?<n>a)\\k<n>bcd";
+    QTest::newRow("control") << "\\cXabc";
+}
+
+void HistoryTrigramIndexTest::escapesWithArguments()
+{
+    QFETCH(QString, pattern);
+
+    QVERIFY(HistoryTrigramIndex::query(QRegularExpression(pattern)).isEmpty());
+}
+
+void HistoryTrigramIndexTest::literalQuery()
+{
+    // lines are indexed in blocks, the last line is in a block of its own
+    const int lines = 1000;
+    HistoryScrollBuffer history(lines);
+    for (int i = 0; i < lines - 1; i++)
+        addLine(history, QStringLiteral("line %1").arg(i));
+    addLine(history, QStringLiteral("42 second"));
+    HistoryTrigramIndex index;
+    index.rebuild(&history);
+
+    const HistoryTrigramIndex::Query query = HistoryTrigramIndex::query(QRegularExpression(QStringLiteral("\\d+ second")));
+    QVERIFY(!query.isEmpty());
+    QVERIFY(!index.mayContain(query, 0, 0));
+    QVERIFY(index.mayContain(query, lines - 1, lines - 1));
+}
+
+void HistoryTrigramIndexTest::piecesInOneBlock_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<bool>("wrapped");
+    QTest::addColumn<bool>("mayContain");
+
+    // "abcdefgh" is split over the last line of one block and the first line of the next
+    QTest::newRow("split text") << "abcdefgh" << false << false;
+    QTest::newRow("split text in a wrapped line") << "abcdefgh" << true << true;
+    QTest::newRow("pieces on different lines") << "abcd\\s+efgh" << false << true;
+    QTest::newRow("one piece missing") << "abcd\\s+efgz" << false << false;
+}
+
+void HistoryTrigramIndexTest::piecesInOneBlock()
+{
+    QFETCH(QString, pattern);
+    QFETCH(bool, wrapped);
+    QFETCH(bool, mayContain);
+
+    // lines are indexed in blocks of 128
+    const int lines = 256;
+    HistoryScrollBuffer history(lines);
+    for (int i = 0; i < 127; i++)
+        addLine(history, QStringLiteral("line %1").arg(i));
+    addLine(history, QStringLiteral("abcd"), wrapped);
+    addLine(history, QStringLiteral("efgh"));
+    for (int i = 129; i < lines; i++)
+        addLine(history, QStringLiteral("line %1").arg(i));
+    HistoryTrigramIndex index;
+    index.rebuild(&history);
+
+    const QRegularExpression regExp(pattern);
+    const HistoryTrigramIndex::Query query = HistoryTrigramIndex::query(regExp);
+    QVERIFY(!query.isEmpty());
+    QCOMPARE(index.mayContain(query, 0, lines - 1), mayContain);
+}
+
+QTEST_GUILESS_MAIN(HistoryTrigramIndexTest)
+
+#include "HistoryTrigramIndexTest.moc"
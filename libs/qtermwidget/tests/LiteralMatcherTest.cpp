@@ -0,0 +1,211 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QRegularExpression>
+#include <QTest>
+#include <QTextStream>
+
+// Konsole
+#include "LiteralMatcher.h"
+#include "Screen.h"
+#include "TerminalCharacterDecoder.h"
+
+using namespace Konsole;
+
+typedef QList<QPair<int, int>> Matches;
+
+/*
+ * Looks for text in the cells of a screen with LiteralMatcher and compares
+ * the matches with those a regular expression finds in the text which
+ * PlainTextDecoder writes out for the same lines.
+ */
+class LiteralMatcherTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void findsMatchesForwards_data();
+    void findsMatchesForwards();
+    void findsMatchesBackwards_data();
+    void findsMatchesBackwards();
+};
+
+namespace
+{
+
+const int SCREEN_LINES = 8;
+const int SCREEN_COLUMNS = 20;
+
+void addRows()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QString>("query");
+    QTest::addColumn<bool>("caseSensitive");
+
+    QTest::newRow("plain text") << QStringLiteral("hello world, hello\nhello") << QStringLiteral("hello") << true;
+    QTest::newRow("overlapping matches") << QStringLiteral("aaaaaa\naaa") << QStringLiteral("aa") << true;
+    QTest::newRow("no match") << QStringLiteral("hello world") << QStringLiteral("worlds") << true;
+    QTest::newRow("wide characters") << QStringLiteral("\u4e2d\u6587 \u4e2d\u6587\u5b57 x\u4e2d\u6587\n\u6587\u4e2d\u6587")
+                                     << QStringLiteral("\u4e2d\u6587") << true;
+    QTest::newRow("after wide characters") << QStringLiteral("\u4e2d\u6587 \u4e2d\u6587x \u6587 x")
+                                           << QStringLiteral("\u6587 ") << true;
+    // the accents are combined with the letters before them into extended characters
+    QTest::newRow("extended characters") << QStringLiteral("e\u0301te e\u0301t\u00e9 ete")
+                                         << QStringLiteral("e\u0301t") << true;
+    QTest::newRow("start of extended characters") << QStringLiteral("e\u0301te e\u0301t ete")
+                                                  << QStringLiteral("e") << true;
+    QTest::newRow("wrapped lines") << QStringLiteral("xxxxxxxxxxxxxxxxxxneedle xxxxneedle\nneed\nle")
+                                   << QStringLiteral("needle") << true;
+    QTest::newRow("wide characters in wrapped lines") << QStringLiteral("xxxxxxxxxxxxxxxxxx\u4e2d\u6587\u4e2d\u6587")
+                                                      << QStringLiteral("x\u4e2d\u6587\u4e2d") << true;
+    QTest::newRow("case insensitive") << QStringLiteral("Hello HELLO hello\nhElLo") << QStringLiteral("hello") << false;
+    QTest::newRow("case sensitive") << QStringLiteral("Hello HELLO hello\nhElLo") << QStringLiteral("hello") << true;
+    QTest::newRow("case insensitive letters past ASCII") << QStringLiteral("\u00c9T\u00c9 \u00e9t\u00e9 \u00c9t\u00e9")
+                                                          << QStringLiteral("\u00e9t\u00e9") << false;
+    QTest::newRow("case insensitive extended characters") << QStringLiteral("E\u0301T e\u0301t e\u0301T")
+                                                          << QStringLiteral("e\u0301t") << false;
+}
+
+void display(Screen& screen, const QString& text)
+{
+    for (const uint c : text.toUcs4())
+    {
+        if (c == '\n')
+            screen.nextLine();
+        else
+            screen.displayCharacter(wchar_t(c));
+    }
+}
+
+int decodedLength(const Character* cells, int count)
+{
+    QString text;
+    QTextStream stream(&text);
+    PlainTextDecoder decoder;
+    decoder.begin(&stream);
+    decoder.decodeLine(cells, count, 0);
+    decoder.end();
+    return text.size();
+}
+
+/*
+ * The cells of the screen and the text decoded from them.  The matches the
+ * regular expression finds are given as the positions of the cells their
+ * first and last characters were decoded from, like those of LiteralMatcher.
+ */
+struct Search
+{
+    LiteralMatcher::Lines lines;
+    Matches expected;
+
+    Search(const QString& text, const QString& query, bool caseSensitive)
+    {
+        Screen screen(SCREEN_LINES, SCREEN_COLUMNS);
+        display(screen, text);
+        screen.copyLineCells(0, SCREEN_LINES - 1, lines.cells, lines.lineEnds, lines.lineProperties);
+
+        QString decodedText;
+        QTextStream stream(&decodedText);
+        PlainTextDecoder decoder;
+        decoder.begin(&stream);
+        decoder.setRecordLinePositions(true);
+        screen.writeLinesToStream(&decoder, 0, SCREEN_LINES - 1);
+        decoder.end();
+
+        // the cell each character of the decoded text comes from, line breaks come from none
+        QVector<int> cellAt(decodedText.size(), -1);
+        for (int line = 0; line < lines.lineCount(); line++)
+        {
+            const int lineStart = lines.lineStart(line);
+            const Character* cells = lines.cells.constData() + lineStart;
+            for (int column = 0; column < lines.lineEnds.at(line) - lineStart; column++)
+            {
+                const int first = decoder.linePositions().at(line) + decodedLength(cells, column);
+                const int last = decoder.linePositions().at(line) + decodedLength(cells, column + 1);
+                for (int i = first; i < last; i++)
+                    cellAt[i] = lineStart + column;
+            }
+        }
+
+        const QRegularExpression regExp(QRegularExpression::escape(query),
+                                        caseSensitive ? QRegularExpression::NoPatternOption
+                                                      : QRegularExpression::CaseInsensitiveOption);
+        for (QRegularExpressionMatch match = regExp.match(decodedText); match.hasMatch();
+             match = regExp.match(decodedText, match.capturedStart() + 1))
+        {
+            expected << qMakePair(cellAt.at(match.capturedStart()), cellAt.at(match.capturedEnd() - 1));
+        }
+    }
+};
+
+}
+
+void LiteralMatcherTest::findsMatchesForwards_data()
+{
+    addRows();
+}
+
+void LiteralMatcherTest::findsMatchesForwards()
+{
+    QFETCH(QString, text);
+    QFETCH(QString, query);
+    QFETCH(bool, caseSensitive);
+
+    const Search search(text, query, caseSensitive);
+    const LiteralMatcher matcher(query, caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive);
+    const int cellCount = search.lines.cells.size();
+
+    Matches matches;
+    int end = 0;
+    for (int start = matcher.indexIn(search.lines, 0, cellCount, &end); start >= 0;
+         start = matcher.indexIn(search.lines, start + 1, cellCount, &end))
+    {
+        matches << qMakePair(start, end);
+    }
+    QCOMPARE(matches, search.expected);
+}
+
+void LiteralMatcherTest::findsMatchesBackwards_data()
+{
+    addRows();
+}
+
+void LiteralMatcherTest::findsMatchesBackwards()
+{
+    QFETCH(QString, text);
+    QFETCH(QString, query);
+    QFETCH(bool, caseSensitive);
+
+    const Search search(text, query, caseSensitive);
+    const LiteralMatcher matcher(query, caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive);
+
+    Matches matches;
+    int end = 0;
+    for (int start = matcher.lastIndexIn(search.lines, 0, search.lines.cells.size(), &end); start >= 0;
+         start = matcher.lastIndexIn(search.lines, 0, start, &end))
+    {
+        matches.prepend(qMakePair(start, end));
+    }
+    QCOMPARE(matches, search.expected);
+}
+
+QTEST_GUILESS_MAIN(LiteralMatcherTest)
+
+#include "LiteralMatcherTest.moc"
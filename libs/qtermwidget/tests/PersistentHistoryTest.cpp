@@ -0,0 +1,205 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QDir>
+#include <QTemporaryDir>
+#include <QTest>
+
+// Konsole
+#include "History.h"
+
+using namespace Konsole;
+
+/*
+ * Writes histories to a file, opens them again and compares the lines
+ * which are restored with the lines which were written.
+ */
+class PersistentHistoryTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void restoresLines_data();
+    void restoresLines();
+    void fileStaysWithinLineLimit();
+};
+
+namespace
+{
+
+// a line of plain text, characters made of several code points and true colors.
+// The lines are long enough for the file to be written while they are added
+QVector<Character> makeLine(int line)
+{
+    QVector<Character> cells;
+    for (const uint c : QStringLiteral("line %1 ").arg(line).leftJustified(200, QLatin1Char('.')).toUcs4())
+        cells << Character(c);
+
+    if (line % 3 == 0)
+    {
+        const uint points[] = { 'e', 0x301, uint(0x300 + line % 16) };
+        const uint id = ExtendedCharTable::instance.createExtendedChar(points, 3);
+        cells << Character(id, CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR),
+                           CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR), RE_EXTENDED_CHAR);
+    }
+    if (line % 5 == 0)
+    {
+        const CharacterColor foreground(COLOR_SPACE_RGB, 0x102030 + line);
+        const CharacterColor background(COLOR_SPACE_RGB, 0xF0E0D0 - line);
+        cells << Character('x', foreground, background, RE_BOLD);
+    }
+    return cells;
+}
+
+void addLines(HistoryScroll& history, int first, int count)
+{
+    for (int line = first; line < first + count; line++)
+    {
+        const QVector<Character> cells = makeLine(line);
+        history.addCellsVector(cells);
+        history.addLine(line % 4 == 1);
+    }
+}
+
+// compares the characters and colors of the cells rather than their ids
+void compareCells(const Character& actual, const Character& expected)
+{
+    QCOMPARE(uint(actual.rendition), uint(expected.rendition));
+    QCOMPARE(CharacterColor(actual.foregroundColor), CharacterColor(expected.foregroundColor));
+    QCOMPARE(CharacterColor(actual.backgroundColor), CharacterColor(expected.backgroundColor));
+    if (!(expected.rendition & RE_EXTENDED_CHAR))
+    {
+        QCOMPARE(uint(actual.character), uint(expected.character));
+        return;
+    }
+
+    ExtendedCharTable::Sequence actualChars;
+    ExtendedCharTable::Sequence expectedChars;
+    QVERIFY(ExtendedCharTable::instance.lookupExtendedChar(actual.character, actualChars));
+    QVERIFY(ExtendedCharTable::instance.lookupExtendedChar(expected.character, expectedChars));
+    QCOMPARE(QList<uint>(actualChars.cbegin(), actualChars.cend()),
+             QList<uint>(expectedChars.cbegin(), expectedChars.cend()));
+}
+
+void compareLines(const HistoryScroll& history, int firstLine)
+{
+    for (int i = 0; i < history.getLines(); i++)
+    {
+        const int line = firstLine + i;
+        const QVector<Character> expected = makeLine(line);
+        QCOMPARE(history.getLineLen(i), int(expected.size()));
+        QCOMPARE(history.isWrappedLine(i), line % 4 == 1);
+
+        QVector<Character> cells(expected.size());
+        history.getCells(i, 0, cells.size(), cells.data());
+        for (int column = 0; column < cells.size() && !QTest::currentTestFailed(); column++)
+            compareCells(cells.at(column), expected.at(column));
+        if (QTest::currentTestFailed())
+            return;
+    }
+}
+
+}
+
+void PersistentHistoryTest::restoresLines_data()
+{
+    QTest::addColumn<int>("lines");
+
+    // a chunk holds 256 lines, the last one is not full
+    QTest::newRow("part of a chunk") << 100;
+    QTest::newRow("whole chunks") << 512;
+    QTest::newRow("whole chunks and part of one") << 700;
+}
+
+void PersistentHistoryTest::restoresLines()
+{
+    QFETCH(int, lines);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("history"));
+
+    {
+        PersistentHistoryScroll history(fileName, 0, false);
+        addLines(history, 0, lines);
+        QCOMPARE(history.getLines(), lines);
+        compareLines(history, 0);
+    }
+    QVERIFY(QFile::exists(fileName));
+
+    {
+        PersistentHistoryScroll history(fileName, 0, true);
+        QCOMPARE(history.getLines(), lines);
+        compareLines(history, 0);
+
+        // lines added after restoring follow the restored ones
+        addLines(history, lines, 50);
+        QCOMPARE(history.getLines(), lines + 50);
+        compareLines(history, 0);
+    }
+
+    PersistentHistoryScroll history(fileName, 0, true);
+    QCOMPARE(history.getLines(), lines + 50);
+    compareLines(history, 0);
+}
+
+void PersistentHistoryTest::fileStaysWithinLineLimit()
+{
+    const int maxLines = 1000;
+    const int lines = 20000;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("history"));
+
+    // the size of the file while the history holds its maximum number of lines
+    qint64 fullSize = 0;
+    auto fileSize = [&dir] {
+        qint64 size = 0;
+        const QFileInfoList files = QDir(dir.path()).entryInfoList(QStringList(QStringLiteral("history.??????")),
+                                                                    QDir::Files);
+        for (const QFileInfo& file : files)
+            size += file.size();
+        return size;
+    };
+
+    {
+        PersistentHistoryScroll history(fileName, maxLines, false);
+        for (int first = 0; first < lines; first += maxLines)
+        {
+            addLines(history, first, maxLines);
+            QCOMPARE(history.getLines(), maxLines);
+            if (first == maxLines)
+                fullSize = fileSize();
+            else if (first > maxLines)
+                QVERIFY2(fileSize() <= 3 * fullSize,
+                         qPrintable(QStringLiteral("%1 bytes, %2 at first").arg(fileSize()).arg(fullSize)));
+        }
+        compareLines(history, lines - maxLines);
+    }
+
+    PersistentHistoryScroll history(fileName, maxLines, true);
+    QCOMPARE(history.getLines(), maxLines);
+    compareLines(history, lines - maxLines);
+}
+
+QTEST_GUILESS_MAIN(PersistentHistoryTest)
+
+#include "PersistentHistoryTest.moc"
@@ -0,0 +1,180 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Standard
+#include <cstring>
+#include <string>
+
+// Qt
+#include <QStringDecoder>
+#include <QTest>
+
+// Konsole
+#include "History.h"
+#include "Vt102Emulation.h"
+
+using namespace Konsole;
+
+/*
+ * Measures how fast output from the terminal is taken in, as when a long
+ * build log is shown with cat: decoding alone, in place as receiveData()
+ * does it and through QString as it did before, and decoding together with
+ * the emulation.
+ */
+class ReceiveDataBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void decode_data();
+    void decode();
+    void emulate_data();
+    void emulate();
+
+private:
+    QByteArray m_asciiLog;
+    QByteArray m_utf8Log;
+};
+
+namespace
+{
+
+const int LOG_SIZE = 8 * 1024 * 1024;
+// what a read from the pty returns at most
+const int CHUNK_SIZE = 4096;
+
+// counts the characters instead of emulating a terminal, so that only the decoding is measured
+class CountingEmulation : public Emulation
+{
+public:
+    void clearEntireScreen() override {}
+    void reset() override {}
+    void sendText(const QString&) override {}
+    void sendString(const char*, int) override {}
+
+    // receiveData() as it was before the bytes were decoded in place
+    void receiveDataThroughQString(const char* text, int length)
+    {
+        QByteArray ba(text, length);
+        QString str = m_toUtf16(ba);
+        std::wstring unicodeText = str.toStdWString();
+
+        for (size_t i = 0; i < unicodeText.length(); i++)
+            receiveChar(unicodeText[i]);
+
+        for (int i = 0; i < length; i++)
+        {
+            if (text[i] == '\030')
+            {
+                if ((length - i - 1 > 3) && (strncmp(text + i + 1, "B00", 3) == 0))
+                    emit zmodemDetected();
+            }
+        }
+    }
+
+    qint64 characters = 0;
+
+protected:
+    void setMode(int) override {}
+    void resetMode(int) override {}
+    void receiveChar(wchar_t) override { characters++; }
+    void receiveChars(const uint*, int count) override { characters += count; }
+
+private:
+    QStringDecoder m_toUtf16{QStringDecoder::Utf8};
+};
+
+QByteArray buildLog(const QByteArray& text)
+{
+    QByteArray log;
+    log.reserve(LOG_SIZE + 256);
+    for (int line = 0; log.size() < LOG_SIZE; line++)
+    {
+        log += "\x1b[32m[" + QByteArray::number(line % 1000) + "/1000]\x1b[0m " + text
+               + QByteArray::number(line) + ".cpp.o\r\n";
+    }
+    return log;
+}
+
+}
+
+void ReceiveDataBenchmark::initTestCase()
+{
+    m_asciiLog = buildLog("Building CXX object src/CMakeFiles/module.dir/file");
+    m_utf8Log = buildLog("Kompiliere \xc3\xbc" "bersetzte Datei \xe6\x96\x87\xe4\xbb\xb6 \xf0\x9f\x94\xa8 file");
+    qInfo("the logs are %d MiB, fed in pieces of %d bytes", LOG_SIZE / (1024 * 1024), CHUNK_SIZE);
+}
+
+void ReceiveDataBenchmark::decode_data()
+{
+    QTest::addColumn<bool>("utf8");
+    QTest::addColumn<bool>("throughQString");
+
+    QTest::newRow("ascii, in place") << false << false;
+    QTest::newRow("ascii, through QString") << false << true;
+    QTest::newRow("utf-8, in place") << true << false;
+    QTest::newRow("utf-8, through QString") << true << true;
+}
+
+void ReceiveDataBenchmark::decode()
+{
+    QFETCH(bool, utf8);
+    QFETCH(bool, throughQString);
+
+    const QByteArray& log = utf8 ? m_utf8Log : m_asciiLog;
+    CountingEmulation emulation;
+    QBENCHMARK {
+        for (int pos = 0; pos < log.size(); pos += CHUNK_SIZE)
+        {
+            const int length = qMin(CHUNK_SIZE, int(log.size()) - pos);
+            if (throughQString)
+                emulation.receiveDataThroughQString(log.constData() + pos, length);
+            else
+                emulation.receiveData(log.constData() + pos, length);
+        }
+    }
+    QVERIFY(emulation.characters > 0);
+}
+
+void ReceiveDataBenchmark::emulate_data()
+{
+    QTest::addColumn<bool>("utf8");
+
+    QTest::newRow("ascii") << false;
+    QTest::newRow("utf-8") << true;
+}
+
+void ReceiveDataBenchmark::emulate()
+{
+    QFETCH(bool, utf8);
+
+    const QByteArray& log = utf8 ? m_utf8Log : m_asciiLog;
+    Vt102Emulation emulation;
+    emulation.setImageSize(40, 120);
+    emulation.setHistory(HistoryTypeBuffer(10000));
+    QBENCHMARK {
+        for (int pos = 0; pos < log.size(); pos += CHUNK_SIZE)
+            emulation.receiveData(log.constData() + pos, qMin(CHUNK_SIZE, int(log.size()) - pos));
+    }
+}
+
+QTEST_GUILESS_MAIN(ReceiveDataBenchmark)
+
+#include "ReceiveDataBenchmark.moc"
@@ -0,0 +1,192 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QTest>
+#include <QTextStream>
+
+// Konsole
+#include "History.h"
+#include "Screen.h"
+#include "TerminalCharacterDecoder.h"
+
+using namespace Konsole;
+
+/*
+ * Resizes a screen with a history to fewer and to more columns, and checks
+ * that the lines are rewrapped without losing text and that the cursor stays
+ * on the same character.
+ */
+class ScreenReflowTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void keepsTextAndCursor_data();
+    void keepsTextAndCursor();
+    void showsRewrappedLinesWhileReflowing();
+};
+
+namespace
+{
+
+const int SCREEN_LINES = 5;
+const int SCREEN_COLUMNS = 40;
+const int OUTPUT_LINES = 30;
+
+// the last line, the cursor is put on its 46th character
+const QString COMMAND = QStringLiteral("abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMN");
+const int CURSOR_OFFSET = 45;
+
+// lines of different lengths, some of them longer than the screen is wide
+QString output()
+{
+    QString text;
+    for (int line = 0; line < OUTPUT_LINES; line++)
+        text += QStringLiteral("line%1-").arg(line).repeated(20).left((line * 13) % 90 + 1) + QLatin1Char('\n');
+    return text + COMMAND;
+}
+
+void display(Screen& screen, const QString& text)
+{
+    for (const uint c : text.toUcs4())
+    {
+        if (c == '\n')
+            screen.nextLine();
+        else
+            screen.displayCharacter(wchar_t(c));
+    }
+}
+
+void setUp(Screen& screen)
+{
+    screen.setScroll(HistoryTypeBuffer(1000), false);
+    screen.setReflowLines(true);
+    display(screen, output());
+
+    // the command wraps once at the width of the screen
+    QCOMPARE(screen.getCursorX(), int(COMMAND.size()) - SCREEN_COLUMNS);
+    screen.setCursorX(CURSOR_OFFSET - SCREEN_COLUMNS + 1);
+}
+
+// the text of the history and the screen, with the wrapped lines joined
+QString text(const Screen& screen)
+{
+    QString text;
+    QTextStream stream(&text);
+    PlainTextDecoder decoder;
+    decoder.setTrailingWhitespace(false);
+    decoder.begin(&stream);
+    screen.writeLinesToStream(&decoder, 0, screen.getHistLines() + screen.getLines() - 1);
+    decoder.end();
+
+    while (text.endsWith(QLatin1Char('\n')))
+        text.chop(1);
+    return text;
+}
+
+uint characterAtCursor(const Screen& screen)
+{
+    const int line = screen.getHistLines() + screen.getCursorY();
+    QVector<Character> cells;
+    QVector<int> lineEnds;
+    QVector<LineProperty> lineProperties;
+    screen.copyLineCells(line, line, cells, lineEnds, lineProperties);
+    return screen.getCursorX() < cells.size() ? uint(cells.at(screen.getCursorX()).character) : 0;
+}
+
+void resize(Screen& screen, int columns)
+{
+    screen.resizeImage(SCREEN_LINES, columns);
+    while (screen.reflowHistoryStep(7))
+    {
+    }
+}
+
+}
+
+void ScreenReflowTest::keepsTextAndCursor_data()
+{
+    QTest::addColumn<QList<int>>("widths");
+
+    QTest::newRow("narrower, then wider") << QList<int>{17, 63, SCREEN_COLUMNS};
+    QTest::newRow("wider, then narrower") << QList<int>{71, 9, SCREEN_COLUMNS};
+    QTest::newRow("narrower twice") << QList<int>{31, 12, 25, SCREEN_COLUMNS};
+}
+
+void ScreenReflowTest::keepsTextAndCursor()
+{
+    QFETCH(QList<int>, widths);
+
+    Screen screen(SCREEN_LINES, SCREEN_COLUMNS);
+    setUp(screen);
+    const QString expected = text(screen);
+    QCOMPARE(expected, output());
+    QCOMPARE(characterAtCursor(screen), uint(COMMAND.at(CURSOR_OFFSET).unicode()));
+
+    for (const int columns : widths)
+    {
+        resize(screen, columns);
+        QCOMPARE(screen.getColumns(), columns);
+        QCOMPARE(text(screen), expected);
+        QCOMPARE(characterAtCursor(screen), uint(COMMAND.at(CURSOR_OFFSET).unicode()));
+    }
+}
+
+void ScreenReflowTest::showsRewrappedLinesWhileReflowing()
+{
+    Screen screen(SCREEN_LINES, SCREEN_COLUMNS);
+    setUp(screen);
+
+    const int columns = 17;
+    const int viewLines = 3;
+    screen.resizeImage(SCREEN_LINES, columns);
+    QVERIFY(screen.isReflowingHistory());
+
+    // the view is drawn again and again while the history is rewrapped,
+    // scrolling through a part of it
+    const int firstLine = screen.getHistLines() / 2;
+    const int views = 6;
+    QList<QVector<Character>> reflowing;
+    for (int view = 0; view < 2 * views; view++)
+    {
+        const int startLine = firstLine + view % views;
+        QVector<Character> image(viewLines * columns);
+        screen.getImage(image.data(), image.size(), startLine, startLine + viewLines - 1);
+        reflowing << image;
+    }
+
+    while (screen.reflowHistoryStep(7))
+    {
+    }
+
+    for (int view = 0; view < 2 * views; view++)
+    {
+        const int startLine = screen.reflowedLine(firstLine + view % views);
+        QVERIFY(startLine + viewLines <= screen.getHistLines());
+        QVector<Character> reflowed(viewLines * columns);
+        screen.getImage(reflowed.data(), reflowed.size(), startLine, startLine + viewLines - 1);
+        for (int i = 0; i < reflowed.size(); i++)
+            QCOMPARE(uint(reflowing.at(view).at(i).character), uint(reflowed.at(i).character));
+    }
+}
+
+QTEST_GUILESS_MAIN(ScreenReflowTest)
+
+#include "ScreenReflowTest.moc"
@@ -0,0 +1,86 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QTest>
+
+// Konsole
+#include "Screen.h"
+
+using namespace Konsole;
+
+/*
+ * Measures how long it takes to scroll the screen by a line, as every new
+ * line at the bottom of the screen does.  A scroll of the whole screen only
+ * moves the start of the ring of lines, a scroll inside margins still moves
+ * the lines between them, so only the latter grows with the screen height.
+ */
+class ScreenScrollBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void newLine_data();
+    void newLine();
+};
+
+namespace
+{
+
+const int NEW_LINES = 100000;
+const int COLUMNS = 160;
+
+}
+
+void ScreenScrollBenchmark::newLine_data()
+{
+    QTest::addColumn<int>("lines");
+    QTest::addColumn<bool>("margins");
+
+    QTest::newRow("50 lines, whole screen") << 50 << false;
+    QTest::newRow("50 lines, inside margins") << 50 << true;
+    QTest::newRow("200 lines, whole screen") << 200 << false;
+    QTest::newRow("200 lines, inside margins") << 200 << true;
+}
+
+void ScreenScrollBenchmark::newLine()
+{
+    QFETCH(int, lines);
+    QFETCH(bool, margins);
+
+    Screen screen(lines, COLUMNS);
+    // a status line at the top, as kept by an editor or a pager
+    if (margins)
+        screen.setMargins(2, lines);
+    screen.setCursorYX(lines, 1);
+
+    QBENCHMARK {
+        for (int i = 0; i < NEW_LINES; i++)
+        {
+            screen.displayCharacter(L'x');
+            screen.toStartOfLine();
+            screen.newLine();
+        }
+    }
+    QCOMPARE(screen.getCursorY(), lines - 1);
+}
+
+QTEST_GUILESS_MAIN(ScreenScrollBenchmark)
+
+#include "ScreenScrollBenchmark.moc"
@@ -0,0 +1,100 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QTest>
+
+// Konsole
+#include "Filter.h"
+
+using namespace Konsole;
+
+/*
+ * Measures the URL filter on a screenful of output, with the triggers
+ * which let it skip the lines that cannot hold a URL and with the
+ * expression run on every line, as it was before.
+ */
+class UrlFilterBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void process_data();
+    void process();
+};
+
+namespace
+{
+
+const int LINES = 200;
+
+QString listing(int line)
+{
+    return QStringLiteral("-rw-r--r--  1 user users %1 Oct 17 12:%2 file%3.cpp")
+        .arg(line * 37 % 100000, 6).arg(line % 60, 2, 10, QLatin1Char('0')).arg(line);
+}
+
+QString logLine(int line)
+{
+    if (line % 10 == 0)
+        return QStringLiteral("see https://example.org/issues/%1 or mail dev%1@example.org").arg(line);
+    return listing(line);
+}
+
+}
+
+void UrlFilterBenchmark::process_data()
+{
+    QTest::addColumn<bool>("urls");
+    QTest::addColumn<bool>("triggers");
+
+    QTest::newRow("ls -la, triggers") << false << true;
+    QTest::newRow("ls -la, every line") << false << false;
+    QTest::newRow("log with urls, triggers") << true << true;
+    QTest::newRow("log with urls, every line") << true << false;
+}
+
+void UrlFilterBenchmark::process()
+{
+    QFETCH(bool, urls);
+    QFETCH(bool, triggers);
+
+    QString buffer;
+    QList<int> linePositions;
+    for (int line = 0; line < LINES; line++)
+    {
+        linePositions << buffer.size();
+        buffer += (urls ? logLine(line) : listing(line)) + QLatin1Char('\n');
+    }
+
+    UrlFilter filter;
+    if (!triggers)
+        filter.setTriggers(QStringList());
+    filter.setBuffer(&buffer, &linePositions);
+
+    QBENCHMARK {
+        filter.reset();
+        filter.process();
+    }
+    QCOMPARE(filter.hotSpots().isEmpty(), !urls);
+}
+
+QTEST_GUILESS_MAIN(UrlFilterBenchmark)
+
+#include "UrlFilterBenchmark.moc"
@@ -0,0 +1,400 @@
+/*
+    This file is part of qtermwidget.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Qt
+#include <QRandomGenerator>
+#include <QTest>
+
+// Konsole
+#include "History.h"
+#include "Screen.h"
+#include "Vt102Emulation.h"
+
+using namespace Konsole;
+
+/*
+ * Replays streams of terminal output through the table driven tokenizer
+ * of Vt102Emulation and through the tokenizer it replaced, which is kept
+ * below as a reference, and compares the screens and replies they lead to.
+ */
+class Vt102TokenizerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void capturedStreams_data();
+    void capturedStreams();
+    void randomStreams();
+};
+
+namespace
+{
+
+// the emulation, with the state the test compares made visible
+class InspectedVt102Emulation : public Vt102Emulation
+{
+public:
+    QPoint cursorPosition() const
+    {
+        return QPoint(_currentScreen->getCursorX(), _currentScreen->getCursorY());
+    }
+};
+
+// The tokenizer as it was before the transition table, which deduced its
+// state from the token scanned so far.  It passes each character on by
+// itself, as the emulation did before runs of printable characters were
+// handed to the screen at once.
+class ReferenceVt102Emulation : public InspectedVt102Emulation
+{
+public:
+    ReferenceVt102Emulation();
+
+protected:
+    void receiveChar(wchar_t cc) override;
+    void receiveChars(const uint* chars, int count) override;
+
+private:
+    int referenceCharClass[256];
+};
+
+#define TY_CONSTRUCT(T,A,N) ( (((static_cast<int>(N)) & 0xffff) << 16) | (((static_cast<int>(A)) & 0xff) << 8) | ((static_cast<int>(T)) & 0xff) )
+
+#define TY_CHR(   )     TY_CONSTRUCT(0,0,0)
+#define TY_CTL(A  )     TY_CONSTRUCT(1,A,0)
+#define TY_ESC(A  )     TY_CONSTRUCT(2,A,0)
+#define TY_ESC_CS(A,B)  TY_CONSTRUCT(3,A,B)
+#define TY_ESC_DE(A  )  TY_CONSTRUCT(4,A,0)
+#define TY_CSI_PS(A,N)  TY_CONSTRUCT(5,A,N)
+#define TY_CSI_PN(A  )  TY_CONSTRUCT(6,A,0)
+#define TY_CSI_PR(A,N)  TY_CONSTRUCT(7,A,N)
+#define TY_CSI_PS_SP(A,N)  TY_CONSTRUCT(11,A,N)
+
+#define TY_VT52(A)    TY_CONSTRUCT(8,A,0)
+#define TY_CSI_PG(A)  TY_CONSTRUCT(9,A,0)
+#define TY_CSI_PE(A)  TY_CONSTRUCT(10,A,0)
+
+// Character Class flags used while decoding
+#define CTL  1  // Control character
+#define CHR  2  // Printable character
+#define CPN  4  // TODO: Document me
+#define DIG  8  // Digit
+#define SCS 16  // TODO: Document me
+#define GRP 32  // TODO: Document me
+#define CPS 64  // Character which indicates end of window resize
+                // escape sequence '\e[8;<row>;<col>t'
+
+ReferenceVt102Emulation::ReferenceVt102Emulation()
+{
+  int i;
+  quint8* s;
+  for(i = 0;i < 256; ++i)
+    referenceCharClass[i] = 0;
+  for(i = 0;i < 32; ++i)
+    referenceCharClass[i] |= CTL;
+  for(i = 32;i < 256; ++i)
+    referenceCharClass[i] |= CHR;
+  for(s = (quint8*)"@ABCDEFGHILMPSTXZbcdfry"; *s; ++s)
+    referenceCharClass[*s] |= CPN;
+  // resize = \e[8;<row>;<col>t
+  for(s = (quint8*)"t"; *s; ++s)
+    referenceCharClass[*s] |= CPS;
+  for(s = (quint8*)"0123456789"; *s; ++s)
+    referenceCharClass[*s] |= DIG;
+  for(s = (quint8*)"()+*%"; *s; ++s)
+    referenceCharClass[*s] |= SCS;
+  for(s = (quint8*)"()+*#[]%"; *s; ++s)
+    referenceCharClass[*s] |= GRP;
+
+  resetTokenizer();
+}
+
+#define lec(P,L,C) (p == (P) && s[(L)] == (C))
+#define lun(     ) (p ==  1  && cc >= 32 )
+#define les(P,L,C) (p == (P) && s[L] < 256 && (referenceCharClass[s[(L)]] & (C)) == (C))
+#define eec(C)     (p >=  3  && cc == (C))
+#define ees(C)     (p >=  3  && cc < 256 && (referenceCharClass[cc] & (C)) == (C))
+#define eps(C)     (p >=  3  && s[2] != '?' && s[2] != '!' && s[2] != '>' && cc < 256 && (referenceCharClass[cc] & (C)) == (C))
+#define epp( )     (p >=  3  && s[2] == '?')
+#define epe( )     (p >=  3  && s[2] == '!')
+#define egt( )     (p >=  3  && s[2] == '>')
+#define esp( )     (p ==  4  && s[3] == ' ')
+#define Xpe        (tokenBufferPos >= 2 && tokenBuffer[1] == ']')
+#define Xte        (Xpe      && (cc ==  7 || (prevCC == 27 && cc == 92) )) // 27, 92 => "\e\\" (ST, String Terminator)
+#define ces(C)     (cc < 256 && (referenceCharClass[cc] & (C)) == (C) && !Xte)
+
+#define CNTL(c) ((c)-'@')
+#define ESC 27
+#define DEL 127
+
+void ReferenceVt102Emulation::receiveChar(wchar_t cc)
+{
+  if (cc == DEL)
+    return; //VT100: ignore.
+
+  if (ces(CTL))
+  {
+    // ignore control characters in the text part of Xpe (aka OSC) "ESC]"
+    // escape sequences; this matches what XTERM docs say
+    if (Xpe) {
+        prevCC = cc;
+        return;
+    }
+
+    // DEC HACK ALERT! Control Characters are allowed *within* esc sequences in VT100
+    // This means, they do neither a resetTokenizer() nor a pushToToken(). Some of them, do
+    // of course. Guess this originates from a weakly layered handling of the X-on
+    // X-off protocol, which comes really below this level.
+    if (cc == CNTL('X') || cc == CNTL('Z') || cc == ESC)
+        resetTokenizer(); //VT100: CAN or SUB
+    if (cc != ESC)
+    {
+        processToken(TY_CTL(cc+'@' ),0,0);
+        return;
+    }
+  }
+  // advance the state
+  addToCurrentToken(cc);
+
+  wchar_t* s = tokenBuffer;
+  int  p = tokenBufferPos;
+
+  if (getMode(MODE_Ansi))
+  {
+    if (lec(1,0,ESC)) { return; }
+    if (lec(1,0,ESC+128)) { s[0] = ESC; receiveChar('['); return; }
+    if (les(2,1,GRP)) { return; }
+    if (Xte         ) { processWindowAttributeChange(); resetTokenizer(); return; }
+    if (Xpe         ) { prevCC = cc; return; }
+    if (lec(3,2,'?')) { return; }
+    if (lec(3,2,'>')) { return; }
+    if (lec(3,2,'!')) { return; }
+    if (lun(       )) { processToken( TY_CHR(), applyCharset(cc), 0);   resetTokenizer(); return; }
+    if (lec(2,0,ESC)) { processToken( TY_ESC(s[1]), 0, 0);              resetTokenizer(); return; }
+    if (les(3,1,SCS)) { processToken( TY_ESC_CS(s[1],s[2]), 0, 0);      resetTokenizer(); return; }
+    if (lec(3,1,'#')) { processToken( TY_ESC_DE(s[2]), 0, 0);           resetTokenizer(); return; }
+    if (eps(    CPN)) { processToken( TY_CSI_PN(cc), argv[0],argv[1]);  resetTokenizer(); return; }
+    if (esp(       )) { return; }
+    if (lec(5, 4, 'q') && s[3] == ' ') {
+      processToken( TY_CSI_PS_SP(cc, argv[0]), argv[0], 0);
+      resetTokenizer();
+      return;
+    }
+
+    // resize = \e[8;<row>;<col>t
+    if (eps(CPS))
+    {
+        processToken( TY_CSI_PS(cc, argv[0]), argv[1], argv[2]);
+        resetTokenizer();
+        return;
+    }
+
+    if (epe(   )) { processToken( TY_CSI_PE(cc), 0, 0); resetTokenizer(); return; }
+    if (ees(DIG)) { addDigit(cc-'0'); return; }
+    if (eec(';') || eec(':')) { addArgument(); return; }
+    for (int i=0;i<=argc;i++)
+    {
+        if (epp())
+            processToken( TY_CSI_PR(cc,argv[i]), 0, 0);
+        else if (egt())
+            processToken( TY_CSI_PG(cc), 0, 0); // spec. case for ESC]>0c or ESC]>c
+        else if (cc == 'm' && argc - i >= 4 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 2)
+        {
+            // ESC[ ... 48;2;<red>;<green>;<blue> ... m -or- ESC[ ... 38;2;<red>;<green>;<blue> ... m
+            i += 2;
+            processToken( TY_CSI_PS(cc, argv[i-2]), COLOR_SPACE_RGB, (argv[i] << 16) | (argv[i+1] << 8) | argv[i+2]);
+            i += 2;
+        }
+        else if (cc == 'm' && argc - i >= 2 && (argv[i] == 38 || argv[i] == 48) && argv[i+1] == 5)
+        {
+            // ESC[ ... 48;5;<index> ... m -or- ESC[ ... 38;5;<index> ... m
+            i += 2;
+            processToken( TY_CSI_PS(cc, argv[i-2]), COLOR_SPACE_256, argv[i]);
+        }
+        else
+            processToken( TY_CSI_PS(cc,argv[i]), 0, 0);
+    }
+    resetTokenizer();
+  }
+  else
+  {
+    // VT52 Mode
+    if (lec(1,0,ESC))
+        return;
+    if (les(1,0,CHR))
+    {
+        processToken( TY_CHR(), s[0], 0);
+        resetTokenizer();
+        return;
+    }
+    if (lec(2,1,'Y'))
+        return;
+    if (lec(3,1,'Y'))
+        return;
+    if (p < 4)
+    {
+        processToken( TY_VT52(s[1] ), 0, 0);
+        resetTokenizer();
+        return;
+    }
+    processToken( TY_VT52(s[1]), s[2], s[3]);
+    resetTokenizer();
+    return;
+  }
+}
+
+void ReferenceVt102Emulation::receiveChars(const uint* chars, int count)
+{
+  for (int i = 0; i < count; i++)
+    receiveChar(chars[i]);
+}
+
+// The state left behind by a stream, which must be the same for both tokenizers
+struct Result
+{
+    QVector<Character> cells;
+    QVector<int> lineEnds;
+    QVector<unsigned char> lineProperties;
+    QPoint cursorPosition;
+    QByteArray replies;
+};
+
+// feeds 'stream' to 'emulation' in pieces of at most 'maxChunk' bytes, split the same way for each emulation
+void replay(InspectedVt102Emulation& emulation, const QByteArray& stream, int maxChunk, Result& result)
+{
+    QObject::connect(&emulation, &Emulation::sendData, [&result](const char* data, int len) {
+        result.replies.append(data, len);
+    });
+    emulation.setImageSize(24, 80);
+    emulation.setHistory(HistoryTypeBuffer(200));
+
+    QRandomGenerator random(uint(stream.size()));
+    for (int pos = 0; pos < stream.size();)
+    {
+        const int length = qMin(int(random.bounded(maxChunk)) + 1, int(stream.size()) - pos);
+        emulation.receiveData(stream.constData() + pos, length);
+        pos += length;
+    }
+
+    emulation.copyLineCells(0, emulation.lineCount() - 1, result.cells, result.lineEnds, result.lineProperties);
+    result.cursorPosition = emulation.cursorPosition();
+}
+
+void compareReplays(const QByteArray& stream, int maxChunk)
+{
+    // the results outlive the emulations, which write the replies into them
+    Result expected;
+    Result actual;
+    ReferenceVt102Emulation reference;
+    InspectedVt102Emulation current;
+    replay(reference, stream, maxChunk, expected);
+    replay(current, stream, maxChunk, actual);
+
+    QCOMPARE(actual.lineEnds, expected.lineEnds);
+    QCOMPARE(actual.lineProperties, expected.lineProperties);
+    for (int i = 0; i < expected.cells.size(); i++)
+    {
+        if (actual.cells.at(i) != expected.cells.at(i))
+            QFAIL(qPrintable(QStringLiteral("cell %1 differs, character %2 instead of %3")
+                                 .arg(i).arg(actual.cells.at(i).character).arg(expected.cells.at(i).character)));
+    }
+    QCOMPARE(actual.cursorPosition, expected.cursorPosition);
+    QCOMPARE(actual.replies, expected.replies);
+}
+
+}
+
+void Vt102TokenizerTest::capturedStreams_data()
+{
+    QTest::addColumn<QByteArray>("stream");
+
+    QTest::newRow("shell prompt")
+        << QByteArray("\x1b]0;user@host: ~/src\x07\x1b[01;32muser@host\x1b[00m:\x1b[01;34m~/src\x1b[00m$ ls --color=auto\r\n"
+                      "\x1b[0m\x1b[01;34mbuild\x1b[0m  CMakeLists.txt  \x1b[01;32mconfigure\x1b[0m\r\n");
+    QTest::newRow("editor")
+        << QByteArray("\x1b[?1049h\x1b[22;0;0t\x1b[?1h\x1b=\x1b[H\x1b[2J\x1b[?2004h\x1b[1;24r\x1b[?12h\x1b[?12l"
+                      "\x1b[27m\x1b[23m\x1b[29m\x1b[m\x1b[H\x1b[2J\x1b[?25l\x1b[2;1H\x1b[94m~                   \x1b[3;1H~ "
+                      "\x1b[m\x1b[24;63H0,0-1\x1b[9CAll\x1b[1;1H\x1b[?25hhello\x1b[?1049l\x1b[23;0;0t\x1b[?1l\x1b>");
+    QTest::newRow("progress")
+        << QByteArray("\r[====>     ] 45%\x1b[K\r[=====>    ] 55%\x1b[K\r[==========] 100%\x1b[K\r\n");
+    QTest::newRow("colors")
+        << QByteArray("\x1b[38;2;255;128;0mora\x1b[48;5;236mnge\x1b[38:2:1:2:3mx\x1b[1;4;7;38;5;9;48;2;1;2;3my\x1b[0m\r\n");
+    QTest::newRow("title ended by ST") << QByteArray("\x1b]2;make: building\x1b\\done\r\n\x1b]1;icon\x07");
+    QTest::newRow("reports") << QByteArray("\x1b[c\x1b[>c\x1b[>0c\x1b[6n\x1b[5n\x1b[0c\x1b[?6n");
+    QTest::newRow("cursor style") << QByteArray("\x1b[2 q\x1b[0 q\x1b[ q\x1b[12 q\x1b[5 qx");
+    QTest::newRow("line drawing")
+        << QByteArray("\x1b(0lqqk\r\nx  x\r\nmqqj\x1b(B\r\n\x1b)0\x0e" "abc\x0f" "def\x1b#8\x1b#3");
+    QTest::newRow("vt52")
+        << QByteArray("\x1b[?2l\x1bH\x1bJ\x1bY%%hello\x1b" "A\x1bZ\x1bY\x1b" "x\x1b<\x1b[1mback\x1b[0m\r\n");
+    QTest::newRow("8-bit csi") << QByteArray("\xc2\x9b" "1;31mred\xc2\x9b" "0m\xc2\x9b?25l\r\n");
+    QTest::newRow("unicode")
+        << QByteArray("na\xc3\xafve \xe4\xb8\xad\xe6\x96\x87 e\xcc\x81 \xf0\x9f\x98\x80 \xe2\x94\x80\r\n");
+    QTest::newRow("controls in sequences") << QByteArray("\x1b[1\r;3\x08mx\x1b[2\x18J\x1b[1\x1ay\x1b]0;a\nb\x07z");
+    QTest::newRow("soft reset") << QByteArray("\x1b[!p\x1b[4;20r\x1b[5Hx\x1b[!x\x1b[?7l") + QByteArray(100, 'w');
+    QTest::newRow("resize request") << QByteArray("\x1b[8;30;100t\x1b[18t\x1b[14t");
+    QTest::newRow("long arguments") << QByteArray("\x1b[99999999999;1;2;3;4;5;6;7;8;9;10;11;12;13;14;15;16;17m\x1b[1;99999Hx");
+
+    QByteArray scrolling;
+    for (int line = 0; line < 300; line++)
+        scrolling += "\x1b[3" + QByteArray::number(line % 8) + "mline " + QByteArray::number(line) + "\x1b[0m\r\n";
+    QTest::newRow("scrolling into history") << scrolling;
+}
+
+void Vt102TokenizerTest::capturedStreams()
+{
+    QFETCH(QByteArray, stream);
+
+    compareReplays(stream, stream.size());
+    if (QTest::currentTestFailed())
+        return;
+    compareReplays(stream, 1);
+    if (QTest::currentTestFailed())
+        return;
+    compareReplays(stream, 7);
+}
+
+void Vt102TokenizerTest::randomStreams()
+{
+    // pieces of escape sequences, which the random streams are put together from
+    const QList<QByteArray> pieces = {
+        "\x1b", "[", "]", "?", ">", "!", "#", "(", ")", "%", "*", "+", ";", ":", " ", "0", "1", "2", "5", "8", "38",
+        "48", "q", "m", "H", "J", "K", "t", "c", "n", "h", "l", "r", "Y", "A", "Z", "<", "=", "\\", "a", "x",
+        "\x07", "\x08", "\x09", "\x0a", "\x0d", "\x0e", "\x0f", "\x18", "\x1a", "\x7f", "\xc2\x9b", "\xc3\xa9",
+        "\xe4\xb8\xad", "\xcc\x81", "\x1b[?2l", "\x1b<", "\x1b]0;", "text ",
+    };
+
+    QRandomGenerator random(3);
+    for (int i = 0; i < 2000; i++)
+    {
+        QByteArray stream;
+        const int count = int(random.bounded(200));
+        for (int j = 0; j < count; j++)
+            stream += pieces.at(int(random.bounded(pieces.size())));
+
+        compareReplays(stream, 16);
+        if (QTest::currentTestFailed())
+        {
+            qWarning("stream %d: %s", i, stream.toPercentEncoding().constData());
+            return;
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(Vt102TokenizerTest)
+
+#include "Vt102TokenizerTest.moc"